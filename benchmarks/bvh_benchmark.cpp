@@ -0,0 +1,149 @@
+// Build-time and quality benchmarks for the CPU-side BVHs (cpu_bvh and cpu_bvh4).
+// Neither a window nor a GPU is required. Only GLM is needed. In Visual Studio, build the bvh-benchmark project of the
+// solution (like hot-path-benchmark, it is excluded from building the solution). Otherwise, e.g.:
+//   g++ -std=c++17 -O2 -I<path to glm> -I../source bvh_benchmark.cpp -pthread -o bvh_benchmark
+// or with MSVC:
+//   cl /std:c++17 /O2 /EHsc /I<path to glm> /I..\source bvh_benchmark.cpp
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "cpu_bvh.hpp"
+#include "cpu_wide_bvh.hpp"
+#include "thread_pool.hpp"
+
+namespace
+{
+	// Runs aFunction aRepetitions times and returns the fastest run in milliseconds:
+	template <typename F>
+	double best_of_ms(int aRepetitions, F&& aFunction)
+	{
+		double best = 1e30;
+		for (int r = 0; r < aRepetitions; ++r) {
+			const auto t0 = std::chrono::steady_clock::now();
+			aFunction();
+			const auto t1 = std::chrono::steady_clock::now();
+			best = std::min(best, std::chrono::duration<double, std::milli>(t1 - t0).count());
+		}
+		return best;
+	}
+
+	// A wavy terrain of roughly aCount triangles, similar in structure to the meshes of the scene:
+	std::vector<aabb> make_terrain_triangles(size_t aCount)
+	{
+		const auto cellsPerSide = std::max<size_t>(1, static_cast<size_t>(std::sqrt(static_cast<double>(aCount) / 2.0)));
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> indices;
+		for (size_t z = 0; z <= cellsPerSide; ++z) {
+			for (size_t x = 0; x <= cellsPerSide; ++x) {
+				const auto fx = static_cast<float>(x) / static_cast<float>(cellsPerSide) * 100.0f - 50.0f;
+				const auto fz = static_cast<float>(z) / static_cast<float>(cellsPerSide) * 100.0f - 50.0f;
+				positions.emplace_back(fx, 2.0f * std::sin(0.2f * fx) * std::cos(0.3f * fz), fz);
+			}
+		}
+		const auto row = static_cast<uint32_t>(cellsPerSide + 1);
+		for (uint32_t z = 0; z < cellsPerSide; ++z) {
+			for (uint32_t x = 0; x < cellsPerSide; ++x) {
+				const auto i = z * row + x;
+				indices.insert(std::end(indices), { i, i + 1, i + row, i + 1, i + row + 1, i + row });
+			}
+		}
+		return triangle_bounds(positions, indices);
+	}
+
+	struct particles
+	{
+		std::vector<float> mX, mY, mZ, mRadii;
+	};
+
+	// Particles in a pool-like volume, with the default radius of new water particles:
+	particles make_particles(size_t aCount, std::mt19937& aRng)
+	{
+		std::uniform_real_distribution<float> xz(-20.0f, 20.0f), y(0.0f, 10.0f);
+		particles p;
+		for (size_t i = 0; i < aCount; ++i) {
+			p.mX.push_back(xz(aRng)); p.mY.push_back(y(aRng)); p.mZ.push_back(xz(aRng)); p.mRadii.push_back(0.1f);
+		}
+		return p;
+	}
+
+	// Casts random rays through the scene's bounds and returns the number of rays per second (in millions):
+	double measure_traversal_mrays(const cpu_bvh4& aBvh, const std::vector<aabb>& aPrimitiveBounds, std::mt19937& aRng)
+	{
+		constexpr int cNumRays = 200000;
+		const auto b = aBvh.bounds();
+		std::uniform_real_distribution<float> u(0.0f, 1.0f);
+		std::vector<cpu_ray> rays;
+		rays.reserve(cNumRays);
+		for (int i = 0; i < cNumRays; ++i) {
+			const glm::vec3 from = b.mMin + (b.mMax - b.mMin) * glm::vec3{ u(aRng), u(aRng), u(aRng) };
+			const glm::vec3 to = b.mMin + (b.mMax - b.mMin) * glm::vec3{ u(aRng), u(aRng), u(aRng) };
+			rays.emplace_back(from, to - from, 0.0f, 1.0f);
+		}
+		size_t numHits = 0;
+		const auto ms = best_of_ms(1, [&]() {
+			for (auto ray : rays) {
+				bool hit = false;
+				aBvh.traverse(ray, [&](uint32_t aPrim, cpu_ray& aRay) {
+					const auto t = intersect_aabb(aRay, aPrimitiveBounds[aPrim].mMin, aPrimitiveBounds[aPrim].mMax);
+					if (t != std::numeric_limits<float>::infinity()) {
+						aRay.mTMax = t;
+						hit = true;
+					}
+					return false;
+				});
+				numHits += hit ? 1 : 0;
+			}
+		});
+		return static_cast<double>(cNumRays) / ms * 1e-3;
+	}
+
+	void run(const char* aName, const std::vector<aabb>& aBounds, thread_pool& aPool, std::mt19937& aRng, const particles* aParticles)
+	{
+		cpu_bvh binary;
+		cpu_bvh4 wide;
+		const auto sequentialMs = best_of_ms(3, [&]() { binary.build(aBounds); });
+		const auto sequentialSah = binary.sah_cost();
+		const auto parallelMs = best_of_ms(3, [&]() { binary.build(aBounds, &aPool); });
+		const auto collapseMs = best_of_ms(3, [&]() { wide.collapse(binary); });
+		const auto mrays = measure_traversal_mrays(wide, aBounds, aRng);
+
+		std::printf("%-10s %8zu  build seq %8.2f ms  par %8.2f ms (x%.1f)  collapse %6.2f ms  SAH bin2 seq %7.2f  par %7.2f  bvh4 %7.2f  %6.2f MRays/s",
+			aName, aBounds.size(), sequentialMs, parallelMs, sequentialMs / parallelMs, collapseMs, sequentialSah, binary.sah_cost(), wide.sah_cost(), mrays);
+
+		if (nullptr != aParticles) {
+			// Let every particle move by up to one radius, as in one simulation step, then refit:
+			std::uniform_real_distribution<float> jitter(-0.1f, 0.1f);
+			auto moved = *aParticles;
+			for (size_t i = 0; i < moved.mX.size(); ++i) {
+				moved.mX[i] += jitter(aRng); moved.mY[i] += jitter(aRng); moved.mZ[i] += jitter(aRng);
+			}
+			std::vector<aabb> movedBounds;
+			sphere_bounds(moved.mX.data(), moved.mY.data(), moved.mZ.data(), moved.mRadii.data(), moved.mX.size(), 0.5f, movedBounds);
+			auto refitted = wide;
+			const auto refitMs = best_of_ms(3, [&]() { refitted.refit(movedBounds); });
+			cpu_bvh4 rebuilt;
+			rebuilt.build(movedBounds, &aPool);
+			std::printf("  refit %6.2f ms  SAH refit %7.2f  rebuild %7.2f", refitMs, refitted.sah_cost(), rebuilt.sah_cost());
+		}
+		std::printf("\n");
+	}
+}
+
+int main()
+{
+	auto& pool = shared_thread_pool();
+	std::mt19937 rng{ 42 };
+	std::printf("BVH benchmark on %zu threads. SAH costs are relative to the root's surface area (lower is better).\n", pool.size());
+	for (size_t count : { size_t{ 10000 }, size_t{ 100000 }, size_t{ 524288 } }) {
+		run("triangles", make_terrain_triangles(count), pool, rng, nullptr);
+
+		const auto p = make_particles(count, rng);
+		std::vector<aabb> sphereBoxes;
+		sphere_bounds(p.mX.data(), p.mY.data(), p.mZ.data(), p.mRadii.data(), count, 0.5f, sphereBoxes);
+		run("spheres", sphereBoxes, pool, rng, &p);
+	}
+	return 0;
+}
@@ -0,0 +1,606 @@
+// Benchmarks for the CPU-side hot paths of a frame and of loading the scene, parameterised over the number of particles:
+//  - tlas_assembly:        writing the instance rows of the TLAS, as fluid_nightmare_main::update() lets the geometry managers do it
+//  - candidate_selection:  choosing new particles among the candidates of one spawn dispatch (spawn_candidate_selector)
+//  - transform_generation: turning particles into TLAS instances, via full matrices (like gvk::matrix_from_transforms) and packed
+//  - geometry_packing:     packing groups, instances and materials into a scene cache, planning BLAS merges, packing static instances
+//  - texture_compression:  BC1/BC3 encoding of a texture with as many texels as there are particles
+//  - surface_reconstruction: reconstructing the fluid surface from a block of resting water (all bricks, and nothing changed)
+//  - particle_lod:         building and refitting the cluster hierarchy, and selecting the spheres for the default camera
+//  - particle_chunks:      grouping the particles into chunks, and updating the boxes of the chunks (all moved, and nothing changed)
+//  - particle_reordering:  checking and restoring the Morton order of the particles, and the simulation step, the LOD build and the
+//                          grouping into chunks with the particles in spawn order vs. in Morton order
+// Neither a window nor a GPU is required. Only GLM and the Vulkan headers are needed. In Visual Studio, build the
+// hot-path-benchmark project of the solution (it is excluded from building the solution, but uses the framework's
+// include directories and the same configurations). Otherwise, e.g.:
+//   g++ -std=c++17 -O2 -mavx2 -I<path to glm> -I<path to Vulkan headers> -I../source hot_path_benchmark.cpp -pthread -o hot_path_benchmark
+// or with MSVC:
+//   cl /std:c++17 /O2 /EHsc /arch:AVX2 /I<path to glm> /I%VULKAN_SDK%\Include /I..\source hot_path_benchmark.cpp
+//
+// The results are written to stdout as CSV (one line per benchmark, variant and count), or as JSON with --json:
+//   hot_path_benchmark [--json] [--max-count <n>] [--repetitions <n>]
+// On Linux, the last-level cache misses of all threads are counted via perf_event as well (averaged over the repetitions).
+// Elsewhere, or if the kernel doesn't permit it (see /proc/sys/kernel/perf_event_paranoid), they are reported as n/a.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#if defined(__linux__)
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "fluid_surface.hpp"
+#include "instance_packing.hpp"
+#include "packed_bitset.hpp"
+#include "particle_chunks.hpp"
+#include "particle_lod.hpp"
+#include "particle_reordering.hpp"
+#include "particle_store.hpp"
+#include "scene_cache.hpp"
+#include "sph_solver.hpp"
+#include "spawn_candidate_selector.hpp"
+#include "texture_compression.hpp"
+#include "thread_pool.hpp"
+#include "tlas_instance_rows.hpp"
+
+namespace
+{
+	// Same values as in procedural_geometry_manager:
+	constexpr size_t cMaxNumParticles = 524288;
+	constexpr size_t cNewParticleCandidatesToSpawn = 64 * 64;
+	constexpr float cRadius = 0.1f;
+
+	// The number of static (triangle mesh) instances of the TLAS, roughly as many as the scene has:
+	constexpr size_t cNumStaticInstances = 400;
+
+	struct result
+	{
+		std::string mBenchmark;
+		std::string mVariant;
+		size_t mCount;
+		int mRepetitions;
+		double mBestMs;
+		double mMedianMs;
+		double mCacheMisses; // Per run, negative if they couldn't be counted
+	};
+
+	// Counts the last-level cache misses of all threads of this process, i.e. also of the thread pool's workers, which must
+	// have been started before the first measurement. Counts nothing if perf_event is not available:
+	class cache_miss_counter
+	{
+	public:
+		cache_miss_counter()
+		{
+#if defined(__linux__)
+			DIR* tasks = opendir("/proc/self/task");
+			if (nullptr == tasks) {
+				return;
+			}
+			while (const dirent* entry = readdir(tasks)) {
+				if ('.' == entry->d_name[0]) {
+					continue;
+				}
+				perf_event_attr attr{};
+				attr.size = sizeof(attr);
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = PERF_COUNT_HW_CACHE_MISSES;
+				attr.disabled = 1;
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				const int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, static_cast<pid_t>(std::atoi(entry->d_name)), -1, -1, 0));
+				if (fd < 0) {
+					close_all(); // Rather count nothing than only some of the threads
+					break;
+				}
+				mFds.push_back(fd);
+			}
+			closedir(tasks);
+#endif
+		}
+		~cache_miss_counter() { close_all(); }
+		cache_miss_counter(const cache_miss_counter&) = delete;
+		cache_miss_counter& operator=(const cache_miss_counter&) = delete;
+
+		[[nodiscard]] bool available() const { return !mFds.empty(); }
+
+		void start()
+		{
+#if defined(__linux__)
+			for (int fd : mFds) {
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+#endif
+		}
+
+		// The number of misses since start():
+		uint64_t stop()
+		{
+			uint64_t sum = 0;
+#if defined(__linux__)
+			for (int fd : mFds) {
+				ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+				uint64_t value = 0;
+				if (sizeof(value) == read(fd, &value, sizeof(value))) {
+					sum += value;
+				}
+			}
+#endif
+			return sum;
+		}
+
+	private:
+		void close_all()
+		{
+#if defined(__linux__)
+			for (int fd : mFds) {
+				close(fd);
+			}
+#endif
+			mFds.clear();
+		}
+
+		std::vector<int> mFds;
+	};
+
+	// Created at the first measurement, after the thread pool has been started (see main):
+	cache_miss_counter& cache_misses()
+	{
+		static cache_miss_counter sCounter;
+		return sCounter;
+	}
+
+	// Runs aFunction aRepetitions times (after one warm-up run) and records its fastest and its median time, and its mean number of cache misses:
+	template <typename F>
+	void measure(std::vector<result>& aResults, const char* aBenchmark, const char* aVariant, size_t aCount, int aRepetitions, F&& aFunction)
+	{
+		auto& counter = cache_misses();
+		aFunction();
+		std::vector<double> ms;
+		uint64_t misses = 0;
+		for (int r = 0; r < aRepetitions; ++r) {
+			counter.start();
+			const auto t0 = std::chrono::steady_clock::now();
+			aFunction();
+			const auto t1 = std::chrono::steady_clock::now();
+			misses += counter.stop();
+			ms.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+		}
+		std::sort(std::begin(ms), std::end(ms));
+		const double missesPerRun = counter.available() ? static_cast<double>(misses) / aRepetitions : -1.0;
+		aResults.push_back(result{ aBenchmark, aVariant, aCount, aRepetitions, ms.front(), ms[ms.size() / 2], missesPerRun });
+	}
+
+	// Particles in a pool-like volume, with the default radius of new water particles:
+	void make_particles(size_t aCount, std::mt19937& aRng, particle_store& aParticles)
+	{
+		std::uniform_real_distribution<float> xz(-20.0f, 20.0f), y(0.0f, 10.0f);
+		aParticles.clear();
+		aParticles.reserve(aCount);
+		for (size_t i = 0; i < aCount; ++i) {
+			aParticles.add(glm::vec3{ xz(aRng), y(aRng), xz(aRng) }, cRadius);
+		}
+	}
+
+	// The instance header which procedural_geometry_manager gets from the framework (the BLAS address is made up):
+	packed_instance_header make_particle_header()
+	{
+		packed_instance prototype{};
+		prototype.mask = 0xFF;
+		prototype.instanceShaderBindingTableRecordOffset = 1;
+		prototype.accelerationStructureReference = 0x10000;
+		packed_instance_header header;
+		std::memcpy(&header, reinterpret_cast<const char*>(&prototype) + sizeof(VkTransformMatrixKHR), sizeof(header));
+		return header;
+	}
+
+	// The same as gvk::matrix_from_transforms(...), which the framework-based instance generation has used:
+	glm::mat4 matrix_from_transforms(const glm::vec3& aTranslation, const glm::quat& aRotation, const glm::vec3& aScale)
+	{
+		return glm::translate(glm::mat4{ 1.0f }, aTranslation) * glm::mat4_cast(aRotation) * glm::scale(glm::mat4{ 1.0f }, aScale);
+	}
+
+	// Writes the rows of a frame in which all particles have moved, like fluid_nightmare_main::update() with both managers:
+	void bench_tlas_assembly(std::vector<result>& aResults, size_t aCount, int aRepetitions, const particle_store& aParticles, thread_pool& aPool)
+	{
+		tlas_instance_rows rows;
+		rows.create(3, cNumStaticInstances, cMaxNumParticles);
+		std::vector<packed_instance> staticInstances(cNumStaticInstances, packed_instance{});
+		for (auto& inst : staticInstances) {
+			inst.mask = 0xFF;
+		}
+		packed_bitset visible(cNumStaticInstances, true);
+		rows.set_static_instances(staticInstances, visible);
+		std::vector<packed_instance> uploaded(cNumStaticInstances + cMaxNumParticles); // Stands in for the host-coherent buffer
+		const auto header = make_particle_header();
+
+		const auto writeDynamic = [&](size_t aBegin, size_t aEnd) {
+			rows.set_number_of_dynamic_instances(aEnd);
+			auto* dst = rows.dynamic_instances();
+			aPool.parallel_for(aBegin, aEnd, 16384, [&](size_t aChunkBegin, size_t aChunkEnd) {
+				pack_sphere_instances(aParticles.positions_x() + aChunkBegin, aParticles.positions_y() + aChunkBegin, aParticles.positions_z() + aChunkBegin,
+					aParticles.radii() + aChunkBegin, aChunkEnd - aChunkBegin, header, dst + aChunkBegin);
+			});
+			rows.mark_dynamic_instances_dirty(aBegin, aEnd);
+		};
+		const auto upload = [&]() {
+			const auto [begin, end] = rows.take_dirty_range(0);
+			if (begin < end) {
+				std::memcpy(uploaded.data() + begin, rows.rows() + begin, (end - begin) * sizeof(packed_instance));
+			}
+		};
+
+		measure(aResults, "tlas_assembly", "all_moved", aCount, aRepetitions, [&]() {
+			writeDynamic(0, aCount);
+			upload();
+		});
+		// One static instance is toggled (only its mask changes), and the most recent spawn dispatch has added particles:
+		size_t toggle = 0;
+		const auto numAppended = std::min(aCount, size_t{ 1024 });
+		measure(aResults, "tlas_assembly", "toggle_and_append", aCount, aRepetitions, [&]() {
+			visible.set(toggle % cNumStaticInstances, !visible[toggle % cNumStaticInstances]);
+			++toggle;
+			rows.set_static_instance_visibility(visible);
+			rows.set_number_of_dynamic_instances(aCount - numAppended);
+			writeDynamic(aCount - numAppended, aCount);
+			upload();
+		});
+	}
+
+	// Selects new particles among the candidates of one spawn dispatch, which are spread over the volume of the existing particles:
+	void bench_candidate_selection(std::vector<result>& aResults, size_t aCount, int aRepetitions, const particle_store& aParticles, std::mt19937& aRng, thread_pool& aPool)
+	{
+		std::uniform_real_distribution<float> xz(-20.0f, 20.0f), y(0.0f, 10.0f);
+		std::vector<glm::vec4> candidates(cNewParticleCandidatesToSpawn);
+		for (auto& c : candidates) {
+			c = glm::vec4{ xz(aRng), y(aRng), xz(aRng), 1.0f };
+		}
+		spawn_candidate_selector selector;
+		std::vector<glm::vec3> selected;
+		measure(aResults, "candidate_selection", "begin", aCount, aRepetitions, [&]() {
+			selector.begin(aParticles, cRadius, aPool);
+		});
+		measure(aResults, "candidate_selection", "begin_and_select", aCount, aRepetitions, [&]() {
+			selected.clear();
+			selector.begin(aParticles, cRadius, aPool);
+			selector.select(candidates.data(), candidates.size(), cRadius, 1024, selected);
+		});
+	}
+
+	// Generates one TLAS instance per particle, single-threaded:
+	void bench_transform_generation(std::vector<result>& aResults, size_t aCount, int aRepetitions, const particle_store& aParticles)
+	{
+		std::vector<packed_instance> out(aCount);
+		const auto header = make_particle_header();
+		measure(aResults, "transform_generation", "matrix_from_transforms", aCount, aRepetitions, [&]() {
+			for (size_t i = 0; i < aCount; ++i) {
+				const auto m = matrix_from_transforms(aParticles.position(i), glm::quat{ 1.0f, 0.0f, 0.0f, 0.0f }, glm::vec3{ aParticles.radii()[i] });
+				out[i] = make_packed_instance(m, 0, 1, 0x10000);
+			}
+		});
+		measure(aResults, "transform_generation", "pack_scalar", aCount, aRepetitions, [&]() {
+			pack_sphere_instances_scalar(aParticles.positions_x(), aParticles.positions_y(), aParticles.positions_z(), aParticles.radii(), aCount, header, out.data());
+		});
+		measure(aResults, "transform_generation", "pack_simd", aCount, aRepetitions, [&]() {
+			pack_sphere_instances(aParticles.positions_x(), aParticles.positions_y(), aParticles.positions_z(), aParticles.radii(), aCount, header, out.data());
+		});
+	}
+
+	// A scene with aCount vertices in total: models of 8 groups each (every group with its own material), and 4 instances per model:
+	void bench_geometry_packing(std::vector<result>& aResults, size_t aCount, int aRepetitions, std::mt19937& aRng)
+	{
+		constexpr size_t cVerticesPerGroup = 2048;
+		const auto numGroups = std::max<size_t>(1, aCount / cVerticesPerGroup);
+		std::uniform_real_distribution<float> u(-50.0f, 50.0f);
+		std::vector<glm::vec3> positions(cVerticesPerGroup);
+		for (auto& p : positions) {
+			p = glm::vec3{ u(aRng), u(aRng), u(aRng) };
+		}
+		std::vector<uint32_t> indices(cVerticesPerGroup * 3);
+		for (size_t i = 0; i < indices.size(); ++i) {
+			indices[i] = static_cast<uint32_t>((i * 7919) % cVerticesPerGroup);
+		}
+		scene_cache_format::material material{};
+		material.mDiffuseReflectivity = glm::vec4{ 1.0f };
+
+		std::vector<uint8_t> image;
+		measure(aResults, "geometry_packing", "scene_cache_build", aCount, aRepetitions, [&]() {
+			scene_cache_builder builder(0);
+			for (size_t g = 0; g < numGroups; ++g) {
+				if (0 == g % 8) {
+					builder.begin_model("model " + std::to_string(g / 8));
+				}
+				material.mName = builder.add_string("material " + std::to_string(g));
+				const auto group = builder.add_group(material, positions, indices, {}, {});
+				if (7 == g % 8 || g + 1 == numGroups) {
+					for (int i = 0; i < 4; ++i) {
+						builder.add_instance(group - static_cast<uint32_t>(g % 8), glm::translate(glm::mat4{ 1.0f }, glm::vec3{ static_cast<float>(i) * 100.0f, 0.0f, 0.0f }), "instance");
+					}
+				}
+			}
+			image = builder.build();
+		});
+
+		scene_cache cache;
+		std::string error;
+		if (!cache.open(std::move(image), error)) {
+			std::fprintf(stderr, "Couldn't open the scene cache: %s\n", error.c_str());
+			return;
+		}
+		std::vector<packed_instance> instances;
+		measure(aResults, "geometry_packing", "plan_merging_and_pack_instances", aCount, aRepetitions, [&]() {
+			// Like triangle_mesh_geometry_manager: only the instances of the first group of every BLAS become TLAS instances:
+			const auto ranges = plan_blas_merging(cache, 16 * 1024, 256 * 1024);
+			std::vector<uint32_t> blasOfGroup(cache.groups().size());
+			for (uint32_t b = 0; b < ranges.size(); ++b) {
+				std::fill(std::begin(blasOfGroup) + ranges[b].first, std::begin(blasOfGroup) + ranges[b].second, b);
+			}
+			instances.clear();
+			for (const auto& inst : cache.instances()) {
+				const auto b = blasOfGroup[inst.mGroup];
+				if (ranges[b].first == inst.mGroup) {
+					instances.push_back(make_packed_instance(inst.mTransform, inst.mGroup, 0, 0x10000 + b));
+				}
+			}
+		});
+	}
+
+	// Compresses an RGBA8 texture with about aCount texels, with and without alpha:
+	void bench_texture_compression(std::vector<result>& aResults, size_t aCount, int aRepetitions, std::mt19937& aRng)
+	{
+		const auto side = std::max<uint32_t>(4, static_cast<uint32_t>(std::sqrt(static_cast<double>(aCount))));
+		std::vector<uint8_t> rgba(static_cast<size_t>(side) * side * 4);
+		std::uniform_int_distribution<int> noise(0, 31);
+		for (uint32_t y = 0; y < side; ++y) {
+			for (uint32_t x = 0; x < side; ++x) {
+				auto* t = &rgba[(static_cast<size_t>(y) * side + x) * 4];
+				t[0] = static_cast<uint8_t>(x * 255 / side);
+				t[1] = static_cast<uint8_t>(y * 255 / side);
+				t[2] = static_cast<uint8_t>(128 + noise(aRng));
+				t[3] = static_cast<uint8_t>(255 - noise(aRng));
+			}
+		}
+		std::vector<uint8_t> out(texture_compression::compressed_size(side, side, true));
+		measure(aResults, "texture_compression", "bc1", static_cast<size_t>(side) * side, aRepetitions, [&]() {
+			texture_compression::compress(rgba.data(), side, side, false, out.data());
+		});
+		measure(aResults, "texture_compression", "bc3", static_cast<size_t>(side) * side, aRepetitions, [&]() {
+			texture_compression::compress(rgba.data(), side, side, true, out.data());
+		});
+	}
+
+	// Reconstructs the surface of a block of water, in which the particles are packed at their rest spacing (with some jitter),
+	// with the default radius of procedural_geometry_manager. "full" meshes all bricks, "unchanged" only bins and hashes them:
+	void bench_surface_reconstruction(std::vector<result>& aResults, size_t aCount, int aRepetitions, std::mt19937& aRng, thread_pool& aPool)
+	{
+		constexpr float cWaterRadius = 0.35f;
+		constexpr size_t cBlockWidth = 80;
+		std::uniform_real_distribution<float> jitter(-0.05f, 0.05f);
+		particle_store water;
+		water.reserve(aCount);
+		for (size_t i = 0; i < aCount; ++i) {
+			const glm::vec3 lattice{ static_cast<float>(i % cBlockWidth), static_cast<float>(i / (cBlockWidth * cBlockWidth)), static_cast<float>(i / cBlockWidth % cBlockWidth) };
+			water.add(lattice * (2.0f * cWaterRadius) + glm::vec3{ jitter(aRng), jitter(aRng), jitter(aRng) }, cWaterRadius);
+		}
+		measure(aResults, "surface_reconstruction", "full", aCount, aRepetitions, [&]() {
+			fluid_surface_reconstructor surface;
+			surface.reconstruct(water.positions_x(), water.positions_y(), water.positions_z(), water.radii(), aCount, aPool);
+		});
+		fluid_surface_reconstructor surface;
+		surface.reconstruct(water.positions_x(), water.positions_y(), water.positions_z(), water.radii(), aCount, aPool);
+		measure(aResults, "surface_reconstruction", "unchanged", aCount, aRepetitions, [&]() {
+			surface.reconstruct(water.positions_x(), water.positions_y(), water.positions_z(), water.radii(), aCount, aPool);
+		});
+	}
+
+	// Updates the LOD hierarchy over the particles and selects the spheres for a camera at the initial position of fluid_nightmare_main's:
+	void bench_particle_lod(std::vector<result>& aResults, size_t aCount, int aRepetitions, const particle_store& aParticles, thread_pool& aPool)
+	{
+		particle_lod lod;
+		measure(aResults, "particle_lod", "build", aCount, aRepetitions, [&]() {
+			lod.invalidate();
+			lod.update(aParticles.positions_x(), aParticles.positions_y(), aParticles.positions_z(), aParticles.radii(), aCount, aPool);
+		});
+		lod.params().mMaxRefitsBeforeRebuild = UINT32_MAX;
+		measure(aResults, "particle_lod", "refit", aCount, aRepetitions, [&]() {
+			lod.update(aParticles.positions_x(), aParticles.positions_y(), aParticles.positions_z(), aParticles.radii(), aCount, aPool);
+		});
+		// Alternate between two camera positions, s.t. every selection differs from the previous one:
+		int frame = 0;
+		measure(aResults, "particle_lod", "select", aCount, aRepetitions, [&]() {
+			const glm::vec3 camera{ 0.0f, 10.0f, 0 == frame++ % 2 ? 45.0f : 40.0f };
+			lod.select(camera, aParticles.positions_x(), aParticles.positions_y(), aParticles.positions_z(), aParticles.radii());
+		});
+	}
+
+	void bench_particle_chunks(std::vector<result>& aResults, size_t aCount, int aRepetitions, const particle_store& aParticles, thread_pool& aPool)
+	{
+		particle_chunks chunks;
+		measure(aResults, "particle_chunks", "group", aCount, aRepetitions, [&]() {
+			chunks.invalidate();
+			chunks.update(aParticles.positions_x(), aParticles.positions_y(), aParticles.positions_z(), aParticles.radii(), aCount, aPool);
+		});
+		// Alternate between two sets of positions, s.t. every update changes all boxes:
+		std::vector<float> movedY(aParticles.positions_y(), aParticles.positions_y() + aCount);
+		for (auto& y : movedY) {
+			y += 0.01f;
+		}
+		chunks.params().mMaxUpdatesBeforeRegroup = UINT32_MAX;
+		int frame = 0;
+		measure(aResults, "particle_chunks", "all_moved", aCount, aRepetitions, [&]() {
+			const float* y = 0 == frame++ % 2 ? movedY.data() : aParticles.positions_y();
+			chunks.update(aParticles.positions_x(), y, aParticles.positions_z(), aParticles.radii(), aCount, aPool);
+		});
+		chunks.update(aParticles.positions_x(), aParticles.positions_y(), aParticles.positions_z(), aParticles.radii(), aCount, aPool);
+		measure(aResults, "particle_chunks", "unchanged", aCount, aRepetitions, [&]() {
+			chunks.update(aParticles.positions_x(), aParticles.positions_y(), aParticles.positions_z(), aParticles.radii(), aCount, aPool);
+		});
+	}
+
+	// The same particles in the same order:
+	void copy_particles(const particle_store& aSource, particle_store& aDestination)
+	{
+		aDestination.clear();
+		aDestination.reserve(aSource.size());
+		for (size_t i = 0; i < aSource.size(); ++i) {
+			aDestination.add(glm::vec3{ aSource.positions_x()[i], aSource.positions_y()[i], aSource.positions_z()[i] }, aSource.radii()[i]);
+		}
+	}
+
+	// make_particles(...) adds the particles in random order, like spawning does. Compares the hot paths which loop over the
+	// particles' neighbours in that order with the Morton order which particle_reorderer establishes:
+	void bench_particle_reordering(std::vector<result>& aResults, size_t aCount, int aRepetitions, const particle_store& aParticles, std::mt19937& aRng, thread_pool& aPool)
+	{
+		particle_store spawnOrder, mortonOrder;
+		copy_particles(aParticles, spawnOrder);
+		copy_particles(aParticles, mortonOrder);
+		particle_reorderer reorderer;
+		reorderer.reorder(mortonOrder, aPool, true);
+
+		// Only computes the codes and finds out that they are in order:
+		measure(aResults, "particle_reordering", "check", aCount, aRepetitions, [&]() {
+			reorderer.reorder(mortonOrder, aPool, false);
+		});
+		// Sorting takes as long for any order, but permuting ordered particles is cheaper than permuting the ones in spawn order:
+		measure(aResults, "particle_reordering", "reorder", aCount, aRepetitions, [&]() {
+			reorderer.reorder(mortonOrder, aPool, true);
+		});
+		std::vector<uint32_t> shuffle(aCount);
+		std::iota(std::begin(shuffle), std::end(shuffle), 0u);
+		std::shuffle(std::begin(shuffle), std::end(shuffle), aRng);
+		particle_store shuffled;
+		copy_particles(aParticles, shuffled);
+		measure(aResults, "particle_reordering", "permute_random", aCount, aRepetitions, [&]() {
+			shuffled.permute(shuffle.data(), aPool);
+		});
+
+		// One step of the same simulation for both orders (the steps hardly change the order):
+		sph_solver spawnSolver, mortonSolver;
+		spawnSolver.parameters().mParticleRadius = mortonSolver.parameters().mParticleRadius = cRadius;
+		measure(aResults, "particle_reordering", "sph_step_spawn_order", aCount, aRepetitions, [&]() {
+			spawnSolver.step(spawnOrder, spawnSolver.parameters().mFixedTimeStep, aPool);
+		});
+		measure(aResults, "particle_reordering", "sph_step_morton_order", aCount, aRepetitions, [&]() {
+			mortonSolver.step(mortonOrder, mortonSolver.parameters().mFixedTimeStep, aPool);
+		});
+
+		// The structures which the acceleration structures are built from:
+		particle_lod lod;
+		measure(aResults, "particle_reordering", "lod_build_spawn_order", aCount, aRepetitions, [&]() {
+			lod.invalidate();
+			lod.update(spawnOrder.positions_x(), spawnOrder.positions_y(), spawnOrder.positions_z(), spawnOrder.radii(), aCount, aPool);
+		});
+		measure(aResults, "particle_reordering", "lod_build_morton_order", aCount, aRepetitions, [&]() {
+			lod.invalidate();
+			lod.update(mortonOrder.positions_x(), mortonOrder.positions_y(), mortonOrder.positions_z(), mortonOrder.radii(), aCount, aPool);
+		});
+		particle_chunks chunks;
+		measure(aResults, "particle_reordering", "chunks_group_spawn_order", aCount, aRepetitions, [&]() {
+			chunks.invalidate();
+			chunks.update(spawnOrder.positions_x(), spawnOrder.positions_y(), spawnOrder.positions_z(), spawnOrder.radii(), aCount, aPool);
+		});
+		measure(aResults, "particle_reordering", "chunks_group_morton_order", aCount, aRepetitions, [&]() {
+			chunks.invalidate();
+			chunks.update(mortonOrder.positions_x(), mortonOrder.positions_y(), mortonOrder.positions_z(), mortonOrder.radii(), aCount, aPool);
+		});
+	}
+
+	void print_csv(const std::vector<result>& aResults, size_t aNumThreads)
+	{
+		std::printf("benchmark,variant,count,threads,repetitions,best_ms,median_ms,items_per_second,cache_misses_per_run\n");
+		for (const auto& r : aResults) {
+			std::printf("%s,%s,%zu,%zu,%d,%.4f,%.4f,%.0f,", r.mBenchmark.c_str(), r.mVariant.c_str(), r.mCount, aNumThreads, r.mRepetitions,
+				r.mBestMs, r.mMedianMs, static_cast<double>(r.mCount) / (r.mMedianMs * 1e-3));
+			if (r.mCacheMisses < 0.0) {
+				std::printf("n/a\n");
+			}
+			else {
+				std::printf("%.0f\n", r.mCacheMisses);
+			}
+		}
+	}
+
+	void print_json(const std::vector<result>& aResults, size_t aNumThreads)
+	{
+		std::printf("{\n  \"threads\": %zu,\n  \"results\": [", aNumThreads);
+		for (size_t i = 0; i < aResults.size(); ++i) {
+			const auto& r = aResults[i];
+			std::printf("%s\n    { \"benchmark\": \"%s\", \"variant\": \"%s\", \"count\": %zu, \"repetitions\": %d, \"best_ms\": %.4f, \"median_ms\": %.4f, \"items_per_second\": %.0f, \"cache_misses_per_run\": ",
+				0 == i ? "" : ",", r.mBenchmark.c_str(), r.mVariant.c_str(), r.mCount, r.mRepetitions, r.mBestMs, r.mMedianMs, static_cast<double>(r.mCount) / (r.mMedianMs * 1e-3));
+			if (r.mCacheMisses < 0.0) {
+				std::printf("null }");
+			}
+			else {
+				std::printf("%.0f }", r.mCacheMisses);
+			}
+		}
+		std::printf("\n  ]\n}\n");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	bool json = false;
+	size_t maxCount = cMaxNumParticles;
+	int repetitions = 9;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if ("--json" == arg) {
+			json = true;
+		}
+		else if ("--max-count" == arg && i + 1 < argc) {
+			maxCount = static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+		}
+		else if ("--repetitions" == arg && i + 1 < argc) {
+			repetitions = std::max(1, std::atoi(argv[++i]));
+		}
+		else {
+			std::fprintf(stderr, "Usage: %s [--json] [--max-count <n>] [--repetitions <n>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	auto& pool = shared_thread_pool();
+	std::mt19937 rng{ 42 };
+	std::vector<result> results;
+	particle_store particles;
+	size_t lastCount = 0;
+	for (size_t count : { size_t{ 1024 }, size_t{ 16384 }, size_t{ 131072 }, cMaxNumParticles }) {
+		count = std::min(count, maxCount);
+		if (count <= lastCount) {
+			break; // All further counts have been capped to one which has been measured already
+		}
+		lastCount = count;
+		make_particles(count, rng, particles);
+		bench_tlas_assembly(results, count, repetitions, particles, pool);
+		bench_candidate_selection(results, count, repetitions, particles, rng, pool);
+		bench_transform_generation(results, count, repetitions, particles);
+		bench_geometry_packing(results, count, repetitions, rng);
+		bench_texture_compression(results, count, repetitions, rng);
+		bench_surface_reconstruction(results, count, repetitions, rng, pool);
+		bench_particle_lod(results, count, repetitions, particles, pool);
+		bench_particle_chunks(results, count, repetitions, particles, pool);
+		bench_particle_reordering(results, count, repetitions, particles, rng, pool);
+	}
+
+	if (json) {
+		print_json(results, pool.size());
+	}
+	else {
+		print_csv(results, pool.size());
+	}
+	return 0;
+}
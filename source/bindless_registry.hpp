@@ -0,0 +1,151 @@
+#pragma once
+
+#include <gvk.hpp>
+
+#include "slot_allocator.hpp"
+
+// Gives every texture and every group of meshes a stable index into the descriptor arrays of the scene's descriptor set:
+// textures are the elements of binding 0, and a group's index, texture coordinate and normal buffer views are the
+// elements of bindings 2, 3 and 4 (see first_hit_closest_hit_shader.rchit). A group's material is the element of the
+// material buffer (binding 1) at the group's index, and materials refer to textures by their indices.
+// The descriptor set is written once, with all elements at once, and there is one copy per frame in flight. Afterwards,
+// write_changed_slots(...) only patches the elements which have changed since the copy has been written last.
+// The arrays have as many elements as there are slots, i.e. the capacities must be known when the descriptor sets are
+// created. Afterwards, new textures and groups can only take over the slots of removed ones. A removed resource stays in
+// its slot until the slot is reused (the descriptors must stay valid) and is kept alive until no frame in flight uses it.
+class bindless_registry
+{
+public:
+	using texture_handle = slot_handle;
+	using geometry_handle = slot_handle;
+
+	// The binding points in descriptor set 0:
+	static constexpr uint32_t cTexturesBinding = 0;
+	static constexpr uint32_t cIndexBuffersBinding = 2;
+	static constexpr uint32_t cTexCoordsBuffersBinding = 3;
+	static constexpr uint32_t cNormalsBuffersBinding = 4;
+
+	// Prepares aMaxTextures texture slots and aMaxGeometries group slots for aNumCopies descriptor sets:
+	void create(uint32_t aMaxTextures, uint32_t aMaxGeometries, uint32_t aNumCopies)
+	{
+		mTextureSlots.reset(aMaxTextures, aNumCopies);
+		mGeometrySlots.reset(aMaxGeometries, aNumCopies);
+		mTextures.clear();
+		mIndexBufferViews.clear();
+		mTexCoordsBufferViews.clear();
+		mNormalsBufferViews.clear();
+	}
+
+	// Assigns a slot to aTexture. Returns a null handle if all slots are taken:
+	texture_handle add_texture(avk::image_sampler aTexture)
+	{
+		const auto handle = mTextureSlots.allocate();
+		if (!handle.is_null()) {
+			put(mTextures, handle.mIndex, std::move(aTexture));
+		}
+		return handle;
+	}
+
+	// Assigns a slot to a group of meshes, i.e. to its index, texture coordinate and normal buffer views. Returns a null handle if all slots are taken:
+	geometry_handle add_geometry(avk::buffer_view aIndices, avk::buffer_view aTexCoords, avk::buffer_view aNormals)
+	{
+		const auto handle = mGeometrySlots.allocate();
+		if (!handle.is_null()) {
+			put(mIndexBufferViews, handle.mIndex, std::move(aIndices));
+			put(mTexCoordsBufferViews, handle.mIndex, std::move(aTexCoords));
+			put(mNormalsBufferViews, handle.mIndex, std::move(aNormals));
+		}
+		return handle;
+	}
+
+	// Replaces the texture in the slot of aHandle, which keeps its index. Returns false if aHandle is stale:
+	bool replace_texture(texture_handle aHandle, avk::image_sampler aTexture)
+	{
+		if (!mTextureSlots.is_valid(aHandle)) {
+			return false;
+		}
+		put(mTextures, aHandle.mIndex, std::move(aTexture));
+		mTextureSlots.mark_changed(aHandle.mIndex);
+		return true;
+	}
+
+	// Frees the slot of aHandle for another texture. Returns false if aHandle is stale:
+	bool remove_texture(texture_handle aHandle)
+	{
+		return mTextureSlots.release(aHandle);
+	}
+
+	// Frees the slot of aHandle for another group of meshes. Returns false if aHandle is stale:
+	bool remove_geometry(geometry_handle aHandle)
+	{
+		return mGeometrySlots.release(aHandle);
+	}
+
+	[[nodiscard]] bool is_valid_texture(texture_handle aHandle) const { return mTextureSlots.is_valid(aHandle); }
+	[[nodiscard]] bool is_valid_geometry(geometry_handle aHandle) const { return mGeometrySlots.is_valid(aHandle); }
+
+	// The elements of the descriptor arrays, for creating the descriptor sets and the pipelines' layouts:
+	[[nodiscard]] const std::vector<avk::image_sampler>& textures() const { return mTextures; }
+	[[nodiscard]] const std::vector<avk::buffer_view>& index_buffer_views() const { return mIndexBufferViews; }
+	[[nodiscard]] const std::vector<avk::buffer_view>& tex_coords_buffer_views() const { return mTexCoordsBufferViews; }
+	[[nodiscard]] const std::vector<avk::buffer_view>& normals_buffer_views() const { return mNormalsBufferViews; }
+
+	// Writes the elements which have changed since the previous invocation for aCopy into aSet, which must have been created
+	// with all elements, and which must not be in use by the GPU. Returns the number of written descriptors:
+	size_t write_changed_slots(uint32_t aCopy, vk::DescriptorSet aSet)
+	{
+		mTextureSlots.take_changed(aCopy, mChangedTextures);
+		mGeometrySlots.take_changed(aCopy, mChangedGeometries);
+		if (mChangedTextures.empty() && mChangedGeometries.empty()) {
+			return 0;
+		}
+
+		// The writes refer to the infos => reserve all of them up front:
+		mImageInfos.clear();
+		mImageInfos.reserve(mChangedTextures.size());
+		mBufferViewHandles.clear();
+		mBufferViewHandles.reserve(mChangedGeometries.size() * 3);
+		mWrites.clear();
+		for (auto i : mChangedTextures) {
+			mImageInfos.push_back(mTextures[i]->descriptor_info());
+			mWrites.emplace_back(aSet, cTexturesBinding, i, 1u, vk::DescriptorType::eCombinedImageSampler, &mImageInfos.back(), nullptr, nullptr);
+		}
+		for (auto i : mChangedGeometries) {
+			for (auto [binding, views] : { std::make_pair(cIndexBuffersBinding, &mIndexBufferViews), std::make_pair(cTexCoordsBuffersBinding, &mTexCoordsBufferViews), std::make_pair(cNormalsBuffersBinding, &mNormalsBufferViews) }) {
+				mBufferViewHandles.push_back((*views)[i]->view_handle());
+				mWrites.emplace_back(aSet, binding, i, 1u, vk::DescriptorType::eUniformTexelBuffer, nullptr, nullptr, &mBufferViewHandles.back());
+			}
+		}
+		gvk::context().device().updateDescriptorSets(mWrites, nullptr);
+		return mWrites.size();
+	}
+
+private:
+	// Puts aResource into the slot aIndex of aArray. A former occupant is kept alive until no frame in flight uses it:
+	template <typename T>
+	static void put(std::vector<T>& aArray, uint32_t aIndex, T aResource)
+	{
+		if (aIndex < aArray.size()) {
+			gvk::context().main_window()->handle_lifetime(avk::owned(aArray[aIndex]));
+			aArray[aIndex] = std::move(aResource);
+		}
+		else {
+			assert(aIndex == aArray.size()); // Slots are handed out in ascending order, unless they are reused
+			aArray.push_back(std::move(aResource));
+		}
+	}
+
+	slot_allocator mTextureSlots;
+	slot_allocator mGeometrySlots;
+	std::vector<avk::image_sampler> mTextures;
+	std::vector<avk::buffer_view> mIndexBufferViews;
+	std::vector<avk::buffer_view> mTexCoordsBufferViews;
+	std::vector<avk::buffer_view> mNormalsBufferViews;
+
+	// Temporary data of write_changed_slots(...), kept around to avoid re-allocations:
+	std::vector<uint32_t> mChangedTextures;
+	std::vector<uint32_t> mChangedGeometries;
+	std::vector<vk::DescriptorImageInfo> mImageInfos;
+	std::vector<vk::BufferView> mBufferViewHandles;
+	std::vector<vk::WriteDescriptorSet> mWrites;
+};
@@ -0,0 +1,476 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "thread_pool.hpp"
+
+// An axis-aligned bounding box:
+struct aabb
+{
+	glm::vec3 mMin = glm::vec3{  std::numeric_limits<float>::max() };
+	glm::vec3 mMax = glm::vec3{ -std::numeric_limits<float>::max() };
+
+	void extend(const glm::vec3& aPoint) { mMin = glm::min(mMin, aPoint); mMax = glm::max(mMax, aPoint); }
+	void extend(const aabb& aOther) { mMin = glm::min(mMin, aOther.mMin); mMax = glm::max(mMax, aOther.mMax); }
+	[[nodiscard]] bool is_empty() const { return mMin.x > mMax.x || mMin.y > mMax.y || mMin.z > mMax.z; }
+	[[nodiscard]] glm::vec3 center() const { return 0.5f * (mMin + mMax); }
+	[[nodiscard]] float surface_area() const
+	{
+		if (is_empty()) {
+			return 0.0f;
+		}
+		const auto e = mMax - mMin;
+		return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+};
+
+// A ray with the same semantics as in the ray tracing shaders: Only hits with
+// mTMin <= t <= mTMax count, and the direction does not need to be normalized.
+struct cpu_ray
+{
+	cpu_ray(const glm::vec3& aOrigin, const glm::vec3& aDirection, float aTMin, float aTMax)
+		: mOrigin{ aOrigin }, mDirection{ aDirection }, mInvDirection{ 1.0f / aDirection }, mTMin{ aTMin }, mTMax{ aTMax }
+	{}
+
+	glm::vec3 mOrigin;
+	glm::vec3 mDirection;
+	glm::vec3 mInvDirection;
+	float mTMin;
+	float mTMax;
+};
+
+// Returns the entry distance of the ray into the box, or +infinity if it misses the box within [mTMin, mTMax]:
+[[nodiscard]] inline float intersect_aabb(const cpu_ray& aRay, const glm::vec3& aMin, const glm::vec3& aMax)
+{
+	const auto t0 = (aMin - aRay.mOrigin) * aRay.mInvDirection;
+	const auto t1 = (aMax - aRay.mOrigin) * aRay.mInvDirection;
+	const auto tNear = glm::min(t0, t1);
+	const auto tFar = glm::max(t0, t1);
+	const auto tEnter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, aRay.mTMin));
+	const auto tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, aRay.mTMax));
+	return tEnter <= tExit ? tEnter : std::numeric_limits<float>::infinity();
+}
+
+// Computes the bounding boxes of indexed triangles (three indices per triangle), e.g. of a cpu_mesh:
+inline std::vector<aabb> triangle_bounds(const std::vector<glm::vec3>& aPositions, const std::vector<uint32_t>& aIndices, thread_pool* aPool = nullptr)
+{
+	std::vector<aabb> bounds(aIndices.size() / 3);
+	auto compute = [&](size_t aBegin, size_t aEnd) {
+		for (auto t = aBegin; t < aEnd; ++t) {
+			bounds[t] = aabb{};
+			for (size_t k = 0; k < 3; ++k) {
+				bounds[t].extend(aPositions[aIndices[3 * t + k]]);
+			}
+		}
+	};
+	if (nullptr != aPool) {
+		aPool->parallel_for(0, bounds.size(), 16384, compute);
+	}
+	else {
+		compute(0, bounds.size());
+	}
+	return bounds;
+}
+
+// Computes the bounding boxes of spheres, given as arrays of centers and radii (e.g. those of a particle_store).
+// aRadiusScale is applied to every radius, which is 0.5 for the water particles (see rt_aabb.rint):
+inline void sphere_bounds(const float* aX, const float* aY, const float* aZ, const float* aRadii, size_t aCount, float aRadiusScale, std::vector<aabb>& aBounds, thread_pool* aPool = nullptr)
+{
+	aBounds.resize(aCount);
+	auto compute = [&](size_t aBegin, size_t aEnd) {
+		for (auto i = aBegin; i < aEnd; ++i) {
+			const glm::vec3 c{ aX[i], aY[i], aZ[i] };
+			const glm::vec3 r{ aRadii[i] * aRadiusScale };
+			aBounds[i] = aabb{ c - r, c + r };
+		}
+	};
+	if (nullptr != aPool) {
+		aPool->parallel_for(0, aCount, 16384, compute);
+	}
+	else {
+		compute(0, aCount);
+	}
+}
+
+// A binary bounding volume hierarchy over arbitrary primitives, which are only known by their bounding boxes.
+// It is built top-down with a binned surface area heuristic (SAH). Intersecting the primitives
+// themselves is up to the user, see traverse(...).
+// If a thread_pool is passed to build(...), the upper levels are split with parallel binning and the
+// resulting subtrees are built concurrently. Either way, children are always stored after their
+// parents, which allows refit(...) to update all nodes in a single backwards pass.
+class cpu_bvh
+{
+public:
+	// 32 bytes per node. Inner nodes store the index of their first child (the second one follows
+	// directly), leaves store a range of primitives in primitive_indices():
+	struct alignas(32) node
+	{
+		glm::vec3 mMin;
+		uint32_t mFirst;
+		glm::vec3 mMax;
+		uint32_t mCount; // 0 for inner nodes
+	};
+	static_assert(sizeof(node) == 32, "Nodes are expected to occupy 32 bytes");
+
+	void build(const std::vector<aabb>& aPrimitiveBounds, thread_pool* aPool = nullptr)
+	{
+		mNodes.clear();
+		mPrimitiveIndices.resize(aPrimitiveBounds.size());
+		for (uint32_t i = 0; i < static_cast<uint32_t>(aPrimitiveBounds.size()); ++i) {
+			mPrimitiveIndices[i] = i;
+		}
+		if (aPrimitiveBounds.empty()) {
+			return;
+		}
+		mNodes.reserve(2 * aPrimitiveBounds.size());
+		mNodes.push_back(node{ {}, 0u, {}, static_cast<uint32_t>(aPrimitiveBounds.size()) });
+
+		const auto numThreads = nullptr == aPool ? size_t{ 1 } : aPool->size();
+		const bool parallel = numThreads > 1 && aPrimitiveBounds.size() >= cMinPrimitivesForParallelBuild;
+		const build_input input{ aPrimitiveBounds, compute_centroids(aPrimitiveBounds, parallel ? aPool : nullptr) };
+		if (!parallel) {
+			build_subtree(mNodes, 0u, mPrimitiveIndices, input, nullptr);
+			return;
+		}
+
+		// Split the upper levels (with parallel binning) until there are enough subtrees to keep all threads busy:
+		const auto subtreeSize = std::max<size_t>(cMinPrimitivesForParallelBuild / 4, aPrimitiveBounds.size() / (8 * numThreads));
+		std::vector<uint32_t> subtrees;
+		std::vector<uint32_t> stack{ 0u };
+		while (!stack.empty()) {
+			const auto nodeIndex = stack.back();
+			stack.pop_back();
+			if (mNodes[nodeIndex].mCount <= subtreeSize) {
+				subtrees.push_back(nodeIndex);
+				continue;
+			}
+			if (subdivide(mNodes, nodeIndex, mPrimitiveIndices, input, aPool)) {
+				stack.push_back(mNodes[nodeIndex].mFirst);
+				stack.push_back(mNodes[nodeIndex].mFirst + 1);
+			}
+		}
+
+		// Build the subtrees concurrently, each into its own array of nodes. They work on disjoint ranges of mPrimitiveIndices:
+		std::vector<std::vector<node>> subtreeNodes(subtrees.size());
+		aPool->parallel_for(0, subtrees.size(), 1, [&](size_t aBegin, size_t aEnd) {
+			for (auto i = aBegin; i < aEnd; ++i) {
+				auto& local = subtreeNodes[i];
+				local.reserve(2 * mNodes[subtrees[i]].mCount);
+				local.push_back(mNodes[subtrees[i]]);
+				build_subtree(local, 0u, mPrimitiveIndices, input, nullptr);
+			}
+		});
+
+		// Stitch them into the final array. A subtree's root replaces its placeholder, all other nodes are appended:
+		for (size_t i = 0; i < subtrees.size(); ++i) {
+			const auto& local = subtreeNodes[i];
+			const auto offset = static_cast<uint32_t>(mNodes.size()) - 1u; // local index 1 => first appended node
+			auto relocate = [offset](const node& aNode) {
+				auto result = aNode;
+				if (0 == result.mCount) {
+					result.mFirst += offset;
+				}
+				return result;
+			};
+			mNodes[subtrees[i]] = relocate(local[0]);
+			for (size_t k = 1; k < local.size(); ++k) {
+				mNodes.push_back(relocate(local[k]));
+			}
+		}
+	}
+
+	// Updates the bounds of all nodes after the primitives have moved, keeping the topology.
+	// Much cheaper than build(...), but the quality degrades if the primitives move a lot:
+	void refit(const std::vector<aabb>& aPrimitiveBounds)
+	{
+		for (size_t i = mNodes.size(); i-- > 0;) {
+			auto& n = mNodes[i];
+			aabb b;
+			if (n.mCount > 0) {
+				for (uint32_t k = n.mFirst; k < n.mFirst + n.mCount; ++k) {
+					b.extend(aPrimitiveBounds[mPrimitiveIndices[k]]);
+				}
+			}
+			else {
+				b = aabb{ mNodes[n.mFirst].mMin, mNodes[n.mFirst].mMax };
+				b.extend(aabb{ mNodes[n.mFirst + 1].mMin, mNodes[n.mFirst + 1].mMax });
+			}
+			n.mMin = b.mMin;
+			n.mMax = b.mMax;
+		}
+	}
+
+	// The expected cost of a random ray according to the SAH, relative to the root's surface area.
+	// Lower is better; useful for comparing the quality of different builds:
+	[[nodiscard]] float sah_cost(float aTraversalCost = 1.0f, float aIntersectionCost = 1.0f) const
+	{
+		if (mNodes.empty()) {
+			return 0.0f;
+		}
+		const auto rootArea = std::max(aabb{ mNodes[0].mMin, mNodes[0].mMax }.surface_area(), std::numeric_limits<float>::min());
+		double cost = 0.0;
+		for (const auto& n : mNodes) {
+			const auto area = aabb{ n.mMin, n.mMax }.surface_area() / rootArea;
+			cost += area * (n.mCount > 0 ? aIntersectionCost * static_cast<float>(n.mCount) : aTraversalCost);
+		}
+		return static_cast<float>(cost);
+	}
+
+	[[nodiscard]] bool empty() const { return mNodes.empty(); }
+	[[nodiscard]] const std::vector<node>& nodes() const { return mNodes; }
+	[[nodiscard]] const std::vector<uint32_t>& primitive_indices() const { return mPrimitiveIndices; }
+	[[nodiscard]] aabb bounds() const { return mNodes.empty() ? aabb{} : aabb{ mNodes[0].mMin, mNodes[0].mMax }; }
+
+	// Visits all primitives whose bounding boxes are hit by aRay, roughly front to back.
+	// aIntersect(primitiveIndex, aRay) may shorten aRay.mTMax when it finds a hit (which prunes
+	// the remaining traversal), and returns true to terminate the traversal altogether.
+	template <typename F>
+	void traverse(cpu_ray& aRay, F&& aIntersect) const
+	{
+		if (mNodes.empty()) {
+			return;
+		}
+		if (intersect_aabb(aRay, mNodes[0].mMin, mNodes[0].mMax) == std::numeric_limits<float>::infinity()) {
+			return;
+		}
+		std::array<uint32_t, cMaxTraversalDepth> stack;
+		size_t stackSize = 0;
+		uint32_t current = 0;
+		for (;;) {
+			const auto& n = mNodes[current];
+			if (n.mCount > 0) {
+				for (uint32_t i = n.mFirst, end = n.mFirst + n.mCount; i < end; ++i) {
+					if (aIntersect(mPrimitiveIndices[i], aRay)) {
+						return;
+					}
+				}
+			}
+			else {
+				const auto& a = mNodes[n.mFirst];
+				const auto& b = mNodes[n.mFirst + 1];
+				auto tA = intersect_aabb(aRay, a.mMin, a.mMax);
+				auto tB = intersect_aabb(aRay, b.mMin, b.mMax);
+				auto nearChild = n.mFirst;
+				auto farChild = n.mFirst + 1;
+				if (tB < tA) {
+					std::swap(tA, tB);
+					std::swap(nearChild, farChild);
+				}
+				if (tA != std::numeric_limits<float>::infinity()) {
+					if (tB != std::numeric_limits<float>::infinity()) {
+						stack[stackSize++] = farChild;
+					}
+					current = nearChild;
+					continue;
+				}
+			}
+			// Pop the next node which might still be hit:
+			for (;;) {
+				if (0 == stackSize) {
+					return;
+				}
+				current = stack[--stackSize];
+				if (intersect_aabb(aRay, mNodes[current].mMin, mNodes[current].mMax) != std::numeric_limits<float>::infinity()) {
+					break;
+				}
+			}
+		}
+	}
+
+private:
+	static constexpr int cNumBins = 12;
+	static constexpr uint32_t cMaxLeafSize = 4;
+	static constexpr uint32_t cMaxLeafSizeIfSplitDoesNotPayOff = 32;
+	static constexpr size_t cMaxTraversalDepth = 256;
+	// Below these sizes, parallelism doesn't pay off:
+	static constexpr size_t cMinPrimitivesForParallelBuild = 16384;
+	static constexpr size_t cMinPrimitivesForParallelBinning = 65536;
+	static constexpr size_t cBinningChunkSize = 16384;
+
+	// Bounds and primitive counts per bin, for all three axes at once:
+	struct bins
+	{
+		std::array<std::array<aabb, cNumBins>, 3> mBounds;
+		std::array<std::array<uint32_t, cNumBins>, 3> mCounts{};
+
+		void merge(const bins& aOther)
+		{
+			for (int axis = 0; axis < 3; ++axis) {
+				for (int bin = 0; bin < cNumBins; ++bin) {
+					mBounds[axis][bin].extend(aOther.mBounds[axis][bin]);
+					mCounts[axis][bin] += aOther.mCounts[axis][bin];
+				}
+			}
+		}
+	};
+
+	// The primitives' bounds, and their centers which are used for binning:
+	struct build_input
+	{
+		const std::vector<aabb>& mBounds;
+		std::vector<glm::vec3> mCentroids;
+	};
+
+	static std::vector<glm::vec3> compute_centroids(const std::vector<aabb>& aPrimitiveBounds, thread_pool* aPool)
+	{
+		std::vector<glm::vec3> centroids(aPrimitiveBounds.size());
+		auto compute = [&](size_t aBegin, size_t aEnd) {
+			for (auto i = aBegin; i < aEnd; ++i) {
+				centroids[i] = aPrimitiveBounds[i].center();
+			}
+		};
+		if (nullptr != aPool) {
+			aPool->parallel_for(0, centroids.size(), cBinningChunkSize, compute);
+		}
+		else {
+			compute(0, centroids.size());
+		}
+		return centroids;
+	}
+
+	static void build_subtree(std::vector<node>& aNodes, uint32_t aRoot, std::vector<uint32_t>& aPrimitiveIndices, const build_input& aInput, thread_pool* aPool)
+	{
+		std::vector<uint32_t> stack{ aRoot };
+		while (!stack.empty()) {
+			const auto nodeIndex = stack.back();
+			stack.pop_back();
+			if (subdivide(aNodes, nodeIndex, aPrimitiveIndices, aInput, aPool)) {
+				stack.push_back(aNodes[nodeIndex].mFirst);
+				stack.push_back(aNodes[nodeIndex].mFirst + 1);
+			}
+		}
+	}
+
+	// Computes the node's bounds and splits it if that pays off according to the SAH. Returns true if it has been split.
+	// Large nodes are binned in parallel if a thread pool is given:
+	static bool subdivide(std::vector<node>& aNodes, uint32_t aNodeIndex, std::vector<uint32_t>& aPrimitiveIndices, const build_input& aInput, thread_pool* aPool)
+	{
+		const auto first = aNodes[aNodeIndex].mFirst;
+		const auto count = aNodes[aNodeIndex].mCount;
+		const bool parallel = nullptr != aPool && count >= cMinPrimitivesForParallelBinning;
+		const auto numChunks = (static_cast<size_t>(count) + cBinningChunkSize - 1) / cBinningChunkSize;
+
+		// Each chunk of primitives reduces into its own slot, which are combined afterwards:
+		auto reduce_chunks = [&](auto& aPerChunk, auto&& aProcessRange) {
+			if (parallel) {
+				aPool->parallel_for(0, count, cBinningChunkSize, [&](size_t aBegin, size_t aEnd) {
+					aProcessRange(aPerChunk[aBegin / cBinningChunkSize], first + static_cast<uint32_t>(aBegin), first + static_cast<uint32_t>(aEnd));
+				});
+			}
+			else {
+				aProcessRange(aPerChunk[0], first, first + count);
+			}
+		};
+
+		std::vector<std::pair<aabb, aabb>> chunkBounds(parallel ? numChunks : 1);
+		reduce_chunks(chunkBounds, [&](std::pair<aabb, aabb>& aResult, uint32_t aBegin, uint32_t aEnd) {
+			for (auto i = aBegin; i < aEnd; ++i) {
+				aResult.first.extend(aInput.mBounds[aPrimitiveIndices[i]]);
+				aResult.second.extend(aInput.mCentroids[aPrimitiveIndices[i]]);
+			}
+		});
+		aabb bounds, centroidBounds;
+		for (const auto& cb : chunkBounds) {
+			bounds.extend(cb.first);
+			centroidBounds.extend(cb.second);
+		}
+		aNodes[aNodeIndex].mMin = bounds.mMin;
+		aNodes[aNodeIndex].mMax = bounds.mMax;
+		if (count <= cMaxLeafSize) {
+			return false;
+		}
+
+		// Sort the primitives into the bins of all three axes:
+		const auto lo = centroidBounds.mMin;
+		const auto extent = centroidBounds.mMax - centroidBounds.mMin;
+		glm::vec3 scale;
+		for (int axis = 0; axis < 3; ++axis) {
+			scale[axis] = extent[axis] > 0.0f ? static_cast<float>(cNumBins) / extent[axis] : 0.0f;
+		}
+		auto bin_of = [&](uint32_t aPrimitive, int aAxis) {
+			return std::min(cNumBins - 1, static_cast<int>((aInput.mCentroids[aPrimitive][aAxis] - lo[aAxis]) * scale[aAxis]));
+		};
+		std::vector<bins> chunkBins(parallel ? numChunks : 1);
+		reduce_chunks(chunkBins, [&](bins& aResult, uint32_t aBegin, uint32_t aEnd) {
+			for (auto i = aBegin; i < aEnd; ++i) {
+				const auto prim = aPrimitiveIndices[i];
+				for (int axis = 0; axis < 3; ++axis) {
+					const auto bin = bin_of(prim, axis);
+					aResult.mBounds[axis][bin].extend(aInput.mBounds[prim]);
+					++aResult.mCounts[axis][bin];
+				}
+			}
+		});
+		for (size_t c = 1; c < chunkBins.size(); ++c) {
+			chunkBins[0].merge(chunkBins[c]);
+		}
+		const auto& allBins = chunkBins[0];
+
+		// Find the best split plane among the bin boundaries of all three axes:
+		auto bestCost = std::numeric_limits<float>::max();
+		int bestAxis = -1;
+		int bestSplit = 0;
+		for (int axis = 0; axis < 3; ++axis) {
+			if (extent[axis] <= 0.0f) {
+				continue;
+			}
+			// Sweep from the right to gather the costs of all right sides:
+			std::array<float, cNumBins> rightCost{};
+			aabb acc;
+			uint32_t accCount = 0;
+			for (int bin = cNumBins - 1; bin > 0; --bin) {
+				acc.extend(allBins.mBounds[axis][bin]);
+				accCount += allBins.mCounts[axis][bin];
+				rightCost[bin] = static_cast<float>(accCount) * acc.surface_area();
+			}
+			acc = aabb{};
+			accCount = 0;
+			for (int split = 1; split < cNumBins; ++split) {
+				acc.extend(allBins.mBounds[axis][split - 1]);
+				accCount += allBins.mCounts[axis][split - 1];
+				if (0 == accCount || count == accCount) {
+					continue;
+				}
+				const auto cost = static_cast<float>(accCount) * acc.surface_area() + rightCost[split];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+
+		// Compare against the cost of not splitting at all (traversal cost = intersection cost).
+		// Large nodes are split anyways, to keep the leaves reasonably small:
+		const auto leafCost = static_cast<float>(count) * bounds.surface_area();
+		if ((bestAxis < 0 || bestCost >= leafCost) && count <= cMaxLeafSizeIfSplitDoesNotPayOff) {
+			return false;
+		}
+		uint32_t mid = first;
+		if (bestAxis >= 0) {
+			const auto it = std::partition(std::begin(aPrimitiveIndices) + first, std::begin(aPrimitiveIndices) + first + count, [&](uint32_t aPrim) {
+				return bin_of(aPrim, bestAxis) < bestSplit;
+			});
+			mid = static_cast<uint32_t>(it - std::begin(aPrimitiveIndices));
+		}
+		if (mid == first || mid == first + count) {
+			// Degenerate distribution (e.g. all centroids in one spot) => split in the middle:
+			mid = first + count / 2;
+		}
+
+		const auto left = static_cast<uint32_t>(aNodes.size());
+		aNodes.push_back(node{ {}, first, {}, mid - first });
+		aNodes.push_back(node{ {}, mid, {}, first + count - mid });
+		aNodes[aNodeIndex].mFirst = left;
+		aNodes[aNodeIndex].mCount = 0;
+		return true;
+	}
+
+	std::vector<node> mNodes;
+	std::vector<uint32_t> mPrimitiveIndices;
+};
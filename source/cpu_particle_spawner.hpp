@@ -0,0 +1,100 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "cpu_scene.hpp"
+#include "thread_pool.hpp"
+
+// The CPU counterpart of push_const_data_particle_spawner:
+struct cpu_spawn_settings
+{
+	// Represents both, offset and rotation for the spawn origin and direction:
+	glm::mat4 mSpawnTransformation = glm::mat4{ 1.0f };
+	// The spawning angle in radians:
+	float mSpawnAngleRad = glm::radians(45.0f);
+	// The new particle's radius:
+	float mNewParticlesRadius = 0.35f;
+};
+
+// The spawn transformation which procedural_geometry_manager pushes for the given origin and direction: the rays of
+// spawn_particles.rgen point into -y, which is rotated into aDirection:
+inline glm::mat4 spawn_transformation(const glm::vec3& aOrigin, const glm::vec3& aDirection)
+{
+	return glm::translate(glm::mat4{ 1.0f }, aOrigin) * glm::mat4_cast(glm::quat(glm::vec3{ 0.0f, -1.0f, 0.0f }, aDirection));
+}
+
+// Traces the spawn rays of one dispatch against a cpu_scene, with the same rules as spawn_particles.rgen and the
+// spawn_particles_*.rchit shaders, s.t. spawning works without any GPU at all (e.g. to pre-fill a scene offline):
+// aNumCandidates rays form a cone around the spawn direction, and every ray which hits something yields a candidate
+// in front of the hit point. The candidates have the layout of the GPU's candidates buffer (w == 0 marks a miss), i.e.
+// they can be passed to spawn_candidate_selector as they are.
+// The cpu_scene holds one sphere per particle. Hence, the candidates match the GPU's as long as the particles are
+// rendered as spheres, but not while the TLAS holds LOD clusters or the reconstructed surface instead.
+// The rays are distributed across all threads of the pool.
+class cpu_particle_spawner
+{
+public:
+	// Same as in spawn_particles.rgen:
+	static constexpr float cTMin = 0.001f;
+	static constexpr float cTMax = 1000.0f;
+
+	// Writes one candidate per ray into aCandidates and returns the number of rays which have hit something:
+	static size_t trace(const cpu_scene& aScene, const cpu_spawn_settings& aSettings, uint32_t aNumCandidates, std::vector<glm::vec4>& aCandidates, thread_pool& aPool)
+	{
+		aCandidates.resize(aNumCandidates);
+		std::vector<size_t> hitsPerChunk((aNumCandidates + cGrainSize - 1) / cGrainSize, 0);
+		aPool.parallel_for(0, aNumCandidates, cGrainSize, [&](size_t aBegin, size_t aEnd) {
+			size_t hits = 0;
+			for (size_t i = aBegin; i < aEnd; ++i) {
+				aCandidates[i] = trace_ray(aScene, aSettings, static_cast<uint32_t>(i), aNumCandidates);
+				hits += aCandidates[i].w != 0.0f ? 1 : 0;
+			}
+			hitsPerChunk[aBegin / cGrainSize] = hits;
+		});
+		size_t numHits = 0;
+		for (auto h : hitsPerChunk) {
+			numHits += h;
+		}
+		return numHits;
+	}
+
+	// The ray of spawn_particles.rgen for gl_LaunchIDEXT.x == aLaunchId and gl_LaunchSizeEXT.x == aLaunchSize:
+	[[nodiscard]] static cpu_ray spawn_ray(const cpu_spawn_settings& aSettings, uint32_t aLaunchId, uint32_t aLaunchSize)
+	{
+		// Without modification, our rays are constructed like a cone pointing in -Y direction:
+		const float numRaysOneDim = std::sqrt(static_cast<float>(aLaunchSize));
+		const uint32_t rayZ = aLaunchId / static_cast<uint32_t>(numRaysOneDim);
+		const uint32_t rayX = aLaunchId - rayZ * static_cast<uint32_t>(numRaysOneDim);
+		const glm::vec3 direction{
+			-numRaysOneDim * 0.5f + static_cast<float>(rayX),
+			-numRaysOneDim / std::tan(aSettings.mSpawnAngleRad),
+			-numRaysOneDim * 0.5f + static_cast<float>(rayZ)
+		};
+		return cpu_ray{
+			glm::vec3{ aSettings.mSpawnTransformation * glm::vec4{ 0.0f, 0.0f, 0.0f, 1.0f } },
+			glm::normalize(glm::mat3{ aSettings.mSpawnTransformation } * direction),
+			cTMin, cTMax
+		};
+	}
+
+private:
+	static constexpr size_t cGrainSize = 64;
+
+	[[nodiscard]] static glm::vec4 trace_ray(const cpu_scene& aScene, const cpu_spawn_settings& aSettings, uint32_t aLaunchId, uint32_t aLaunchSize)
+	{
+		const auto ray = spawn_ray(aSettings, aLaunchId, aLaunchSize);
+		cpu_hit hit;
+		if (!aScene.closest_hit(ray, hit)) {
+			return glm::vec4{ glm::vec3{ 3.0e38f }, 0.0f }; // Like the payload's noHit value
+		}
+		// Like spawn_particles_triangles.rchit and spawn_particles_procedural.rchit:
+		const glm::vec3 hitPos = ray.mOrigin + ray.mDirection * hit.mT;
+		return glm::vec4{ hitPos - glm::normalize(ray.mDirection) * aSettings.mNewParticlesRadius / std::sqrt(2.0f), 1.0f };
+	}
+};
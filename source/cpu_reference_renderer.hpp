@@ -0,0 +1,168 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "cpu_scene.hpp"
+#include "tile_scheduler.hpp"
+
+// The CPU counterpart of push_const_data_scene_rendering:
+struct cpu_render_settings
+{
+	glm::vec3 mAmbientLight = glm::vec3{ 0.5f };
+	glm::vec3 mLightDir = glm::vec3{ 0.8f, 1.0f, 0.0f };
+	glm::mat4 mCameraTransform = glm::mat4{ 1.0f };
+	float mCameraHalfFovAngle = glm::radians(22.5f);
+	bool mEnableShadows = true;
+	float mShadowsFactor = 0.5f;
+	glm::vec3 mShadowsColor = glm::vec3{ 0.0f };
+	bool mEnableAmbientOcclusion = true;
+	float mAmbientOcclusionMinDist = 0.05f;
+	float mAmbientOcclusionMaxDist = 0.25f;
+	float mAmbientOcclusionFactor = 0.5f;
+	glm::vec3 mAmbientOcclusionColor = glm::vec3{ 0.0f };
+};
+
+// Renders a cpu_scene on the CPU with the same rules as the ray tracing pipeline of fluid_nightmare_main,
+// i.e. ray_gen_shader.rgen, first_hit_closest_hit_shader.rchit, rt_aabb.rchit and the shadow and AO shaders.
+// The result serves as a reference for the GPU output and works without any GPU at all.
+// The image is split into tiles, which are distributed across all cores by a tile_scheduler.
+class cpu_reference_renderer
+{
+public:
+	static constexpr uint32_t cTileSize = 16;
+
+	struct statistics
+	{
+		uint64_t mNumPrimaryRays = 0;
+		uint64_t mNumShadowRays = 0;
+		uint64_t mNumAmbientOcclusionRays = 0;
+		double mSeconds = 0.0;
+		size_t mNumThreads = 0;
+		uint64_t mNumTiles = 0;
+		uint64_t mNumStolenTiles = 0;
+
+		[[nodiscard]] uint64_t total_rays() const { return mNumPrimaryRays + mNumShadowRays + mNumAmbientOcclusionRays; }
+		[[nodiscard]] double rays_per_second() const { return mSeconds > 0.0 ? static_cast<double>(total_rays()) / mSeconds : 0.0; }
+	};
+
+	// Renders an image of aWidth x aHeight pixels into aColors (row by row, top row first, linear colors, not clamped):
+	static statistics render(const cpu_scene& aScene, const cpu_render_settings& aSettings, uint32_t aWidth, uint32_t aHeight, std::vector<glm::vec3>& aColors, size_t aNumThreads = std::max(1u, std::thread::hardware_concurrency()))
+	{
+		aColors.assign(static_cast<size_t>(aWidth) * aHeight, glm::vec3{ 0.0f });
+		const auto tilesX = (aWidth + cTileSize - 1) / cTileSize;
+		const auto tilesY = (aHeight + cTileSize - 1) / cTileSize;
+
+		// Counters per thread, each on its own cache line:
+		struct alignas(64) ray_counters { uint64_t mPrimary = 0, mShadow = 0, mAmbientOcclusion = 0; };
+		std::vector<ray_counters> counters(std::max<size_t>(1, aNumThreads));
+
+		const auto t0 = std::chrono::steady_clock::now();
+		const auto schedulerStats = tile_scheduler::run(static_cast<size_t>(tilesX) * tilesY, aNumThreads, [&](size_t aTile, size_t aThread) {
+			auto& c = counters[aThread];
+			const auto x0 = static_cast<uint32_t>(aTile % tilesX) * cTileSize;
+			const auto y0 = static_cast<uint32_t>(aTile / tilesX) * cTileSize;
+			for (uint32_t y = y0; y < std::min(y0 + cTileSize, aHeight); ++y) {
+				for (uint32_t x = x0; x < std::min(x0 + cTileSize, aWidth); ++x) {
+					aColors[static_cast<size_t>(y) * aWidth + x] = shade_pixel(aScene, aSettings, x, y, aWidth, aHeight, c.mPrimary, c.mShadow, c.mAmbientOcclusion);
+				}
+			}
+		});
+		const auto t1 = std::chrono::steady_clock::now();
+
+		statistics stats;
+		for (const auto& c : counters) {
+			stats.mNumPrimaryRays += c.mPrimary;
+			stats.mNumShadowRays += c.mShadow;
+			stats.mNumAmbientOcclusionRays += c.mAmbientOcclusion;
+		}
+		stats.mSeconds = std::chrono::duration<double>(t1 - t0).count();
+		stats.mNumThreads = schedulerStats.mNumThreads;
+		stats.mNumTiles = schedulerStats.mNumTiles;
+		stats.mNumStolenTiles = schedulerStats.mNumStolenTiles;
+		return stats;
+	}
+
+	// Converts a linear color into the value which is stored in the rgba8 (UNORM) offscreen image:
+	[[nodiscard]] static uint8_t to_unorm8(float aValue)
+	{
+		return static_cast<uint8_t>(std::lround(glm::clamp(aValue, 0.0f, 1.0f) * 255.0f));
+	}
+
+private:
+	// Equivalent of ray_gen_shader.rgen for one pixel:
+	static glm::vec3 shade_pixel(const cpu_scene& aScene, const cpu_render_settings& aSettings, uint32_t aX, uint32_t aY, uint32_t aWidth, uint32_t aHeight, uint64_t& aNumPrimary, uint64_t& aNumShadow, uint64_t& aNumAmbientOcclusion)
+	{
+		const auto pixelCenter = glm::vec2{ static_cast<float>(aX), static_cast<float>(aY) } + glm::vec2{ 0.5f };
+		const auto inUv = pixelCenter / glm::vec2{ static_cast<float>(aWidth), static_cast<float>(aHeight) };
+		const auto xyDir = inUv * 2.0f - 1.0f;
+		const auto aspectRatio = static_cast<float>(aWidth) / static_cast<float>(aHeight);
+		auto direction = glm::normalize(glm::vec3{ xyDir.x * aspectRatio, -xyDir.y, -1.0f / std::tan(aSettings.mCameraHalfFovAngle) });
+		direction = glm::normalize(glm::mat3{ aSettings.mCameraTransform } * direction);
+		const auto origin = glm::vec3{ aSettings.mCameraTransform[3] };
+
+		++aNumPrimary;
+		cpu_hit hit;
+		if (!aScene.closest_hit(cpu_ray{ origin, direction, 0.001f, 1000.0f }, hit)) {
+			return glm::vec3{ 0.0f, 0.1f, 0.3f }; // first_hit_miss_shader.rmiss
+		}
+		if (cpu_hit::kind::sphere == hit.mKind) {
+			// rt_aabb.rchit encodes the instance index as color:
+			return glm::vec3{
+				static_cast<float>((hit.mInstanceIndex >> 16) & 0xFFu),
+				static_cast<float>((hit.mInstanceIndex >>  8) & 0xFFu),
+				static_cast<float>((hit.mInstanceIndex >>  0) & 0xFFu)
+			} / 255.0f;
+		}
+		return shade_triangle_hit(aScene, aSettings, origin + direction * hit.mT, hit, aNumShadow, aNumAmbientOcclusion);
+	}
+
+	// Equivalent of first_hit_closest_hit_shader.rchit. Note that secondary rays never hit water particles
+	// on the GPU: with their instance offset of 1, they end up at hit groups without an intersection shader.
+	static glm::vec3 shade_triangle_hit(const cpu_scene& aScene, const cpu_render_settings& aSettings, const glm::vec3& aHitPos, const cpu_hit& aHit, uint64_t& aNumShadow, uint64_t& aNumAmbientOcclusion)
+	{
+		const auto& mesh = aScene.meshes()[aHit.mCustomIndex];
+		const auto& material = aScene.materials()[aHit.mCustomIndex];
+		const glm::vec3 bary{ 1.0f - aHit.mBarycentrics.x - aHit.mBarycentrics.y, aHit.mBarycentrics.x, aHit.mBarycentrics.y };
+		const auto i0 = mesh.mIndices[3 * aHit.mPrimitiveIndex];
+		const auto i1 = mesh.mIndices[3 * aHit.mPrimitiveIndex + 1];
+		const auto i2 = mesh.mIndices[3 * aHit.mPrimitiveIndex + 2];
+
+		const auto uv = bary.x * mesh.mTexCoords[i0] + bary.y * mesh.mTexCoords[i1] + bary.z * mesh.mTexCoords[i2];
+		// Like in the shader, the normal is neither normalized nor transformed into world space:
+		const auto normal = bary.x * mesh.mNormals[i0] + bary.y * mesh.mNormals[i1] + bary.z * mesh.mNormals[i2];
+
+		const auto texCoords = uv * glm::vec2{ material.mDiffuseTexOffsetTiling.z, material.mDiffuseTexOffsetTiling.w } + glm::vec2{ material.mDiffuseTexOffsetTiling.x, material.mDiffuseTexOffsetTiling.y };
+		const auto diffuseTexColor = material.mDiffuseTexIndex < 0
+			? glm::vec3{ 1.0f }
+			: glm::vec3{ aScene.textures()[material.mDiffuseTexIndex].sample(texCoords) };
+
+		const auto nDotL = glm::dot(normal, glm::normalize(aSettings.mLightDir));
+		auto hitValue = diffuseTexColor * (std::max(0.0f, nDotL) + aSettings.mAmbientLight);
+
+		if (aSettings.mEnableShadows) {
+			++aNumShadow;
+			if (aScene.any_hit(cpu_ray{ aHitPos, aSettings.mLightDir, 0.01f, 1000.0f }, false)) {
+				hitValue = glm::mix(hitValue, aSettings.mShadowsColor, aSettings.mShadowsFactor);
+			}
+		}
+
+		if (aSettings.mEnableAmbientOcclusion) {
+			float ao = 0.0f;
+			for (int i = 0; i < 8; ++i) {
+				const glm::vec3 sampleDirection{ (i & 4) ? -1.0f : 1.0f, (i & 2) ? -1.0f : 1.0f, (i & 1) ? -1.0f : 1.0f };
+				++aNumAmbientOcclusion;
+				if (aScene.any_hit(cpu_ray{ aHitPos, sampleDirection, aSettings.mAmbientOcclusionMinDist, aSettings.mAmbientOcclusionMaxDist }, false)) {
+					ao += 1.0f;
+				}
+			}
+			ao /= 8.0f;
+			hitValue = glm::mix(hitValue, aSettings.mAmbientOcclusionColor, ao * aSettings.mAmbientOcclusionFactor);
+		}
+		return hitValue;
+	}
+};
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "cpu_wide_bvh.hpp"
+#include "thread_pool.hpp"
+
+// A texture on the CPU with linear RGBA texels, stored row by row:
+struct cpu_texture
+{
+	uint32_t mWidth = 1;
+	uint32_t mHeight = 1;
+	std::vector<glm::vec4> mTexels = { glm::vec4{ 1.0f } };
+
+	// Bilinear lookup with repeat addressing, i.e. what a sampler with linear filtering returns at LOD 0:
+	[[nodiscard]] glm::vec4 sample(const glm::vec2& aUv) const
+	{
+		const auto x = aUv.x * static_cast<float>(mWidth) - 0.5f;
+		const auto y = aUv.y * static_cast<float>(mHeight) - 0.5f;
+		const auto x0 = std::floor(x);
+		const auto y0 = std::floor(y);
+		const auto fx = x - x0;
+		const auto fy = y - y0;
+		auto texel = [this](float aX, float aY) {
+			const auto w = static_cast<int64_t>(mWidth);
+			const auto h = static_cast<int64_t>(mHeight);
+			const auto ix = ((static_cast<int64_t>(aX) % w) + w) % w;
+			const auto iy = ((static_cast<int64_t>(aY) % h) + h) % h;
+			return mTexels[static_cast<size_t>(iy * w + ix)];
+		};
+		return glm::mix(
+			glm::mix(texel(x0, y0), texel(x0 + 1.0f, y0), fx),
+			glm::mix(texel(x0, y0 + 1.0f), texel(x0 + 1.0f, y0 + 1.0f), fx),
+			fy
+		);
+	}
+};
+
+// The part of a material which the scene rendering shaders use:
+struct cpu_material
+{
+	// Index into cpu_scene::textures(), or -1 for a plain white texture:
+	int32_t mDiffuseTexIndex = -1;
+	glm::vec4 mDiffuseTexOffsetTiling = glm::vec4{ 0.0f, 0.0f, 1.0f, 1.0f };
+};
+
+// Indexed triangle geometry with per-vertex attributes, in object space:
+struct cpu_mesh
+{
+	std::vector<glm::vec3> mPositions;
+	std::vector<glm::vec3> mNormals;
+	std::vector<glm::vec2> mTexCoords;
+	std::vector<uint32_t> mIndices; // three per triangle
+	cpu_bvh4 mBvh;
+
+	[[nodiscard]] size_t number_of_triangles() const { return mIndices.size() / 3; }
+
+	void build_bvh(thread_pool* aPool = nullptr)
+	{
+		mBvh.build(triangle_bounds(mPositions, mIndices, aPool), aPool);
+	}
+};
+
+// Information about the closest hit of a ray:
+struct cpu_hit
+{
+	enum struct kind { none, triangle, sphere };
+
+	kind mKind = kind::none;
+	float mT = std::numeric_limits<float>::max();
+	// Corresponds to gl_InstanceID, i.e. the index of the instance in the TLAS:
+	uint32_t mInstanceIndex = 0;
+	// Corresponds to gl_InstanceCustomIndexEXT, i.e. the mesh (and material) index of a triangle hit:
+	uint32_t mCustomIndex = 0;
+	// Corresponds to gl_PrimitiveID:
+	uint32_t mPrimitiveIndex = 0;
+	// Corresponds to the hit attributes of a triangle hit:
+	glm::vec2 mBarycentrics = glm::vec2{ 0.0f };
+};
+
+// The CPU counterpart of the scene's TLAS: triangle mesh instances, followed by one sphere per water particle.
+// Instance indices follow the layout of the TLAS instance buffer: all mesh instances (including
+// inactive ones) come first, the spheres are appended. Materials are aligned with meshes.
+// Call build(...) after all changes and before tracing rays.
+class cpu_scene
+{
+public:
+	uint32_t add_texture(cpu_texture aTexture)
+	{
+		mTextures.push_back(std::move(aTexture));
+		return static_cast<uint32_t>(mTextures.size() - 1);
+	}
+
+	// Adds a mesh and its material. Returns the mesh's index, which is also its custom index:
+	uint32_t add_mesh(cpu_mesh aMesh, const cpu_material& aMaterial)
+	{
+		mMeshes.push_back(std::move(aMesh));
+		mMaterials.push_back(aMaterial);
+		return static_cast<uint32_t>(mMeshes.size() - 1);
+	}
+
+	void add_mesh_instance(uint32_t aMeshIndex, const glm::mat4& aTransform, bool aActive = true)
+	{
+		mMeshInstances.push_back(mesh_instance{ aMeshIndex, aTransform, glm::inverse(aTransform), aActive });
+	}
+
+	void set_mesh_instance_active(size_t aInstanceIndex, bool aActive) { mMeshInstances[aInstanceIndex].mActive = aActive; }
+
+	// Sets the water particles. Like the procedural geometry, each one is a sphere with half the given radius
+	// (the intersection shader's sphere of radius 0.5, scaled by the instance's radius):
+	void set_spheres(const float* aX, const float* aY, const float* aZ, const float* aRadii, size_t aCount)
+	{
+		mSpheres.resize(aCount);
+		for (size_t i = 0; i < aCount; ++i) {
+			mSpheres[i] = glm::vec4{ aX[i], aY[i], aZ[i], cSphereRadiusScale * aRadii[i] };
+		}
+	}
+
+	// Moves the water particles after build(...) has been invoked, and refits the top-level BVH instead of
+	// rebuilding it. The number of particles must not have changed; use set_spheres(...) and build(...) otherwise:
+	void refit_spheres(const float* aX, const float* aY, const float* aZ, const float* aRadii, size_t aCount, thread_pool* aPool = nullptr)
+	{
+		assert(aCount == mSpheres.size());
+		set_spheres(aX, aY, aZ, aRadii, aCount);
+		std::vector<aabb> sphereBounds;
+		sphere_bounds(aX, aY, aZ, aRadii, aCount, cSphereRadiusScale, sphereBounds, aPool);
+		std::copy(std::begin(sphereBounds), std::end(sphereBounds), std::end(mTopLevelBounds) - static_cast<ptrdiff_t>(aCount));
+		mTopLevel.refit(mTopLevelBounds);
+	}
+
+	[[nodiscard]] const std::vector<cpu_texture>& textures() const { return mTextures; }
+	[[nodiscard]] const std::vector<cpu_mesh>& meshes() const { return mMeshes; }
+	[[nodiscard]] const std::vector<cpu_material>& materials() const { return mMaterials; }
+	[[nodiscard]] size_t number_of_mesh_instances() const { return mMeshInstances.size(); }
+	[[nodiscard]] size_t number_of_spheres() const { return mSpheres.size(); }
+
+	[[nodiscard]] size_t number_of_triangles() const
+	{
+		size_t n = 0;
+		for (const auto& m : mMeshes) {
+			n += m.number_of_triangles();
+		}
+		return n;
+	}
+
+	// Builds the BVHs of all meshes which don't have one yet, and the top-level BVH over all active instances:
+	void build(thread_pool& aPool)
+	{
+		// One mesh per task; the builds of the individual meshes are therefore sequential:
+		aPool.parallel_for(0, mMeshes.size(), 1, [this](size_t aBegin, size_t aEnd) {
+			for (auto i = aBegin; i < aEnd; ++i) {
+				if (mMeshes[i].mBvh.empty() && mMeshes[i].number_of_triangles() > 0) {
+					mMeshes[i].build_bvh();
+				}
+			}
+		});
+
+		mTopLevelRefs.clear();
+		auto& bounds = mTopLevelBounds;
+		bounds.clear();
+		for (uint32_t i = 0; i < static_cast<uint32_t>(mMeshInstances.size()); ++i) {
+			const auto& inst = mMeshInstances[i];
+			const auto& bvh = mMeshes[inst.mMeshIndex].mBvh;
+			if (!inst.mActive || bvh.empty()) {
+				continue;
+			}
+			// Transform the corners of the object-space bounds into world space:
+			const auto objBounds = bvh.bounds();
+			aabb worldBounds;
+			for (int c = 0; c < 8; ++c) {
+				const glm::vec3 corner{ (c & 1) ? objBounds.mMax.x : objBounds.mMin.x, (c & 2) ? objBounds.mMax.y : objBounds.mMin.y, (c & 4) ? objBounds.mMax.z : objBounds.mMin.z };
+				worldBounds.extend(glm::vec3{ inst.mTransform * glm::vec4{ corner, 1.0f } });
+			}
+			bounds.push_back(worldBounds);
+			mTopLevelRefs.push_back(i);
+		}
+		// The spheres come last, which allows refit_spheres(...) to update their bounds in one go:
+		for (uint32_t i = 0; i < static_cast<uint32_t>(mSpheres.size()); ++i) {
+			const glm::vec3 c{ mSpheres[i] };
+			bounds.push_back(aabb{ c - glm::vec3{ mSpheres[i].w }, c + glm::vec3{ mSpheres[i].w } });
+			mTopLevelRefs.push_back(cSphereBit | i);
+		}
+		mTopLevel.build(bounds, &aPool);
+	}
+
+	// Finds the closest hit of the ray, like traceRayEXT with gl_RayFlagsOpaqueEXT. Returns false on a miss:
+	bool closest_hit(const cpu_ray& aRay, cpu_hit& aHit) const
+	{
+		auto ray = aRay;
+		aHit = cpu_hit{};
+		mTopLevel.traverse(ray, [&](uint32_t aRef, cpu_ray& aWorldRay) {
+			intersect_top_level_ref(mTopLevelRefs[aRef], aWorldRay, aHit, true, false);
+			return false;
+		});
+		return cpu_hit::kind::none != aHit.mKind;
+	}
+
+	// Returns true if the ray hits anything. Spheres are only considered if aIncludeSpheres is set:
+	[[nodiscard]] bool any_hit(const cpu_ray& aRay, bool aIncludeSpheres) const
+	{
+		auto ray = aRay;
+		cpu_hit hit;
+		bool found = false;
+		mTopLevel.traverse(ray, [&](uint32_t aRef, cpu_ray& aWorldRay) {
+			found = intersect_top_level_ref(mTopLevelRefs[aRef], aWorldRay, hit, aIncludeSpheres, true);
+			return found;
+		});
+		return found;
+	}
+
+private:
+	static constexpr uint32_t cSphereBit = 0x80000000u;
+	static constexpr float cSphereRadiusScale = 0.5f;
+
+	struct mesh_instance
+	{
+		uint32_t mMeshIndex;
+		glm::mat4 mTransform;
+		glm::mat4 mInverseTransform;
+		bool mActive;
+	};
+
+	// Intersects one entry of the top-level BVH and shortens aWorldRay on a hit. Returns true if there was a hit:
+	bool intersect_top_level_ref(uint32_t aRef, cpu_ray& aWorldRay, cpu_hit& aHit, bool aIncludeSpheres, bool aAnyHit) const
+	{
+		if (0u != (aRef & cSphereBit)) {
+			if (!aIncludeSpheres) {
+				return false;
+			}
+			const auto sphereIndex = aRef & ~cSphereBit;
+			const auto t = intersect_sphere(aWorldRay, mSpheres[sphereIndex]);
+			if (t > 0.0f && t >= aWorldRay.mTMin && t <= aWorldRay.mTMax) {
+				aWorldRay.mTMax = t;
+				aHit.mKind = cpu_hit::kind::sphere;
+				aHit.mT = t;
+				aHit.mInstanceIndex = static_cast<uint32_t>(mMeshInstances.size()) + sphereIndex;
+				aHit.mCustomIndex = 0;
+				aHit.mPrimitiveIndex = 0;
+				return true;
+			}
+			return false;
+		}
+
+		// Transform the ray into object space. Since the direction is not normalized, t stays the same:
+		const auto& inst = mMeshInstances[aRef];
+		const auto& mesh = mMeshes[inst.mMeshIndex];
+		cpu_ray objRay{
+			glm::vec3{ inst.mInverseTransform * glm::vec4{ aWorldRay.mOrigin, 1.0f } },
+			glm::mat3{ inst.mInverseTransform } * aWorldRay.mDirection,
+			aWorldRay.mTMin, aWorldRay.mTMax
+		};
+		bool found = false;
+		mesh.mBvh.traverse(objRay, [&](uint32_t aTriangle, cpu_ray& aObjRay) {
+			float t; glm::vec2 bary;
+			if (intersect_triangle(aObjRay, mesh.mPositions[mesh.mIndices[3 * aTriangle]], mesh.mPositions[mesh.mIndices[3 * aTriangle + 1]], mesh.mPositions[mesh.mIndices[3 * aTriangle + 2]], t, bary)) {
+				aObjRay.mTMax = t;
+				found = true;
+				aHit.mKind = cpu_hit::kind::triangle;
+				aHit.mT = t;
+				aHit.mInstanceIndex = aRef;
+				aHit.mCustomIndex = inst.mMeshIndex;
+				aHit.mPrimitiveIndex = aTriangle;
+				aHit.mBarycentrics = bary;
+				return aAnyHit;
+			}
+			return false;
+		});
+		if (found) {
+			aWorldRay.mTMax = objRay.mTMax;
+		}
+		return found;
+	}
+
+	// Like rt_aabb.rint: only the first intersection counts; returns a negative value on a miss:
+	[[nodiscard]] static float intersect_sphere(const cpu_ray& aRay, const glm::vec4& aSphere)
+	{
+		const auto oc = aRay.mOrigin - glm::vec3{ aSphere };
+		const auto a = glm::dot(aRay.mDirection, aRay.mDirection);
+		const auto b = 2.0f * glm::dot(oc, aRay.mDirection);
+		const auto c = glm::dot(oc, oc) - aSphere.w * aSphere.w;
+		const auto discriminant = b * b - 4.0f * a * c;
+		if (discriminant < 0.0f) {
+			return -1.0f;
+		}
+		return (-b - std::sqrt(discriminant)) / (2.0f * a);
+	}
+
+	// Moeller-Trumbore intersection, without back-face culling. aBary receives the weights of aV1 and aV2:
+	[[nodiscard]] static bool intersect_triangle(const cpu_ray& aRay, const glm::vec3& aV0, const glm::vec3& aV1, const glm::vec3& aV2, float& aT, glm::vec2& aBary)
+	{
+		const auto e1 = aV1 - aV0;
+		const auto e2 = aV2 - aV0;
+		const auto p = glm::cross(aRay.mDirection, e2);
+		const auto det = glm::dot(e1, p);
+		if (std::abs(det) < 1e-12f) {
+			return false;
+		}
+		const auto invDet = 1.0f / det;
+		const auto s = aRay.mOrigin - aV0;
+		const auto u = glm::dot(s, p) * invDet;
+		if (u < 0.0f || u > 1.0f) {
+			return false;
+		}
+		const auto q = glm::cross(s, e1);
+		const auto v = glm::dot(aRay.mDirection, q) * invDet;
+		if (v < 0.0f || u + v > 1.0f) {
+			return false;
+		}
+		const auto t = glm::dot(e2, q) * invDet;
+		if (t < aRay.mTMin || t > aRay.mTMax) {
+			return false;
+		}
+		aT = t;
+		aBary = glm::vec2{ u, v };
+		return true;
+	}
+
+	std::vector<cpu_texture> mTextures;
+	std::vector<cpu_mesh> mMeshes;
+	std::vector<cpu_material> mMaterials;
+	std::vector<mesh_instance> mMeshInstances;
+	std::vector<glm::vec4> mSpheres; // center and radius
+
+	// Entries of the top-level BVH: mesh instance indices, or sphere indices with cSphereBit set:
+	std::vector<uint32_t> mTopLevelRefs;
+	std::vector<aabb> mTopLevelBounds;
+	cpu_bvh4 mTopLevel;
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <gvk.hpp>
+#include <stb_image.h>
+
+#include "cpu_scene.hpp"
+#include "thread_pool.hpp"
+
+// Converts an 8-bit sRGB-encoded value into linear space, like sampling from an image with an sRGB format:
+inline float srgb_to_linear(uint8_t aValue)
+{
+	const auto c = static_cast<float>(aValue) / 255.0f;
+	return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+// Loads an image file into a cpu_texture the same way as triangle_mesh_geometry_manager prepares its
+// textures: assuming sRGB, and flipped vertically. Returns a plain white texture if loading fails:
+inline cpu_texture load_cpu_texture(const std::string& aPath)
+{
+	cpu_texture result;
+	int w, h, channels;
+	auto* data = stbi_load(aPath.c_str(), &w, &h, &channels, 4);
+	if (nullptr == data) {
+		LOG_WARNING("Couldn't load texture '" + aPath + "' for CPU rendering, using white instead.");
+		return result;
+	}
+	result.mWidth = static_cast<uint32_t>(w);
+	result.mHeight = static_cast<uint32_t>(h);
+	result.mTexels.resize(static_cast<size_t>(w) * h);
+	for (int y = 0; y < h; ++y) {
+		const auto* srcRow = data + static_cast<size_t>(h - 1 - y) * w * 4;
+		for (int x = 0; x < w; ++x) {
+			const auto* src = srcRow + 4 * x;
+			result.mTexels[static_cast<size_t>(y) * w + x] = glm::vec4{ srgb_to_linear(src[0]), srgb_to_linear(src[1]), srgb_to_linear(src[2]), static_cast<float>(src[3]) / 255.0f };
+		}
+	}
+	stbi_image_free(data);
+	return result;
+}
+
+// Loads an ORCA scene into a cpu_scene. Meshes, materials and instances are created in exactly the same
+// order as in triangle_mesh_geometry_manager::initialize(), s.t. custom indices and instance indices match
+// the ones of the GPU's TLAS. Textures are loaded in parallel on the given thread pool.
+// The scene is not built, i.e. cpu_scene::build(...) must still be invoked before tracing rays.
+inline cpu_scene load_cpu_scene_from_orca(const std::string& aPath, aiProcessFlagType aFlags, thread_pool& aPool)
+{
+	cpu_scene scene;
+	auto orca = gvk::orca_scene_t::load_from_file(aPath, aFlags);
+
+	std::vector<std::string> texturePaths;
+	for (auto& model : orca->models()) {
+		auto distinctMaterials = model.mLoadedModel->distinct_material_configs();
+		for (const auto& [materialConfig, meshIndices] : distinctMaterials) {
+			auto selection = gvk::make_models_and_meshes_selection(model.mLoadedModel, meshIndices);
+
+			cpu_mesh mesh;
+			std::tie(mesh.mPositions, mesh.mIndices) = gvk::get_vertices_and_indices(selection);
+			mesh.mNormals = gvk::get_normals(selection);
+			mesh.mTexCoords = gvk::get_2d_texture_coordinates(selection);
+
+			// Textures are shared between materials, therefore load each one only once:
+			cpu_material material;
+			material.mDiffuseTexOffsetTiling = materialConfig.mDiffuseTexOffsetTiling;
+			if (!materialConfig.mDiffuseTex.empty()) {
+				const auto it = std::find(std::begin(texturePaths), std::end(texturePaths), materialConfig.mDiffuseTex);
+				material.mDiffuseTexIndex = static_cast<int32_t>(it - std::begin(texturePaths));
+				if (std::end(texturePaths) == it) {
+					texturePaths.push_back(materialConfig.mDiffuseTex);
+				}
+			}
+
+			const auto meshIndex = scene.add_mesh(std::move(mesh), material);
+			for (const auto& inst : model.mInstances) {
+				scene.add_mesh_instance(meshIndex, gvk::matrix_from_transforms(inst.mTranslation, glm::quat(inst.mRotation), inst.mScaling));
+			}
+		}
+	}
+
+	std::vector<cpu_texture> textures(texturePaths.size());
+	aPool.parallel_for(0, texturePaths.size(), 1, [&](size_t aBegin, size_t aEnd) {
+		for (auto i = aBegin; i < aEnd; ++i) {
+			textures[i] = load_cpu_texture(texturePaths[i]);
+		}
+	});
+	for (auto& tex : textures) {
+		scene.add_texture(std::move(tex));
+	}
+	return scene;
+}
@@ -8,7 +8,7 @@ struct push_const_data_scene_rendering {
 	glm::vec4  mLightDir;
 	glm::mat4  mCameraTransform;
 	float mCameraHalfFovAngle;
-	float _padding;
+	uint32_t mTemporalFlags; // temporal_accumulation::cFlag*
 	vk::Bool32  mEnableShadows;
 	float mShadowsFactor;
 	glm::vec4  mShadowsColor;
@@ -17,6 +17,22 @@ struct push_const_data_scene_rendering {
 	float mAmbientOcclusionMaxDist;
 	float mAmbientOcclusionFactor;
 	glm::vec4  mAmbientOcclusionColor;
+	// Temporal accumulation of ambient occlusion (see temporal_accumulation.hpp):
+	glm::mat4  mPrevWorldToCamera;
+	uint32_t mFrameIndex;
+	uint32_t mAoBaseRays;
+	uint32_t mAoExtraRays;
+	float mMaxHistoryLength;
+	float mVarianceThreshold;
+	float mDepthTolerance;
+	float mNormalTolerance;
+	float _padding;
+};
+
+// Data to be pushed to the GPU along with the compute pipeline which upscales
+// the ray traced image to the output resolution (see spatial_upscaler.hpp):
+struct push_const_data_upscaling {
+	float mEdgeSharpness;
 };
 
 // Data to be pushed to the GPU along with a ray tracing pipeline invocation
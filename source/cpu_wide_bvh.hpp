@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "cpu_bvh.hpp"
+
+// A 4-wide bounding volume hierarchy, obtained by collapsing a binary cpu_bvh. Every node stores the
+// bounds of its four children in structure-of-arrays layout, so that one ray is tested against all
+// four boxes in a loop which the compiler turns into SIMD instructions. Compared to the binary BVH,
+// this halves the depth of the tree and the number of nodes that have to be fetched during traversal.
+// Like cpu_bvh, children are stored after their parents, which is exploited by refit(...).
+class cpu_bvh4
+{
+public:
+	static constexpr uint32_t cInvalidChild = std::numeric_limits<uint32_t>::max();
+
+	// 128 bytes per node, aligned to 32 bytes. A child slot is either an inner node (mCount == 0),
+	// a leaf referring to a range of primitive_indices() (mCount > 0), or empty (mChild == cInvalidChild):
+	struct alignas(32) node
+	{
+		float mMinX[4], mMinY[4], mMinZ[4];
+		float mMaxX[4], mMaxY[4], mMaxZ[4];
+		uint32_t mChild[4];
+		uint32_t mCount[4];
+
+		void set_bounds(int aSlot, const aabb& aBounds)
+		{
+			mMinX[aSlot] = aBounds.mMin.x; mMinY[aSlot] = aBounds.mMin.y; mMinZ[aSlot] = aBounds.mMin.z;
+			mMaxX[aSlot] = aBounds.mMax.x; mMaxY[aSlot] = aBounds.mMax.y; mMaxZ[aSlot] = aBounds.mMax.z;
+		}
+		[[nodiscard]] aabb bounds(int aSlot) const
+		{
+			return aabb{ glm::vec3{ mMinX[aSlot], mMinY[aSlot], mMinZ[aSlot] }, glm::vec3{ mMaxX[aSlot], mMaxY[aSlot], mMaxZ[aSlot] } };
+		}
+	};
+	static_assert(sizeof(node) == 128, "Nodes are expected to occupy 128 bytes");
+
+	// Builds the binary BVH first (in parallel if a pool is given) and collapses it:
+	void build(const std::vector<aabb>& aPrimitiveBounds, thread_pool* aPool = nullptr)
+	{
+		cpu_bvh binary;
+		binary.build(aPrimitiveBounds, aPool);
+		collapse(binary);
+	}
+
+	// Converts a binary BVH into a 4-wide one. Each node adopts the grandchildren of its binary node,
+	// always opening up the child with the largest surface area, until four slots are filled:
+	void collapse(const cpu_bvh& aBinary)
+	{
+		mNodes.clear();
+		mPrimitiveIndices = aBinary.primitive_indices();
+		mBounds = aBinary.bounds();
+		const auto& bin = aBinary.nodes();
+		if (bin.empty()) {
+			return;
+		}
+		mNodes.reserve(bin.size() / 2 + 1);
+
+		// Pairs of (wide node index, binary node index) which still have to be filled:
+		std::vector<std::pair<uint32_t, uint32_t>> stack{ { 0u, 0u } };
+		mNodes.emplace_back();
+		while (!stack.empty()) {
+			const auto [wideIndex, binaryIndex] = stack.back();
+			stack.pop_back();
+
+			std::array<uint32_t, 4> children;
+			int numChildren = 0;
+			if (bin[binaryIndex].mCount > 0) {
+				children[numChildren++] = binaryIndex; // A leaf as root
+			}
+			else {
+				children[numChildren++] = bin[binaryIndex].mFirst;
+				children[numChildren++] = bin[binaryIndex].mFirst + 1;
+				while (numChildren < 4) {
+					int largest = -1;
+					float largestArea = -1.0f;
+					for (int c = 0; c < numChildren; ++c) {
+						const auto& n = bin[children[c]];
+						const auto area = aabb{ n.mMin, n.mMax }.surface_area();
+						if (0 == n.mCount && area > largestArea) {
+							largest = c;
+							largestArea = area;
+						}
+					}
+					if (largest < 0) {
+						break; // Only leaves left
+					}
+					const auto opened = bin[children[largest]].mFirst;
+					children[largest] = opened;
+					children[numChildren++] = opened + 1;
+				}
+			}
+
+			for (int slot = 0; slot < 4; ++slot) {
+				auto& wide = mNodes[wideIndex];
+				if (slot >= numChildren) {
+					wide.set_bounds(slot, aabb{});
+					wide.mChild[slot] = cInvalidChild;
+					wide.mCount[slot] = 0;
+					continue;
+				}
+				const auto& child = bin[children[slot]];
+				wide.set_bounds(slot, aabb{ child.mMin, child.mMax });
+				if (child.mCount > 0) {
+					wide.mChild[slot] = child.mFirst;
+					wide.mCount[slot] = child.mCount;
+				}
+				else {
+					const auto newIndex = static_cast<uint32_t>(mNodes.size());
+					wide.mChild[slot] = newIndex;
+					wide.mCount[slot] = 0;
+					mNodes.emplace_back(); // invalidates wide
+					stack.emplace_back(newIndex, children[slot]);
+				}
+			}
+		}
+	}
+
+	// Updates all bounds after the primitives have moved, keeping the topology:
+	void refit(const std::vector<aabb>& aPrimitiveBounds)
+	{
+		for (size_t i = mNodes.size(); i-- > 0;) {
+			auto& n = mNodes[i];
+			for (int slot = 0; slot < 4; ++slot) {
+				if (cInvalidChild == n.mChild[slot]) {
+					continue;
+				}
+				aabb b;
+				if (n.mCount[slot] > 0) {
+					for (uint32_t k = n.mChild[slot]; k < n.mChild[slot] + n.mCount[slot]; ++k) {
+						b.extend(aPrimitiveBounds[mPrimitiveIndices[k]]);
+					}
+				}
+				else {
+					b = node_bounds(mNodes[n.mChild[slot]]);
+				}
+				n.set_bounds(slot, b);
+			}
+		}
+		mBounds = mNodes.empty() ? aabb{} : node_bounds(mNodes[0]);
+	}
+
+	// The expected cost of a random ray according to the SAH, relative to the root's surface area.
+	// Testing one node (i.e. four boxes) counts as one traversal step:
+	[[nodiscard]] float sah_cost(float aTraversalCost = 1.0f, float aIntersectionCost = 1.0f) const
+	{
+		if (mNodes.empty()) {
+			return 0.0f;
+		}
+		const auto rootArea = std::max(mBounds.surface_area(), std::numeric_limits<float>::min());
+		double cost = aTraversalCost; // the root is always visited
+		for (const auto& n : mNodes) {
+			for (int slot = 0; slot < 4; ++slot) {
+				if (cInvalidChild == n.mChild[slot]) {
+					continue;
+				}
+				const auto area = n.bounds(slot).surface_area() / rootArea;
+				cost += area * (n.mCount[slot] > 0 ? aIntersectionCost * static_cast<float>(n.mCount[slot]) : aTraversalCost);
+			}
+		}
+		return static_cast<float>(cost);
+	}
+
+	[[nodiscard]] bool empty() const { return mNodes.empty(); }
+	[[nodiscard]] const std::vector<node>& nodes() const { return mNodes; }
+	[[nodiscard]] const std::vector<uint32_t>& primitive_indices() const { return mPrimitiveIndices; }
+	[[nodiscard]] aabb bounds() const { return mBounds; }
+
+	// Same contract as cpu_bvh::traverse(...):
+	template <typename F>
+	void traverse(cpu_ray& aRay, F&& aIntersect) const
+	{
+		if (mNodes.empty()) {
+			return;
+		}
+		// Every entry refers to a child slot, stored as (node index * 4 + slot), along with the ray's entry distance:
+		struct stack_entry { uint32_t mSlot; float mTEnter; };
+		std::array<stack_entry, cMaxStackSize> stack;
+		size_t stackSize = 0;
+		uint32_t current = 0;
+		for (;;) {
+			const auto& n = mNodes[current];
+
+			// Slab test against all four children at once:
+			float tEnter[4];
+			for (int s = 0; s < 4; ++s) {
+				const auto tx0 = (n.mMinX[s] - aRay.mOrigin.x) * aRay.mInvDirection.x;
+				const auto tx1 = (n.mMaxX[s] - aRay.mOrigin.x) * aRay.mInvDirection.x;
+				const auto ty0 = (n.mMinY[s] - aRay.mOrigin.y) * aRay.mInvDirection.y;
+				const auto ty1 = (n.mMaxY[s] - aRay.mOrigin.y) * aRay.mInvDirection.y;
+				const auto tz0 = (n.mMinZ[s] - aRay.mOrigin.z) * aRay.mInvDirection.z;
+				const auto tz1 = (n.mMaxZ[s] - aRay.mOrigin.z) * aRay.mInvDirection.z;
+				const auto tNear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), aRay.mTMin));
+				const auto tFar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), aRay.mTMax));
+				tEnter[s] = tNear <= tFar ? tNear : std::numeric_limits<float>::infinity();
+			}
+
+			// Push the hit children far to near, so that the nearest one is processed next:
+			int order[4];
+			int numHits = 0;
+			for (int s = 0; s < 4; ++s) {
+				if (tEnter[s] == std::numeric_limits<float>::infinity() || cInvalidChild == n.mChild[s]) {
+					continue;
+				}
+				int k = numHits++;
+				while (k > 0 && tEnter[order[k - 1]] < tEnter[s]) {
+					order[k] = order[k - 1];
+					--k;
+				}
+				order[k] = s;
+			}
+			for (int h = 0; h < numHits; ++h) {
+				stack[stackSize++] = stack_entry{ current * 4u + static_cast<uint32_t>(order[h]), tEnter[order[h]] };
+			}
+
+			// Pop child slots until reaching an inner node, intersecting leaves on the way:
+			for (;;) {
+				if (0 == stackSize) {
+					return;
+				}
+				const auto entry = stack[--stackSize];
+				// The ray might have been shortened since the child was pushed:
+				if (entry.mTEnter > aRay.mTMax) {
+					continue;
+				}
+				const auto& parent = mNodes[entry.mSlot / 4u];
+				const auto slot = static_cast<int>(entry.mSlot % 4u);
+				if (0 == parent.mCount[slot]) {
+					current = parent.mChild[slot];
+					break;
+				}
+				for (uint32_t i = parent.mChild[slot], end = parent.mChild[slot] + parent.mCount[slot]; i < end; ++i) {
+					if (aIntersect(mPrimitiveIndices[i], aRay)) {
+						return;
+					}
+				}
+			}
+		}
+	}
+
+private:
+	static constexpr size_t cMaxStackSize = 3 * 256 + 4;
+
+	[[nodiscard]] static aabb node_bounds(const node& aNode)
+	{
+		aabb b;
+		for (int slot = 0; slot < 4; ++slot) {
+			if (cInvalidChild != aNode.mChild[slot]) {
+				b.extend(aNode.bounds(slot));
+			}
+		}
+		return b;
+	}
+
+	std::vector<node> mNodes;
+	std::vector<uint32_t> mPrimitiveIndices;
+	aabb mBounds;
+};
@@ -6,6 +6,14 @@
 
 #include "preprocessor_defines.hpp"
 #include "cpu_to_gpu_data_types.hpp"
+#include "tlas_manager.hpp"
+#include "stable_descriptor_sets.hpp"
+#include "profiler.hpp"
+#include "task_graph.hpp"
+#include "stage_command_buffers.hpp"
+#include "temporal_accumulation.hpp"
+#include "render_scale.hpp"
+#include "spatial_upscaler.hpp"
 
 // Main invokee of this application:
 class fluid_nightmare_main : public gvk::invokee
@@ -19,7 +27,28 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 
 	void render() override;
 
-	[[nodiscard]] const avk::top_level_acceleration_structure& get_tlas() const;
+	void finalize() override;
+
+	// The TLAS which is built and read by the frames of the given in-flight index:
+	[[nodiscard]] const avk::top_level_acceleration_structure& get_tlas(int64_t aInFlightIndex) const;
+
+	// The position of the camera (in world space), as of the most recent frame:
+	[[nodiscard]] glm::vec3 camera_position() const;
+
+private: // v== Helper functions ==v
+
+	// (Re-)creates the images which are rendered into (at aRenderResolution) and the image which receives
+	// the upscaled result (at aOutputResolution). Previous images stay alive until no frame in flight uses them:
+	void create_render_targets(const glm::uvec2& aRenderResolution, const glm::uvec2& aOutputResolution);
+
+	// Stages of the frame (see initialize()): Write the instances which have changed into the persistent instance rows, and
+	// bring the TLAS of this frame in flight up to date:
+	void pack_instances();
+	void build_tlas();
+
+	// Draws the timeline of the most recent run of the frame's stages: one lane per thread, one bar per stage. The stages
+	// on the critical path are highlighted; hovering a bar shows the stage's name and duration:
+	void draw_stage_timeline();
 
 private: // v== Member variables ==v
 
@@ -41,26 +70,67 @@ private: // v== Member variables ==v
 
 	// ----------- Resources required for ray tracing -----------
 
-	// We are using one single top-level acceleration structure (TLAS) to keep things simple:
-	//    (We're not duplicating the TLAS per frame in flight. Instead, we
-	//     are using barriers to ensure correct rendering after some data 
-	//     has changed in one or multiple of the acceleration structures.)
-	avk::top_level_acceleration_structure mTlas;
+	// We are using one top-level acceleration structure (TLAS) per frame in flight, s.t.
+	// (update-)builds of one frame's TLAS can overlap with rendering of the other frames.
+	// The manager also decides between full rebuilds and cheaper update-builds (refits):
+	tlas_manager mTlasManager;
+
+	// The instance data of all TLAS, kept up to date incrementally:
+	tlas_instance_buffer mTlasInstances;
 
-	// We are rendering into one single target offscreen image (Otherwise we would need multiple
-	// TLAS instances, too.) to keep things simple:
+	// We are rendering into one single target offscreen image to keep things simple:
 	avk::image_view mOffscreenImageView;
 	// (After blitting this image into one of the window's backbuffers, the GPU can 
 	//  possibly achieve some parallelization of work during presentation.)
 
+	// If the render resolution is lower than the window's resolution, the offscreen image is upscaled into this image:
+	avk::image_view mUpscaledImageView;
+	// The compute pipeline which performs the upscaling (see spatial_upscaler.hpp):
+	avk::compute_pipeline mUpscalePipeline;
+	// The resolutions which the render targets have been created with:
+	glm::uvec2 mRenderResolution = glm::uvec2{ 0u, 0u };
+	glm::uvec2 mOutputResolution = glm::uvec2{ 0u, 0u };
+
+	// Ambient occlusion history for temporal accumulation, one pair of images per frame parity: Every frame reads
+	// the history which the previous frame has written and writes into the other pair (see temporal_accumulation.hpp):
+	std::array<avk::image_view, 2> mAoHistoryViews;        // mean, second moment, history length, view depth
+	std::array<avk::image_view, 2> mAoHistoryNormalsViews; // world space normal
+
 	// The ray tracing pipeline that renders everything into the mOffscreenImageView:
 	avk::ray_tracing_pipeline mPipeline;
 
+	// The descriptor set of the scene's resources (set 0 of mPipeline), one per frame in flight:
+	stable_descriptor_sets mSceneResourceSets;
+
+	// ---------------- Stages of the frame -------------------
+
+	// The stages of update() and their dependencies (see initialize()), and the threads which run the independent ones
+	// concurrently if enabled (UI). Otherwise, they run one after the other:
+	task_graph mFrameStages;
+	task_executor mStageExecutor{ 3 };
+	bool mRunStagesConcurrently = false;
+
+	// The command buffers which the stages record into. They are allocated and released by update():
+	stage_command_buffers mStageCommandBuffers;
+
 	// ----------------- Further invokees --------------------
 
 	// A camera to navigate our scene, which provides us with the view matrix:
 	gvk::quake_camera mQuakeCam;
 
+	// -------------------- Profiling ------------------------
+
+	// Profiler scopes of the whole frame (measured from one update() to the next), the TLAS build,
+	// the ray tracing and the blit into the backbuffer, and of building the UI:
+	profiler::scope_id mFrameScope = 0;
+	profiler::scope_id mTlasBuildScope = 0;
+	profiler::scope_id mTraceRaysScope = 0;
+	profiler::scope_id mUpscaleScope = 0;
+	profiler::scope_id mBlitScope = 0;
+	profiler::scope_id mUiScope = 0;
+	std::chrono::steady_clock::time_point mLastUpdateTime;
+	std::string mProfileExportStatus;
+
 	// ------------------- UI settings -----------------------
 
 	float mFieldOfViewForRayTracing = 45.0f;
@@ -72,11 +142,23 @@ private: // v== Member variables ==v
 	float mAmbientOcclusionMaxDist = 0.25f;
 	float mAmbientOcclusionFactor = 0.5f;
 	glm::vec3 mAmbientOcclusionColor = glm::vec3{ 0.0f, 0.0f, 0.0f };
+	bool mEnableTemporalAccumulation = true;
+	temporal_accumulation::parameters mTemporalParams;
+
+	// Ray trace at a fraction of the window's resolution (per axis), either fixed or adapted to a GPU time budget:
+	float mRenderScale = 1.0f;
+	bool mDynamicRenderScale = false;
+	dynamic_render_scale mDynamicRenderScaleController;
+	float mUpscalerEdgeSharpness = spatial_upscaling::cDefaultEdgeSharpness;
+
+	// State of the temporal accumulation across frames: the camera of the previous frame, the number of
+	// rendered frames (which seeds the random AO rays), and whether the history is usable at all:
+	glm::mat4 mPrevWorldToCamera = glm::mat4{ 1.0f };
+	uint32_t mFrameIndex = 0;
+	bool mHistoryValid = false;
 
 	// One boolean per geometry instance to tell if it shall be included in the
 	// generation of the TLAS or not:
 	std::vector<bool> mGeometryInstanceActive;
 
-	bool mTlasUpdateRequired = false;
-
 }; // End of fluid_nightmare_main
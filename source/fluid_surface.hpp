@@ -0,0 +1,437 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "thread_pool.hpp"
+
+// Reconstructs the surface of the fluid as a triangle mesh from the particles, as an alternative to rendering every
+// particle as a procedural sphere. Particles are splatted into a density field, which is sampled on a sparse grid
+// of bricks (cubes of cBrickCells^3 cells), and the iso-surface of the field is extracted per brick. Only bricks
+// which contain particles exist, and only bricks whose particles (or the parameters) have changed since the previous
+// reconstruction are meshed again. Hence, the geometry of one brick can be replaced (e.g. its BLAS rebuilt) without
+// touching the others; changed_bricks() tells which ones have changed.
+//
+// Every particle contributes w = (1 - d^2/h^2)^3 to the samples within its kernel radius h = mKernelRadiusScale * radius,
+// and the iso level is the contribution at d = radius, i.e. an isolated particle becomes a sphere of its own radius.
+// Samples of shared brick faces are computed from the same particles in the same order in both bricks, so the meshes
+// of neighbouring bricks fit together without cracks.
+// The iso-surface is extracted via marching tetrahedra: every cell is split into six tetrahedra along its main diagonal.
+// This does without the case tables of marching cubes and results in a watertight mesh without ambiguous cases.
+// This class does not depend on the GPU or on the framework and can be used anywhere.
+class fluid_surface_reconstructor
+{
+public:
+	// Cells per brick and axis:
+	static constexpr int cBrickCells = 16;
+	// Samples per brick and axis: the cells' corners plus one more sample on either side for the central differences of the normals:
+	static constexpr int cBrickSamples = cBrickCells + 3;
+	// Upper limit for the number of bricks of the bounding box of all particles (protects against particles which have gone astray):
+	static constexpr size_t cMaxBricksInBounds = size_t{ 1 } << 21;
+
+	struct parameters
+	{
+		float mCellSize = 0.35f;          // Edge length of one grid cell (in world space)
+		float mKernelRadiusScale = 3.0f;  // The kernel radius of a particle relative to its radius
+	};
+
+	// The surface within one brick. Positions are in world space, normals are normalized, and
+	// indices refer to this brick's vertices (three per triangle):
+	struct brick_mesh
+	{
+		glm::ivec3 mCoords;
+		std::vector<glm::vec3> mPositions;
+		std::vector<glm::vec3> mNormals;
+		std::vector<uint32_t> mIndices;
+		uint64_t mInputHash = 0;
+		uint64_t mLastTouched = 0;
+	};
+
+	struct statistics
+	{
+		size_t mNumParticles = 0;
+		size_t mNumBricks = 0;
+		size_t mNumDirtyBricks = 0;
+		size_t mNumRemovedBricks = 0;
+		size_t mNumTriangles = 0;
+		size_t mNumVertices = 0;
+		double mBinningMs = 0.0;
+		double mMeshingMs = 0.0;
+		double mTotalMs = 0.0;
+	};
+
+	[[nodiscard]] static uint64_t key_of(const glm::ivec3& aBrickCoords)
+	{
+		constexpr uint64_t cMask = (uint64_t{ 1 } << 21) - 1;
+		return (static_cast<uint64_t>(aBrickCoords.x) & cMask) | ((static_cast<uint64_t>(aBrickCoords.y) & cMask) << 21) | ((static_cast<uint64_t>(aBrickCoords.z) & cMask) << 42);
+	}
+
+	// The iso level for the given parameters, i.e. the contribution of a particle at a distance of its radius:
+	[[nodiscard]] static float iso_level(const parameters& aParams)
+	{
+		const float s = 1.0f / (aParams.mKernelRadiusScale * aParams.mKernelRadiusScale);
+		return (1.0f - s) * (1.0f - s) * (1.0f - s);
+	}
+
+	[[nodiscard]] parameters& params() { return mParams; }
+	[[nodiscard]] const parameters& params() const { return mParams; }
+	[[nodiscard]] const statistics& stats() const { return mStats; }
+	[[nodiscard]] const std::unordered_map<uint64_t, brick_mesh>& bricks() const { return mBricks; }
+	// The keys of the bricks which have been meshed again or removed by the most recent reconstruct(...):
+	[[nodiscard]] const std::vector<uint64_t>& changed_bricks() const { return mChangedBricks; }
+
+	void clear()
+	{
+		mChangedBricks.clear();
+		for (const auto& [key, brick] : mBricks) {
+			mChangedBricks.push_back(key);
+		}
+		mBricks.clear();
+	}
+
+	// Updates the surface for the given particles (SoA, like particle_store). Returns false (and leaves
+	// all bricks as they are) if the particles are spread over too large a volume:
+	bool reconstruct(const float* aX, const float* aY, const float* aZ, const float* aRadii, size_t aCount, thread_pool& aPool)
+	{
+		const auto t0 = std::chrono::steady_clock::now();
+		mChangedBricks.clear();
+		mStats = statistics{};
+		mStats.mNumParticles = aCount;
+		++mReconstruction;
+
+		// The range of bricks which every particle influences, and the bounds of all of them:
+		const float invCellSize = 1.0f / mParams.mCellSize;
+		mFirstBrick.resize(aCount);
+		mLastBrick.resize(aCount);
+		glm::ivec3 boundsMin{ std::numeric_limits<int>::max() }, boundsMax{ std::numeric_limits<int>::min() };
+		std::mutex boundsMutex;
+		aPool.parallel_for(0, aCount, 8192, [&](size_t aBegin, size_t aEnd) {
+			glm::ivec3 localMin{ std::numeric_limits<int>::max() }, localMax{ std::numeric_limits<int>::min() };
+			for (size_t i = aBegin; i < aEnd; ++i) {
+				const glm::vec3 p{ aX[i], aY[i], aZ[i] };
+				const float h = mParams.mKernelRadiusScale * aRadii[i];
+				const auto [first, last] = sample_range(p, h, invCellSize);
+				// A brick holds the samples [b * cBrickCells - 1, b * cBrickCells + cBrickCells + 1]:
+				mFirstBrick[i] = glm::ivec3{ 0 } - floor_div(glm::ivec3{ cBrickCells + 1 } - first, cBrickCells);
+				mLastBrick[i] = floor_div(last + 1, cBrickCells);
+				localMin = glm::min(localMin, mFirstBrick[i]);
+				localMax = glm::max(localMax, mLastBrick[i]);
+			}
+			std::lock_guard<std::mutex> lock(boundsMutex);
+			boundsMin = glm::min(boundsMin, localMin);
+			boundsMax = glm::max(boundsMax, localMax);
+		});
+		if (0 == aCount) {
+			boundsMin = boundsMax = glm::ivec3{ 0 };
+		}
+		const glm::ivec3 extent = boundsMax - boundsMin + 1;
+		if (static_cast<double>(extent.x) * extent.y * extent.z > static_cast<double>(cMaxBricksInBounds)) {
+			mStats.mTotalMs = elapsed_ms(t0);
+			return false;
+		}
+
+		// Counting sort of the particles into the bricks of the bounding box. Every brick's particles
+		// end up in ascending order, which makes the sums over them deterministic:
+		const size_t numBricksInBounds = static_cast<size_t>(extent.x) * extent.y * extent.z;
+		const auto denseIndex = [&](const glm::ivec3& b) {
+			const glm::ivec3 r = b - boundsMin;
+			return (static_cast<size_t>(r.z) * extent.y + r.y) * extent.x + r.x;
+		};
+		mBrickStart.assign(numBricksInBounds + 1, 0u);
+		for (size_t i = 0; i < aCount; ++i) {
+			for_each_brick(mFirstBrick[i], mLastBrick[i], [&](const glm::ivec3& b) { ++mBrickStart[denseIndex(b) + 1]; });
+		}
+		for (size_t b = 0; b < numBricksInBounds; ++b) {
+			mBrickStart[b + 1] += mBrickStart[b];
+		}
+		mBrickParticles.resize(mBrickStart.back());
+		mWriteCursor.assign(std::begin(mBrickStart), std::end(mBrickStart) - 1);
+		for (size_t i = 0; i < aCount; ++i) {
+			for_each_brick(mFirstBrick[i], mLastBrick[i], [&](const glm::ivec3& b) { mBrickParticles[mWriteCursor[denseIndex(b)]++] = static_cast<uint32_t>(i); });
+		}
+
+		// Hash the inputs of every occupied brick to find out which ones have to be meshed again:
+		mOccupied.clear();
+		for (size_t b = 0; b < numBricksInBounds; ++b) {
+			if (mBrickStart[b] < mBrickStart[b + 1]) {
+				mOccupied.push_back(static_cast<uint32_t>(b));
+			}
+		}
+		mOccupiedHashes.resize(mOccupied.size());
+		const uint64_t paramsHash = mix(mix(0, float_bits(mParams.mCellSize)), float_bits(mParams.mKernelRadiusScale));
+		aPool.parallel_for_each_index(0, mOccupied.size(), 64, [&](size_t o) {
+			uint64_t hash = paramsHash;
+			for (auto k = mBrickStart[mOccupied[o]]; k < mBrickStart[mOccupied[o] + 1]; ++k) {
+				const auto i = mBrickParticles[k];
+				hash = mix(mix(mix(mix(mix(hash, i), float_bits(aX[i])), float_bits(aY[i])), float_bits(aZ[i])), float_bits(aRadii[i]));
+			}
+			mOccupiedHashes[o] = hash;
+		});
+
+		mDirty.clear();
+		for (size_t o = 0; o < mOccupied.size(); ++o) {
+			const auto d = mOccupied[o];
+			const glm::ivec3 coords = boundsMin + glm::ivec3{ static_cast<int>(d % extent.x), static_cast<int>(d / extent.x % extent.y), static_cast<int>(d / (static_cast<size_t>(extent.x) * extent.y)) };
+			const auto key = key_of(coords);
+			auto [it, inserted] = mBricks.try_emplace(key);
+			it->second.mLastTouched = mReconstruction;
+			if (inserted || it->second.mInputHash != mOccupiedHashes[o]) {
+				it->second.mCoords = coords;
+				it->second.mInputHash = mOccupiedHashes[o];
+				mDirty.push_back(dirty_brick{ &it->second, mBrickStart[d], mBrickStart[d + 1] });
+				mChangedBricks.push_back(key);
+			}
+		}
+		for (auto it = std::begin(mBricks); it != std::end(mBricks);) {
+			if (it->second.mLastTouched != mReconstruction) {
+				mChangedBricks.push_back(it->first);
+				it = mBricks.erase(it);
+				++mStats.mNumRemovedBricks;
+			}
+			else {
+				++it;
+			}
+		}
+		mStats.mBinningMs = elapsed_ms(t0);
+
+		// Mesh the dirty bricks:
+		const auto t1 = std::chrono::steady_clock::now();
+		const float iso = iso_level(mParams);
+		aPool.parallel_for_each_index(0, mDirty.size(), 1, [&](size_t d) {
+			thread_local brick_scratch scratch;
+			const auto& dirty = mDirty[d];
+			splat(*dirty.mBrick, mBrickParticles.data() + dirty.mBegin, mBrickParticles.data() + dirty.mEnd, aX, aY, aZ, aRadii, scratch);
+			polygonize(*dirty.mBrick, iso, scratch);
+		});
+		mStats.mMeshingMs = elapsed_ms(t1);
+
+		mStats.mNumBricks = mBricks.size();
+		mStats.mNumDirtyBricks = mDirty.size();
+		for (const auto& [key, brick] : mBricks) {
+			mStats.mNumTriangles += brick.mIndices.size() / 3;
+			mStats.mNumVertices += brick.mPositions.size();
+		}
+		mStats.mTotalMs = elapsed_ms(t0);
+		return true;
+	}
+
+private:
+	static constexpr int cSamplesPerBrick = cBrickSamples * cBrickSamples * cBrickSamples;
+	// Directions of the edges of the tetrahedra (from the lower to the upper corner), encoded as x + 2y + 4z - 1:
+	static constexpr int cNumEdgeDirections = 7;
+	static constexpr uint32_t cNoVertex = std::numeric_limits<uint32_t>::max();
+
+	struct dirty_brick
+	{
+		brick_mesh* mBrick;
+		uint32_t mBegin;
+		uint32_t mEnd;
+	};
+
+	// Per-thread memory for meshing one brick:
+	struct brick_scratch
+	{
+		std::array<float, cSamplesPerBrick> mDensity;
+		std::array<glm::vec3, cSamplesPerBrick> mGradient;
+		std::vector<uint32_t> mEdgeVertex = std::vector<uint32_t>(static_cast<size_t>(cSamplesPerBrick) * cNumEdgeDirections, cNoVertex);
+		std::vector<uint32_t> mUsedEdges;
+	};
+
+	[[nodiscard]] static int floor_div(int a, int b) { return a >= 0 ? a / b : -((-a + b - 1) / b); }
+	[[nodiscard]] static glm::ivec3 floor_div(const glm::ivec3& a, int b) { return glm::ivec3{ floor_div(a.x, b), floor_div(a.y, b), floor_div(a.z, b) }; }
+	[[nodiscard]] static int sample_index(int x, int y, int z) { return (z * cBrickSamples + y) * cBrickSamples + x; }
+	[[nodiscard]] static uint64_t float_bits(float aValue) { uint32_t bits; std::memcpy(&bits, &aValue, sizeof(bits)); return bits; }
+	[[nodiscard]] static uint64_t mix(uint64_t aHash, uint64_t aValue)
+	{
+		// splitmix64 of the combination:
+		uint64_t z = aHash ^ (aValue + 0x9E3779B97F4A7C15ull + (aHash << 6) + (aHash >> 2));
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+	[[nodiscard]] static double elapsed_ms(std::chrono::steady_clock::time_point aStart)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - aStart).count();
+	}
+
+	// The range of (global) sample coordinates within the kernel radius aH around aPos:
+	[[nodiscard]] static std::pair<glm::ivec3, glm::ivec3> sample_range(const glm::vec3& aPos, float aH, float aInvCellSize)
+	{
+		return { glm::ivec3{ glm::ceil((aPos - aH) * aInvCellSize) }, glm::ivec3{ glm::floor((aPos + aH) * aInvCellSize) } };
+	}
+
+	template <typename F>
+	static void for_each_brick(const glm::ivec3& aFirst, const glm::ivec3& aLast, F&& aFunc)
+	{
+		for (int z = aFirst.z; z <= aLast.z; ++z) {
+			for (int y = aFirst.y; y <= aLast.y; ++y) {
+				for (int x = aFirst.x; x <= aLast.x; ++x) {
+					aFunc(glm::ivec3{ x, y, z });
+				}
+			}
+		}
+	}
+
+	// Sums up the kernels of the brick's particles at its samples, and computes the gradients of the density:
+	void splat(const brick_mesh& aBrick, const uint32_t* aBegin, const uint32_t* aEnd, const float* aX, const float* aY, const float* aZ, const float* aRadii, brick_scratch& aScratch) const
+	{
+		const float cellSize = mParams.mCellSize;
+		const float invCellSize = 1.0f / cellSize;
+		// Global sample coordinates of the brick's local sample (0, 0, 0):
+		const glm::ivec3 origin = aBrick.mCoords * cBrickCells - 1;
+		aScratch.mDensity.fill(0.0f);
+		for (auto* it = aBegin; it != aEnd; ++it) {
+			const auto i = *it;
+			const glm::vec3 p{ aX[i], aY[i], aZ[i] };
+			const float h = mParams.mKernelRadiusScale * aRadii[i];
+			const float invH2 = 1.0f / (h * h);
+			auto [first, last] = sample_range(p, h, invCellSize);
+			first = glm::max(first - origin, glm::ivec3{ 0 });
+			last = glm::min(last - origin, glm::ivec3{ cBrickSamples - 1 });
+			for (int z = first.z; z <= last.z; ++z) {
+				const float dz = static_cast<float>(origin.z + z) * cellSize - p.z;
+				for (int y = first.y; y <= last.y; ++y) {
+					const float dy = static_cast<float>(origin.y + y) * cellSize - p.y;
+					const float dyz2 = dy * dy + dz * dz;
+					float* row = aScratch.mDensity.data() + sample_index(0, y, z);
+					for (int x = first.x; x <= last.x; ++x) {
+						const float dx = static_cast<float>(origin.x + x) * cellSize - p.x;
+						const float q = 1.0f - (dx * dx + dyz2) * invH2;
+						if (q > 0.0f) {
+							row[x] += q * q * q;
+						}
+					}
+				}
+			}
+		}
+
+		// Central differences at the cells' corners:
+		for (int z = 1; z < cBrickSamples - 1; ++z) {
+			for (int y = 1; y < cBrickSamples - 1; ++y) {
+				for (int x = 1; x < cBrickSamples - 1; ++x) {
+					const auto& d = aScratch.mDensity;
+					aScratch.mGradient[sample_index(x, y, z)] = glm::vec3{
+						d[sample_index(x + 1, y, z)] - d[sample_index(x - 1, y, z)],
+						d[sample_index(x, y + 1, z)] - d[sample_index(x, y - 1, z)],
+						d[sample_index(x, y, z + 1)] - d[sample_index(x, y, z - 1)]
+					};
+				}
+			}
+		}
+	}
+
+	// Extracts the iso-surface of the brick's cells via marching tetrahedra:
+	void polygonize(brick_mesh& aBrick, float aIso, brick_scratch& aScratch) const
+	{
+		// The six tetrahedra of a cell, as paths from corner 0 to corner 7 (corner bits: x + 2y + 4z). Every
+		// edge of such a tetrahedron goes from a lower to an upper corner, which lets vertices be shared via
+		// the lower corner's sample and the direction of the edge:
+		static constexpr std::array<std::array<int, 4>, 6> cTetrahedra = { {
+			{ 0, 1, 3, 7 }, { 0, 1, 5, 7 }, { 0, 2, 3, 7 }, { 0, 2, 6, 7 }, { 0, 4, 5, 7 }, { 0, 4, 6, 7 }
+		} };
+		const float cellSize = mParams.mCellSize;
+		const glm::ivec3 origin = aBrick.mCoords * cBrickCells - 1;
+		aBrick.mPositions.clear();
+		aBrick.mNormals.clear();
+		aBrick.mIndices.clear();
+
+		const auto cornerSample = [](const glm::ivec3& aCell, int aCorner) {
+			return aCell + glm::ivec3{ aCorner & 1, (aCorner >> 1) & 1, (aCorner >> 2) & 1 };
+		};
+		// The vertex on the edge between two corners (aLower's bits are a subset of aUpper's):
+		const auto edgeVertex = [&](const glm::ivec3& aCell, int aLower, int aUpper) {
+			const glm::ivec3 a = cornerSample(aCell, aLower);
+			const glm::ivec3 b = cornerSample(aCell, aUpper);
+			const int ia = sample_index(a.x, a.y, a.z);
+			const int ib = sample_index(b.x, b.y, b.z);
+			auto& slot = aScratch.mEdgeVertex[static_cast<size_t>(ia) * cNumEdgeDirections + (aLower ^ aUpper) - 1];
+			if (cNoVertex == slot) {
+				const float da = aScratch.mDensity[ia];
+				const float db = aScratch.mDensity[ib];
+				const float t = std::clamp((aIso - da) / (db - da), 0.0f, 1.0f);
+				const glm::vec3 pa = glm::vec3{ origin + a } * cellSize;
+				const glm::vec3 pb = glm::vec3{ origin + b } * cellSize;
+				const glm::vec3 n = -(aScratch.mGradient[ia] + (aScratch.mGradient[ib] - aScratch.mGradient[ia]) * t);
+				const float len = glm::length(n);
+				slot = static_cast<uint32_t>(aBrick.mPositions.size());
+				aBrick.mPositions.push_back(pa + (pb - pa) * t);
+				aBrick.mNormals.push_back(len > 0.0f ? n / len : glm::vec3{ 0.0f, 1.0f, 0.0f });
+				aScratch.mUsedEdges.push_back(static_cast<uint32_t>(&slot - aScratch.mEdgeVertex.data()));
+			}
+			return slot;
+		};
+		// Adds a triangle, facing the way the interpolated normals (i.e. away from the fluid) point:
+		const auto addTriangle = [&](uint32_t a, uint32_t b, uint32_t c) {
+			const auto& p = aBrick.mPositions;
+			const auto& n = aBrick.mNormals;
+			if (glm::dot(glm::cross(p[b] - p[a], p[c] - p[a]), n[a] + n[b] + n[c]) < 0.0f) {
+				std::swap(b, c);
+			}
+			aBrick.mIndices.insert(std::end(aBrick.mIndices), { a, b, c });
+		};
+
+		for (int z = 1; z <= cBrickCells; ++z) {
+			for (int y = 1; y <= cBrickCells; ++y) {
+				for (int x = 1; x <= cBrickCells; ++x) {
+					const glm::ivec3 cell{ x, y, z };
+					uint32_t inside = 0;
+					for (int c = 0; c < 8; ++c) {
+						const glm::ivec3 s = cornerSample(cell, c);
+						inside |= (aScratch.mDensity[sample_index(s.x, s.y, s.z)] >= aIso ? 1u : 0u) << c;
+					}
+					if (0u == inside || 0xFFu == inside) {
+						continue;
+					}
+					for (const auto& tet : cTetrahedra) {
+						int in[4], out[4], numIn = 0, numOut = 0;
+						for (int v : tet) {
+							if (inside & (1u << v)) { in[numIn++] = v; } else { out[numOut++] = v; }
+						}
+						// Corners are ordered from lower to upper within a tetrahedron, hence std::min/std::max give the lower and the upper one:
+						const auto vertex = [&](int aA, int aB) { return edgeVertex(cell, std::min(aA, aB), std::max(aA, aB)); };
+						if (1 == numIn) {
+							addTriangle(vertex(in[0], out[0]), vertex(in[0], out[1]), vertex(in[0], out[2]));
+						}
+						else if (3 == numIn) {
+							addTriangle(vertex(out[0], in[0]), vertex(out[0], in[1]), vertex(out[0], in[2]));
+						}
+						else if (2 == numIn) {
+							const auto v00 = vertex(in[0], out[0]), v01 = vertex(in[0], out[1]), v10 = vertex(in[1], out[0]), v11 = vertex(in[1], out[1]);
+							addTriangle(v00, v01, v11);
+							addTriangle(v00, v11, v10);
+						}
+					}
+				}
+			}
+		}
+
+		for (auto e : aScratch.mUsedEdges) {
+			aScratch.mEdgeVertex[e] = cNoVertex;
+		}
+		aScratch.mUsedEdges.clear();
+	}
+
+	parameters mParams;
+	statistics mStats;
+	std::unordered_map<uint64_t, brick_mesh> mBricks;
+	std::vector<uint64_t> mChangedBricks;
+	uint64_t mReconstruction = 0;
+
+	std::vector<glm::ivec3> mFirstBrick;
+	std::vector<glm::ivec3> mLastBrick;
+	std::vector<uint32_t> mBrickStart;
+	std::vector<uint32_t> mWriteCursor;
+	std::vector<uint32_t> mBrickParticles;
+	std::vector<uint32_t> mOccupied;
+	std::vector<uint64_t> mOccupiedHashes;
+	std::vector<dirty_brick> mDirty;
+};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <gvk.hpp>
+
+#include <deque>
+#include <unordered_map>
+
+#include "fluid_surface.hpp"
+#include "instance_packing.hpp"
+#include "static_blas.hpp"
+
+// The GPU side of the reconstructed fluid surface (see fluid_surface_reconstructor): one triangle BLAS per brick,
+// which is replaced whenever the brick has been meshed again, and one TLAS instance per non-empty brick.
+// Every brick's vertices and indices live in one host-coherent buffer, which the BLAS build reads and the closest hit
+// shader fetches the normals from. The shader finds a brick's buffer via the brick table: the custom index of a
+// brick's instance is cCustomIndexFlag | slot, and the table's entry at slot holds the device addresses of its data.
+// Resources which have been replaced are kept alive until all frames in flight which might use them have completed.
+class fluid_surface_geometry
+{
+public:
+	// Upper limit for the number of bricks with triangles (i.e. the number of entries of the brick table):
+	static constexpr uint32_t cMaxBricks = 16384;
+	// Marks the custom indices of the fluid surface's instances; must match FLUID_SURFACE_CUSTOM_INDEX_FLAG in first_hit_closest_hit_shader.rchit:
+	static constexpr uint32_t cCustomIndexFlag = 0x800000u;
+
+	// One entry of the brick table, as the shader expects it (two buffer references):
+	struct brick_table_entry
+	{
+		vk::DeviceAddress mNormals; // glm::vec3 per vertex
+		vk::DeviceAddress mIndices; // uint32_t per index
+	};
+
+	void create(size_t aNumConcurrentFrames)
+	{
+		mTable.assign(cMaxBricks, brick_table_entry{ 0, 0 });
+		mPerFrame.clear();
+		mPerFrame.resize(aNumConcurrentFrames);
+		for (auto& entry : mPerFrame) {
+			entry.mBuffer = gvk::context().create_buffer(
+				avk::memory_usage::host_coherent, {},
+				avk::storage_buffer_meta::create_from_size(cMaxBricks * sizeof(brick_table_entry))
+			);
+			entry.mBuffer->fill(mTable.data(), 0, avk::sync::not_required());
+		}
+		mFreeSlots.clear();
+		for (uint32_t s = cMaxBricks; s > 0; --s) {
+			mFreeSlots.push_back(s - 1);
+		}
+	}
+
+	// Replaces the geometry of all bricks which aSurface has changed during its most recent reconstruction, and records
+	// the builds of their BLAS into aCommandBuffer. Replaced resources are retired with aFrameId. Bricks which don't
+	// fit into the brick table anymore are left out. Returns true if the TLAS instances have changed:
+	bool update(const fluid_surface_reconstructor& aSurface, avk::command_buffer_t& aCommandBuffer, int64_t aFrameId)
+	{
+		if (aSurface.changed_bricks().empty()) {
+			return false;
+		}
+		auto& retired = retire(aFrameId);
+		mNumDroppedBricks = 0;
+		static_blas_batch batch(false);
+		std::vector<uint64_t> built;
+		for (const auto key : aSurface.changed_bricks()) {
+			if (auto it = mBricks.find(key); it != std::end(mBricks)) {
+				retired.mBlas.push_back(std::move(it->second.mBlas));
+				retired.mBuffers.push_back(std::move(it->second.mBuffer));
+				mTable[it->second.mSlot] = brick_table_entry{ 0, 0 };
+				mFreeSlots.push_back(it->second.mSlot);
+				mBricks.erase(it);
+			}
+			const auto src = aSurface.bricks().find(key);
+			if (src == std::end(aSurface.bricks()) || src->second.mIndices.empty()) {
+				continue;
+			}
+			if (mFreeSlots.empty()) {
+				++mNumDroppedBricks;
+				continue;
+			}
+
+			// Vertices and indices go into one buffer: [positions | normals | indices]:
+			const auto& mesh = src->second;
+			const auto positionsSize = mesh.mPositions.size() * sizeof(glm::vec3);
+			const auto indicesSize = mesh.mIndices.size() * sizeof(uint32_t);
+			gpu_brick brick;
+			brick.mSize = 2 * positionsSize + indicesSize;
+			brick.mBuffer = gvk::context().create_buffer(
+				avk::memory_usage::host_coherent,
+				vk::BufferUsageFlagBits::eShaderDeviceAddressKHR | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
+				avk::storage_buffer_meta::create_from_size(brick.mSize)
+			);
+			brick.mBuffer->fill(mesh.mPositions.data(), 0, 0, positionsSize, avk::sync::not_required());
+			brick.mBuffer->fill(mesh.mNormals.data(), 0, positionsSize, positionsSize, avk::sync::not_required());
+			brick.mBuffer->fill(mesh.mIndices.data(), 0, 2 * positionsSize, indicesSize, avk::sync::not_required());
+			const auto address = brick.mBuffer->device_address();
+			batch.add({ static_blas_geometry{ address, address + 2 * positionsSize, static_cast<uint32_t>(mesh.mPositions.size()), static_cast<uint32_t>(mesh.mIndices.size() / 3) } });
+
+			brick.mSlot = mFreeSlots.back();
+			mFreeSlots.pop_back();
+			mTable[brick.mSlot] = brick_table_entry{ address + positionsSize, address + 2 * positionsSize };
+			mBricks.emplace(key, std::move(brick));
+			built.push_back(key);
+		}
+
+		// The buffers are host-coherent, i.e. their contents are visible to the builds after submission:
+		batch.record_builds(aCommandBuffer);
+		for (size_t i = 0; i < built.size(); ++i) {
+			mBricks[built[i]].mBlas = std::move(batch.blas()[i]);
+		}
+		retired.mBatches.push_back(std::move(batch)); // Owns the scratch buffer
+		++mTableVersion;
+		return true;
+	}
+
+	// Releases all geometry (e.g. when switching back to spheres). The resources are retired with aFrameId:
+	void clear(int64_t aFrameId)
+	{
+		auto& retired = retire(aFrameId);
+		for (auto& [key, brick] : mBricks) {
+			retired.mBlas.push_back(std::move(brick.mBlas));
+			retired.mBuffers.push_back(std::move(brick.mBuffer));
+			mTable[brick.mSlot] = brick_table_entry{ 0, 0 };
+			mFreeSlots.push_back(brick.mSlot);
+		}
+		mBricks.clear();
+		++mTableVersion;
+	}
+
+	// Destroys the resources which have been retired at least aNumConcurrentFrames frames before aFrameId:
+	void release_retired(int64_t aFrameId, int64_t aNumConcurrentFrames)
+	{
+		while (!mRetired.empty() && mRetired.front().mFrameId + aNumConcurrentFrames <= aFrameId) {
+			mRetired.pop_front();
+		}
+	}
+
+	[[nodiscard]] size_t number_of_instances() const { return mBricks.size(); }
+	// How many bricks the last update(...) has left out, because the brick table was full:
+	[[nodiscard]] size_t number_of_dropped_bricks() const { return mNumDroppedBricks; }
+
+	// Writes one instance per brick into aDst, which must have room for number_of_instances() rows:
+	void write_instances(packed_instance* aDst) const
+	{
+		for (const auto& [key, brick] : mBricks) {
+			*aDst++ = make_packed_instance(glm::mat4{ 1.0f }, cCustomIndexFlag | brick.mSlot, 0 /* Triangles, like the meshes */, brick.mBlas.device_address());
+		}
+	}
+
+	// Copies the brick table into the given frame in flight's buffer (if it has changed since) and returns that buffer:
+	[[nodiscard]] const avk::buffer& brick_table(int64_t aInFlightIndex)
+	{
+		auto& entry = mPerFrame[static_cast<size_t>(aInFlightIndex) % mPerFrame.size()];
+		if (entry.mVersion != mTableVersion) {
+			entry.mBuffer->fill(mTable.data(), 0, avk::sync::not_required());
+			entry.mVersion = mTableVersion;
+		}
+		return entry.mBuffer;
+	}
+
+	// Bytes of all bricks' vertex and index data:
+	[[nodiscard]] size_t geometry_memory() const
+	{
+		size_t sum = 0;
+		for (const auto& [key, brick] : mBricks) {
+			sum += brick.mSize;
+		}
+		return sum;
+	}
+
+private:
+	struct gpu_brick
+	{
+		avk::buffer mBuffer;
+		static_blas mBlas;
+		size_t mSize = 0;
+		uint32_t mSlot = 0;
+	};
+
+	struct retired_resources
+	{
+		int64_t mFrameId;
+		std::vector<static_blas> mBlas;
+		std::vector<avk::buffer> mBuffers;
+		std::vector<static_blas_batch> mBatches;
+	};
+
+	struct per_frame_table
+	{
+		avk::buffer mBuffer;
+		uint64_t mVersion = 0;
+	};
+
+	retired_resources& retire(int64_t aFrameId)
+	{
+		if (mRetired.empty() || mRetired.back().mFrameId != aFrameId) {
+			mRetired.push_back(retired_resources{ aFrameId, {}, {}, {} });
+		}
+		return mRetired.back();
+	}
+
+	std::unordered_map<uint64_t, gpu_brick> mBricks;
+	std::vector<uint32_t> mFreeSlots;
+	std::vector<brick_table_entry> mTable;
+	uint64_t mTableVersion = 0;
+	size_t mNumDroppedBricks = 0;
+	std::vector<per_frame_table> mPerFrame;
+	std::deque<retired_resources> mRetired;
+};
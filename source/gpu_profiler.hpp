@@ -0,0 +1,141 @@
+#pragma once
+
+#include <gvk.hpp>
+
+#include "profiler.hpp"
+
+// Measures GPU time of profiler scopes with timestamp queries. There is one query pool per frame in flight;
+// the timestamps which a frame has written are read when its in-flight index comes around again, i.e. when
+// the frame has completed, and are added to the profiler as GPU time of their scopes. The query pools are
+// reset from the host (hostQueryReset), s.t. scopes can be recorded into any command buffer of a frame.
+// If the queue doesn't support timestamps, nothing is measured.
+class gpu_profiler
+{
+public:
+	void create(size_t aNumConcurrentFrames, const avk::queue& aQueue, uint32_t aMaxScopesPerFrame = 64)
+	{
+		mPerFrame.clear();
+		const auto validBits = gvk::context().physical_device().getQueueFamilyProperties()[aQueue.family_index()].timestampValidBits;
+		mAvailable = validBits > 0;
+		if (!mAvailable) {
+			LOG_WARNING("The queue doesn't support timestamps, GPU times won't be measured.");
+			return;
+		}
+		mTimestampPeriodNs = static_cast<double>(gvk::context().physical_device().getProperties().limits.timestampPeriod);
+		mTimestampMask = validBits >= 64 ? ~uint64_t{ 0 } : (uint64_t{ 1 } << validBits) - 1;
+		mMaxQueries = 2 * aMaxScopesPerFrame;
+		for (size_t i = 0; i < aNumConcurrentFrames; ++i) {
+			auto& entry = mPerFrame.emplace_back();
+			entry.mPool = gvk::context().device().createQueryPoolUnique(vk::QueryPoolCreateInfo{ {}, vk::QueryType::eTimestamp, mMaxQueries });
+			gvk::context().device().resetQueryPool(entry.mPool.get(), 0, mMaxQueries);
+		}
+	}
+
+	// Destroys the query pools. Must be invoked before the device is destroyed:
+	void destroy()
+	{
+		mPerFrame.clear();
+		mAvailable = false;
+	}
+
+	[[nodiscard]] bool is_available() const { return mAvailable; }
+
+	// Writes a timestamp which starts a measurement of aScope into aCommandBuffer. Returns the index
+	// of the measurement, which must be passed to end(...), or -1 if nothing can be measured:
+	int begin(avk::command_buffer_t& aCommandBuffer, profiler::scope_id aScope)
+	{
+		auto* entry = current_frame();
+		if (nullptr == entry || entry->mScopes.size() * 2 + 2 > mMaxQueries) {
+			return -1;
+		}
+		const auto measurement = static_cast<int>(entry->mScopes.size());
+		entry->mScopes.push_back(aScope);
+		aCommandBuffer.handle().writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, entry->mPool.get(), 2 * measurement);
+		return measurement;
+	}
+
+	// Writes the timestamp which ends the given measurement into aCommandBuffer (after all previously recorded commands):
+	void end(avk::command_buffer_t& aCommandBuffer, int aMeasurement)
+	{
+		auto* entry = current_frame();
+		if (nullptr == entry || aMeasurement < 0) {
+			return;
+		}
+		aCommandBuffer.handle().writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, entry->mPool.get(), 2 * aMeasurement + 1);
+	}
+
+private:
+	struct per_frame_pool
+	{
+		vk::UniqueQueryPool mPool;
+		std::vector<profiler::scope_id> mScopes; // One per measurement, which occupies two queries
+		int64_t mFrameId = -1;
+	};
+
+	// Returns the query pool of the current frame. When a frame uses its pool for the first time, the
+	// measurements of the frame which has used it before are collected, and the pool is reset:
+	per_frame_pool* current_frame()
+	{
+		if (!mAvailable || mPerFrame.empty()) {
+			return nullptr;
+		}
+		auto* wnd = gvk::context().main_window();
+		const auto frameId = wnd->current_frame();
+		auto& entry = mPerFrame[static_cast<size_t>(wnd->in_flight_index_for_frame()) % mPerFrame.size()];
+		if (entry.mFrameId == frameId) {
+			return &entry;
+		}
+		if (!entry.mScopes.empty()) {
+			// Timestamp value and availability per query:
+			const auto numQueries = static_cast<uint32_t>(2 * entry.mScopes.size());
+			std::vector<uint64_t> results(2 * numQueries);
+			const auto result = gvk::context().device().getQueryPoolResults(entry.mPool.get(), 0, numQueries,
+				results.size() * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability);
+			bool allAvailable = vk::Result::eSuccess == result;
+			for (uint32_t q = 0; allAvailable && q < numQueries; ++q) {
+				allAvailable = 0 != results[2 * q + 1];
+			}
+			if (!allAvailable) {
+				return nullptr; // Still in use by the GPU => skip measuring this frame
+			}
+			for (size_t m = 0; m < entry.mScopes.size(); ++m) {
+				const auto ticks = (results[4 * m + 2] - results[4 * m]) & mTimestampMask;
+				shared_profiler().add_time(entry.mScopes[m], profiler::source::gpu, std::chrono::nanoseconds{ static_cast<int64_t>(static_cast<double>(ticks) * mTimestampPeriodNs) });
+			}
+			gvk::context().device().resetQueryPool(entry.mPool.get(), 0, numQueries);
+			entry.mScopes.clear();
+		}
+		entry.mFrameId = frameId;
+		return &entry;
+	}
+
+	std::vector<per_frame_pool> mPerFrame;
+	uint32_t mMaxQueries = 0;
+	double mTimestampPeriodNs = 1.0;
+	uint64_t mTimestampMask = ~uint64_t{ 0 };
+	bool mAvailable = false;
+};
+
+// Measures the GPU time of the commands which are recorded into a command buffer during its lifetime:
+class gpu_scope
+{
+public:
+	gpu_scope(gpu_profiler& aProfiler, avk::command_buffer_t& aCommandBuffer, profiler::scope_id aScope)
+		: mProfiler{ &aProfiler }, mCommandBuffer{ &aCommandBuffer }, mMeasurement{ aProfiler.begin(aCommandBuffer, aScope) }
+	{}
+	gpu_scope(const gpu_scope&) = delete;
+	gpu_scope& operator=(const gpu_scope&) = delete;
+	~gpu_scope() { mProfiler->end(*mCommandBuffer, mMeasurement); }
+
+private:
+	gpu_profiler* mProfiler;
+	avk::command_buffer_t* mCommandBuffer;
+	int mMeasurement;
+};
+
+// A GPU profiler which is shared by all systems of this application. It measures nothing until create(...) has been invoked:
+inline gpu_profiler& shared_gpu_profiler()
+{
+	static gpu_profiler sProfiler;
+	return sProfiler;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <gvk.hpp>
+
+#include "cpu_scene_loader.hpp"
+#include "cpu_reference_renderer.hpp"
+#include "image_writer.hpp"
+#include "thread_pool.hpp"
+#include "profiler.hpp"
+#include "render_scale.hpp"
+#include "spatial_upscaler.hpp"
+
+// Command line switch which renders one frame on the CPU instead of opening a window:
+//   fluid-nightmare --headless-render <output.png|output.exr> [width height] [--render-scale <scale>] [--profile-output <profile.csv|profile.json>]
+constexpr const char* cHeadlessRenderSwitch = "--headless-render";
+// Optional switch which ray traces at a fraction of the output resolution and upscales the result (like the interactive application does):
+constexpr const char* cRenderScaleSwitch = "--render-scale";
+
+// Returns the index of the headless switch in argv, or -1 if it isn't present:
+inline int find_headless_rendering_switch(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i) {
+		if (std::string(argv[i]) == cHeadlessRenderSwitch) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Renders the scene of the interactive application, with its default settings and initial camera,
+// using the cpu_reference_renderer and writes the result into a file. The format depends on the
+// file extension: .exr files receive the linear colors, .png files the values that the GPU
+// stores into its rgba8 offscreen image. Returns the exit code for main():
+inline int run_headless_rendering(int argc, char* argv[])
+{
+	const auto switchIndex = find_headless_rendering_switch(argc, argv);
+	if (switchIndex < 0 || switchIndex + 1 >= argc) {
+		LOG_ERROR(std::string("Usage: ") + argv[0] + " " + cHeadlessRenderSwitch + " <output.png|output.exr> [width height]");
+		return 1;
+	}
+	const std::string outputPath = argv[switchIndex + 1];
+	uint32_t width = 1920, height = 1080; // same as the main window
+	if (switchIndex + 3 < argc && 0 != std::string(argv[switchIndex + 2]).rfind("--", 0)) { // Not followed by another switch
+		width = static_cast<uint32_t>(std::max(1, std::atoi(argv[switchIndex + 2])));
+		height = static_cast<uint32_t>(std::max(1, std::atoi(argv[switchIndex + 3])));
+	}
+	const auto isExr = outputPath.size() >= 4 && 0 == outputPath.compare(outputPath.size() - 4, 4, ".exr");
+	float renderScale = 1.0f;
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (std::string(argv[i]) == cRenderScaleSwitch) {
+			renderScale = glm::clamp(static_cast<float>(std::atof(argv[i + 1])), 0.1f, 1.0f);
+		}
+	}
+	const auto renderResolution = scaled_render_resolution(glm::uvec2{ width, height }, renderScale);
+
+	// Every stage is measured as one scope of the profiler; the whole run is one frame:
+	auto& prof = shared_profiler();
+	const auto loadScope = prof.scope("scene load");
+	const auto bvhScope = prof.scope("BVH build");
+	const auto renderScope = prof.scope("CPU render");
+	const auto upscaleScope = prof.scope("upscale");
+	const auto writeScope = prof.scope("image write");
+
+	auto& pool = shared_thread_pool();
+	auto t0 = std::chrono::steady_clock::now();
+	auto scene = load_cpu_scene_from_orca("assets/sponza_and_terrain.fscene", aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace, pool);
+	auto t1 = std::chrono::steady_clock::now();
+	scene.build(pool);
+	auto t2 = std::chrono::steady_clock::now();
+	prof.add_time(loadScope, profiler::source::cpu, t1 - t0);
+	prof.add_time(bvhScope, profiler::source::cpu, t2 - t1);
+	LOG_INFO(fmt::format("Loaded {} meshes ({} triangles) and {} textures in {:.2f}s, built BVHs in {:.2f}s",
+		scene.meshes().size(), scene.number_of_triangles(), scene.textures().size(),
+		std::chrono::duration<double>(t1 - t0).count(), std::chrono::duration<double>(t2 - t1).count()));
+
+	// Same as the initial state of fluid_nightmare_main's camera:
+	cpu_render_settings settings;
+	settings.mCameraTransform = glm::translate(glm::mat4{ 1.0f }, glm::vec3{ 0.0f, 10.0f, 45.0f });
+
+	std::vector<glm::vec3> colors;
+	const auto stats = [&]() {
+		cpu_scope scope(prof, renderScope);
+		return cpu_reference_renderer::render(scene, settings, renderResolution.x, renderResolution.y, colors, pool.size());
+	}();
+	LOG_INFO(fmt::format("Rendered {}x{} pixels in {:.3f}s on {} threads ({} tiles, {} stolen): {} primary, {} shadow, {} AO rays => {:.2f} MRays/s",
+		renderResolution.x, renderResolution.y, stats.mSeconds, stats.mNumThreads, stats.mNumTiles, stats.mNumStolenTiles,
+		stats.mNumPrimaryRays, stats.mNumShadowRays, stats.mNumAmbientOcclusionRays, stats.rays_per_second() * 1e-6));
+
+	if (renderResolution != glm::uvec2{ width, height }) {
+		cpu_scope scope(prof, upscaleScope);
+		// The GPU upscales the values of its rgba8 offscreen image, i.e. clamped ones:
+		if (!isExr) {
+			for (auto& c : colors) {
+				c = glm::clamp(c, glm::vec3{ 0.0f }, glm::vec3{ 1.0f });
+			}
+		}
+		std::vector<glm::vec3> upscaled;
+		spatial_upscaling::upscale(colors, renderResolution.x, renderResolution.y, upscaled, width, height, spatial_upscaling::cDefaultEdgeSharpness, pool);
+		colors = std::move(upscaled);
+		LOG_INFO(fmt::format("Upscaled to {}x{} pixels", width, height));
+	}
+
+	bool success;
+	const auto t3 = std::chrono::steady_clock::now();
+	if (isExr) {
+		success = image_writer::write_exr_rgb32f(outputPath, width, height, &colors[0].x);
+	}
+	else {
+		std::vector<uint8_t> pixels(colors.size() * 3);
+		for (size_t i = 0; i < colors.size(); ++i) {
+			for (int c = 0; c < 3; ++c) {
+				pixels[3 * i + c] = cpu_reference_renderer::to_unorm8(colors[i][c]);
+			}
+		}
+		success = image_writer::write_png_rgb8(outputPath, width, height, pixels.data());
+	}
+	prof.add_time(writeScope, profiler::source::cpu, std::chrono::steady_clock::now() - t3);
+	prof.end_frame();
+
+	const auto profileOutputPath = find_profile_output_path(argc, argv);
+	if (!profileOutputPath.empty()) {
+		if (prof.write(profileOutputPath)) {
+			LOG_INFO("Wrote the profile to '" + profileOutputPath + "'");
+		}
+		else {
+			LOG_ERROR("Couldn't write the profile to '" + profileOutputPath + "'");
+		}
+	}
+	if (!success) {
+		LOG_ERROR("Couldn't write the rendered image to '" + outputPath + "'");
+		return 1;
+	}
+	LOG_INFO("Wrote the rendered image to '" + outputPath + "'");
+	return 0;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <gvk.hpp>
+
+#include "cpu_scene_loader.hpp"
+#include "cpu_particle_spawner.hpp"
+#include "particle_snapshot.hpp"
+#include "particle_store.hpp"
+#include "spawn_candidate_selector.hpp"
+#include "sph_solver.hpp"
+#include "thread_pool.hpp"
+#include "profiler.hpp"
+
+// Command line switch which spawns (and simulates) particles on the CPU instead of opening a window, and saves them as a snapshot:
+//   fluid-nightmare --headless-spawn <output.fnps> [dispatches] [--profile-output <profile.csv|profile.json>]
+constexpr const char* cHeadlessSpawnSwitch = "--headless-spawn";
+
+// Returns the index of the headless spawn switch in argv, or -1 if it isn't present:
+inline int find_headless_spawning_switch(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; ++i) {
+		if (std::string(argv[i]) == cHeadlessSpawnSwitch) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Pre-fills the scene of the interactive application with water: performs the given number of spawn dispatches with the
+// default spawn settings of procedural_geometry_manager, tracing the spawn rays with the cpu_particle_spawner on all cores,
+// and lets the particles flow for one frame of 1/60 s after every dispatch. The particles are written into a snapshot,
+// which the interactive application can load. Returns the exit code for main():
+inline int run_headless_spawning(int argc, char* argv[])
+{
+	const auto switchIndex = find_headless_spawning_switch(argc, argv);
+	if (switchIndex < 0 || switchIndex + 1 >= argc) {
+		LOG_ERROR(std::string("Usage: ") + argv[0] + " " + cHeadlessSpawnSwitch + " <output.fnps> [dispatches]");
+		return 1;
+	}
+	const std::string outputPath = argv[switchIndex + 1];
+	int numDispatches = 600;
+	if (switchIndex + 2 < argc && 0 != std::string(argv[switchIndex + 2]).rfind("--", 0)) { // Not followed by another switch
+		numDispatches = std::max(1, std::atoi(argv[switchIndex + 2]));
+	}
+
+	// Same values as in procedural_geometry_manager:
+	constexpr size_t cMaxNumParticles = 524288;
+	constexpr uint32_t cNewParticleCandidatesToSpawn = 64u * 64u;
+	constexpr size_t cMaxNewParticlesPerSpawnDispatch = 1024;
+	constexpr float cFrameTime = 1.0f / 60.0f;
+	cpu_spawn_settings settings;
+	settings.mSpawnTransformation = spawn_transformation(glm::vec3{ 0.0f, 20.0f, 0.0f }, glm::vec3{ 0.0f, -1.0f, 0.0f });
+
+	// Every stage is measured as one scope of the profiler; every dispatch is one frame:
+	auto& prof = shared_profiler();
+	const auto loadScope = prof.scope("scene load");
+	const auto bvhScope = prof.scope("BVH build");
+	const auto spawnScope = prof.scope("CPU spawn");
+	const auto simulationScope = prof.scope("simulation");
+	const auto writeScope = prof.scope("snapshot write");
+
+	auto& pool = shared_thread_pool();
+	const auto t0 = std::chrono::steady_clock::now();
+	auto scene = [&]() {
+		cpu_scope scope(prof, loadScope);
+		return load_cpu_scene_from_orca("assets/sponza_and_terrain.fscene", aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace, pool);
+	}();
+	LOG_INFO(fmt::format("Loaded {} meshes ({} triangles) in {:.2f}s", scene.meshes().size(), scene.number_of_triangles(), std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count()));
+
+	particle_store particles;
+	particles.set_max_size(cMaxNumParticles);
+	sph_solver solver;
+	solver.parameters().mParticleRadius = settings.mNewParticlesRadius;
+	spawn_candidate_selector selector;
+	std::vector<glm::vec4> candidates;
+	std::vector<glm::vec3> newPositions;
+	size_t builtCount = SIZE_MAX;
+
+	const auto t1 = std::chrono::steady_clock::now();
+	for (int d = 0; d < numDispatches && particles.size() < cMaxNumParticles; ++d) {
+		{
+			// The top-level BVH is only refit while the number of particles stays the same:
+			cpu_scope scope(prof, bvhScope);
+			if (builtCount == particles.size()) {
+				scene.refit_spheres(particles.positions_x(), particles.positions_y(), particles.positions_z(), particles.radii(), particles.size(), &pool);
+			}
+			else {
+				scene.set_spheres(particles.positions_x(), particles.positions_y(), particles.positions_z(), particles.radii(), particles.size());
+				scene.build(pool);
+				builtCount = particles.size();
+			}
+		}
+		{
+			cpu_scope scope(prof, spawnScope);
+			cpu_particle_spawner::trace(scene, settings, cNewParticleCandidatesToSpawn, candidates, pool);
+			newPositions.clear();
+			selector.begin(particles, settings.mNewParticlesRadius, pool);
+			selector.select(candidates.data(), candidates.size(), settings.mNewParticlesRadius, std::min(cMaxNumParticles - particles.size(), cMaxNewParticlesPerSpawnDispatch), newPositions);
+			// The selector refers to the particles' arrays => only add the new particles after the selection has been made:
+			particles.reserve(particles.size() + newPositions.size());
+			for (const auto& p : newPositions) {
+				particles.add(p, settings.mNewParticlesRadius);
+			}
+		}
+		{
+			cpu_scope scope(prof, simulationScope);
+			solver.advance(particles, cFrameTime, pool);
+		}
+		prof.end_frame();
+	}
+	LOG_INFO(fmt::format("Spawned {} particles in {:.2f}s on {} threads", particles.size(), std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count(), pool.size()));
+
+	bool success;
+	{
+		cpu_scope scope(prof, writeScope);
+		success = save_particle_snapshot(outputPath, particles);
+	}
+	prof.end_frame();
+
+	const auto profileOutputPath = find_profile_output_path(argc, argv);
+	if (!profileOutputPath.empty()) {
+		if (prof.write(profileOutputPath)) {
+			LOG_INFO("Wrote the profile to '" + profileOutputPath + "'");
+		}
+		else {
+			LOG_ERROR("Couldn't write the profile to '" + profileOutputPath + "'");
+		}
+	}
+	if (!success) {
+		LOG_ERROR("Couldn't write the snapshot to '" + outputPath + "'");
+		return 1;
+	}
+	LOG_INFO("Wrote the snapshot to '" + outputPath + "'");
+	return 0;
+}
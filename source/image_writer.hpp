@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Minimal, dependency-free writers for images that were produced on the CPU.
+// PNG files are written with uncompressed (stored) deflate blocks, which every decoder
+// accepts. EXR files are written as uncompressed scanline images with 32-bit float channels.
+namespace image_writer
+{
+	namespace detail
+	{
+		inline void put_u32_be(std::vector<uint8_t>& aOut, uint32_t aValue)
+		{
+			aOut.push_back(static_cast<uint8_t>(aValue >> 24)); aOut.push_back(static_cast<uint8_t>(aValue >> 16));
+			aOut.push_back(static_cast<uint8_t>(aValue >>  8)); aOut.push_back(static_cast<uint8_t>(aValue));
+		}
+
+		template <typename T>
+		void put_le(std::vector<uint8_t>& aOut, T aValue)
+		{
+			uint8_t bytes[sizeof(T)];
+			std::memcpy(bytes, &aValue, sizeof(T));
+			// Both of our target platforms are little-endian:
+			aOut.insert(std::end(aOut), bytes, bytes + sizeof(T));
+		}
+
+		inline void put_string(std::vector<uint8_t>& aOut, const char* aString)
+		{
+			aOut.insert(std::end(aOut), aString, aString + std::strlen(aString) + 1); // including the terminating null
+		}
+
+		inline uint32_t crc32(const uint8_t* aData, size_t aSize, uint32_t aCrc = 0u)
+		{
+			static const auto sTable = []() {
+				std::array<uint32_t, 256> table{};
+				for (uint32_t n = 0; n < 256; ++n) {
+					uint32_t c = n;
+					for (int k = 0; k < 8; ++k) {
+						c = (c & 1u) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+					}
+					table[n] = c;
+				}
+				return table;
+			}();
+			auto c = aCrc ^ 0xFFFFFFFFu;
+			for (size_t i = 0; i < aSize; ++i) {
+				c = sTable[(c ^ aData[i]) & 0xFFu] ^ (c >> 8);
+			}
+			return c ^ 0xFFFFFFFFu;
+		}
+
+		inline void put_png_chunk(std::vector<uint8_t>& aOut, const char* aType, const std::vector<uint8_t>& aData)
+		{
+			put_u32_be(aOut, static_cast<uint32_t>(aData.size()));
+			const auto typeAndDataBegin = aOut.size();
+			aOut.insert(std::end(aOut), aType, aType + 4);
+			aOut.insert(std::end(aOut), std::begin(aData), std::end(aData));
+			put_u32_be(aOut, crc32(aOut.data() + typeAndDataBegin, aOut.size() - typeAndDataBegin));
+		}
+
+		inline bool write_file(const std::string& aPath, const std::vector<uint8_t>& aBytes)
+		{
+			std::ofstream file(aPath, std::ios::binary | std::ios::trunc);
+			if (!file) {
+				return false;
+			}
+			file.write(reinterpret_cast<const char*>(aBytes.data()), static_cast<std::streamsize>(aBytes.size()));
+			return static_cast<bool>(file);
+		}
+	}
+
+	// Writes 8-bit RGB pixels (row by row, top row first) into a PNG file. Returns false on failure:
+	inline bool write_png_rgb8(const std::string& aPath, uint32_t aWidth, uint32_t aHeight, const uint8_t* aPixels)
+	{
+		std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+		std::vector<uint8_t> ihdr;
+		detail::put_u32_be(ihdr, aWidth);
+		detail::put_u32_be(ihdr, aHeight);
+		ihdr.insert(std::end(ihdr), { 8 /* bit depth */, 2 /* RGB */, 0 /* deflate */, 0 /* adaptive filtering */, 0 /* no interlace */ });
+		detail::put_png_chunk(png, "IHDR", ihdr);
+
+		// Raw scanlines, each prefixed with filter type 0 (none):
+		const size_t rowSize = static_cast<size_t>(aWidth) * 3;
+		std::vector<uint8_t> raw;
+		raw.reserve((rowSize + 1) * aHeight);
+		for (uint32_t y = 0; y < aHeight; ++y) {
+			raw.push_back(0);
+			raw.insert(std::end(raw), aPixels + y * rowSize, aPixels + (y + 1) * rowSize);
+		}
+
+		// zlib stream consisting of stored deflate blocks:
+		std::vector<uint8_t> idat = { 0x78, 0x01 };
+		size_t offset = 0;
+		do {
+			const auto blockSize = std::min<size_t>(65535, raw.size() - offset);
+			const bool isLast = offset + blockSize == raw.size();
+			idat.push_back(isLast ? 1 : 0);
+			idat.push_back(static_cast<uint8_t>(blockSize));
+			idat.push_back(static_cast<uint8_t>(blockSize >> 8));
+			idat.push_back(static_cast<uint8_t>(~blockSize));
+			idat.push_back(static_cast<uint8_t>(~blockSize >> 8));
+			idat.insert(std::end(idat), std::begin(raw) + offset, std::begin(raw) + offset + blockSize);
+			offset += blockSize;
+		} while (offset < raw.size());
+		uint32_t a = 1, b = 0;
+		for (auto byte : raw) {
+			a = (a + byte) % 65521u;
+			b = (b + a) % 65521u;
+		}
+		detail::put_u32_be(idat, (b << 16) | a);
+		detail::put_png_chunk(png, "IDAT", idat);
+		detail::put_png_chunk(png, "IEND", {});
+
+		return detail::write_file(aPath, png);
+	}
+
+	// Writes linear RGB float pixels (row by row, top row first, 3 floats per pixel) into an OpenEXR file. Returns false on failure:
+	inline bool write_exr_rgb32f(const std::string& aPath, uint32_t aWidth, uint32_t aHeight, const float* aPixels)
+	{
+		std::vector<uint8_t> exr;
+		detail::put_le<uint32_t>(exr, 20000630u); // magic number
+		detail::put_le<uint32_t>(exr, 2u);        // version 2, single-part scanline file
+
+		// Header attributes. Channels must be sorted alphabetically:
+		detail::put_string(exr, "channels");
+		detail::put_string(exr, "chlist");
+		detail::put_le<uint32_t>(exr, 3u * (2u + 16u) + 1u);
+		for (const char* channel : { "B", "G", "R" }) {
+			detail::put_string(exr, channel);
+			detail::put_le<int32_t>(exr, 2);            // pixel type FLOAT
+			exr.insert(std::end(exr), { 0, 0, 0, 0 });  // pLinear + reserved
+			detail::put_le<int32_t>(exr, 1);            // x sampling
+			detail::put_le<int32_t>(exr, 1);            // y sampling
+		}
+		exr.push_back(0);
+
+		detail::put_string(exr, "compression");
+		detail::put_string(exr, "compression");
+		detail::put_le<uint32_t>(exr, 1u);
+		exr.push_back(0); // NO_COMPRESSION
+
+		for (const char* window : { "dataWindow", "displayWindow" }) {
+			detail::put_string(exr, window);
+			detail::put_string(exr, "box2i");
+			detail::put_le<uint32_t>(exr, 16u);
+			detail::put_le<int32_t>(exr, 0);
+			detail::put_le<int32_t>(exr, 0);
+			detail::put_le<int32_t>(exr, static_cast<int32_t>(aWidth) - 1);
+			detail::put_le<int32_t>(exr, static_cast<int32_t>(aHeight) - 1);
+		}
+
+		detail::put_string(exr, "lineOrder");
+		detail::put_string(exr, "lineOrder");
+		detail::put_le<uint32_t>(exr, 1u);
+		exr.push_back(0); // INCREASING_Y
+
+		detail::put_string(exr, "pixelAspectRatio");
+		detail::put_string(exr, "float");
+		detail::put_le<uint32_t>(exr, 4u);
+		detail::put_le<float>(exr, 1.0f);
+
+		detail::put_string(exr, "screenWindowCenter");
+		detail::put_string(exr, "v2f");
+		detail::put_le<uint32_t>(exr, 8u);
+		detail::put_le<float>(exr, 0.0f);
+		detail::put_le<float>(exr, 0.0f);
+
+		detail::put_string(exr, "screenWindowWidth");
+		detail::put_string(exr, "float");
+		detail::put_le<uint32_t>(exr, 4u);
+		detail::put_le<float>(exr, 1.0f);
+
+		exr.push_back(0); // end of header
+
+		// Offset table (one scanline per block), followed by the blocks:
+		const uint32_t blockDataSize = aWidth * 3u * sizeof(float);
+		const uint64_t firstBlock = exr.size() + static_cast<uint64_t>(aHeight) * sizeof(uint64_t);
+		for (uint32_t y = 0; y < aHeight; ++y) {
+			detail::put_le<uint64_t>(exr, firstBlock + static_cast<uint64_t>(y) * (8u + blockDataSize));
+		}
+		exr.reserve(exr.size() + static_cast<size_t>(aHeight) * (8u + blockDataSize));
+		for (uint32_t y = 0; y < aHeight; ++y) {
+			detail::put_le<int32_t>(exr, static_cast<int32_t>(y));
+			detail::put_le<uint32_t>(exr, blockDataSize);
+			for (int channel = 2; channel >= 0; --channel) { // B, G, R
+				for (uint32_t x = 0; x < aWidth; ++x) {
+					detail::put_le<float>(exr, aPixels[(static_cast<size_t>(y) * aWidth + x) * 3 + channel]);
+				}
+			}
+		}
+
+		return detail::write_file(aPath, exr);
+	}
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define INSTANCE_PACKING_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define INSTANCE_PACKING_SSE2 1
+#endif
+
+// Packing of TLAS instance rows. Only GLM and the Vulkan headers are required, not the framework (see
+// tlas_instance_buffer.hpp for make_packed_instance_header, which lets the framework create the header).
+
+// One row of a TLAS instance buffer, exactly as the GPU expects it:
+using packed_instance = VkAccelerationStructureInstanceKHR;
+static_assert(sizeof(packed_instance) == 64, "VkAccelerationStructureInstanceKHR is expected to occupy 64 bytes");
+
+// The last 16 bytes of a packed_instance, i.e. everything but the transformation matrix:
+// custom index, mask, SBT record offset, flags, and the BLAS reference. These are equal
+// for all instances which refer to the same BLAS with the same settings.
+struct packed_instance_header
+{
+	uint32_t mData[4];
+};
+static_assert(sizeof(packed_instance_header) == sizeof(packed_instance) - sizeof(VkTransformMatrixKHR), "The header must cover all data after the transformation matrix");
+
+// Packs one instance with the given (column-major) transformation matrix which refers to a BLAS via its device address.
+// The instance is visible to all rays (mask 0xFF) and uses the given custom index and SBT record offset:
+[[nodiscard]] inline packed_instance make_packed_instance(const glm::mat4& aTransform, uint32_t aCustomIndex, uint32_t aSbtRecordOffset, uint64_t aBlasDeviceAddress)
+{
+	packed_instance result{};
+	for (int r = 0; r < 3; ++r) {
+		for (int c = 0; c < 4; ++c) {
+			result.transform.matrix[r][c] = aTransform[c][r];
+		}
+	}
+	result.instanceCustomIndex = aCustomIndex;
+	result.mask = 0xFF;
+	result.instanceShaderBindingTableRecordOffset = aSbtRecordOffset;
+	result.flags = 0;
+	result.accelerationStructureReference = aBlasDeviceAddress;
+	return result;
+}
+
+// Scalar reference implementation of pack_sphere_instances(...):
+inline void pack_sphere_instances_scalar(const float* aX, const float* aY, const float* aZ, const float* aRadii, size_t aCount, const packed_instance_header& aHeader, packed_instance* aOut)
+{
+	for (size_t i = 0; i < aCount; ++i) {
+		auto& m = aOut[i].transform.matrix;
+		const auto r = aRadii[i];
+		m[0][0] = r;    m[0][1] = 0.0f; m[0][2] = 0.0f; m[0][3] = aX[i];
+		m[1][0] = 0.0f; m[1][1] = r;    m[1][2] = 0.0f; m[1][3] = aY[i];
+		m[2][0] = 0.0f; m[2][1] = 0.0f; m[2][2] = r;    m[2][3] = aZ[i];
+		std::memcpy(reinterpret_cast<char*>(&aOut[i]) + sizeof(VkTransformMatrixKHR), &aHeader, sizeof(aHeader));
+	}
+}
+
+// Writes one instance per sphere (translated to its center and uniformly scaled by its radius; no rotation) into aOut.
+// This produces the very same bits as matrix_from_transforms(center, identity, vec3{ radius }) would after the
+// framework's conversion, because all involved products are multiplications by exactly 1 or 0.
+// The matrices are assembled in SIMD registers and written as full 64-byte rows, four spheres at a time.
+inline void pack_sphere_instances(const float* aX, const float* aY, const float* aZ, const float* aRadii, size_t aCount, const packed_instance_header& aHeader, packed_instance* aOut)
+{
+	size_t i = 0;
+#if INSTANCE_PACKING_AVX2
+	// Each 32-byte store writes two rows of the 3x4 matrix (or the last row + the header):
+	const auto rowMask01 = _mm256_castsi256_ps(_mm256_setr_epi32(-1, 0, 0, -1,  0, -1, 0, -1));
+	const auto rowMask23 = _mm256_castsi256_ps(_mm256_setr_epi32( 0, 0, -1, -1, 0,  0, 0,  0));
+	const auto pick01 = _mm256_setr_epi32(0, 0, 0, 1,  0, 0, 0, 2);
+	const auto pick23 = _mm256_setr_epi32(0, 0, 0, 3,  0, 0, 0, 0);
+	const auto header = _mm256_castsi256_ps(_mm256_setr_epi32(0, 0, 0, 0,
+		static_cast<int>(aHeader.mData[0]), static_cast<int>(aHeader.mData[1]), static_cast<int>(aHeader.mData[2]), static_cast<int>(aHeader.mData[3])));
+	for (; i + 4 <= aCount; i += 4) {
+		// Transpose (r, x, y, z) of four spheres into one register per sphere:
+		auto r = _mm_loadu_ps(aRadii + i);
+		auto x = _mm_loadu_ps(aX + i);
+		auto y = _mm_loadu_ps(aY + i);
+		auto z = _mm_loadu_ps(aZ + i);
+		_MM_TRANSPOSE4_PS(r, x, y, z);
+		const __m128 spheres[4] = { r, x, y, z };
+		for (int k = 0; k < 4; ++k) {
+			const auto s = _mm256_castps128_ps256(spheres[k]); // Upper half is never picked
+			const auto rows01 = _mm256_and_ps(_mm256_permutevar8x32_ps(s, pick01), rowMask01);
+			const auto rows23 = _mm256_or_ps(_mm256_and_ps(_mm256_permutevar8x32_ps(s, pick23), rowMask23), header);
+			auto* dst = reinterpret_cast<float*>(aOut + i + k);
+			_mm256_storeu_ps(dst, rows01);
+			_mm256_storeu_ps(dst + 8, rows23);
+		}
+	}
+#elif INSTANCE_PACKING_SSE2
+	// Each 16-byte store writes one row of the 3x4 matrix (or the header):
+	const auto rowMask0 = _mm_castsi128_ps(_mm_setr_epi32(-1, 0, 0, -1));
+	const auto rowMask1 = _mm_castsi128_ps(_mm_setr_epi32(0, -1, 0, -1));
+	const auto rowMask2 = _mm_castsi128_ps(_mm_setr_epi32(0, 0, -1, -1));
+	const auto header = _mm_castsi128_ps(_mm_setr_epi32(
+		static_cast<int>(aHeader.mData[0]), static_cast<int>(aHeader.mData[1]), static_cast<int>(aHeader.mData[2]), static_cast<int>(aHeader.mData[3])));
+	for (; i + 4 <= aCount; i += 4) {
+		// Transpose (r, x, y, z) of four spheres into one register per sphere:
+		auto r = _mm_loadu_ps(aRadii + i);
+		auto x = _mm_loadu_ps(aX + i);
+		auto y = _mm_loadu_ps(aY + i);
+		auto z = _mm_loadu_ps(aZ + i);
+		_MM_TRANSPOSE4_PS(r, x, y, z);
+		const __m128 spheres[4] = { r, x, y, z };
+		for (int k = 0; k < 4; ++k) {
+			const auto s = spheres[k];
+			auto* dst = reinterpret_cast<float*>(aOut + i + k);
+			_mm_storeu_ps(dst,      _mm_and_ps(_mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 0, 0)), rowMask0)); // (r, 0, 0, x)
+			_mm_storeu_ps(dst + 4,  _mm_and_ps(_mm_shuffle_ps(s, s, _MM_SHUFFLE(2, 0, 0, 0)), rowMask1)); // (0, r, 0, y)
+			_mm_storeu_ps(dst + 8,  _mm_and_ps(_mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 0, 0, 0)), rowMask2)); // (0, 0, r, z)
+			_mm_storeu_ps(dst + 12, header);
+		}
+	}
+#endif
+	// Remainder (or everything, if there is no SIMD support):
+	pack_sphere_instances_scalar(aX + i, aY + i, aZ + i, aRadii + i, aCount - i, aHeader, aOut + i);
+}
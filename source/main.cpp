@@ -7,6 +7,10 @@
 #include "fluid_nightmare_main.hpp"
 #include "triangle_mesh_geometry_manager.hpp"
 #include "procedural_geometry_manager.hpp"
+#include "headless_rendering.hpp"
+#include "headless_spawning.hpp"
+#include "profiler.hpp"
+#include "gpu_profiler.hpp"
 
 fluid_nightmare_main::fluid_nightmare_main(avk::queue& aQueue)
 	: mQueue{ &aQueue }
@@ -24,13 +28,8 @@ void fluid_nightmare_main::initialize()
 	// Get a pointer to the main window:		
 	auto* mainWnd = gvk::context().main_window();
 
-	// Create an offscreen image to ray-trace into. It is accessed via an image view:
-	const auto wdth = gvk::context().main_window()->resolution().x;
-	const auto hght = gvk::context().main_window()->resolution().y;
-	const auto frmt = gvk::format_from_window_color_buffer(mainWnd);
-	auto offscreenImage = gvk::context().create_image(wdth, hght, frmt, 1, avk::memory_usage::device, avk::image_usage::general_storage_image);
-	offscreenImage->transition_to_layout();
-	mOffscreenImageView = gvk::context().create_image_view(avk::owned(offscreenImage));
+	// Create the images to ray-trace into, at the render resolution, and the image which receives the upscaled result:
+	create_render_targets(scaled_render_resolution(mainWnd->resolution(), mRenderScale), mainWnd->resolution());
 
 	// Both, triangle_mesh_geometry_manager and procedural_geometry_manager, have lower execution orders.
 	// Therefore, we can assume that they already contain the data that we require:
@@ -39,12 +38,36 @@ void fluid_nightmare_main::initialize()
 	auto* procMeshGeomMgr = gvk::current_composition()->element_by_type<procedural_geometry_manager>();
 	assert(nullptr != procMeshGeomMgr);
 
-	// Initialize the TLAS (but don't build it yet)
-	mTlas = gvk::context().create_top_level_acceleration_structure(
-		triMeshGeomMgr->max_number_of_geometry_instances() + procMeshGeomMgr->max_number_of_geometry_instances(), // <-- Specify how many geometry instances there are expected to be at most
-		true               // <-- Allow updates since we want to have the opportunity to enable/disable some of them via the UI (triangle meshes), or add new ones (procedural geometry).
+	// Register the scopes which are measured by the profiler, and prepare GPU timestamp queries for every frame in flight:
+	mFrameScope = shared_profiler().scope("frame");
+	mTlasBuildScope = shared_profiler().scope("TLAS build");
+	mTraceRaysScope = shared_profiler().scope("trace_rays");
+	mUpscaleScope = shared_profiler().scope("upscale");
+	mBlitScope = shared_profiler().scope("blit");
+	mUiScope = shared_profiler().scope("UI");
+	shared_gpu_profiler().create(mainWnd->number_of_frames_in_flight(), *mQueue);
+	mLastUpdateTime = std::chrono::steady_clock::now();
+
+	// Initialize one TLAS per frame in flight (but don't build them yet)
+	mTlasManager.create(
+		mainWnd->number_of_frames_in_flight(),
+		triMeshGeomMgr->max_number_of_geometry_instances() + procMeshGeomMgr->max_number_of_geometry_instances() // <-- Specify how many geometry instances there are expected to be at most
+	);
+	// ...and the buffers which contain their instance data. Triangle mesh instances come first, water particles are appended:
+	mTlasInstances.create(
+		mainWnd->number_of_frames_in_flight(),
+		triMeshGeomMgr->max_number_of_geometry_instances(),
+		procMeshGeomMgr->max_number_of_geometry_instances()
 	);
 
+	// The stages of update(): those of the procedural geometry, then the instance packing and the TLAS build, which wait for
+	// the water representation, and finally the spawn dispatch, which traces against the TLAS. The triangle meshes have no
+	// work per frame. All stages which record GPU work form one chain (see stage_command_buffers):
+	const auto procStages = procMeshGeomMgr->add_update_stages(mFrameStages, mStageCommandBuffers);
+	const auto packing = mFrameStages.add("instance packing", [this]() { pack_instances(); }, { procStages.mWaterRepresentation });
+	const auto tlasBuild = mFrameStages.add("TLAS build", [this]() { build_tlas(); }, { packing });
+	mFrameStages.add("spawn dispatch", [procMeshGeomMgr]() { procMeshGeomMgr->dispatch_spawn_rays(); }, { procStages.mReadback, tlasBuild });
+
 	// Create our ray tracing pipeline with the required configuration:
 	mPipeline = gvk::context().create_ray_tracing_pipeline_for(
 		// Specify all the shaders which participate in rendering in a shader binding table (the order matters):
@@ -69,32 +92,61 @@ void fluid_nightmare_main::initialize()
 		avk::descriptor_binding(0, 2, avk::as_uniform_texel_buffer_views(triMeshGeomMgr->index_buffer_views())),
 		avk::descriptor_binding(0, 3, avk::as_uniform_texel_buffer_views(triMeshGeomMgr->tex_coords_buffer_views())),
 		avk::descriptor_binding(0, 4, avk::as_uniform_texel_buffer_views(triMeshGeomMgr->normals_buffer_views())),
+		avk::descriptor_binding(0, 5, procMeshGeomMgr->fluid_surface_brick_table(0)->as_storage_buffer()), // Where the reconstructed fluid surface's normals are
+		avk::descriptor_binding(0, 6, procMeshGeomMgr->particle_boxes()->as_storage_buffer()),              // Where the spheres of chunked particles are
 		avk::descriptor_binding(1, 0, mOffscreenImageView->as_storage_image()), // Bind the offscreen image to render into as storage image
-		avk::descriptor_binding(2, 0, mTlas)                                    // Bind the TLAS, s.t. we can trace rays against it
+		avk::descriptor_binding(1, 1, mAoHistoryViews[1]->as_storage_image()),         // The previous frame's AO history...
+		avk::descriptor_binding(1, 2, mAoHistoryNormalsViews[1]->as_storage_image()),
+		avk::descriptor_binding(1, 3, mAoHistoryViews[0]->as_storage_image()),         // ...and this frame's
+		avk::descriptor_binding(1, 4, mAoHistoryNormalsViews[0]->as_storage_image()),
+		avk::descriptor_binding(2, 0, mTlasManager.tlas_for_frame(0))          // Bind the TLAS, s.t. we can trace rays against it
 	);
 
 	// Print the structure of our shader binding table, also displaying the offsets:
 	mPipeline->print_shader_binding_table_groups();
 
-#if ENABLE_SHADER_HOT_RELOADING_FOR_RAY_TRACING_PIPELINE || ENABLE_RESIZABLE_WINDOW
+	// Write the scene's resources (set 0) once per frame in flight, into sets of their own (not into sets of the descriptor
+	// cache, which are identified by their bindings). Afterwards, only the slots of the textures and groups which change are
+	// patched (see render()), s.t. the cost per frame doesn't depend on the number of meshes:
+	mSceneResourceSets.create({
+		avk::descriptor_binding(0, 0, triMeshGeomMgr->image_samplers()),
+		avk::descriptor_binding(0, 1, triMeshGeomMgr->material_buffer()),
+		avk::descriptor_binding(0, 2, avk::as_uniform_texel_buffer_views(triMeshGeomMgr->index_buffer_views())),
+		avk::descriptor_binding(0, 3, avk::as_uniform_texel_buffer_views(triMeshGeomMgr->tex_coords_buffer_views())),
+		avk::descriptor_binding(0, 4, avk::as_uniform_texel_buffer_views(triMeshGeomMgr->normals_buffer_views())),
+		avk::descriptor_binding(0, 5, procMeshGeomMgr->fluid_surface_brick_table(0)->as_storage_buffer()),
+		avk::descriptor_binding(0, 6, procMeshGeomMgr->particle_boxes()->as_storage_buffer())
+	}, static_cast<uint32_t>(mainWnd->number_of_frames_in_flight()));
+	for (size_t f = 0; f < mSceneResourceSets.size(); ++f) {
+		mSceneResourceSets.write(f, bindless_registry::cTexturesBinding, triMeshGeomMgr->image_samplers());
+		mSceneResourceSets.write(f, 1, triMeshGeomMgr->material_buffer());
+		mSceneResourceSets.write(f, bindless_registry::cIndexBuffersBinding, triMeshGeomMgr->index_buffer_views());
+		mSceneResourceSets.write(f, bindless_registry::cTexCoordsBuffersBinding, triMeshGeomMgr->tex_coords_buffer_views());
+		mSceneResourceSets.write(f, bindless_registry::cNormalsBuffersBinding, triMeshGeomMgr->normals_buffer_views());
+		mSceneResourceSets.write(f, 5, procMeshGeomMgr->fluid_surface_brick_table(static_cast<int64_t>(f)));
+		mSceneResourceSets.write(f, 6, procMeshGeomMgr->particle_boxes());
+		triMeshGeomMgr->bindless().write_changed_slots(static_cast<uint32_t>(f), mSceneResourceSets[f]); // Nothing has changed since
+	}
+
+	// Create the compute pipeline which upscales the ray traced image to the window's resolution:
+	mUpscalePipeline = gvk::context().create_compute_pipeline_for(
+		"shaders/upscale.comp",
+		avk::push_constant_binding_data{ avk::shader_type::compute, 0, sizeof(push_const_data_upscaling) },
+		avk::descriptor_binding(0, 0, mOffscreenImageView->as_storage_image()),
+		avk::descriptor_binding(0, 1, mUpscaledImageView->as_storage_image())
+	);
+
+	// The render targets follow the window's resolution (see render()), hence, there's nothing to update on resize:
+#if ENABLE_SHADER_HOT_RELOADING_FOR_RAY_TRACING_PIPELINE
 	// Create an updater:
 	mUpdater.emplace();
 	mPipeline.enable_shared_ownership(); // The updater needs to hold a reference to it, so we need to enable shared ownership.
+	mUpscalePipeline.enable_shared_ownership();
 
-#if ENABLE_SHADER_HOT_RELOADING_FOR_RAY_TRACING_PIPELINE
 	mUpdater->on(gvk::shader_files_changed_event(mPipeline))
 	            .update(mPipeline);
-#endif
-	
-#if ENABLE_RESIZABLE_WINDOW
-	mOffscreenImageView.enable_shared_ownership(); // The updater needs to hold a reference to it, so we need to enable shared ownership.
-	mUpdater->on(gvk::swapchain_resized_event(gvk::context().main_window()))
-		        .update(mOffscreenImageView, mPipeline)
-		     .then_on(gvk::destroying_image_view_event()) // Make sure that our descriptor cache stays cleaned up:
-		        .invoke([this](const avk::image_view& aImageViewToBeDestroyed) {
-					auto numRemoved = mDescriptorCache.remove_sets_with_handle(aImageViewToBeDestroyed->handle());
-			    });
-#endif
+	mUpdater->on(gvk::shader_files_changed_event(mUpscalePipeline))
+	            .update(mUpscalePipeline);
 #endif
 	
 	// Add the camera to the composition (and let it handle the updates)
@@ -106,6 +158,7 @@ void fluid_nightmare_main::initialize()
 	auto imguiManager = gvk::current_composition()->element_by_type<gvk::imgui_manager>();
 	if (nullptr != imguiManager) {
 		imguiManager->add_callback([this]() {
+			cpu_scope uiScope(shared_profiler(), mUiScope); // Only the CPU side, the imgui_manager records its own commands
 			ImGui::Begin("Info & Settings");
 			ImGui::SetWindowPos(ImVec2(3.0f, 3.0f), ImGuiCond_FirstUseEver);
 			ImGui::SetWindowSize(ImVec2(410.0f, 468.0f), ImGuiCond_FirstUseEver);
@@ -113,12 +166,52 @@ void fluid_nightmare_main::initialize()
 			ImGui::Text("%.3f ms/frame", 1000.0f / ImGui::GetIO().Framerate);
 			ImGui::Text("%.1f FPS", ImGui::GetIO().Framerate);
 
-			static std::vector<float> values;
-			values.push_back(1000.0f / ImGui::GetIO().Framerate);
-			if (values.size() > 1000) {
-				values.erase(values.begin());
+			const auto& frameTimes = shared_profiler().history(mFrameScope, profiler::source::cpu);
+			ImGui::PlotLines("ms/frame", frameTimes.data(), static_cast<int>(frameTimes.size()), static_cast<int>(frameTimes.offset()), nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 100.0f));
+
+			if (ImGui::CollapsingHeader("Profiler")) {
+				ImGui::Text("%-20s %-4s %8s %8s %8s", "scope", "", "min ms", "avg ms", "p99 ms");
+				for (profiler::scope_id i = 0; i < shared_profiler().number_of_scopes(); ++i) {
+					for (auto src : { profiler::source::cpu, profiler::source::gpu }) {
+						const auto stats = shared_profiler().statistics(i, src);
+						if (stats.mNumSamples > 0) {
+							ImGui::Text("%-20s %-4s %8.3f %8.3f %8.3f", shared_profiler().name(i).c_str(), profiler::source::cpu == src ? "CPU" : "GPU", stats.mMin, stats.mAvg, stats.mP99);
+						}
+					}
+				}
+				if (!shared_gpu_profiler().is_available()) {
+					ImGui::TextColored(ImVec4(.8f, .6f, 0.f, 1.f), "GPU timestamps are not supported by the queue.");
+				}
+				if (ImGui::Button("Export CSV")) {
+					mProfileExportStatus = shared_profiler().write("profile.csv") ? "Wrote profile.csv" : "Couldn't write profile.csv";
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("Export JSON")) {
+					mProfileExportStatus = shared_profiler().write("profile.json") ? "Wrote profile.json" : "Couldn't write profile.json";
+				}
+				if (!mProfileExportStatus.empty()) {
+					ImGui::SameLine();
+					ImGui::Text("%s", mProfileExportStatus.c_str());
+				}
+			}
+
+			const auto& tlasStats = mTlasManager.last_frame_stats();
+			ImGui::Text("TLAS: %u build(s) in %.3f ms, %u refit(s) in %.3f ms", tlasStats.mNumBuilds, tlasStats.mBuildTimeMs, tlasStats.mNumRefits, tlasStats.mRefitTimeMs);
+			ImGui::Text("      %.3f ms waited for the previous frame in flight", tlasStats.mReadsWaitMs);
+			ImGui::Text("      %u instances, %llu builds and %llu refits in total", tlasStats.mNumInstances,
+				static_cast<unsigned long long>(mTlasManager.total_number_of_builds()), static_cast<unsigned long long>(mTlasManager.total_number_of_refits()));
+			ImGui::Text("      %.1f KiB of instance data uploaded", static_cast<float>(tlasStats.mUploadedBytes) / 1024.0f);
+			int maxRefits = static_cast<int>(mTlasManager.max_refits_before_rebuild());
+			if (ImGui::SliderInt("Max. TLAS Refits", &maxRefits, 0, 256)) {
+				mTlasManager.set_max_refits_before_rebuild(static_cast<uint32_t>(maxRefits));
+			}
+
+			if (ImGui::CollapsingHeader("Stages of the Frame")) {
+				ImGui::Checkbox("Run Independent Stages Concurrently", &mRunStagesConcurrently);
+				const auto& stats = mFrameStages.stats();
+				ImGui::Text("Critical path %.2f ms, wall %.2f ms, work %.2f ms (%zu threads)", stats.mCriticalPathMs, stats.mWallMs, stats.mWorkMs, stats.mNumThreads);
+				draw_stage_timeline();
 			}
-			ImGui::PlotLines("ms/frame", values.data(), values.size(), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 100.0f));
 
 			ImGui::TextColored(ImVec4(0.f, .6f, .8f, 1.f), "[F1]: Toggle input-mode");
 			ImGui::TextColored(ImVec4(0.f, .6f, .8f, 1.f), " (UI vs. scene navigation)");
@@ -133,6 +226,26 @@ void fluid_nightmare_main::initialize()
 			// Let the user change the field of view, and evaluate in the ray generation shader:
 			ImGui::DragFloat("Field of View", &mFieldOfViewForRayTracing, 1, 10.0f, 160.0f);
 
+			ImGui::Separator();
+			// Let the user trade image quality for performance by ray tracing fewer pixels, which are upscaled afterwards:
+			if (ImGui::Checkbox("Dynamic Render Scale", &mDynamicRenderScale) && mDynamicRenderScale) {
+				mDynamicRenderScaleController.reset(mRenderScale);
+			}
+			if (mDynamicRenderScale) {
+				float budget = mDynamicRenderScaleController.budget_ms();
+				if (ImGui::SliderFloat("Ray Tracing Budget [ms]", &budget, 1.0f, 33.0f)) {
+					mDynamicRenderScaleController.set_budget_ms(budget);
+				}
+				ImGui::Text("Render Scale: %.2f", mRenderScale);
+			}
+			else {
+				ImGui::SliderFloat("Render Scale", &mRenderScale, mDynamicRenderScaleController.min_scale(), mDynamicRenderScaleController.max_scale());
+				// Only whole steps, s.t. dragging the slider doesn't recreate the render targets in every frame:
+				mRenderScale = std::round(mRenderScale / dynamic_render_scale::cScaleStep) * dynamic_render_scale::cScaleStep;
+			}
+			ImGui::Text("Render Resolution: %u x %u", mRenderResolution.x, mRenderResolution.y);
+			ImGui::SliderFloat("Upscaler Edge Sharpness", &mUpscalerEdgeSharpness, 0.0f, 32.0f);
+
 			ImGui::Separator();
 			// Let the user change shadow parameters:
 			ImGui::Checkbox("Enable Shadows", &mEnableShadows);
@@ -149,6 +262,22 @@ void fluid_nightmare_main::initialize()
 				ImGui::DragFloat("AO Rays Max. Length", &mAmbientOcclusionMaxDist, 0.01f,  0.001f,    1000.0f);
 				ImGui::SliderFloat("AO Intensity", &mAmbientOcclusionFactor, 0.0f, 1.0f);
 				ImGui::ColorEdit3("AO Color", glm::value_ptr(mAmbientOcclusionColor));
+				// Trace only a few randomized rays per frame, and accumulate them over time:
+				if (ImGui::Checkbox("Temporal AO", &mEnableTemporalAccumulation) && mEnableTemporalAccumulation) {
+					mHistoryValid = false;
+				}
+				if (mEnableTemporalAccumulation) {
+					int baseRays = static_cast<int>(mTemporalParams.mBaseRays);
+					int extraRays = static_cast<int>(mTemporalParams.mExtraRays);
+					ImGui::SliderInt("AO Rays per Frame", &baseRays, 1, 2);
+					ImGui::SliderInt("AO Extra Rays (noisy)", &extraRays, 0, 4);
+					mTemporalParams.mBaseRays = static_cast<uint32_t>(baseRays);
+					mTemporalParams.mExtraRays = static_cast<uint32_t>(extraRays);
+					ImGui::SliderFloat("AO Max. History", &mTemporalParams.mMaxHistoryLength, 1.0f, 128.0f);
+					ImGui::SliderFloat("AO Variance Threshold", &mTemporalParams.mVarianceThreshold, 0.0f, 0.5f);
+					ImGui::SliderFloat("AO Depth Tolerance", &mTemporalParams.mDepthTolerance, 0.001f, 0.5f);
+					ImGui::SliderFloat("AO Normal Tolerance", &mTemporalParams.mNormalTolerance, 0.0f, 1.0f);
+				}
 			}
 
 			ImGui::End();
@@ -158,54 +287,32 @@ void fluid_nightmare_main::initialize()
 
 void fluid_nightmare_main::update()
 {
-	auto* triMeshGeomMgr = gvk::current_composition()->element_by_type<triangle_mesh_geometry_manager>();
-	assert(nullptr != triMeshGeomMgr);
-	auto* procMeshGeomMgr = gvk::current_composition()->element_by_type<procedural_geometry_manager>();
-	assert(nullptr != procMeshGeomMgr);
-	if (triMeshGeomMgr->has_updated_geometry_for_tlas() || procMeshGeomMgr->has_updated_geometry_for_tlas())
-	{
-		// Getometry selection has changed => rebuild the TLAS:
-
-		std::vector<avk::geometry_instance> activeGeometryInstances = triMeshGeomMgr->get_active_geometry_instances_for_tlas_build();
-		// And add all the water particles to it:
-		activeGeometryInstances.insert(std::end(activeGeometryInstances), std::begin(procMeshGeomMgr->get_geometry_instances_buffer()), std::end(procMeshGeomMgr->get_geometry_instances_buffer()));
-		
-		if (!activeGeometryInstances.empty()) {
-			auto& commandPool = gvk::context().get_command_pool_for_single_use_command_buffers(*mQueue);
-			auto cmdbfr = commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
-			cmdbfr->begin_recording();
-
-			// We're using only one TLAS for all frames in flight. Therefore, we need to set up a barrier
-			// affecting the whole queue which waits until all previous ray tracing work has completed:
-			cmdbfr->establish_execution_barrier(
-				avk::pipeline_stage::ray_tracing_shaders, /* -> */ avk::pipeline_stage::acceleration_structure_build
-			);
-
-			// ...then we can safely update the TLAS with new data:
-			mTlas->build(                // We're not updating existing geometry, but we are changing the geometry => therefore, we need to perform a full rebuild (not just an update-build).
-				activeGeometryInstances, // Build only with all the active geometry instances, be it a reference to a triangle mesh, or an AABB => just everything mixed
-				{},                      // Let the scratch buffer be created internally
-				avk::sync::with_barriers_into_existing_command_buffer(*cmdbfr, {}, {})
-			);
-
-			// ...and we need to ensure that the TLAS update-build has completed (also in terms of memory
-			// access--not only execution) before we may continue ray tracing with that TLAS:
-			cmdbfr->establish_global_memory_barrier(
-				avk::pipeline_stage::acceleration_structure_build,       /* -> */ avk::pipeline_stage::ray_tracing_shaders,
-				avk::memory_access::acceleration_structure_write_access, /* -> */ avk::memory_access::acceleration_structure_read_access
-			);
-
-			cmdbfr->end_recording();
-			mQueue->submit(avk::referenced(cmdbfr));
-			gvk::context().main_window()->handle_lifetime(avk::owned(cmdbfr));
+	mTlasManager.begin_frame();
+
+	// The previous frame ends here. Turn everything which has been measured during it into samples:
+	const auto now = std::chrono::steady_clock::now();
+	shared_profiler().add_time(mFrameScope, profiler::source::cpu, now - mLastUpdateTime);
+	shared_profiler().end_frame();
+	mLastUpdateTime = now;
+
+	// Adapt the render scale to the GPU time of ray tracing (it takes effect in render()):
+	if (mDynamicRenderScale) {
+		const auto& gpuTraceTimes = shared_profiler().history(mTraceRaysScope, profiler::source::gpu);
+		if (gpuTraceTimes.size() > 0) {
+			mRenderScale = mDynamicRenderScaleController.update(gpuTraceTimes.last());
 		}
+	}
 
-		gvk::context().device().waitIdle();
-
-		triMeshGeomMgr->reset_update_required_flag(); // We have re-built the TLAS with triangle_mesh_geometry_manager's most up to date data => safe to reset its flag.
-		procMeshGeomMgr->reset_update_required_flag(); // We have re-built the TLAS with procedural_geometry_manager's most up to date data => safe to reset its flag.
-		mTlasUpdateRequired = false;
+	// Run the stages of the frame (see initialize()), the independent ones concurrently if enabled. Their command buffers
+	// are allocated before and released after, here on the main thread:
+	mStageCommandBuffers.allocate(*mQueue, procedural_geometry_manager::cNumStageCommandBuffers + 1);
+	if (mRunStagesConcurrently) {
+		mFrameStages.run(mStageExecutor);
+	}
+	else {
+		mFrameStages.run_sequentially();
 	}
+	mStageCommandBuffers.release();
 
 	if (gvk::input().key_pressed(gvk::key_code::space)) {
 		// Print the current camera position
@@ -234,31 +341,68 @@ void fluid_nightmare_main::render()
 	auto mainWnd = gvk::context().main_window();
 	auto inFlightIndex = mainWnd->in_flight_index_for_frame();
 
+	// Follow the window's resolution and the render scale:
+	const auto outputResolution = mainWnd->resolution();
+	const auto renderResolution = scaled_render_resolution(outputResolution, mRenderScale);
+	if (renderResolution != mRenderResolution || outputResolution != mOutputResolution) {
+		create_render_targets(renderResolution, outputResolution);
+	}
+	const auto upscale = mRenderResolution != mOutputResolution;
+
 	auto& commandPool = gvk::context().get_command_pool_for_single_use_command_buffers(*mQueue);
 	auto cmdbfr = commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
 	cmdbfr->begin_recording();
 
-	// The triangle_mesh_geometry_manager has some of the data we require:
+	// The triangle_mesh_geometry_manager keeps track of the slots in the scene's resources:
 	auto* triMeshGeomMgr = gvk::current_composition()->element_by_type<triangle_mesh_geometry_manager>();
 
-	cmdbfr->bind_pipeline(avk::const_referenced(mPipeline));
-	cmdbfr->bind_descriptors(mPipeline->layout(), mDescriptorCache.get_or_create_descriptor_sets({
-		avk::descriptor_binding(0, 0, triMeshGeomMgr->image_samplers()),
-		avk::descriptor_binding(0, 1, triMeshGeomMgr->material_buffer()),
-		avk::descriptor_binding(0, 2, avk::as_uniform_texel_buffer_views(triMeshGeomMgr->index_buffer_views())),
-		avk::descriptor_binding(0, 3, avk::as_uniform_texel_buffer_views(triMeshGeomMgr->tex_coords_buffer_views())),
-		avk::descriptor_binding(0, 4, avk::as_uniform_texel_buffer_views(triMeshGeomMgr->normals_buffer_views())),
+	// The AO history which the previous frame has written is read in this frame, and vice versa:
+	const auto historyWriteIndex = mFrameIndex % 2;
+	const auto historyReadIndex = 1 - historyWriteIndex;
+	// The history is unusable after the render targets have been recreated and when temporal accumulation has been switched off:
+	uint32_t temporalFlags = 0;
+	if (mEnableTemporalAccumulation) {
+		temporalFlags |= temporal_accumulation::cFlagEnabled;
+		if (!mHistoryValid) {
+			temporalFlags |= temporal_accumulation::cFlagResetHistory;
+		}
+		mHistoryValid = true;
+	}
+	else {
+		mHistoryValid = false;
+	}
+
+	// The previous frame's history must have been written before it is read, and the previous frame's
+	// images must have been read (by ray tracing, upscaling, or the blit) before they are overwritten:
+	cmdbfr->establish_global_memory_barrier(
+		avk::pipeline_stage::all_commands, avk::pipeline_stage::ray_tracing_shaders,
+		avk::memory_access::shader_buffers_and_images_write_access, avk::memory_access::shader_buffers_and_images_read_access
+	);
+
+	// This frame's set of the scene's resources is not in use anymore => patch the slots which have changed since it has been used last.
+	// Only the few render targets and the TLAS are looked up in the descriptor cache:
+	triMeshGeomMgr->bindless().write_changed_slots(static_cast<uint32_t>(inFlightIndex), mSceneResourceSets[static_cast<size_t>(inFlightIndex)]);
+	auto descriptorSets = mDescriptorCache.get_or_create_descriptor_sets({
 		avk::descriptor_binding(1, 0, mOffscreenImageView->as_storage_image()),
-		avk::descriptor_binding(2, 0, mTlas)
-		}));
+		avk::descriptor_binding(1, 1, mAoHistoryViews[historyReadIndex]->as_storage_image()),
+		avk::descriptor_binding(1, 2, mAoHistoryNormalsViews[historyReadIndex]->as_storage_image()),
+		avk::descriptor_binding(1, 3, mAoHistoryViews[historyWriteIndex]->as_storage_image()),
+		avk::descriptor_binding(1, 4, mAoHistoryNormalsViews[historyWriteIndex]->as_storage_image()),
+		avk::descriptor_binding(2, 0, mTlasManager.tlas_for_frame(inFlightIndex))
+		});
+
+	cmdbfr->bind_pipeline(avk::const_referenced(mPipeline));
+	mSceneResourceSets.bind(*cmdbfr, vk::PipelineBindPoint::eRayTracingKHR, mPipeline->layout_handle(), static_cast<size_t>(inFlightIndex));
+	cmdbfr->bind_descriptors(mPipeline->layout(), std::move(descriptorSets));
 
 	// Set the push constants:
+	const auto cameraTransform = mQuakeCam.global_transformation_matrix();
 	auto pushConstantsForThisDrawCall = push_const_data_scene_rendering{
 		glm::vec4{mAmbientLight, 0.0f},
 		glm::vec4{mLightDir, 0.0f},
-		mQuakeCam.global_transformation_matrix(),
+		cameraTransform,
 		glm::radians(mFieldOfViewForRayTracing) * 0.5f,
-		0.0f, // padding
+		temporalFlags,
 		mEnableShadows ? vk::Bool32{VK_TRUE} : vk::Bool32{VK_FALSE},
 		mShadowsFactor,
 		glm::vec4{ mShadowsColor, 1.0f },
@@ -266,30 +410,77 @@ void fluid_nightmare_main::render()
 		mAmbientOcclusionMinDist,
 		mAmbientOcclusionMaxDist,
 		mAmbientOcclusionFactor,
-		glm::vec4{ mAmbientOcclusionColor, 1.0f }
+		glm::vec4{ mAmbientOcclusionColor, 1.0f },
+		mPrevWorldToCamera,
+		mFrameIndex,
+		mTemporalParams.mBaseRays,
+		mTemporalParams.mExtraRays,
+		mTemporalParams.mMaxHistoryLength,
+		mTemporalParams.mVarianceThreshold,
+		mTemporalParams.mDepthTolerance,
+		mTemporalParams.mNormalTolerance,
+		0.0f // padding
 	};
+	mPrevWorldToCamera = glm::inverse(cameraTransform);
+	++mFrameIndex;
 	cmdbfr->handle().pushConstants(mPipeline->layout_handle(), vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR, 0, sizeof(pushConstantsForThisDrawCall), &pushConstantsForThisDrawCall);
 
 	// Do it:
-	cmdbfr->trace_rays(
-		gvk::for_each_pixel(mainWnd),
-		mPipeline->shader_binding_table(),
-		avk::using_raygen_group_at_index(0),
-		avk::using_miss_group_at_index(0),
-		avk::using_hit_group_at_index(0)
-	);
+	{
+		cpu_scope traceCpuScope(shared_profiler(), mTraceRaysScope);
+		gpu_scope traceGpuScope(shared_gpu_profiler(), *cmdbfr, mTraceRaysScope);
+		cmdbfr->trace_rays(
+			vk::Extent3D{ mRenderResolution.x, mRenderResolution.y, 1u },
+			mPipeline->shader_binding_table(),
+			avk::using_raygen_group_at_index(0),
+			avk::using_miss_group_at_index(0),
+			avk::using_hit_group_at_index(0)
+		);
+	}
 
-	// Sync ray tracing with transfer:
-	cmdbfr->establish_global_memory_barrier(
-		avk::pipeline_stage::ray_tracing_shaders, avk::pipeline_stage::transfer,
-		avk::memory_access::shader_buffers_and_images_write_access, avk::memory_access::transfer_read_access
-	);
+	if (upscale) {
+		// Sync ray tracing with the upscaling compute shader:
+		cmdbfr->establish_global_memory_barrier(
+			avk::pipeline_stage::ray_tracing_shaders, avk::pipeline_stage::compute_shader,
+			avk::memory_access::shader_buffers_and_images_write_access, avk::memory_access::shader_buffers_and_images_read_access
+		);
+
+		{
+			cpu_scope upscaleCpuScope(shared_profiler(), mUpscaleScope);
+			gpu_scope upscaleGpuScope(shared_gpu_profiler(), *cmdbfr, mUpscaleScope);
+			cmdbfr->bind_pipeline(avk::const_referenced(mUpscalePipeline));
+			cmdbfr->bind_descriptors(mUpscalePipeline->layout(), mDescriptorCache.get_or_create_descriptor_sets({
+				avk::descriptor_binding(0, 0, mOffscreenImageView->as_storage_image()),
+				avk::descriptor_binding(0, 1, mUpscaledImageView->as_storage_image())
+				}));
+			const auto upscalePushConstants = push_const_data_upscaling{ mUpscalerEdgeSharpness };
+			cmdbfr->handle().pushConstants(mUpscalePipeline->layout_handle(), vk::ShaderStageFlagBits::eCompute, 0, sizeof(upscalePushConstants), &upscalePushConstants);
+			cmdbfr->handle().dispatch((mOutputResolution.x + 15u) / 16u, (mOutputResolution.y + 15u) / 16u, 1u);
+		}
 
-	avk::copy_image_to_another(
-		mOffscreenImageView->get_image(),
-		mainWnd->current_backbuffer()->image_at(0),
-		avk::sync::with_barriers_into_existing_command_buffer(*cmdbfr, {}, {})
-	);
+		// Sync the upscaling compute shader with transfer:
+		cmdbfr->establish_global_memory_barrier(
+			avk::pipeline_stage::compute_shader, avk::pipeline_stage::transfer,
+			avk::memory_access::shader_buffers_and_images_write_access, avk::memory_access::transfer_read_access
+		);
+	}
+	else {
+		// Sync ray tracing with transfer:
+		cmdbfr->establish_global_memory_barrier(
+			avk::pipeline_stage::ray_tracing_shaders, avk::pipeline_stage::transfer,
+			avk::memory_access::shader_buffers_and_images_write_access, avk::memory_access::transfer_read_access
+		);
+	}
+
+	{
+		cpu_scope blitCpuScope(shared_profiler(), mBlitScope);
+		gpu_scope blitGpuScope(shared_gpu_profiler(), *cmdbfr, mBlitScope);
+		avk::copy_image_to_another(
+			(upscale ? mUpscaledImageView : mOffscreenImageView)->get_image(),
+			mainWnd->current_backbuffer()->image_at(0),
+			avk::sync::with_barriers_into_existing_command_buffer(*cmdbfr, {}, {})
+		);
+	}
 
 	// Make sure to properly sync with ImGui manager which comes afterwards (it uses a graphics pipeline):
 	cmdbfr->establish_global_memory_barrier(
@@ -306,20 +497,148 @@ void fluid_nightmare_main::render()
 	// Submit the draw call and take care of the command buffer's lifetime:
 	mQueue->submit(cmdbfr, imageAvailableSemaphore);
 	mainWnd->handle_lifetime(avk::owned(cmdbfr));
+
+	// This frame's spawn rays and ray tracing have been submitted, i.e. all reads of this frame's TLAS:
+	mTlasManager.end_reads(inFlightIndex, *mQueue);
+}
+
+void fluid_nightmare_main::pack_instances()
+{
+	auto* triMeshGeomMgr = gvk::current_composition()->element_by_type<triangle_mesh_geometry_manager>();
+	assert(nullptr != triMeshGeomMgr);
+	auto* procMeshGeomMgr = gvk::current_composition()->element_by_type<procedural_geometry_manager>();
+	assert(nullptr != procMeshGeomMgr);
+
+	// Find out what has changed. A refit is sufficient if only transformations have changed:
+	const auto updateType = combine(triMeshGeomMgr->required_tlas_update(), procMeshGeomMgr->required_tlas_update());
+	if (tlas_update_type::none == updateType) {
+		return;
+	}
+	// Write only the instances which have changed into the persistent instance rows:
+	if (tlas_update_type::none != triMeshGeomMgr->required_tlas_update()) {
+		triMeshGeomMgr->write_geometry_instances_for_tlas_build(mTlasInstances);
+	}
+	if (tlas_update_type::none != procMeshGeomMgr->required_tlas_update()) {
+		procMeshGeomMgr->write_geometry_instances_for_tlas_build(mTlasInstances);
+	}
+	mTlasManager.request_update(updateType);
+	triMeshGeomMgr->reset_update_required_flag(); // The TLAS manager knows about the change of triangle_mesh_geometry_manager's data => safe to reset its flag.
+	procMeshGeomMgr->reset_update_required_flag(); // The TLAS manager knows about the change of procedural_geometry_manager's data => safe to reset its flag.
+}
+
+void fluid_nightmare_main::build_tlas()
+{
+	// Bring the TLAS of this frame in flight up to date (it might also be outdated due to changes during the previous frames):
+	const auto inFlightIndex = gvk::context().main_window()->in_flight_index_for_frame();
+	if (!mTlasManager.needs_update(inFlightIndex) || 0 == mTlasInstances.size()) {
+		return;
+	}
+	cpu_scope tlasScope(shared_profiler(), mTlasBuildScope);
+	auto& cmdbfr = mStageCommandBuffers.acquire();
+	cmdbfr->begin_recording();
+	{
+		gpu_scope tlasGpuScope(shared_gpu_profiler(), *cmdbfr, mTlasBuildScope);
+		mTlasManager.update(inFlightIndex, mTlasInstances, *cmdbfr);
+	}
+	cmdbfr->end_recording();
+	mQueue->submit(avk::referenced(cmdbfr));
+	// No need to wait for the device to become idle: This frame's commands are submitted to the same queue after
+	// the TLAS build commands, and the build has only waited for the frame which has read this TLAS before.
 }
 
-[[nodiscard]] const avk::top_level_acceleration_structure& fluid_nightmare_main::get_tlas() const
+void fluid_nightmare_main::draw_stage_timeline()
 {
-	return mTlas;
+	constexpr float cLaneHeight = 14.0f;
+	const auto& stats = mFrameStages.stats();
+	const auto& timeline = mFrameStages.timeline();
+	const auto origin = ImGui::GetCursorScreenPos();
+	const float width = std::max(ImGui::GetContentRegionAvail().x, 1.0f);
+	const float height = cLaneHeight * static_cast<float>(std::max<size_t>(stats.mNumThreads, 1));
+	const float msToPixels = width / static_cast<float>(std::max(stats.mWallMs, 0.001));
+	auto* drawList = ImGui::GetWindowDrawList();
+	drawList->AddRectFilled(origin, ImVec2{ origin.x + width, origin.y + height }, IM_COL32(40, 40, 40, 255));
+	const auto mouse = ImGui::GetIO().MousePos;
+	for (task_graph::task_id t = 0; t < timeline.size(); ++t) {
+		const auto& e = timeline[t];
+		const ImVec2 min{ origin.x + static_cast<float>(e.mStartMs) * msToPixels, origin.y + cLaneHeight * static_cast<float>(e.mThread) + 1.0f };
+		const ImVec2 max{ std::max(origin.x + static_cast<float>(e.mEndMs) * msToPixels, min.x + 1.0f), min.y + cLaneHeight - 2.0f };
+		drawList->AddRectFilled(min, max, e.mOnCriticalPath ? IM_COL32(230, 120, 40, 255) : IM_COL32(70, 130, 200, 255));
+		if (mouse.x >= min.x && mouse.x < max.x && mouse.y >= min.y && mouse.y < max.y && ImGui::IsWindowHovered()) {
+			ImGui::SetTooltip("%s: %.3f ms%s", mFrameStages.name(t).c_str(), e.mEndMs - e.mStartMs, e.mOnCriticalPath ? " (critical path)" : "");
+		}
+	}
+	ImGui::Dummy(ImVec2{ width, height });
 }
 
-int main() // <== Starting point ==
+void fluid_nightmare_main::create_render_targets(const glm::uvec2& aRenderResolution, const glm::uvec2& aOutputResolution)
 {
+	auto* mainWnd = gvk::context().main_window();
+
+	// Frames in flight might still use the current images => let the window keep them alive long enough:
+	if (mOutputResolution != glm::uvec2{ 0u, 0u }) {
+		for (auto* view : { &mOffscreenImageView, &mUpscaledImageView, &mAoHistoryViews[0], &mAoHistoryViews[1], &mAoHistoryNormalsViews[0], &mAoHistoryNormalsViews[1] }) {
+			mDescriptorCache.remove_sets_with_handle((*view)->handle());
+			mainWnd->handle_lifetime(avk::owned(*view));
+		}
+	}
+
+	const auto create_storage_image_view = [](const glm::uvec2& aResolution, vk::Format aFormat) {
+		auto image = gvk::context().create_image(aResolution.x, aResolution.y, aFormat, 1, avk::memory_usage::device, avk::image_usage::general_storage_image);
+		image->transition_to_layout();
+		return gvk::context().create_image_view(avk::owned(image));
+	};
+
+	// The offscreen image to ray-trace into. It is accessed via an image view:
+	const auto frmt = gvk::format_from_window_color_buffer(mainWnd);
+	mOffscreenImageView = create_storage_image_view(aRenderResolution, frmt);
+	mUpscaledImageView = create_storage_image_view(aOutputResolution, frmt);
+
+	// The images which hold the ambient occlusion history, for temporal accumulation:
+	for (size_t i = 0; i < 2; ++i) {
+		mAoHistoryViews[i] = create_storage_image_view(aRenderResolution, vk::Format::eR32G32B32A32Sfloat);
+		mAoHistoryNormalsViews[i] = create_storage_image_view(aRenderResolution, vk::Format::eR16G16B16A16Sfloat);
+	}
+	mHistoryValid = false;
+
+	mRenderResolution = aRenderResolution;
+	mOutputResolution = aOutputResolution;
+}
+
+void fluid_nightmare_main::finalize()
+{
+	// The profiler outlives the device => release its query pools now:
+	shared_gpu_profiler().destroy();
+}
+
+[[nodiscard]] const avk::top_level_acceleration_structure& fluid_nightmare_main::get_tlas(int64_t aInFlightIndex) const
+{
+	return mTlasManager.tlas_for_frame(aInFlightIndex);
+}
+
+[[nodiscard]] glm::vec3 fluid_nightmare_main::camera_position() const
+{
+	return mQuakeCam.translation();
+}
+
+int main(int argc, char* argv[]) // <== Starting point ==
+{
+	// Render a reference image on the CPU, without opening a window, if requested:
+	if (find_headless_rendering_switch(argc, argv) >= 0) {
+		return run_headless_rendering(argc, argv);
+	}
+	// Pre-fill the scene with particles on the CPU and save them as a snapshot, without opening a window, if requested:
+	if (find_headless_spawning_switch(argc, argv) >= 0) {
+		return run_headless_spawning(argc, argv);
+	}
+
+	// Write the profiler's statistics into this file when the render loop has ended (if given):
+	const auto profileOutputPath = find_profile_output_path(argc, argv);
+
 	try {
 		// Create a window and open it:
 		auto mainWnd = gvk::context().create_window("Fluid Nightmare - Main Window");
 		mainWnd->set_resolution({ 1920, 1080 });
-		mainWnd->enable_resizing(true);
+		mainWnd->enable_resizing(ENABLE_RESIZABLE_WINDOW != 0);
 		mainWnd->set_presentaton_mode(gvk::presentation_mode::mailbox);
 		mainWnd->set_number_of_concurrent_frames(3u);
 		mainWnd->open();
@@ -333,7 +652,7 @@ int main() // <== Starting point ==
 		// Create an instance of our main invokee:
 		auto mainInvokee = fluid_nightmare_main(singleQueue);
 		// Create an instance of the invokee that handles our triangle mesh geometry:
-		auto triMeshGeomMgrInvokee = triangle_mesh_geometry_manager();
+		auto triMeshGeomMgrInvokee = triangle_mesh_geometry_manager(singleQueue);
 		// Create an instance of the invokee that handles our procedural geometry (the water particles):
 		auto procGeomMgrInvokee = procedural_geometry_manager(singleQueue);
 		// Create another element for drawing the UI with ImGui
@@ -350,9 +669,15 @@ int main() // <== Starting point ==
 				.add_extension(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME)
 				.add_extension(VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME)
 				.add_extension(VK_KHR_GET_MEMORY_REQUIREMENTS_2_EXTENSION_NAME),
+			[](vk::PhysicalDeviceFeatures& aPhysicalDeviceFeatures) {
+				// The texture cache stores block-compressed textures:
+				aPhysicalDeviceFeatures.setTextureCompressionBC(VK_TRUE);
+			},
 			[](vk::PhysicalDeviceVulkan12Features& aVulkan12Featues) {
 				// Also this Vulkan 1.2 feature is required for ray tracing:
 				aVulkan12Featues.setBufferDeviceAddress(VK_TRUE);
+				// The GPU profiler resets its timestamp queries from the host:
+				aVulkan12Featues.setHostQueryReset(VK_TRUE);
 			},
 			[](vk::PhysicalDeviceRayTracingPipelineFeaturesKHR& aRayTracingFeatures) {
 				// Enabling the extensions is not enough, we need to activate ray tracing features explicitly here:
@@ -367,6 +692,15 @@ int main() // <== Starting point ==
 			// Pass the invokees that shall be invoked every frame:
 			mainInvokee, triMeshGeomMgrInvokee, procGeomMgrInvokee, imguiManagerInvokee
 			);
+
+		if (!profileOutputPath.empty()) {
+			if (shared_profiler().write(profileOutputPath)) {
+				LOG_INFO("Wrote the profile to '" + profileOutputPath + "'");
+			}
+			else {
+				LOG_ERROR("Couldn't write the profile to '" + profileOutputPath + "'");
+			}
+		}
 	}
 	catch (gvk::logic_error& e)    { LOG_ERROR(std::string("Caught gvk::logic_error in main(): ")   + e.what()); }
 	catch (gvk::runtime_error& e)  { LOG_ERROR(std::string("Caught gvk::runtime_error in main(): ") + e.what()); }
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A file which is mapped into memory read-only. Its contents are paged in by the operating system
+// on first access, i.e. opening even a large file is cheap, and only the parts which are actually
+// read ever leave the disk. Data can be used in place, without copying it into separate buffers.
+class mapped_file
+{
+public:
+	mapped_file() = default;
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+	mapped_file(mapped_file&& aOther) noexcept { *this = std::move(aOther); }
+	mapped_file& operator=(mapped_file&& aOther) noexcept
+	{
+		if (this != &aOther) {
+			close();
+			std::swap(mData, aOther.mData);
+			std::swap(mSize, aOther.mSize);
+#if defined(_WIN32)
+			std::swap(mFile, aOther.mFile);
+			std::swap(mMapping, aOther.mMapping);
+#endif
+		}
+		return *this;
+	}
+	~mapped_file() { close(); }
+
+	// Maps the whole file. Returns false if it can't be opened or is empty:
+	bool open(const std::string& aPath)
+	{
+		close();
+#if defined(_WIN32)
+		mFile = CreateFileA(aPath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (INVALID_HANDLE_VALUE == mFile) {
+			return false;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(mFile, &size) || 0 == size.QuadPart) {
+			close();
+			return false;
+		}
+		mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (nullptr == mMapping) {
+			close();
+			return false;
+		}
+		mData = static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+		mSize = static_cast<size_t>(size.QuadPart);
+#else
+		const int fd = ::open(aPath.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (0 != fstat(fd, &st) || 0 == st.st_size) {
+			::close(fd);
+			return false;
+		}
+		void* ptr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // The mapping stays valid
+		if (MAP_FAILED != ptr) {
+			mData = static_cast<const uint8_t*>(ptr);
+			mSize = static_cast<size_t>(st.st_size);
+		}
+#endif
+		if (nullptr == mData) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+#if defined(_WIN32)
+		if (nullptr != mData) {
+			UnmapViewOfFile(mData);
+		}
+		if (nullptr != mMapping) {
+			CloseHandle(mMapping);
+		}
+		if (INVALID_HANDLE_VALUE != mFile) {
+			CloseHandle(mFile);
+		}
+		mMapping = nullptr;
+		mFile = INVALID_HANDLE_VALUE;
+#else
+		if (nullptr != mData) {
+			munmap(const_cast<uint8_t*>(mData), mSize);
+		}
+#endif
+		mData = nullptr;
+		mSize = 0;
+	}
+
+	[[nodiscard]] bool is_open() const { return nullptr != mData; }
+	[[nodiscard]] const uint8_t* data() const { return mData; }
+	[[nodiscard]] size_t size() const { return mSize; }
+
+	// Tells the operating system that the given range will be read soon, s.t. it can be paged in ahead of time:
+	void prefetch(size_t aOffset, size_t aSize) const
+	{
+		if (nullptr == mData || aOffset >= mSize) {
+			return;
+		}
+		aSize = std::min(aSize, mSize - aOffset);
+#if defined(_WIN32)
+		WIN32_MEMORY_RANGE_ENTRY range{ const_cast<uint8_t*>(mData + aOffset), aSize };
+		PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+		// madvise requires a page-aligned address:
+		const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		const auto alignedOffset = aOffset / pageSize * pageSize;
+		madvise(const_cast<uint8_t*>(mData + alignedOffset), aSize + (aOffset - alignedOffset), MADV_WILLNEED);
+#endif
+	}
+
+private:
+	const uint8_t* mData = nullptr;
+	size_t mSize = 0;
+#if defined(_WIN32)
+	HANDLE mFile = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = nullptr;
+#endif
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+// Morton codes interleave the bits of three grid coordinates (x occupies the lowest bit). Sorting by these codes
+// orders the cells of the grid along a Z-order curve, which keeps cells that are close in space close in the order.
+
+// Interleaves the lower 10 bits of x, y, and z into a 30-bit code:
+[[nodiscard]] inline uint32_t morton_code_30(uint32_t x, uint32_t y, uint32_t z)
+{
+	const auto spread = [](uint32_t v) {
+		v &= 0x3FF;
+		v = (v | (v << 16)) & 0x030000FFu;
+		v = (v | (v << 8)) & 0x0300F00Fu;
+		v = (v | (v << 4)) & 0x030C30C3u;
+		v = (v | (v << 2)) & 0x09249249u;
+		return v;
+	};
+	return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+}
+
+// Interleaves the lower 21 bits of x, y, and z into a 63-bit code:
+[[nodiscard]] inline uint64_t morton_code_63(uint32_t x, uint32_t y, uint32_t z)
+{
+	const auto spread = [](uint64_t v) {
+		v &= 0x1FFFFF;
+		v = (v | (v << 32)) & 0x1F00000000FFFFull;
+		v = (v | (v << 16)) & 0x1F0000FF0000FFull;
+		v = (v | (v << 8)) & 0x100F00F00F00F00Full;
+		v = (v | (v << 4)) & 0x10C30C30C30C30C3ull;
+		v = (v | (v << 2)) & 0x1249249249249249ull;
+		return v;
+	};
+	return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+// A dynamically sized set of bits, packed into 64-bit words. Bulk operations (like enabling all
+// bits, or all but one) work on whole words, and count() uses one popcount per word.
+// Bits beyond size() in the last word are always zero.
+class packed_bitset
+{
+public:
+	packed_bitset() = default;
+	explicit packed_bitset(size_t aSize, bool aValue = false) { assign(aSize, aValue); }
+
+	void assign(size_t aSize, bool aValue)
+	{
+		mSize = aSize;
+		mWords.assign((aSize + 63) / 64, aValue ? ~uint64_t{ 0 } : uint64_t{ 0 });
+		clear_unused_bits();
+	}
+
+	[[nodiscard]] size_t size() const { return mSize; }
+
+	[[nodiscard]] bool test(size_t aIndex) const
+	{
+		assert(aIndex < mSize);
+		return 0 != (mWords[aIndex / 64] & bit(aIndex));
+	}
+	[[nodiscard]] bool operator[](size_t aIndex) const { return test(aIndex); }
+
+	void set(size_t aIndex, bool aValue = true)
+	{
+		assert(aIndex < mSize);
+		if (aValue) {
+			mWords[aIndex / 64] |= bit(aIndex);
+		}
+		else {
+			mWords[aIndex / 64] &= ~bit(aIndex);
+		}
+	}
+
+	// Sets all bits to aValue:
+	void set_all(bool aValue)
+	{
+		std::fill(std::begin(mWords), std::end(mWords), aValue ? ~uint64_t{ 0 } : uint64_t{ 0 });
+		clear_unused_bits();
+	}
+
+	// Sets only the given bit, and clears all others:
+	void set_only(size_t aIndex)
+	{
+		set_all(false);
+		set(aIndex, true);
+	}
+
+	// Clears only the given bit, and sets all others:
+	void set_all_except(size_t aIndex)
+	{
+		set_all(true);
+		set(aIndex, false);
+	}
+
+	// The number of set bits:
+	[[nodiscard]] size_t count() const
+	{
+		size_t sum = 0;
+		for (const auto w : mWords) {
+			sum += std::bitset<64>{ w }.count();
+		}
+		return sum;
+	}
+
+	// Invokes aCallback(index) for every bit which differs between this set and aOther (which must have the same size):
+	template <typename F>
+	void for_each_difference(const packed_bitset& aOther, F&& aCallback) const
+	{
+		assert(mSize == aOther.mSize);
+		for (size_t w = 0; w < mWords.size(); ++w) {
+			for (auto diff = mWords[w] ^ aOther.mWords[w]; 0 != diff; diff &= diff - 1) {
+				size_t b = 0;
+				while (0 == (diff & (uint64_t{ 1 } << b))) {
+					++b;
+				}
+				aCallback(w * 64 + b);
+			}
+		}
+	}
+
+	[[nodiscard]] bool operator==(const packed_bitset& aOther) const { return mSize == aOther.mSize && mWords == aOther.mWords; }
+	[[nodiscard]] bool operator!=(const packed_bitset& aOther) const { return !(*this == aOther); }
+
+private:
+	[[nodiscard]] static uint64_t bit(size_t aIndex) { return uint64_t{ 1 } << (aIndex % 64); }
+
+	void clear_unused_bits()
+	{
+		if (0 != mSize % 64) {
+			mWords.back() &= (uint64_t{ 1 } << (mSize % 64)) - 1;
+		}
+	}
+
+	std::vector<uint64_t> mWords;
+	size_t mSize = 0;
+};
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <gvk.hpp>
+
+#include "particle_chunks.hpp"
+#include "instance_packing.hpp"
+#include "static_blas.hpp"
+
+static_assert(sizeof(particle_chunks::box) == sizeof(VkAabbPositionsKHR), "A box is expected to be layout-compatible with VkAabbPositionsKHR");
+
+// The GPU side of the chunked particles (see particle_chunks): one AABB-BLAS per chunk over the boxes of its particles,
+// and one TLAS instance per chunk. The boxes of all chunks live in one device buffer, which the BLAS builds read and
+// rt_aabb.rint fetches the spheres from: the custom index of a chunk's instance is cCustomIndexFlag | the chunk's first box,
+// and gl_PrimitiveID is the index of the box within the chunk. The boxes of dirty chunks are uploaded via a staging buffer
+// per frame in flight. Dirty chunks are refit, unless they have got different particles, in which case they are rebuilt.
+// The box buffer and the BLAS are shared by all frames in flight, i.e. the frames before might still trace against them.
+// Therefore, an update starts with an execution barrier which makes its copies, and via those its BLAS builds, wait (on
+// the GPU) until all ray tracing work which has been submitted before has completed. This is unlike the TLAS, of which
+// every frame in flight has got its own, and whose builds only wait for the frame which has used it before (see tlas_manager).
+class particle_chunk_geometry
+{
+public:
+	// Marks the custom indices of the chunks' instances; must match PARTICLE_CHUNK_CUSTOM_INDEX_FLAG in rt_aabb.rint and rt_aabb.rchit:
+	static constexpr uint32_t cCustomIndexFlag = 0x400000u;
+
+	// Creates the box buffer for up to aMaxParticles particles. It exists from the start, because it is bound to the
+	// ray tracing pipelines even while the particles are instanced one by one:
+	void create(size_t aMaxParticles, size_t aNumConcurrentFrames)
+	{
+		mMaxChunks = static_cast<uint32_t>((aMaxParticles + particle_chunks::cChunkCapacity - 1) / particle_chunks::cChunkCapacity);
+		assert(static_cast<size_t>(mMaxChunks) * particle_chunks::cChunkCapacity <= cCustomIndexFlag); // The first box must fit below the flag
+		mBoxes = gvk::context().create_buffer(
+			avk::memory_usage::device,
+			vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eShaderDeviceAddressKHR | vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
+			avk::storage_buffer_meta::create_from_size(boxes_size())
+		);
+		mStaging.clear();
+		mStaging.resize(aNumConcurrentFrames);
+
+		// Every BLAS is large enough for a full chunk, s.t. it can be rebuilt in place:
+		const auto geometry = aabb_geometry(mBoxes->device_address());
+		const auto sizes = gvk::context().device().getAccelerationStructureBuildSizesKHR(
+			vk::AccelerationStructureBuildTypeKHR::eDevice, build_info(geometry, vk::BuildAccelerationStructureModeKHR::eBuild),
+			std::vector<uint32_t>{ particle_chunks::cChunkCapacity }, gvk::context().dynamic_dispatch()
+		);
+		mBlasSize = sizes.accelerationStructureSize;
+		const auto alignment = scratch_offset_alignment();
+		mScratchPerChunk = (std::max(sizes.buildScratchSize, sizes.updateScratchSize) + alignment - 1) / alignment * alignment;
+	}
+
+	// Uploads the boxes of all dirty chunks of aChunks and records the builds or refits of their BLAS into aCommandBuffer.
+	// The BLAS and the scratch memory are created with the first update. Returns true if the TLAS instances have changed:
+	bool update(const particle_chunks& aChunks, avk::command_buffer_t& aCommandBuffer, int64_t aInFlightIndex)
+	{
+		const auto& chunks = aChunks.chunks();
+		const bool instancesChanged = chunks.size() != mNumInstances;
+		mNumInstances = chunks.size();
+		mNumRebuilt = 0;
+		mNumUpdated = 0;
+		while (mBlas.size() < chunks.size()) {
+			mBlas.push_back(chunk_blas{ static_blas::create(mBlasSize), false });
+		}
+		std::vector<uint32_t> dirty;
+		for (uint32_t c = 0; c < static_cast<uint32_t>(chunks.size()); ++c) {
+			if (chunks[c].mDirty && chunks[c].mNumParticles > 0) {
+				dirty.push_back(c);
+			}
+		}
+		if (dirty.empty()) {
+			return instancesChanged;
+		}
+
+		auto& staging = mStaging[static_cast<size_t>(aInFlightIndex) % mStaging.size()];
+		if (!staging.mCreated) {
+			staging.mBuffer = gvk::context().create_buffer(
+				avk::memory_usage::host_coherent, vk::BufferUsageFlagBits::eTransferSrc,
+				avk::generic_buffer_meta::create_from_size(boxes_size())
+			);
+			staging.mCreated = true;
+		}
+		if (!mScratchCreated) {
+			mScratchBuffer = gvk::context().create_buffer(
+				avk::memory_usage::device, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddressKHR,
+				avk::generic_buffer_meta::create_from_size(mMaxChunks * mScratchPerChunk + scratch_offset_alignment()) // Reserve room to align the base address
+			);
+			mScratchCreated = true;
+		}
+
+		// Earlier frames might still trace rays against the boxes and the BLAS:
+		aCommandBuffer.establish_execution_barrier(
+			avk::pipeline_stage::ray_tracing_shaders, /* -> */ avk::pipeline_stage::transfer
+		);
+		std::vector<vk::BufferCopy> regions;
+		for (const auto c : dirty) {
+			const auto offset = static_cast<vk::DeviceSize>(chunks[c].mFirstBox) * sizeof(particle_chunks::box);
+			const auto size = static_cast<vk::DeviceSize>(chunks[c].mNumParticles) * sizeof(particle_chunks::box);
+			staging.mBuffer->fill(aChunks.boxes() + chunks[c].mFirstBox, 0, offset, size, avk::sync::not_required());
+			regions.push_back(vk::BufferCopy{ offset, offset, size });
+		}
+		aCommandBuffer.handle().copyBuffer(staging.mBuffer->handle(), mBoxes->handle(), regions);
+		// The BLAS builds and the intersection shader read the uploaded boxes:
+		aCommandBuffer.establish_global_memory_barrier(
+			avk::pipeline_stage::transfer,              /* -> */ avk::pipeline_stage::acceleration_structure_build,
+			avk::memory_access::transfer_write_access,  /* -> */ avk::memory_access::shader_buffers_and_images_read_access
+		);
+		aCommandBuffer.establish_global_memory_barrier(
+			avk::pipeline_stage::transfer,              /* -> */ avk::pipeline_stage::ray_tracing_shaders,
+			avk::memory_access::transfer_write_access,  /* -> */ avk::memory_access::shader_buffers_and_images_read_access
+		);
+
+		// Build or refit the dirty chunks' BLAS, each one with its own range of the scratch buffer:
+		const auto alignment = scratch_offset_alignment();
+		const auto scratchBase = (mScratchBuffer->device_address() + alignment - 1) / alignment * alignment;
+		const auto boxesAddress = mBoxes->device_address();
+		std::vector<vk::AccelerationStructureGeometryKHR> geometries;
+		std::vector<vk::AccelerationStructureBuildRangeInfoKHR> ranges;
+		geometries.reserve(dirty.size()); // The build infos point into these, i.e. they must not reallocate
+		ranges.reserve(dirty.size());
+		std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> infos;
+		std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> rangePointers;
+		for (size_t d = 0; d < dirty.size(); ++d) {
+			const auto& ch = chunks[dirty[d]];
+			auto& blas = mBlas[dirty[d]];
+			// A refit requires the same primitives as the build before, which is the case as long as the chunk keeps its particles:
+			const bool rebuild = ch.mRegrouped || !blas.mBuilt;
+			geometries.push_back(aabb_geometry(boxesAddress + static_cast<vk::DeviceSize>(ch.mFirstBox) * sizeof(particle_chunks::box)));
+			ranges.push_back(vk::AccelerationStructureBuildRangeInfoKHR{ ch.mNumParticles, 0, 0, 0 });
+			infos.push_back(build_info(geometries.back(), rebuild ? vk::BuildAccelerationStructureModeKHR::eBuild : vk::BuildAccelerationStructureModeKHR::eUpdate)
+				.setSrcAccelerationStructure(rebuild ? vk::AccelerationStructureKHR{} : blas.mBlas.handle())
+				.setDstAccelerationStructure(blas.mBlas.handle())
+				.setScratchData(vk::DeviceOrHostAddressKHR{}.setDeviceAddress(scratchBase + d * mScratchPerChunk))
+			);
+			rangePointers.push_back(&ranges.back());
+			blas.mBuilt = true;
+			mNumRebuilt += rebuild ? 1 : 0;
+		}
+		aCommandBuffer.handle().buildAccelerationStructuresKHR(infos, rangePointers, gvk::context().dynamic_dispatch());
+
+		// The TLAS builds read the BLAS:
+		aCommandBuffer.establish_global_memory_barrier(
+			avk::pipeline_stage::acceleration_structure_build,       /* -> */ avk::pipeline_stage::acceleration_structure_build,
+			avk::memory_access::acceleration_structure_write_access, /* -> */ avk::memory_access::acceleration_structure_read_access
+		);
+		mNumUpdated = dirty.size();
+		return instancesChanged;
+	}
+
+	[[nodiscard]] size_t number_of_instances() const { return mNumInstances; }
+	// How many BLAS the last update(...) has rebuilt, and how many it has rebuilt or refit in total:
+	[[nodiscard]] size_t number_of_rebuilt_blas() const { return mNumRebuilt; }
+	[[nodiscard]] size_t number_of_updated_blas() const { return mNumUpdated; }
+
+	// Writes one instance per chunk into aDst, which must have room for number_of_instances() rows:
+	void write_instances(const particle_chunks& aChunks, packed_instance* aDst) const
+	{
+		for (size_t c = 0; c < mNumInstances; ++c) {
+			*aDst++ = make_packed_instance(glm::mat4{ 1.0f }, cCustomIndexFlag | aChunks.chunks()[c].mFirstBox, 1 /* Procedural, like the particles */, mBlas[c].mBlas.device_address());
+		}
+	}
+
+	// The boxes of all chunks (a VkAabbPositionsKHR per particle):
+	[[nodiscard]] const avk::buffer& boxes() const { return mBoxes; }
+
+	// Bytes of all BLAS which have been created so far:
+	[[nodiscard]] size_t blas_memory() const { return mBlas.size() * static_cast<size_t>(mBlasSize); }
+
+private:
+	struct chunk_blas
+	{
+		static_blas mBlas;
+		bool mBuilt;
+	};
+
+	struct staging_buffer
+	{
+		avk::buffer mBuffer;
+		bool mCreated = false;
+	};
+
+	[[nodiscard]] vk::DeviceSize boxes_size() const
+	{
+		return static_cast<vk::DeviceSize>(mMaxChunks) * particle_chunks::cChunkCapacity * sizeof(particle_chunks::box);
+	}
+
+	[[nodiscard]] static vk::AccelerationStructureGeometryKHR aabb_geometry(vk::DeviceAddress aBoxes)
+	{
+		return vk::AccelerationStructureGeometryKHR{}
+			.setGeometryType(vk::GeometryTypeKHR::eAabbs)
+			.setFlags(vk::GeometryFlagBitsKHR::eOpaque)
+			.setGeometry(vk::AccelerationStructureGeometryAabbsDataKHR{}
+				.setData(vk::DeviceOrHostAddressConstKHR{}.setDeviceAddress(aBoxes))
+				.setStride(sizeof(particle_chunks::box))
+			);
+	}
+
+	[[nodiscard]] static vk::AccelerationStructureBuildGeometryInfoKHR build_info(const vk::AccelerationStructureGeometryKHR& aGeometry, vk::BuildAccelerationStructureModeKHR aMode)
+	{
+		return vk::AccelerationStructureBuildGeometryInfoKHR{}
+			.setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
+			.setFlags(vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate)
+			.setMode(aMode)
+			.setGeometryCount(1)
+			.setPGeometries(&aGeometry);
+	}
+
+	static vk::DeviceSize scratch_offset_alignment()
+	{
+		static const vk::DeviceSize sAlignment = std::max<vk::DeviceSize>(1, gvk::context().physical_device().getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceAccelerationStructurePropertiesKHR>()
+			.get<vk::PhysicalDeviceAccelerationStructurePropertiesKHR>().minAccelerationStructureScratchOffsetAlignment);
+		return sAlignment;
+	}
+
+	uint32_t mMaxChunks = 0;
+	vk::DeviceSize mBlasSize = 0;
+	vk::DeviceSize mScratchPerChunk = 0;
+	avk::buffer mBoxes;
+	std::vector<staging_buffer> mStaging;
+	avk::buffer mScratchBuffer;
+	bool mScratchCreated = false;
+	std::vector<chunk_blas> mBlas;
+	size_t mNumInstances = 0;
+	size_t mNumRebuilt = 0;
+	size_t mNumUpdated = 0;
+};
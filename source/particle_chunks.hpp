@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "thread_pool.hpp"
+
+// Groups the particles spatially into chunks of up to cChunkCapacity particles, as an alternative to instancing one box
+// per particle: every chunk becomes one BLAS over the boxes of its particles, and the TLAS holds one instance per chunk
+// instead of one per particle. The boxes are tight around the spheres which are rendered for the particles. (An instanced
+// particle's box spans [-1, 1] in object space, but rt_aabb.rint intersects a sphere of radius 0.5, i.e. most rays which
+// invoke the intersection shader for such a box miss the sphere.)
+//
+// The particles are grouped by splitting them recursively at the median of their longest axis, which results in chunks of
+// (almost) equal size whose bounds hardly overlap. While the number of particles stays the same, the chunks keep their particles and only the boxes
+// are updated. Chunks whose boxes have not changed at all are not dirty, i.e. their BLAS need neither a rebuild nor a refit.
+// Because the chunks grow into each other as their particles move, the particles are grouped anew after
+// mMaxUpdatesBeforeRegroup updates which have changed any boxes.
+// This class does not depend on the GPU or on the framework and can be used anywhere.
+class particle_chunks
+{
+public:
+	// Upper limit for the number of particles of one chunk:
+	static constexpr uint32_t cChunkCapacity = 4096;
+	// The radius of the sphere which is rendered for a particle, relative to the particle's radius (see rt_aabb.rint):
+	static constexpr float cSphereRadiusScale = 0.5f;
+
+	// The box around one particle's sphere; layout-compatible with VkAabbPositionsKHR:
+	struct box
+	{
+		glm::vec3 mMin;
+		glm::vec3 mMax;
+	};
+
+	struct parameters
+	{
+		uint32_t mMaxUpdatesBeforeRegroup = 60;
+	};
+
+	// The boxes of a chunk are [mFirstBox, mFirstBox + mNumParticles) of boxes(); every chunk has room for cChunkCapacity boxes:
+	struct chunk
+	{
+		uint32_t mFirstBox;
+		uint32_t mNumParticles;
+		glm::vec3 mMin;  // Bounds of all of the chunk's boxes
+		glm::vec3 mMax;
+		bool mDirty;     // The boxes have changed during the most recent update(...)
+		bool mRegrouped; // The chunk has got different particles during the most recent update(...)
+	};
+
+	struct statistics
+	{
+		size_t mNumParticles = 0;
+		size_t mNumChunks = 0;
+		size_t mNumDirtyChunks = 0;
+		bool mRegrouped = false;
+		double mUpdateMs = 0.0;
+	};
+
+	[[nodiscard]] parameters& params() { return mParams; }
+	[[nodiscard]] const parameters& params() const { return mParams; }
+	[[nodiscard]] const statistics& stats() const { return mStats; }
+	[[nodiscard]] const std::vector<chunk>& chunks() const { return mChunks; }
+	[[nodiscard]] const box* boxes() const { return mBoxes.data(); }
+
+	// Forces the particles to be grouped anew with the next update(...):
+	void invalidate() { mNumParticles = std::numeric_limits<size_t>::max(); }
+
+	// Follows a reordering of the particles (see particle_reorderer), s.t. the chunks keep their particles:
+	// If the chunks have not been built for exactly as many particles, they are invalidated instead:
+	void remap_particles(const std::vector<uint32_t>& aNewIndexOf)
+	{
+		if (aNewIndexOf.size() != mNumParticles || mSortedParticles.size() != mNumParticles) {
+			invalidate();
+			return;
+		}
+		for (auto& i : mSortedParticles) {
+			i = aNewIndexOf[i];
+		}
+	}
+
+	// Brings the chunks up to date with the given particles (SoA, like particle_store). If their number hasn't changed,
+	// the particles stay in their chunks, unless the boxes have changed mMaxUpdatesBeforeRegroup times in a row:
+	void update(const float* aX, const float* aY, const float* aZ, const float* aRadii, size_t aCount, thread_pool& aPool)
+	{
+		const auto t0 = std::chrono::steady_clock::now();
+		mStats = statistics{};
+		mStats.mNumParticles = aCount;
+		mStats.mRegrouped = aCount != mNumParticles || mNumUpdates >= mParams.mMaxUpdatesBeforeRegroup;
+		if (mStats.mRegrouped) {
+			group(aX, aY, aZ, aCount);
+			mNumUpdates = 0;
+		}
+
+		// Write the boxes of every chunk and find out whether they have changed:
+		const bool regrouped = mStats.mRegrouped;
+		aPool.parallel_for_each_index(0, mChunks.size(), 1, [&](size_t c) {
+			auto& ch = mChunks[c];
+			const uint32_t* particles = mSortedParticles.data() + mChunkBegin[c];
+			box* dst = mBoxes.data() + ch.mFirstBox;
+			bool changed = regrouped;
+			glm::vec3 lo{ std::numeric_limits<float>::max() }, hi{ std::numeric_limits<float>::lowest() };
+			for (uint32_t k = 0; k < ch.mNumParticles; ++k) {
+				const auto i = particles[k];
+				const glm::vec3 p{ aX[i], aY[i], aZ[i] };
+				const float h = cSphereRadiusScale * aRadii[i];
+				const box b{ p - h, p + h };
+				changed = changed || 0 != std::memcmp(&b, dst + k, sizeof(box));
+				dst[k] = b;
+				lo = glm::min(lo, b.mMin);
+				hi = glm::max(hi, b.mMax);
+			}
+			ch.mMin = lo;
+			ch.mMax = hi;
+			ch.mDirty = changed;
+			ch.mRegrouped = regrouped;
+		});
+
+		mStats.mNumChunks = mChunks.size();
+		mStats.mNumDirtyChunks = static_cast<size_t>(std::count_if(std::begin(mChunks), std::end(mChunks), [](const chunk& c) { return c.mDirty; }));
+		if (!regrouped && mStats.mNumDirtyChunks > 0) {
+			++mNumUpdates;
+		}
+		mStats.mUpdateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	}
+
+private:
+	// Assigns the particles to as few chunks as possible, each one holding the particles of a compact region:
+	void group(const float* aX, const float* aY, const float* aZ, size_t aCount)
+	{
+		mNumParticles = aCount;
+		mChunks.clear();
+		mChunkBegin.clear();
+		if (0 == aCount) {
+			mBoxes.clear();
+			return;
+		}
+
+		mSortedParticles.resize(aCount);
+		for (size_t i = 0; i < aCount; ++i) {
+			mSortedParticles[i] = static_cast<uint32_t>(i);
+		}
+		const auto numChunks = static_cast<uint32_t>((aCount + cChunkCapacity - 1) / cChunkCapacity);
+		mChunks.resize(numChunks);
+		mChunkBegin.resize(numChunks);
+		split(aX, aY, aZ, 0, static_cast<uint32_t>(aCount), 0, numChunks);
+		mBoxes.resize(static_cast<size_t>(numChunks) * cChunkCapacity, box{ glm::vec3{ 0.0f }, glm::vec3{ 0.0f } });
+	}
+
+	// Distributes the particles [aBegin, aEnd) of mSortedParticles among the chunks [aFirstChunk, aEndChunk): they are
+	// split at the median of their longest axis (with as many particles on either side as its chunks can hold in equal
+	// shares) until every part fits into one chunk:
+	void split(const float* aX, const float* aY, const float* aZ, uint32_t aBegin, uint32_t aEnd, uint32_t aFirstChunk, uint32_t aEndChunk)
+	{
+		if (aEndChunk - aFirstChunk == 1) {
+			mChunkBegin[aFirstChunk] = aBegin;
+			mChunks[aFirstChunk] = chunk{ aFirstChunk * cChunkCapacity, aEnd - aBegin, glm::vec3{ 0.0f }, glm::vec3{ 0.0f }, true, true };
+			return;
+		}
+		glm::vec3 lo{ std::numeric_limits<float>::max() }, hi{ std::numeric_limits<float>::lowest() };
+		for (auto k = aBegin; k < aEnd; ++k) {
+			const auto i = mSortedParticles[k];
+			const glm::vec3 p{ aX[i], aY[i], aZ[i] };
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+		const glm::vec3 extent = hi - lo;
+		const float* axis = extent.x >= extent.y && extent.x >= extent.z ? aX : extent.y >= extent.z ? aY : aZ;
+		const auto midChunk = aFirstChunk + (aEndChunk - aFirstChunk) / 2;
+		const auto mid = aBegin + static_cast<uint32_t>(static_cast<uint64_t>(aEnd - aBegin) * (midChunk - aFirstChunk) / (aEndChunk - aFirstChunk));
+		std::nth_element(mSortedParticles.data() + aBegin, mSortedParticles.data() + mid, mSortedParticles.data() + aEnd, [axis](uint32_t a, uint32_t b) {
+			return axis[a] < axis[b] || (axis[a] == axis[b] && a < b);
+		});
+		split(aX, aY, aZ, aBegin, mid, aFirstChunk, midChunk);
+		split(aX, aY, aZ, mid, aEnd, midChunk, aEndChunk);
+	}
+
+	parameters mParams;
+	statistics mStats;
+	size_t mNumParticles = std::numeric_limits<size_t>::max();
+	uint32_t mNumUpdates = 0;
+
+	std::vector<chunk> mChunks;
+	std::vector<uint32_t> mChunkBegin; // Every chunk's first particle in mSortedParticles
+	std::vector<box> mBoxes;
+	std::vector<uint32_t> mSortedParticles; // Particle indices, grouped by chunk
+};
@@ -0,0 +1,332 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "morton.hpp"
+#include "thread_pool.hpp"
+
+// A level-of-detail hierarchy over the particles, which lets distant regions be represented by a few coarse clusters
+// instead of one sphere per particle. Particles are sorted along a Morton curve of a grid with cells of mClusterCellSize;
+// the particles of every occupied cell form a cluster of the finest level, and every coarser level merges the clusters
+// of 2x2x2 cells. Hence, every cluster covers a contiguous range of the sorted particles. Every cluster is bounded by
+// a sphere, s.t. it can be rendered with the very same geometry as a particle. The spheres bound what is rendered for the
+// particles, i.e. spheres of cSphereRadiusScale times their radii, and a selected cluster's radius is scaled inversely.
+//
+// select(...) chooses a cut through the hierarchy: starting at the coarsest level, the cluster which appears the largest
+// from the camera (its radius divided by its distance) is replaced by its children, until all remaining clusters appear
+// smaller than mMaxAngularError or until refining any further would exceed mInstanceBudget spheres.
+// While particles only move, the hierarchy is refit (the bounding spheres are recomputed) instead of being rebuilt.
+// This class does not depend on the GPU or on the framework and can be used anywhere.
+class particle_lod
+{
+public:
+	// The coarsest level has at most this many clusters, i.e. at least this many spheres are always selected:
+	static constexpr size_t cMaxRoots = 64;
+	// The radius of the sphere which is rendered for a particle, relative to the particle's radius (see rt_aabb.rint):
+	static constexpr float cSphereRadiusScale = 0.5f;
+
+	struct parameters
+	{
+		float mClusterCellSize = 2.0f;     // Edge length of the cells of the finest level of clusters (in world space)
+		float mMaxAngularError = 0.004f;   // Clusters which appear smaller than this (radius / distance) are not refined
+		size_t mInstanceBudget = 65536;    // Upper limit for the number of selected spheres (clusters and particles)
+		uint32_t mMaxRefitsBeforeRebuild = 30;
+	};
+
+	struct statistics
+	{
+		size_t mNumLevels = 0;
+		size_t mNumClusters = 0;
+		size_t mNumSelectedClusters = 0;
+		size_t mNumSelectedParticles = 0;
+		bool mRebuilt = false;
+		double mUpdateMs = 0.0;
+		double mSelectMs = 0.0;
+	};
+
+	[[nodiscard]] parameters& params() { return mParams; }
+	[[nodiscard]] const parameters& params() const { return mParams; }
+	[[nodiscard]] const statistics& stats() const { return mStats; }
+
+	// Forces a rebuild with the next update(...), e.g. after the parameters have changed:
+	void invalidate() { mNumParticles = std::numeric_limits<size_t>::max(); }
+
+	// Follows a reordering of the particles (see particle_reorderer), s.t. the hierarchy can keep being refit and its clusters keep their particles:
+	// If the hierarchy have not been built for exactly as many particles, they are invalidated instead:
+	void remap_particles(const std::vector<uint32_t>& aNewIndexOf)
+	{
+		if (aNewIndexOf.size() != mNumParticles || mSortedParticles.size() != mNumParticles) {
+			invalidate();
+			return;
+		}
+		for (auto& i : mSortedParticles) {
+			i = aNewIndexOf[i];
+		}
+	}
+
+	// Brings the hierarchy up to date with the given particles (SoA, like particle_store). If their number hasn't
+	// changed, the hierarchy is only refit, unless it has been refit mMaxRefitsBeforeRebuild times in a row:
+	void update(const float* aX, const float* aY, const float* aZ, const float* aRadii, size_t aCount, thread_pool& aPool)
+	{
+		const auto t0 = std::chrono::steady_clock::now();
+		mStats.mRebuilt = aCount != mNumParticles || mNumRefits >= mParams.mMaxRefitsBeforeRebuild;
+		if (mStats.mRebuilt) {
+			build(aX, aY, aZ, aRadii, aCount, aPool);
+			mNumRefits = 0;
+		}
+		else {
+			refit(aX, aY, aZ, aRadii, aPool);
+			++mNumRefits;
+		}
+		mStats.mNumLevels = mLevelStart.empty() ? 0 : mLevelStart.size() - 1;
+		mStats.mNumClusters = mNodes.size();
+		mStats.mUpdateMs = elapsed_ms(t0);
+	}
+
+	// Selects the spheres to render for a camera at aCameraPos and stores them in selected_x/y/z/radii(), whose radii are
+	// given like the particles' ones, i.e. the rendered spheres are cSphereRadiusScale times as large. The selection
+	// is ordered along the particles' Morton curve, s.t. a change in one region leaves the others at their positions.
+	// Returns the range of the selection which differs from the previous one (empty if nothing has changed):
+	std::pair<size_t, size_t> select(const glm::vec3& aCameraPos, const float* aX, const float* aY, const float* aZ, const float* aRadii)
+	{
+		const auto t0 = std::chrono::steady_clock::now();
+		std::swap(mSelection, mPrevSelection);
+		mSelection.clear();
+		mStats.mNumSelectedClusters = 0;
+		mStats.mNumSelectedParticles = 0;
+
+		if (!mNodes.empty()) {
+			const auto budget = std::max(mParams.mInstanceBudget, cMaxRoots);
+			const auto error = [&](uint32_t aNode) {
+				const auto& n = mNodes[aNode];
+				const float distance = glm::length(n.mCenter - aCameraPos) - n.mRadius;
+				return distance > 0.0f ? n.mRadius / distance : std::numeric_limits<float>::max();
+			};
+			std::priority_queue<std::pair<float, uint32_t>> candidates;
+			for (auto n = mLevelStart[mLevelStart.size() - 2]; n < mLevelStart.back(); ++n) {
+				candidates.emplace(error(n), n);
+			}
+			size_t count = candidates.size();
+			while (!candidates.empty()) {
+				const auto [e, n] = candidates.top();
+				candidates.pop();
+				const auto& node = mNodes[n];
+				if (e <= mParams.mMaxAngularError || count + node.mNumChildren - 1 > budget) {
+					add_cluster(n);
+					continue;
+				}
+				count += node.mNumChildren - 1;
+				if (node.mLevel == 0) {
+					for (auto k = node.mBegin; k < node.mEnd; ++k) {
+						const auto i = mSortedParticles[k];
+						mSelection.push_back(selected_sphere{ k, aX[i], aY[i], aZ[i], aRadii[i] });
+					}
+					mStats.mNumSelectedParticles += node.mEnd - node.mBegin;
+				}
+				else {
+					for (auto c = node.mFirstChild; c < node.mFirstChild + node.mNumChildren; ++c) {
+						candidates.emplace(error(c), c);
+					}
+				}
+			}
+			std::sort(std::begin(mSelection), std::end(mSelection), [](const auto& a, const auto& b) { return a.mOrder < b.mOrder; });
+		}
+
+		// Find out which range has changed, from both ends:
+		const auto same = [](const selected_sphere& a, const selected_sphere& b) {
+			return a.mX == b.mX && a.mY == b.mY && a.mZ == b.mZ && a.mRadius == b.mRadius;
+		};
+		size_t first = 0;
+		const auto common = std::min(mSelection.size(), mPrevSelection.size());
+		while (first < common && same(mSelection[first], mPrevSelection[first])) {
+			++first;
+		}
+		size_t end = mSelection.size();
+		if (mSelection.size() == mPrevSelection.size()) {
+			while (end > first && same(mSelection[end - 1], mPrevSelection[end - 1])) {
+				--end;
+			}
+		}
+		mSelectedX.resize(mSelection.size());
+		mSelectedY.resize(mSelection.size());
+		mSelectedZ.resize(mSelection.size());
+		mSelectedRadii.resize(mSelection.size());
+		for (auto s = first; s < end; ++s) {
+			mSelectedX[s] = mSelection[s].mX;
+			mSelectedY[s] = mSelection[s].mY;
+			mSelectedZ[s] = mSelection[s].mZ;
+			mSelectedRadii[s] = mSelection[s].mRadius;
+		}
+		mStats.mSelectMs = elapsed_ms(t0);
+		return { first, end };
+	}
+
+	// The spheres of the most recent selection (SoA):
+	[[nodiscard]] size_t number_of_selected() const { return mSelection.size(); }
+	[[nodiscard]] const float* selected_x() const { return mSelectedX.data(); }
+	[[nodiscard]] const float* selected_y() const { return mSelectedY.data(); }
+	[[nodiscard]] const float* selected_z() const { return mSelectedZ.data(); }
+	[[nodiscard]] const float* selected_radii() const { return mSelectedRadii.data(); }
+
+private:
+	struct node
+	{
+		glm::vec3 mCenter;
+		float mRadius;
+		uint32_t mBegin;       // Range of the sorted particles which this cluster covers
+		uint32_t mEnd;
+		uint32_t mFirstChild;  // Clusters of the next finer level (unused at level 0, whose children are the particles)
+		uint32_t mNumChildren;
+		uint32_t mLevel;
+	};
+
+	struct selected_sphere
+	{
+		uint32_t mOrder; // The first sorted particle which the sphere covers
+		float mX, mY, mZ, mRadius;
+	};
+
+	[[nodiscard]] static double elapsed_ms(std::chrono::steady_clock::time_point aStart)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - aStart).count();
+	}
+
+	void add_cluster(uint32_t aNode)
+	{
+		const auto& n = mNodes[aNode];
+		mSelection.push_back(selected_sphere{ n.mBegin, n.mCenter.x, n.mCenter.y, n.mCenter.z, n.mRadius / cSphereRadiusScale });
+		++mStats.mNumSelectedClusters;
+	}
+
+	void build(const float* aX, const float* aY, const float* aZ, const float* aRadii, size_t aCount, thread_pool& aPool)
+	{
+		mNumParticles = aCount;
+		mNodes.clear();
+		mNodeCodes.clear();
+		mLevelStart.clear();
+		if (0 == aCount) {
+			return;
+		}
+
+		// Sort the particles along the Morton curve of the finest level's cells:
+		glm::vec3 boundsMin{ std::numeric_limits<float>::max() };
+		std::mutex boundsMutex;
+		aPool.parallel_for(0, aCount, 16384, [&](size_t aBegin, size_t aEnd) {
+			glm::vec3 localMin{ std::numeric_limits<float>::max() };
+			for (size_t i = aBegin; i < aEnd; ++i) {
+				localMin = glm::min(localMin, glm::vec3{ aX[i], aY[i], aZ[i] });
+			}
+			std::lock_guard<std::mutex> lock(boundsMutex);
+			boundsMin = glm::min(boundsMin, localMin);
+		});
+		const float invCellSize = 1.0f / mParams.mClusterCellSize;
+		mParticleCodes.resize(aCount);
+		aPool.parallel_for(0, aCount, 16384, [&](size_t aBegin, size_t aEnd) {
+			for (size_t i = aBegin; i < aEnd; ++i) {
+				const glm::vec3 cell = glm::min((glm::vec3{ aX[i], aY[i], aZ[i] } - boundsMin) * invCellSize, glm::vec3{ static_cast<float>(0x1FFFFF) });
+				mParticleCodes[i] = std::make_pair(morton_code_63(static_cast<uint32_t>(cell.x), static_cast<uint32_t>(cell.y), static_cast<uint32_t>(cell.z)), static_cast<uint32_t>(i));
+			}
+		});
+		std::sort(std::begin(mParticleCodes), std::end(mParticleCodes));
+		mSortedParticles.resize(aCount);
+		for (size_t k = 0; k < aCount; ++k) {
+			mSortedParticles[k] = mParticleCodes[k].second;
+		}
+
+		// The finest level: one cluster per occupied cell:
+		mLevelStart.push_back(0);
+		for (uint32_t k = 0; k < aCount;) {
+			uint32_t end = k + 1;
+			while (end < aCount && mParticleCodes[end].first == mParticleCodes[k].first) {
+				++end;
+			}
+			mNodes.push_back(node{ glm::vec3{ 0.0f }, 0.0f, k, end, 0, end - k, 0 });
+			mNodeCodes.push_back(mParticleCodes[k].first);
+			k = end;
+		}
+		mLevelStart.push_back(static_cast<uint32_t>(mNodes.size()));
+
+		// Coarser levels merge 2x2x2 cells, i.e. the clusters whose codes only differ in their lowest three bits:
+		for (uint32_t level = 1; level < 22 && mLevelStart.back() - mLevelStart[mLevelStart.size() - 2] > cMaxRoots; ++level) {
+			const auto childBegin = mLevelStart[mLevelStart.size() - 2];
+			const auto childEnd = mLevelStart.back();
+			for (auto c = childBegin; c < childEnd;) {
+				const auto code = mNodeCodes[c] >> 3;
+				auto end = c + 1;
+				while (end < childEnd && (mNodeCodes[end] >> 3) == code) {
+					++end;
+				}
+				mNodes.push_back(node{ glm::vec3{ 0.0f }, 0.0f, mNodes[c].mBegin, mNodes[end - 1].mEnd, c, end - c, level });
+				mNodeCodes.push_back(code);
+				c = end;
+			}
+			mLevelStart.push_back(static_cast<uint32_t>(mNodes.size()));
+		}
+
+		refit(aX, aY, aZ, aRadii, aPool);
+	}
+
+	// Recomputes the bounding spheres bottom-up: every sphere is centered at the bounding box of its children's spheres.
+	// At the finest level, the children are the particles' rendered spheres:
+	void refit(const float* aX, const float* aY, const float* aZ, const float* aRadii, thread_pool& aPool)
+	{
+		for (size_t level = 0; level + 1 < mLevelStart.size(); ++level) {
+			aPool.parallel_for_each_index(mLevelStart[level], mLevelStart[level + 1], 256, [&](size_t aNode) {
+				auto& n = mNodes[aNode];
+				glm::vec3 lo{ std::numeric_limits<float>::max() }, hi{ std::numeric_limits<float>::lowest() };
+				float radius = 0.0f;
+				if (0 == level) {
+					for (auto k = n.mBegin; k < n.mEnd; ++k) {
+						const auto i = mSortedParticles[k];
+						const glm::vec3 p{ aX[i], aY[i], aZ[i] };
+						lo = glm::min(lo, p - aRadii[i] * cSphereRadiusScale);
+						hi = glm::max(hi, p + aRadii[i] * cSphereRadiusScale);
+					}
+					n.mCenter = (lo + hi) * 0.5f;
+					for (auto k = n.mBegin; k < n.mEnd; ++k) {
+						const auto i = mSortedParticles[k];
+						radius = std::max(radius, glm::length(glm::vec3{ aX[i], aY[i], aZ[i] } - n.mCenter) + aRadii[i] * cSphereRadiusScale);
+					}
+				}
+				else {
+					for (auto c = n.mFirstChild; c < n.mFirstChild + n.mNumChildren; ++c) {
+						lo = glm::min(lo, mNodes[c].mCenter - mNodes[c].mRadius);
+						hi = glm::max(hi, mNodes[c].mCenter + mNodes[c].mRadius);
+					}
+					n.mCenter = (lo + hi) * 0.5f;
+					for (auto c = n.mFirstChild; c < n.mFirstChild + n.mNumChildren; ++c) {
+						radius = std::max(radius, glm::length(mNodes[c].mCenter - n.mCenter) + mNodes[c].mRadius);
+					}
+				}
+				n.mRadius = radius;
+			});
+		}
+	}
+
+	parameters mParams;
+	statistics mStats;
+	size_t mNumParticles = std::numeric_limits<size_t>::max();
+	uint32_t mNumRefits = 0;
+
+	// All clusters, level by level (finest first); the clusters of level l are [mLevelStart[l], mLevelStart[l + 1]):
+	std::vector<node> mNodes;
+	std::vector<uint64_t> mNodeCodes;
+	std::vector<uint32_t> mLevelStart;
+	std::vector<std::pair<uint64_t, uint32_t>> mParticleCodes;
+	std::vector<uint32_t> mSortedParticles;
+
+	std::vector<selected_sphere> mSelection;
+	std::vector<selected_sphere> mPrevSelection;
+	std::vector<float> mSelectedX;
+	std::vector<float> mSelectedY;
+	std::vector<float> mSelectedZ;
+	std::vector<float> mSelectedRadii;
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "morton.hpp"
+#include "particle_store.hpp"
+#include "radix_sort.hpp"
+#include "thread_pool.hpp"
+
+// Reorders the particles of a particle_store along a Morton curve, s.t. particles which are close in space are close in
+// memory. Particles are appended in spawn order, which scatters spatial neighbours over the arrays: every neighbour loop
+// (e.g. the simulation's gathers into grid order) misses the caches, and neighbouring particles' instances end up far
+// apart in the TLAS instance buffer.
+//
+// update(...) is meant to be invoked once per frame. Every mFramesBetweenChecks frames, it computes the particles' Morton
+// codes and measures how disordered they are, i.e. the fraction of adjacent particles whose codes descend. Only if this
+// exceeds mMaxDisorder, the codes are radix-sorted and the permutation is applied to all attributes. Hence, reordering
+// happens after many particles have been spawned or after the fluid has been stirred up, but not while it is at rest.
+// After a reorder, new_index_of() maps every old particle index to its new one; everything which refers to particles by
+// their indices must be remapped with it.
+// The grid's cells have an edge length of mCellSize, unless the particles span more cells than the codes can address
+// (2^10 per axis with 30-bit codes, 2^21 with 63-bit codes), in which case the cells are enlarged accordingly.
+// This class does not depend on the GPU or on the framework and can be used anywhere.
+class particle_reorderer
+{
+public:
+	// Iterations per chunk of the parallel loops; the descents between chunks are counted separately:
+	static constexpr size_t cGrainSize = 16384;
+
+	struct parameters
+	{
+		float mCellSize = 0.5f;              // Edge length of the cells of the Morton curve's grid (in world space)
+		bool mUse63BitCodes = false;         // 21 instead of 10 bits per axis, for large domains (but twice the sorting passes)
+		float mMaxDisorder = 0.05f;          // Reorder if more than this fraction of adjacent particles are out of order
+		uint32_t mFramesBetweenChecks = 30;
+	};
+
+	struct statistics
+	{
+		size_t mNumParticles = 0;
+		float mDisorder = 0.0f;   // As measured by the most recent check
+		bool mReordered = false;  // Whether the most recent check has reordered the particles
+		uint32_t mNumSortPasses = 0;
+		double mCodesMs = 0.0;
+		double mSortMs = 0.0;
+		double mPermuteMs = 0.0;
+		uint64_t mNumReorders = 0;
+	};
+
+	[[nodiscard]] parameters& params() { return mParams; }
+	[[nodiscard]] const parameters& params() const { return mParams; }
+	[[nodiscard]] const statistics& stats() const { return mStats; }
+	// Maps the index which every particle has had before the most recent reorder to its new index:
+	[[nodiscard]] const std::vector<uint32_t>& new_index_of() const { return mNewIndexOf; }
+
+	// Checks the order every mFramesBetweenChecks invocations and reorders the particles if required. Returns true if it has:
+	bool update(particle_store& aParticles, thread_pool& aPool)
+	{
+		if (++mFramesSinceCheck < mParams.mFramesBetweenChecks) {
+			return false;
+		}
+		mFramesSinceCheck = 0;
+		return reorder(aParticles, aPool, false);
+	}
+
+	// Reorders the particles if they are more disordered than mMaxDisorder, or in any case if aForce is set. Returns true if it has:
+	bool reorder(particle_store& aParticles, thread_pool& aPool, bool aForce)
+	{
+		if (mParams.mUse63BitCodes) {
+			return reorder(aParticles, aPool, aForce, mCodes63, mSorter63, 21, morton_code_63);
+		}
+		return reorder(aParticles, aPool, aForce, mCodes30, mSorter30, 10, morton_code_30);
+	}
+
+private:
+	[[nodiscard]] static double elapsed_ms(std::chrono::steady_clock::time_point aStart)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - aStart).count();
+	}
+
+	template <typename Key, typename Encode>
+	bool reorder(particle_store& aParticles, thread_pool& aPool, bool aForce, std::vector<Key>& aCodes, radix_sorter<Key>& aSorter, int aBitsPerAxis, Encode aEncode)
+	{
+		const auto t0 = std::chrono::steady_clock::now();
+		const size_t n = aParticles.size();
+		mStats.mNumParticles = n;
+		mStats.mReordered = false;
+		mStats.mNumSortPasses = 0;
+		mStats.mCodesMs = mStats.mSortMs = mStats.mPermuteMs = 0.0;
+		if (n < 2) {
+			mStats.mDisorder = 0.0f;
+			return false;
+		}
+		const float* x = aParticles.positions_x();
+		const float* y = aParticles.positions_y();
+		const float* z = aParticles.positions_z();
+
+		glm::vec3 boundsMin{ std::numeric_limits<float>::max() }, boundsMax{ std::numeric_limits<float>::lowest() };
+		std::mutex boundsMutex;
+		aPool.parallel_for(0, n, cGrainSize, [&](size_t aBegin, size_t aEnd) {
+			glm::vec3 localMin{ std::numeric_limits<float>::max() }, localMax{ std::numeric_limits<float>::lowest() };
+			for (size_t i = aBegin; i < aEnd; ++i) {
+				const glm::vec3 p{ x[i], y[i], z[i] };
+				localMin = glm::min(localMin, p);
+				localMax = glm::max(localMax, p);
+			}
+			std::lock_guard<std::mutex> lock(boundsMutex);
+			boundsMin = glm::min(boundsMin, localMin);
+			boundsMax = glm::max(boundsMax, localMax);
+		});
+		const float maxCell = static_cast<float>((1u << aBitsPerAxis) - 1);
+		const glm::vec3 extent = boundsMax - boundsMin;
+		const float cellSize = std::max({ mParams.mCellSize, extent.x / maxCell, extent.y / maxCell, extent.z / maxCell, std::numeric_limits<float>::min() });
+		const float invCellSize = 1.0f / cellSize;
+
+		// Compute the codes and count the descents between adjacent particles:
+		aCodes.resize(n);
+		size_t descents = 0;
+		std::mutex descentsMutex;
+		aPool.parallel_for(0, n, cGrainSize, [&](size_t aBegin, size_t aEnd) {
+			size_t localDescents = 0;
+			for (size_t i = aBegin; i < aEnd; ++i) {
+				const glm::vec3 cell = glm::min((glm::vec3{ x[i], y[i], z[i] } - boundsMin) * invCellSize, glm::vec3{ maxCell });
+				aCodes[i] = static_cast<Key>(aEncode(static_cast<uint32_t>(cell.x), static_cast<uint32_t>(cell.y), static_cast<uint32_t>(cell.z)));
+			}
+			for (size_t i = std::max<size_t>(aBegin, 1); i < aEnd; ++i) {
+				localDescents += aCodes[i] < aCodes[i - 1] ? 1 : 0;
+			}
+			std::lock_guard<std::mutex> lock(descentsMutex);
+			descents += localDescents;
+		});
+		// The descents at the borders of the ranges:
+		for (size_t i = cGrainSize; i < n; i += cGrainSize) {
+			descents += aCodes[i] < aCodes[i - 1] ? 1 : 0;
+		}
+		mStats.mDisorder = static_cast<float>(descents) / static_cast<float>(n - 1);
+		mStats.mCodesMs = elapsed_ms(t0);
+		if (!aForce && mStats.mDisorder <= mParams.mMaxDisorder) {
+			return false;
+		}
+
+		const auto t1 = std::chrono::steady_clock::now();
+		mOldIndexOf.resize(n);
+		std::iota(std::begin(mOldIndexOf), std::end(mOldIndexOf), 0u);
+		aSorter.sort(aCodes, mOldIndexOf, aPool);
+		mStats.mNumSortPasses = aSorter.number_of_passes();
+		mStats.mSortMs = elapsed_ms(t1);
+
+		const auto t2 = std::chrono::steady_clock::now();
+		mNewIndexOf.resize(n);
+		aPool.parallel_for(0, n, cGrainSize, [&](size_t aBegin, size_t aEnd) {
+			for (size_t k = aBegin; k < aEnd; ++k) {
+				mNewIndexOf[mOldIndexOf[k]] = static_cast<uint32_t>(k);
+			}
+		});
+		aParticles.permute(mOldIndexOf.data(), aPool);
+		mStats.mPermuteMs = elapsed_ms(t2);
+		mStats.mReordered = true;
+		++mStats.mNumReorders;
+		return true;
+	}
+
+	parameters mParams;
+	statistics mStats;
+	uint32_t mFramesSinceCheck = 0;
+
+	std::vector<uint32_t> mCodes30;
+	std::vector<uint64_t> mCodes63;
+	radix_sorter<uint32_t> mSorter30;
+	radix_sorter<uint64_t> mSorter63;
+	std::vector<uint32_t> mOldIndexOf; // The index which the particle at every new index has had before
+	std::vector<uint32_t> mNewIndexOf;
+};
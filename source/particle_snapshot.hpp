@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "particle_store.hpp"
+
+// A compact, versioned binary format for the water particles of a particle_store, holding either one
+// snapshot or a sequence of frames. All offsets are in bytes from the beginning of the file, and all
+// blocks are aligned to 64 bytes, s.t. a mapped file can be read in place (e.g. by pack_sphere_instances):
+//
+//   header
+//   per frame: positions x, y, z of all particles [, velocities x, y, z of all particles]
+//   radii and flags of all particles which occur in any frame
+//   frame table, one frame_record per frame
+//
+// Particles are never removed from a particle_store, and they are not reordered while a sequence is being
+// recorded (see procedural_geometry_manager::reorder_particles), i.e. they keep their indices. Therefore, the
+// frames of a sequence only differ in the number of particles and in their positions (and velocities), and
+// the per-particle constants are stored only once.
+namespace particle_snapshot_format
+{
+	constexpr uint32_t cMagic = 0x53504E46u; // "FNPS"
+	constexpr uint32_t cVersion = 1u;
+	constexpr size_t cAlignment = 64;
+
+	struct header
+	{
+		uint32_t mMagic;
+		uint32_t mVersion;
+		uint32_t mHeaderSize;
+		uint32_t mNumFrames;
+		uint64_t mNumParticles; // in the frame with the most particles
+		uint64_t mRadiiOffset;
+		uint64_t mFlagsOffset;
+		uint64_t mFrameTableOffset;
+		uint64_t mReserved[2];
+	};
+	static_assert(sizeof(header) == 64, "The header is expected to occupy 64 bytes");
+
+	struct frame_record
+	{
+		uint64_t mNumParticles;
+		double mTime; // in seconds, relative to the first frame
+		uint64_t mPositionOffsets[3];
+		uint64_t mVelocityOffsets[3]; // 0 if velocities have not been stored
+	};
+	static_assert(sizeof(frame_record) == 64, "Frame records are expected to occupy 64 bytes");
+}
+
+// Writes particle snapshots, either one frame via save_particle_snapshot(...), or a sequence of frames:
+// open(...), then write_frame(...) for every frame, and finally finish().
+class particle_snapshot_writer
+{
+public:
+	~particle_snapshot_writer() { finish(); }
+
+	bool open(const std::string& aPath, bool aStoreVelocities)
+	{
+		finish();
+		mFile.open(aPath, std::ios::binary | std::ios::trunc);
+		if (!mFile) {
+			return false;
+		}
+		mStoreVelocities = aStoreVelocities;
+		mFrames.clear();
+		mRadii.clear();
+		mFlags.clear();
+		mOffset = 0;
+		const particle_snapshot_format::header placeholder{};
+		write_bytes(&placeholder, sizeof(placeholder)); // written for real in finish()
+		return static_cast<bool>(mFile);
+	}
+
+	[[nodiscard]] bool is_open() const { return mFile.is_open(); }
+	[[nodiscard]] size_t number_of_frames() const { return mFrames.size(); }
+
+	// Appends the current state of the particles. The number of particles must not decrease between frames, and
+	// the particles which have been written before must keep their indices (and thereby, their radii and flags):
+	bool write_frame(const particle_store& aParticles, double aTime)
+	{
+		if (!mFile.is_open() || aParticles.size() < mRadii.size()) {
+			return false;
+		}
+		const auto n = aParticles.size();
+		particle_snapshot_format::frame_record record{};
+		record.mNumParticles = n;
+		record.mTime = aTime;
+		record.mPositionOffsets[0] = write_block(aParticles.positions_x(), n * sizeof(float));
+		record.mPositionOffsets[1] = write_block(aParticles.positions_y(), n * sizeof(float));
+		record.mPositionOffsets[2] = write_block(aParticles.positions_z(), n * sizeof(float));
+		if (mStoreVelocities) {
+			record.mVelocityOffsets[0] = write_block(aParticles.velocities_x(), n * sizeof(float));
+			record.mVelocityOffsets[1] = write_block(aParticles.velocities_y(), n * sizeof(float));
+			record.mVelocityOffsets[2] = write_block(aParticles.velocities_z(), n * sizeof(float));
+		}
+		mFrames.push_back(record);
+
+		// Remember the constants of the particles which are new in this frame:
+		mRadii.insert(std::end(mRadii), aParticles.radii() + mRadii.size(), aParticles.radii() + n);
+		mFlags.insert(std::end(mFlags), aParticles.flags() + mFlags.size(), aParticles.flags() + n);
+		return static_cast<bool>(mFile);
+	}
+
+	// Writes the per-particle constants, the frame table and the header, and closes the file:
+	bool finish()
+	{
+		if (!mFile.is_open()) {
+			return false;
+		}
+		particle_snapshot_format::header h{};
+		h.mMagic = particle_snapshot_format::cMagic;
+		h.mVersion = particle_snapshot_format::cVersion;
+		h.mHeaderSize = sizeof(h);
+		h.mNumFrames = static_cast<uint32_t>(mFrames.size());
+		h.mNumParticles = mRadii.size();
+		h.mRadiiOffset = write_block(mRadii.data(), mRadii.size() * sizeof(float));
+		h.mFlagsOffset = write_block(mFlags.data(), mFlags.size() * sizeof(uint32_t));
+		h.mFrameTableOffset = write_block(mFrames.data(), mFrames.size() * sizeof(particle_snapshot_format::frame_record));
+		mFile.seekp(0);
+		mFile.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		const bool success = static_cast<bool>(mFile);
+		mFile.close();
+		return success;
+	}
+
+private:
+	void write_bytes(const void* aData, size_t aSize)
+	{
+		mFile.write(static_cast<const char*>(aData), static_cast<std::streamsize>(aSize));
+		mOffset += aSize;
+	}
+
+	// Pads the file to the next aligned offset, writes the block there and returns its offset:
+	uint64_t write_block(const void* aData, size_t aSize)
+	{
+		static const char sZeros[particle_snapshot_format::cAlignment] = {};
+		const auto padding = (particle_snapshot_format::cAlignment - mOffset % particle_snapshot_format::cAlignment) % particle_snapshot_format::cAlignment;
+		write_bytes(sZeros, padding);
+		const auto offset = mOffset;
+		if (aSize > 0) {
+			write_bytes(aData, aSize);
+		}
+		return offset;
+	}
+
+	std::ofstream mFile;
+	uint64_t mOffset = 0;
+	bool mStoreVelocities = true;
+	std::vector<particle_snapshot_format::frame_record> mFrames;
+	std::vector<float> mRadii;
+	std::vector<uint32_t> mFlags;
+};
+
+// Saves the complete state of all particles as a single-frame snapshot:
+inline bool save_particle_snapshot(const std::string& aPath, const particle_store& aParticles)
+{
+	particle_snapshot_writer writer;
+	return writer.open(aPath, true) && writer.write_frame(aParticles, 0.0) && writer.finish();
+}
+
+// A memory-mapped particle snapshot file. Frames are accessed in place, without copying them;
+// the operating system loads their pages on first access (see prefetch_frame(...)).
+class particle_snapshot
+{
+public:
+	// Pointers into the mapped file. Velocities are nullptr if they have not been stored:
+	struct frame_view
+	{
+		size_t mNumParticles = 0;
+		double mTime = 0.0;
+		const float* mPositionsX = nullptr;
+		const float* mPositionsY = nullptr;
+		const float* mPositionsZ = nullptr;
+		const float* mVelocitiesX = nullptr;
+		const float* mVelocitiesY = nullptr;
+		const float* mVelocitiesZ = nullptr;
+		const float* mRadii = nullptr;
+		const uint32_t* mFlags = nullptr;
+	};
+
+	// Maps the file and validates its structure. Returns false and describes the problem in aError if it is not a valid snapshot:
+	bool open(const std::string& aPath, std::string& aError)
+	{
+		using namespace particle_snapshot_format;
+		close();
+		if (!mFile.open(aPath)) {
+			aError = "Couldn't open '" + aPath + "'";
+			return false;
+		}
+		auto fail = [this, &aError](const std::string& aMessage) { aError = aMessage; close(); return false; };
+		if (mFile.size() < sizeof(header)) {
+			return fail("File too small for a particle snapshot");
+		}
+		mHeader = reinterpret_cast<const header*>(mFile.data());
+		if (cMagic != mHeader->mMagic) {
+			return fail("Not a particle snapshot");
+		}
+		if (cVersion != mHeader->mVersion || sizeof(header) != mHeader->mHeaderSize) {
+			return fail("Unsupported particle snapshot version " + std::to_string(mHeader->mVersion));
+		}
+		if (0 == mHeader->mNumFrames
+			|| !is_valid_block(mHeader->mFrameTableOffset, static_cast<uint64_t>(mHeader->mNumFrames) * sizeof(frame_record))
+			|| !is_valid_block(mHeader->mRadiiOffset, mHeader->mNumParticles * sizeof(float))
+			|| !is_valid_block(mHeader->mFlagsOffset, mHeader->mNumParticles * sizeof(uint32_t))) {
+			return fail("Corrupt particle snapshot header");
+		}
+		mFrames = reinterpret_cast<const frame_record*>(mFile.data() + mHeader->mFrameTableOffset);
+		for (uint32_t f = 0; f < mHeader->mNumFrames; ++f) {
+			const auto& r = mFrames[f];
+			bool valid = r.mNumParticles <= mHeader->mNumParticles;
+			for (int c = 0; c < 3; ++c) {
+				valid = valid && is_valid_block(r.mPositionOffsets[c], r.mNumParticles * sizeof(float));
+				valid = valid && (0 == r.mVelocityOffsets[c] || is_valid_block(r.mVelocityOffsets[c], r.mNumParticles * sizeof(float)));
+			}
+			if (!valid) {
+				return fail("Corrupt record of frame " + std::to_string(f));
+			}
+		}
+		return true;
+	}
+
+	void close()
+	{
+		mFile.close();
+		mHeader = nullptr;
+		mFrames = nullptr;
+	}
+
+	[[nodiscard]] bool is_open() const { return nullptr != mHeader; }
+	[[nodiscard]] size_t number_of_frames() const { return is_open() ? mHeader->mNumFrames : 0; }
+	[[nodiscard]] size_t max_number_of_particles() const { return is_open() ? static_cast<size_t>(mHeader->mNumParticles) : 0; }
+
+	[[nodiscard]] frame_view frame(size_t aIndex) const
+	{
+		const auto& r = mFrames[aIndex];
+		const auto floats = [this](uint64_t aOffset) { return 0 == aOffset ? nullptr : reinterpret_cast<const float*>(mFile.data() + aOffset); };
+		frame_view v;
+		v.mNumParticles = static_cast<size_t>(r.mNumParticles);
+		v.mTime = r.mTime;
+		v.mPositionsX = floats(r.mPositionOffsets[0]);
+		v.mPositionsY = floats(r.mPositionOffsets[1]);
+		v.mPositionsZ = floats(r.mPositionOffsets[2]);
+		v.mVelocitiesX = floats(r.mVelocityOffsets[0]);
+		v.mVelocitiesY = floats(r.mVelocityOffsets[1]);
+		v.mVelocitiesZ = floats(r.mVelocityOffsets[2]);
+		v.mRadii = floats(mHeader->mRadiiOffset);
+		v.mFlags = reinterpret_cast<const uint32_t*>(mFile.data() + mHeader->mFlagsOffset);
+		return v;
+	}
+
+	// Returns the index of the last frame whose time stamp is not later than aTime:
+	[[nodiscard]] size_t frame_at_time(double aTime) const
+	{
+		const auto* end = mFrames + mHeader->mNumFrames;
+		const auto* it = std::upper_bound(mFrames, end, aTime, [](double aT, const particle_snapshot_format::frame_record& aRecord) { return aT < aRecord.mTime; });
+		return it == mFrames ? 0 : static_cast<size_t>(it - mFrames) - 1;
+	}
+
+	// Lets the operating system read the given frame's data in the background, e.g. one frame ahead during playback:
+	void prefetch_frame(size_t aIndex) const
+	{
+		if (aIndex >= number_of_frames()) {
+			return;
+		}
+		const auto& r = mFrames[aIndex];
+		const auto bytes = static_cast<size_t>(r.mNumParticles) * sizeof(float);
+		for (int c = 0; c < 3; ++c) {
+			mFile.prefetch(static_cast<size_t>(r.mPositionOffsets[c]), bytes);
+		}
+	}
+
+	// Replaces the contents of aParticles with one frame (missing velocities become zero). This copies the data:
+	void load_into(size_t aIndex, particle_store& aParticles) const
+	{
+		const auto v = frame(aIndex);
+		aParticles.resize(v.mNumParticles);
+		const auto bytes = v.mNumParticles * sizeof(float);
+		std::memcpy(aParticles.positions_x(), v.mPositionsX, bytes);
+		std::memcpy(aParticles.positions_y(), v.mPositionsY, bytes);
+		std::memcpy(aParticles.positions_z(), v.mPositionsZ, bytes);
+		float* velocities[3] = { aParticles.velocities_x(), aParticles.velocities_y(), aParticles.velocities_z() };
+		const float* storedVelocities[3] = { v.mVelocitiesX, v.mVelocitiesY, v.mVelocitiesZ };
+		for (int c = 0; c < 3; ++c) {
+			if (nullptr != storedVelocities[c]) {
+				std::memcpy(velocities[c], storedVelocities[c], bytes);
+			}
+			else {
+				std::fill(velocities[c], velocities[c] + v.mNumParticles, 0.0f);
+			}
+		}
+		std::memcpy(aParticles.radii(), v.mRadii, bytes);
+		std::memcpy(aParticles.flags(), v.mFlags, v.mNumParticles * sizeof(uint32_t));
+	}
+
+private:
+	[[nodiscard]] bool is_valid_block(uint64_t aOffset, uint64_t aSize) const
+	{
+		return 0 == aOffset % particle_snapshot_format::cAlignment && aOffset <= mFile.size() && aSize <= mFile.size() - aOffset;
+	}
+
+	mapped_file mFile;
+	const particle_snapshot_format::header* mHeader = nullptr;
+	const particle_snapshot_format::frame_record* mFrames = nullptr;
+};
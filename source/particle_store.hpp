@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <glm/glm.hpp>
+
+#include "thread_pool.hpp"
+
+// Per-particle flags, stored in particle_store::flags():
+namespace particle_flags
+{
+	constexpr uint32_t none = 0u;
+	// The particle is not moved by the simulation (but still interacts with the others):
+	constexpr uint32_t frozen = 1u << 0;
+}
+
+// The source of truth for all water particles, stored as structure of arrays: one contiguous array
+// per attribute, each aligned to a cache line. Every per-particle loop (simulation, instance packing)
+// therefore streams through exactly the attributes it needs and can be vectorised.
+// Capacity grows in chunks of cGrowthChunk particles (never beyond max_size()), which keeps the
+// number of re-allocations low without reserving memory for the maximum number of particles upfront.
+// A particle's index only changes if the particles are reordered via permute(...), which affects all attributes alike.
+class particle_store
+{
+public:
+	static constexpr size_t cAlignment = 64;
+	static constexpr size_t cGrowthChunk = 16384;
+
+	explicit particle_store(size_t aMaxSize = SIZE_MAX)
+		: mMaxSize{ aMaxSize }
+	{}
+
+	[[nodiscard]] size_t size() const { return mSize; }
+	[[nodiscard]] bool empty() const { return 0 == mSize; }
+	[[nodiscard]] size_t capacity() const { return mCapacity; }
+	[[nodiscard]] size_t max_size() const { return mMaxSize; }
+	void set_max_size(size_t aMaxSize) { assert(aMaxSize >= mSize); mMaxSize = aMaxSize; }
+
+	// Memory which is occupied per particle (allocated or not):
+	[[nodiscard]] static constexpr size_t bytes_per_particle() { return cNumFloatArrays * sizeof(float) + sizeof(uint32_t); }
+
+	// Makes sure that there is room for at least aCount particles, rounded up to the next chunk:
+	void reserve(size_t aCount)
+	{
+		assert(aCount <= mMaxSize);
+		if (aCount <= mCapacity) {
+			return;
+		}
+		const auto newCapacity = std::min(mMaxSize, (aCount + cGrowthChunk - 1) / cGrowthChunk * cGrowthChunk);
+		for (auto& arr : mFloats) {
+			arr = reallocate(arr, newCapacity);
+		}
+		mFlags = reallocate(mFlags, newCapacity);
+		mCapacity = newCapacity;
+	}
+
+	void clear() { mSize = 0; }
+
+	// Sets the number of particles, e.g. before filling the arrays in bulk. Attributes of new particles are uninitialized:
+	void resize(size_t aCount)
+	{
+		reserve(aCount);
+		mSize = aCount;
+	}
+
+	// Appends a particle and returns its index:
+	size_t add(const glm::vec3& aPosition, float aRadius, const glm::vec3& aVelocity = glm::vec3{ 0.0f }, uint32_t aFlags = particle_flags::none)
+	{
+		assert(mSize < mMaxSize);
+		if (mSize == mCapacity) {
+			reserve(mSize + 1);
+		}
+		const auto i = mSize++;
+		mFloats[pos_x][i] = aPosition.x; mFloats[pos_y][i] = aPosition.y; mFloats[pos_z][i] = aPosition.z;
+		mFloats[vel_x][i] = aVelocity.x; mFloats[vel_y][i] = aVelocity.y; mFloats[vel_z][i] = aVelocity.z;
+		mFloats[radius][i] = aRadius;
+		mFlags[i] = aFlags;
+		return i;
+	}
+
+	// Reorders the particles s.t. the particle at index i is the one which has been at index aOldIndexOfNew[i] before.
+	// aOldIndexOfNew must be a permutation of [0, size()). Every attribute is gathered into a spare array, which then
+	// replaces the attribute's array; the replaced array becomes the spare one for the next attribute:
+	void permute(const uint32_t* aOldIndexOfNew, thread_pool& aPool)
+	{
+		const auto gather = [&](auto* aDst, const auto* aSrc) {
+			aPool.parallel_for(0, mSize, 16384, [=](size_t aBegin, size_t aEnd) {
+				for (size_t i = aBegin; i < aEnd; ++i) {
+					aDst[i] = aSrc[aOldIndexOfNew[i]];
+				}
+			});
+		};
+		auto spare = allocate<float>(mCapacity);
+		for (auto& arr : mFloats) {
+			gather(spare.get(), arr.get());
+			arr.swap(spare);
+		}
+		auto flags = allocate<uint32_t>(mCapacity);
+		gather(flags.get(), mFlags.get());
+		mFlags.swap(flags);
+	}
+
+	[[nodiscard]] glm::vec3 position(size_t aIndex) const { return glm::vec3{ mFloats[pos_x][aIndex], mFloats[pos_y][aIndex], mFloats[pos_z][aIndex] }; }
+	[[nodiscard]] glm::vec3 velocity(size_t aIndex) const { return glm::vec3{ mFloats[vel_x][aIndex], mFloats[vel_y][aIndex], mFloats[vel_z][aIndex] }; }
+
+	// The arrays of all attributes. Only the first size() elements are valid:
+	[[nodiscard]] float* positions_x() { return mFloats[pos_x].get(); }
+	[[nodiscard]] float* positions_y() { return mFloats[pos_y].get(); }
+	[[nodiscard]] float* positions_z() { return mFloats[pos_z].get(); }
+	[[nodiscard]] float* velocities_x() { return mFloats[vel_x].get(); }
+	[[nodiscard]] float* velocities_y() { return mFloats[vel_y].get(); }
+	[[nodiscard]] float* velocities_z() { return mFloats[vel_z].get(); }
+	[[nodiscard]] float* radii() { return mFloats[radius].get(); }
+	[[nodiscard]] uint32_t* flags() { return mFlags.get(); }
+	[[nodiscard]] const float* positions_x() const { return mFloats[pos_x].get(); }
+	[[nodiscard]] const float* positions_y() const { return mFloats[pos_y].get(); }
+	[[nodiscard]] const float* positions_z() const { return mFloats[pos_z].get(); }
+	[[nodiscard]] const float* velocities_x() const { return mFloats[vel_x].get(); }
+	[[nodiscard]] const float* velocities_y() const { return mFloats[vel_y].get(); }
+	[[nodiscard]] const float* velocities_z() const { return mFloats[vel_z].get(); }
+	[[nodiscard]] const float* radii() const { return mFloats[radius].get(); }
+	[[nodiscard]] const uint32_t* flags() const { return mFlags.get(); }
+
+private:
+	struct aligned_deleter
+	{
+		void operator()(void* aPtr) const { ::operator delete(aPtr, std::align_val_t{ cAlignment }); }
+	};
+	template <typename T>
+	using aligned_array = std::unique_ptr<T[], aligned_deleter>;
+
+	// Allocates a new aligned array of aCapacity (uninitialized) elements:
+	template <typename T>
+	[[nodiscard]] static aligned_array<T> allocate(size_t aCapacity)
+	{
+		return aligned_array<T>{ static_cast<T*>(::operator new(aCapacity * sizeof(T), std::align_val_t{ cAlignment })) };
+	}
+
+	// Allocates a new aligned array of aCapacity elements and moves the valid elements over:
+	template <typename T>
+	[[nodiscard]] aligned_array<T> reallocate(const aligned_array<T>& aOld, size_t aCapacity) const
+	{
+		auto result = allocate<T>(aCapacity);
+		if (mSize > 0) {
+			std::memcpy(result.get(), aOld.get(), mSize * sizeof(T));
+		}
+		return result;
+	}
+
+	enum float_array : size_t { pos_x, pos_y, pos_z, vel_x, vel_y, vel_z, radius, cNumFloatArrays };
+
+	aligned_array<float> mFloats[cNumFloatArrays];
+	aligned_array<uint32_t> mFlags;
+	size_t mSize = 0;
+	size_t mCapacity = 0;
+	size_t mMaxSize;
+};
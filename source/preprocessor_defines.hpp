@@ -5,5 +5,25 @@
 #define ENABLE_SHADER_HOT_RELOADING_FOR_RAY_TRACING_PIPELINE 1
 
 // Set this compiler switch to 1 to make the window resizable
-// and have the pipeline adapt to it. Set to 0 ti disable it.
+// and have the render targets adapt to it. Set to 0 to disable it.
 #define ENABLE_RESIZABLE_WINDOW 1
+
+// Set this compiler switch to 1 to store the imported triangle mesh geometry in a binary
+// cache file next to the scene, which makes subsequent launches skip Assimp. Set to 0 to disable it.
+#define ENABLE_SCENE_CACHE 1
+
+// Set this compiler switch to 1 to compact the BLAS of the static triangle
+// mesh geometry after they have been built. Set to 0 to disable it.
+#define ENABLE_BLAS_COMPACTION 1
+
+// Set this compiler switch to 1 to merge small static meshes of the same model
+// into shared BLAS, which reduces the number of TLAS instances. Set to 0 to disable it.
+#define ENABLE_STATIC_BLAS_MERGING 1
+
+// Set this compiler switch to 1 to store the preprocessed textures of the triangle mesh geometry
+// in a binary cache file next to the scene, which makes subsequent launches skip decoding. Set to 0 to disable it.
+#define ENABLE_TEXTURE_CACHE 1
+
+// Set this compiler switch to 1 to block-compress (BC1/BC3) the textures in the texture cache
+// if the device supports sampling from such images. Set to 0 to store them uncompressed.
+#define ENABLE_TEXTURE_COMPRESSION 1
@@ -7,6 +7,26 @@
 #include "preprocessor_defines.hpp"
 #include "cpu_to_gpu_data_types.hpp"
 #include "fluid_nightmare_main.hpp"
+#include "tlas_manager.hpp"
+#include "stable_descriptor_sets.hpp"
+#include "instance_packing.hpp"
+#include "thread_pool.hpp"
+#include "particle_store.hpp"
+#include "sph_solver.hpp"
+#include "spawn_candidate_selector.hpp"
+#include "cpu_scene_loader.hpp"
+#include "cpu_particle_spawner.hpp"
+#include "particle_snapshot.hpp"
+#include "fluid_surface.hpp"
+#include "fluid_surface_geometry.hpp"
+#include "particle_lod.hpp"
+#include "particle_chunks.hpp"
+#include "particle_chunk_geometry.hpp"
+#include "particle_reordering.hpp"
+#include "task_graph.hpp"
+#include "stage_command_buffers.hpp"
+#include "profiler.hpp"
+#include "gpu_profiler.hpp"
 
 // An invokee that handles triangle mesh geometry:
 class procedural_geometry_manager : public gvk::invokee
@@ -19,19 +39,47 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 
 	void initialize() override
 	{
-		// Create a descriptor cache that helps us to conveniently create descriptor sets,
-		// which describe where shaders can find resources like buffers or images:
-		mDescriptorCache = gvk::context().create_descriptor_cache();
-		
+		// Prepare the CPU-side fluid simulation for the maximum number of particles:
+		mParticles.set_max_size(cMaxNumParticles);
+
+		// Register the scopes which are measured by the profiler:
+		mSpawnDispatchScope = shared_profiler().scope("spawn dispatch");
+		mCpuSpawnScope = shared_profiler().scope("CPU spawn");
+		mCandidateReadbackScope = shared_profiler().scope("candidate readback");
+		mSimulationScope = shared_profiler().scope("simulation");
+		mSurfaceReconstructionScope = shared_profiler().scope("surface reconstruction");
+		mLodScope = shared_profiler().scope("particle LOD");
+		mChunksScope = shared_profiler().scope("particle chunks");
+		mReorderScope = shared_profiler().scope("particle reordering");
+
+		// Prepare the brick table of the reconstructed fluid surface (one per frame in flight):
+		mSurfaceGeometry.create(gvk::context().main_window()->number_of_frames_in_flight());
+
+		// Prepare the buffer of the particles' boxes for chunked BLAS (it is bound to the pipelines in any case):
+		mChunkGeometry.create(cMaxNumParticles, gvk::context().main_window()->number_of_frames_in_flight());
+
 		// For the BLAS, one single AABB is sufficient. Build it:
 		mBlas = gvk::context().create_bottom_level_acceleration_structure({ avk::acceleration_structure_size_requirements::from_aabbs(1u) }, false);
 		mBlas->build({ VkAabbPositionsKHR{ /* min: */ -1.f, -1.f, -1.f,  /* max: */ 1.f,  1.f,  1.f } });
 
-		// Create a buffer to hold a number of spawned particle candidiates, each one represented just by their position:
-		mSpawnedParticlesBuffer = gvk::context().create_buffer(
-			avk::memory_usage::host_coherent, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
-			avk::storage_buffer_meta::create_from_size(cNewParticleCandidatesToSpawn * sizeof(glm::vec4))
+		// All water particles' geometry instances only differ in their transformation matrices. Prepare the rest once:
+		mParticleInstanceHeader = make_packed_instance_header(
+			gvk::context().create_geometry_instance(mBlas) // Refer to the concrete BLAS; it is the same for each water particle
+				// Handle water particles instance offset of 1; i.e. based on that, the
+				// right (procedural) shaders will be chosen from the shader binding table:
+				.set_instance_offset(1)
 		);
+
+		mCandidates.resize(cNewParticleCandidatesToSpawn);
+
+		// Create buffers to hold a number of spawned particle candidiates, each one represented just by their position.
+		// We need one per slot of the readback queue, s.t. the GPU can fill one while we're reading another:
+		for (auto& slot : mSpawnSlots) {
+			slot.mCandidatesBuffer = gvk::context().create_buffer(
+				avk::memory_usage::host_coherent, vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+				avk::storage_buffer_meta::create_from_size(cNewParticleCandidatesToSpawn * sizeof(glm::vec4))
+			);
+		}
 		
 		// Create our ray tracing pipeline which spawns particles:
 		mPipeline = gvk::context().create_ray_tracing_pipeline_for(
@@ -46,9 +94,18 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 			// Define push constants and descriptor bindings:
 			avk::push_constant_binding_data{ avk::shader_type::ray_generation | avk::shader_type::closest_hit, 0, sizeof(push_const_data_particle_spawner) },
 			avk::descriptor_binding<avk::top_level_acceleration_structure>(0, 0, 1),
-			avk::descriptor_binding(0, 1, mSpawnedParticlesBuffer->as_storage_buffer())
+			avk::descriptor_binding(0, 1, mSpawnSlots[0].mCandidatesBuffer->as_storage_buffer()),
+			avk::descriptor_binding(0, 6, mChunkGeometry.boxes()->as_storage_buffer()) // rt_aabb.rint reads the spheres of chunked particles from there
 		);
 
+		// One descriptor set per frame in flight (whose TLAS is traced against) and slot (whose candidates buffer is filled).
+		// They are written at the first dispatch (see dispatch_spawn_rays) and bound as they are afterwards:
+		mSpawnDescriptorSets.create({
+			avk::descriptor_binding<avk::top_level_acceleration_structure>(0, 0, 1),
+			avk::descriptor_binding(0, 1, mSpawnSlots[0].mCandidatesBuffer->as_storage_buffer()),
+			avk::descriptor_binding(0, 6, mChunkGeometry.boxes()->as_storage_buffer())
+		}, static_cast<uint32_t>(gvk::context().main_window()->number_of_frames_in_flight()) * cMaxSpawnQueueDepth);
+
 #if ENABLE_SHADER_HOT_RELOADING_FOR_RAY_TRACING_PIPELINE
 		// Create an updater:
 		mUpdater.emplace();
@@ -63,7 +120,7 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 			imguiManager->add_callback([this]() {
 				ImGui::Begin("Procedural Geometry");
 				ImGui::SetWindowPos(ImVec2(422, 2.0f), ImGuiCond_FirstUseEver);
-				ImGui::SetWindowSize(ImVec2(402.0f, 224.0f), ImGuiCond_FirstUseEver);
+				ImGui::SetWindowSize(ImVec2(402.0f, 440.0f), ImGuiCond_FirstUseEver);
 
 				ImGui::Separator();
 				ImGui::Text("Spawn Settings:");
@@ -72,20 +129,142 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 				ImGui::SliderFloat("Spawn Cone Angle (Degrees)", &mSpawnAngle, 10.0f, 80.0f);
 				ImGui::Checkbox("Add Random Offset", &mRandomlyOffsetDirecion);
 				ImGui::SliderFloat("Radius of newly spawned particle", &mRadiusOfNewWaterParticles, 0.0001f, 1.0f);
+				ImGui::SliderInt("Max. New Particles per Dispatch", &mMaxNewParticlesPerSpawnDispatch, 1, static_cast<int>(cNewParticleCandidatesToSpawn));
+				ImGui::Text("Last dispatch: %zu of %u candidates accepted", mLastNumAcceptedCandidates, cNewParticleCandidatesToSpawn);
+				ImGui::Checkbox("Trace Spawn Rays on the CPU", &mSpawnOnCpu);
+				if (mSpawnOnCpu) {
+					ImGui::Text("Last CPU dispatch: %zu rays hit in %.2f ms (%zu threads)", mLastNumCpuSpawnHits, mLastCpuSpawnTimeMs, shared_thread_pool().size());
+				}
 
 				ImGui::Separator();
 				ImVec4 particlesStatusTextColor(0.0f, 0.9f, 0.3f, 1.0f);
-				if (mGeometryInstances.size() >= cMaxNumParticles) {
+				if (mParticles.size() >= cMaxNumParticles) {
 					mCurrentlySpawningWaterParticles = false; // Can't spawn any more
 					ImGui::PushItemFlag(ImGuiItemFlags_Disabled, true); // Disable the following checkbox
 					particlesStatusTextColor = ImVec4(0.9f, 0.3f, 0.0f, 1.0f);
 				}
 				ImGui::Checkbox("SPAWN NEW WATER PARTICLES!", &mCurrentlySpawningWaterParticles);
-				if (mGeometryInstances.size() >= cMaxNumParticles) {
+				if (mParticles.size() >= cMaxNumParticles) {
 					ImGui::PopItemFlag();
 				}
-				auto spawnStatus = fmt::format("{} particles spawned so far.", mGeometryInstances.size());
+				auto spawnStatus = fmt::format("{} particles spawned so far.", mParticles.size());
 				ImGui::TextColored(particlesStatusTextColor, spawnStatus.c_str());
+				ImGui::Text("Particle memory: %.2f MiB (%zu bytes per particle)", static_cast<float>(mParticles.capacity() * particle_store::bytes_per_particle()) / (1024.0f * 1024.0f), particle_store::bytes_per_particle());
+				ImGui::SliderInt("Spawn Readback Queue Depth", &mSpawnQueueDepth, 1, static_cast<int>(cMaxSpawnQueueDepth));
+				ImGui::Text("%llu frames stalled on spawn readback", static_cast<unsigned long long>(mNumStalledSpawnFrames));
+
+				ImGui::Separator();
+				ImGui::Text("Simulation Settings (SPH):");
+				auto& params = mSolver.parameters();
+				ImGui::Checkbox("Simulate Water Particles", &mSimulateParticles);
+				ImGui::DragFloat("Rest Density", &params.mRestDensity, 1.0f, 100.0f, 5000.0f);
+				ImGui::DragFloat("Stiffness", &params.mStiffness, 10.0f, 10.0f, 20000.0f);
+				ImGui::DragFloat("Viscosity", &params.mViscosity, 1.0f, 0.0f, 2000.0f);
+				ImGui::DragFloat3("Gravity", glm::value_ptr(params.mGravity), 0.01f);
+				ImGui::SliderFloat("Time Step [s]", &params.mFixedTimeStep, 1.0f / 1000.0f, 1.0f / 30.0f, "%.4f");
+				ImGui::SliderInt("Max. Substeps per Frame", &params.mMaxSubstepsPerFrame, 1, 16);
+				ImGui::DragFloat3("Domain Min", glm::value_ptr(params.mBoundsMin), 0.1f);
+				ImGui::DragFloat3("Domain Max", glm::value_ptr(params.mBoundsMax), 0.1f);
+				ImGui::Text("%d substeps in %.3f ms (last frame, %zu threads)", mLastNumSubsteps, mLastSimulationTimeMs, shared_thread_pool().size());
+
+				ImGui::Separator();
+				ImGui::Text("Particle Order:");
+				ImGui::Checkbox("Reorder Particles along a Morton Curve", &mReorderParticles);
+				auto& reorderParams = mReorderer.params();
+				ImGui::SliderFloat("Morton Cell Size", &reorderParams.mCellSize, 0.05f, 4.0f);
+				ImGui::Checkbox("63-bit Morton Codes", &reorderParams.mUse63BitCodes);
+				ImGui::SliderFloat("Reorder above Disorder", &reorderParams.mMaxDisorder, 0.0f, 0.5f, "%.3f");
+				int framesBetweenChecks = static_cast<int>(reorderParams.mFramesBetweenChecks);
+				if (ImGui::SliderInt("Frames between Checks", &framesBetweenChecks, 1, 300)) {
+					reorderParams.mFramesBetweenChecks = static_cast<uint32_t>(framesBetweenChecks);
+				}
+				if (ImGui::Button("Reorder Now")) {
+					mReorderNow = true;
+				}
+				if (mRecorder.is_open()) {
+					ImGui::Text("Paused while a sequence is being recorded.");
+				}
+				{
+					const auto& stats = mReorderer.stats();
+					ImGui::Text("Disorder: %.3f at the last check, %llu reorders so far", stats.mDisorder, static_cast<unsigned long long>(stats.mNumReorders));
+					if (stats.mReordered) {
+						ImGui::Text("Last reorder: codes %.2f ms, sort %.2f ms (%u passes), permute %.2f ms", stats.mCodesMs, stats.mSortMs, stats.mNumSortPasses, stats.mPermuteMs);
+					}
+				}
+
+				ImGui::Separator();
+				ImGui::Text("Level of Detail:");
+				ImGui::Checkbox("Cluster Distant Particles", &mEnableLod);
+				auto& lodParams = mLod.params();
+				int lodBudget = static_cast<int>(lodParams.mInstanceBudget);
+				if (ImGui::SliderInt("Instance Budget", &lodBudget, static_cast<int>(particle_lod::cMaxRoots), static_cast<int>(cMaxNumParticles))) {
+					lodParams.mInstanceBudget = static_cast<size_t>(lodBudget);
+					mLodOutdated = true;
+				}
+				mLodOutdated = ImGui::SliderFloat("Max. Angular Error", &lodParams.mMaxAngularError, 0.0005f, 0.05f, "%.4f") || mLodOutdated;
+				if (ImGui::SliderFloat("Cluster Cell Size", &lodParams.mClusterCellSize, 0.25f, 8.0f)) {
+					mLod.invalidate();
+					mLodOutdated = true;
+				}
+				ImGui::SliderFloat("Re-select after Camera Moved by", &mLodReselectDistance, 0.0f, 5.0f);
+				if (mLodActive) {
+					const auto& stats = mLod.stats();
+					ImGui::Text("%zu clusters in %zu levels (%s in %.2f ms)", stats.mNumClusters, stats.mNumLevels, stats.mRebuilt ? "built" : "refit", stats.mUpdateMs);
+					ImGui::Text("Selected: %zu clusters + %zu particles in %.2f ms", stats.mNumSelectedClusters, stats.mNumSelectedParticles, stats.mSelectMs);
+				}
+
+				ImGui::Separator();
+				ImGui::Text("Chunked BLAS:");
+				ImGui::Checkbox("Group Particles into Chunks (instead of one Instance each)", &mEnableChunks);
+				if (mChunksActive) {
+					const auto& stats = mChunks.stats();
+					ImGui::Text("%zu chunks of up to %u particles", stats.mNumChunks, particle_chunks::cChunkCapacity);
+					ImGui::Text("Last update: %zu BLAS rebuilt, %zu refit (%s in %.2f ms)", mChunkGeometry.number_of_rebuilt_blas(),
+						mChunkGeometry.number_of_updated_blas() - mChunkGeometry.number_of_rebuilt_blas(), stats.mRegrouped ? "regrouped" : "updated", stats.mUpdateMs);
+					ImGui::Text("BLAS memory: %.2f MiB", static_cast<float>(mChunkGeometry.blas_memory()) / (1024.0f * 1024.0f));
+				}
+
+				ImGui::Separator();
+				ImGui::Text("Fluid Surface:");
+				ImGui::Checkbox("Render Reconstructed Surface (instead of Spheres)", &mRenderSurface);
+				auto& surfaceParams = mSurface.params();
+				mSurfaceOutdated = ImGui::SliderFloat("Surface Cell Size", &surfaceParams.mCellSize, 0.05f, 1.0f) || mSurfaceOutdated;
+				mSurfaceOutdated = ImGui::SliderFloat("Kernel Radius / Particle Radius", &surfaceParams.mKernelRadiusScale, 1.5f, 4.0f) || mSurfaceOutdated;
+				if (mRenderSurface) {
+					const auto& stats = mSurface.stats();
+					ImGui::Text("%zu bricks (%zu re-meshed), %zu triangles", stats.mNumBricks, stats.mNumDirtyBricks, stats.mNumTriangles);
+					ImGui::Text("Reconstruction: %.2f ms (binning %.2f ms, meshing %.2f ms)", stats.mTotalMs, stats.mBinningMs, stats.mMeshingMs);
+					ImGui::Text("Surface memory: %.2f MiB", static_cast<float>(mSurfaceGeometry.geometry_memory()) / (1024.0f * 1024.0f));
+					if (!mSurfaceStatus.empty()) {
+						ImGui::TextWrapped("%s", mSurfaceStatus.c_str());
+					}
+				}
+
+				ImGui::Separator();
+				ImGui::Text("Particle Snapshots:");
+				ImGui::InputText("File", mSnapshotPath.data(), mSnapshotPath.size());
+				if (ImGui::Button("Save")) {
+					save_snapshot();
+				}
+				ImGui::SameLine();
+				if (ImGui::Button("Load")) {
+					load_snapshot();
+				}
+				ImGui::SameLine();
+				if (ImGui::Button(mRecorder.is_open() ? "Stop Recording" : "Record Sequence")) {
+					toggle_recording();
+				}
+				ImGui::SameLine();
+				if (ImGui::Button(mPlayingSequence ? "Stop Playback" : "Play Sequence")) {
+					toggle_playback();
+				}
+				if (mRecorder.is_open()) {
+					ImGui::Text("Recording: %zu frames", mRecorder.number_of_frames());
+				}
+				if (mPlayingSequence) {
+					ImGui::Text("Playing: frame %zu of %zu", mPlaybackFrame + 1, mPlayback.number_of_frames());
+				}
+				ImGui::TextWrapped("%s", mSnapshotStatus.c_str());
 
 				ImGui::End();
 			});
@@ -93,21 +272,91 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 	}
 	
 	// Returns true if a TLAS that uses the geometry of this invokee must be updated because the geometry has changed,
-	// which in this case always means: more particles have been added.
+	// which in this case means: more particles have been added, or particles have moved.
 	[[nodiscard]] bool has_updated_geometry_for_tlas() const
+	{
+		return tlas_update_type::none != mTlasUpdateRequired;
+	}
+
+	// Returns which kind of TLAS update the changes require: Moved particles can be refit,
+	// but new particles require a rebuild.
+	[[nodiscard]] tlas_update_type required_tlas_update() const
 	{
 		return mTlasUpdateRequired;
 	}
 
 	void reset_update_required_flag()
 	{
-		mTlasUpdateRequired = false;
+		mTlasUpdateRequired = tlas_update_type::none;
 	}
 
-	// Return the geometry instances to the caller, who will use it for a TLAS build:
-	[[nodiscard]] const auto& get_geometry_instances_buffer()
+	// Writes the water particles' geometry instances into the dynamic section of the given TLAS instance buffer.
+	// Only the instances which have changed since the last call are packed. Depending on the representation of
+	// the water, these are the spheres of all particles, the spheres which the LOD selection has chosen (clusters
+	// and particles), the chunks of particles (one per BLAS), or the instances of the reconstructed surface (one per brick):
+	void write_geometry_instances_for_tlas_build(tlas_instance_buffer& aInstances)
 	{
-		return mGeometryInstances;
+		const auto representation = mSurfaceActive ? water_representation::surface
+			: mChunksActive ? water_representation::chunks
+			: mLodActive ? water_representation::lod
+			: water_representation::spheres;
+		const bool switched = representation != mWrittenRepresentation; // All rows must be written
+		mWrittenRepresentation = representation;
+
+		if (water_representation::surface == representation) {
+			const auto count = mSurfaceGeometry.number_of_instances();
+			aInstances.set_number_of_dynamic_instances(count);
+			mSurfaceGeometry.write_instances(aInstances.dynamic_instances());
+			aInstances.mark_dynamic_instances_dirty(0, count);
+			return;
+		}
+
+		if (water_representation::chunks == representation) {
+			const auto count = mChunkGeometry.number_of_instances();
+			aInstances.set_number_of_dynamic_instances(count);
+			mChunkGeometry.write_instances(mChunks, aInstances.dynamic_instances());
+			aInstances.mark_dynamic_instances_dirty(0, count);
+			return;
+		}
+
+		if (water_representation::lod == representation) {
+			const auto count = mLod.number_of_selected();
+			const auto begin = switched ? 0 : std::min(mLodDirtyBegin, count);
+			const auto end = switched ? count : std::min(mLodDirtyEnd, count);
+			aInstances.set_number_of_dynamic_instances(count);
+			auto* rows = aInstances.dynamic_instances();
+			shared_thread_pool().parallel_for(begin, end, 16384, [this, rows](size_t aBegin, size_t aEnd) {
+				pack_sphere_instances(mLod.selected_x() + aBegin, mLod.selected_y() + aBegin, mLod.selected_z() + aBegin, mLod.selected_radii() + aBegin,
+					aEnd - aBegin, mParticleInstanceHeader, rows + aBegin);
+			});
+			aInstances.mark_dynamic_instances_dirty(begin, std::max(begin, end));
+			mLodDirtyBegin = SIZE_MAX;
+			mLodDirtyEnd = 0;
+			return;
+		}
+
+		// During playback of a sequence, the instances are packed directly from the mapped file:
+		const auto [x, y, z, r, end] = current_particles();
+		const auto begin = switched ? 0 : std::min(mFirstOutdatedInstance, end);
+		aInstances.set_number_of_dynamic_instances(end);
+		auto* rows = aInstances.dynamic_instances();
+		shared_thread_pool().parallel_for(begin, end, 16384, [this, rows, x, y, z, r](size_t aBegin, size_t aEnd) {
+			pack_sphere_instances(x + aBegin, y + aBegin, z + aBegin, r + aBegin, aEnd - aBegin, mParticleInstanceHeader, rows + aBegin);
+		});
+		aInstances.mark_dynamic_instances_dirty(begin, end);
+		mFirstOutdatedInstance = end;
+
+#ifdef _DEBUG
+		// The packed rows must be bit-identical to what the framework would produce for the same geometry instance:
+		if (begin < end) {
+			const packed_instance reference = avk::convert_for_gpu_usage(
+				gvk::context().create_geometry_instance(mBlas)
+					.set_instance_offset(1)
+					.set_transform_column_major(gvk::to_array(gvk::matrix_from_transforms(glm::vec3{ x[begin], y[begin], z[begin] }, glm::quat(), glm::vec3{ r[begin] })))
+			);
+			assert(0 == std::memcmp(&reference, rows + begin, sizeof(packed_instance)));
+		}
+#endif
 	}
 
 	// Invoked by the framework every frame:
@@ -119,47 +368,99 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 			mSpawnDirection = glm::vec3{ 0.0f, -1.0f, 0.0f };
 		}
 		mSpawnAngleRad = glm::radians(mSpawnAngle);
+		// The rest of this invokee's work is done by the stages which fluid_nightmare_main::update() runs (see add_update_stages)
+	}
 
-		if (mCurrentlySpawningWaterParticles && mGeometryInstances.size() <= cMaxNumParticles) {
-
-			// Okay, here's what we're going to do:
-			//  1) We let the GPU trace several rays
-			//  2) We read back the result
-			//  3) We select ONE particle position and add that to our instances
-			
-			auto& commandPool = gvk::context().get_command_pool_for_single_use_command_buffers(*mQueue);
-			auto cmdbfr = commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
-			cmdbfr->begin_recording();
-
-			// We're using only one TLAS for all frames in flight. Therefore, we need to set up a barrier
-			// affecting the whole queue which waits until all previous ray tracing work has completed:
-			cmdbfr->establish_execution_barrier(
-				avk::pipeline_stage::ray_tracing_shaders, /* -> */ avk::pipeline_stage::acceleration_structure_build
-			);
+	// The stages which add_update_stages(...) has added, which other stages of the frame depend on:
+	struct update_stages
+	{
+		task_graph::task_id mReadback;
+		task_graph::task_id mWaterRepresentation;
+	};
+
+	// How many command buffers the stages of add_update_stages(...) and dispatch_spawn_rays() acquire per frame at most:
+	static constexpr size_t cNumStageCommandBuffers = 3;
+
+	// Adds the stages of this invokee's per-frame work to aStages. A stage depends on the stages whose results it uses or
+	// whose data it modifies. The stages which record GPU work acquire their command buffers from aCommandBuffers, and they
+	// depend on each other, s.t. their submissions keep their order. The spawn rays are not dispatched by these stages,
+	// because they trace against the TLAS, which is built after the water representation (see dispatch_spawn_rays()):
+	update_stages add_update_stages(task_graph& aStages, stage_command_buffers& aCommandBuffers)
+	{
+		mStageCommandBuffers = &aCommandBuffers;
+		const auto readback = aStages.add("spawn readback", [this]() { readback_stage(); });
+		const auto simulation = aStages.add("simulation", [this]() { simulate(); }, { readback });
+		const auto reordering = aStages.add("reordering", [this]() { reorder_particles(); }, { simulation });
+		aStages.add("recording", [this]() { record_frame(); }, { reordering });
+		const auto playback = aStages.add("playback", [this]() {
+			if (mPlayingSequence) {
+				advance_playback(gvk::time().delta_time());
+			}
+		}, { reordering });
+		const auto waterRepresentation = aStages.add("water representation", [this]() {
+			update_lod();
+			update_fluid_surface();
+			update_particle_chunks();
+		}, { playback });
+		return update_stages{ readback, waterRepresentation };
+	}
+
+	// Lets the GPU trace this frame's spawn rays, if readback_stage() has decided so. The particles are not accessed.
+	// It is a stage of the frame, which must depend on this frame's TLAS build and on the "spawn readback" stage, and
+	// which must be submitted before tlas_manager::end_reads(...):
+	void dispatch_spawn_rays()
+	{
+		if (!mDispatchSpawnRays) {
+			return;
+		}
+		// Okay, here's what we're going to do:
+		//  1) We let the GPU trace several rays into the candidates buffer of the current slot
+		//  2) We read back the result a few frames later, when the GPU is done with it (see consume_completed_spawn_requests)
+		//  3) We select several non-overlapping particle positions and add them to our instances
+		cpu_scope dispatchScope(shared_profiler(), mSpawnDispatchScope);
+
+		// readback_stage() has made sure that this slot is free:
+		const auto slotIndex = static_cast<size_t>(mSpawnDispatchCounter % static_cast<uint64_t>(mSpawnQueueDepth));
+		auto& slot = mSpawnSlots[slotIndex];
+		assert(!slot.mPending);
+
+		auto& cmdbfr = mStageCommandBuffers->acquire();
+		cmdbfr->begin_recording();
+
+		auto* mainInvokee = gvk::current_composition()->element_by_type<fluid_nightmare_main>();
+		assert(nullptr != mainInvokee);
 
-			auto* mainInvokee = gvk::current_composition()->element_by_type<fluid_nightmare_main>();
-			assert(nullptr != mainInvokee);
-
-			cmdbfr->bind_pipeline(avk::const_referenced(mPipeline));
-			cmdbfr->bind_descriptors(mPipeline->layout(), mDescriptorCache.get_or_create_descriptor_sets({
-				avk::descriptor_binding(0, 0, mainInvokee->get_tlas()),
-				avk::descriptor_binding(0, 1, mSpawnedParticlesBuffer->as_storage_buffer())
-			}));
-
-			// Set the push constants:
-			auto pushConstantsForThisDrawCall = push_const_data_particle_spawner{
-				gvk::matrix_from_transforms(
-					glm::vec3{ mSpawnOrigin },                                 // Location of our spawning point
-					// Build a from-to-rotation quaternion:
-					glm::quat(glm::vec3{0.0f, -1.0f, 0.0f}, mSpawnDirection),  // How our spawning direction will be rotated => Create rotation relative to our default -y direction!
-					glm::vec3{1.0f}                                            // Scale doesn't matter
-				),
-				mSpawnAngleRad,
-				mRadiusOfNewWaterParticles
-			};
-			cmdbfr->handle().pushConstants(mPipeline->layout_handle(), vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR, 0, sizeof(pushConstantsForThisDrawCall), &pushConstantsForThisDrawCall);
-
-			// Do it:
+		// The TLASs are created by the main invokee, which is initialized after this one. Hence, the sets are written now:
+		if (!mSpawnDescriptorSetsWritten) {
+			for (size_t i = 0; i < mSpawnDescriptorSets.size(); ++i) {
+				mSpawnDescriptorSets.write(i, 0, mainInvokee->get_tlas(static_cast<int64_t>(i / cMaxSpawnQueueDepth)));
+				mSpawnDescriptorSets.write(i, 1, mSpawnSlots[i % cMaxSpawnQueueDepth].mCandidatesBuffer);
+				mSpawnDescriptorSets.write(i, 6, mChunkGeometry.boxes());
+			}
+			mSpawnDescriptorSetsWritten = true;
+		}
+
+		// Trace against this frame's TLAS, which has been built before (see tlas_manager), into the slot's candidates buffer:
+		const auto inFlightIndex = static_cast<size_t>(gvk::context().main_window()->in_flight_index_for_frame());
+		cmdbfr->bind_pipeline(avk::const_referenced(mPipeline));
+		mSpawnDescriptorSets.bind(*cmdbfr, vk::PipelineBindPoint::eRayTracingKHR, mPipeline->layout_handle(), inFlightIndex * cMaxSpawnQueueDepth + slotIndex);
+
+		// Set the push constants:
+		auto pushConstantsForThisDrawCall = push_const_data_particle_spawner{
+			gvk::matrix_from_transforms(
+				glm::vec3{ mSpawnOrigin },                                 // Location of our spawning point
+				// Build a from-to-rotation quaternion:
+				glm::quat(glm::vec3{0.0f, -1.0f, 0.0f}, mSpawnDirection),  // How our spawning direction will be rotated => Create rotation relative to our default -y direction!
+				glm::vec3{1.0f}                                            // Scale doesn't matter
+			),
+			mSpawnAngleRad,
+			mRadiusOfNewWaterParticles
+		};
+		cmdbfr->handle().pushConstants(mPipeline->layout_handle(), vk::ShaderStageFlagBits::eRaygenKHR | vk::ShaderStageFlagBits::eClosestHitKHR, 0, sizeof(pushConstantsForThisDrawCall), &pushConstantsForThisDrawCall);
+
+		// Do it:
+		{
+			gpu_scope traceScope(shared_gpu_profiler(), *cmdbfr, mSpawnDispatchScope);
 			cmdbfr->trace_rays(
 				vk::Extent3D{ cNewParticleCandidatesToSpawn, 1u, 1u },
 				mPipeline->shader_binding_table(),
@@ -167,51 +468,542 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 				avk::using_miss_group_at_index(0),
 				avk::using_hit_group_at_index(0)
 			);
+		}
+
+		// Make the candidates visible to the host, where we'll read them as soon as the fence has been signalled:
+		cmdbfr->establish_global_memory_barrier(
+			avk::pipeline_stage::ray_tracing_shaders,                /* -> */ avk::pipeline_stage::host,
+			avk::memory_access::shader_buffers_and_images_write_access, /* -> */ avk::memory_access::host_read_access
+		);
+
+		cmdbfr->end_recording();
+		// The command buffer stays alive until no frame in flight uses it anymore (see stage_command_buffers::release()),
+		// i.e. at least until the fence has been signalled:
+		slot.mFence = mQueue->submit_with_fence(avk::referenced(cmdbfr));
+		slot.mRadius = mRadiusOfNewWaterParticles;
+		slot.mSequenceNumber = mSpawnDispatchCounter++;
+		slot.mPending = true;
+	}
+
+	// The boxes of all particles while they are grouped into chunks (see particle_chunk_geometry):
+	[[nodiscard]] const avk::buffer& particle_boxes() const
+	{
+		return mChunkGeometry.boxes();
+	}
+
+	// The brick table of the reconstructed fluid surface for the given frame in flight (see fluid_surface_geometry):
+	[[nodiscard]] const avk::buffer& fluid_surface_brick_table(int64_t aInFlightIndex)
+	{
+		return mSurfaceGeometry.brick_table(aInFlightIndex);
+	}
+
+	// Invoked by the framework before the invokee is destroyed:
+	void finalize() override
+	{
+		mRecorder.finish();
+		// Don't destroy any resources which the GPU is still working with:
+		for (auto& slot : mSpawnSlots) {
+			if (slot.mPending) {
+				slot.mFence->wait_until_signalled();
+			}
+		}
+	}
+
+	// Some getters that will be used by the main invokee:
+	[[nodiscard]] constexpr uint32_t max_number_of_geometry_instances() const { return cMaxNumParticles; }
+
+	// How many particles one spawn dispatch may add at most (1 reproduces the original behavior of one particle per dispatch).
+	// Candidates which would overlap with existing particles or with each other are never accepted:
+	void set_max_new_particles_per_spawn_dispatch(uint32_t aMaxCount)
+	{
+		mMaxNewParticlesPerSpawnDispatch = static_cast<int>(std::clamp(aMaxCount, 1u, cNewParticleCandidatesToSpawn));
+	}
+	[[nodiscard]] uint32_t max_new_particles_per_spawn_dispatch() const { return static_cast<uint32_t>(mMaxNewParticlesPerSpawnDispatch); }
+	
+private: // v== Helper functions ==v
+
+	struct spawn_request_slot; // see below
+
+	// The number of spawn dispatches whose results have not been consumed yet:
+	[[nodiscard]] size_t num_pending_spawn_requests() const
+	{
+		return static_cast<size_t>(std::count_if(std::begin(mSpawnSlots), std::end(mSpawnSlots), [](const auto& slot) { return slot.mPending; }));
+	}
+
+	// The in-flight spawn dispatch with the lowest sequence number, or nullptr if there is none:
+	[[nodiscard]] spawn_request_slot* oldest_pending_spawn_request()
+	{
+		spawn_request_slot* oldest = nullptr;
+		for (auto& slot : mSpawnSlots) {
+			if (slot.mPending && (nullptr == oldest || slot.mSequenceNumber < oldest->mSequenceNumber)) {
+				oldest = &slot;
+			}
+		}
+		return oldest;
+	}
+
+	// The particles which are currently shown, i.e. a frame of the sequence which is being replayed, or mParticles:
+	[[nodiscard]] std::tuple<const float*, const float*, const float*, const float*, size_t> current_particles() const
+	{
+		if (mPlayingSequence) {
+			const auto frame = mPlayback.frame(mPlaybackFrame);
+			return { frame.mPositionsX, frame.mPositionsY, frame.mPositionsZ, frame.mRadii, frame.mNumParticles };
+		}
+		return { mParticles.positions_x(), mParticles.positions_y(), mParticles.positions_z(), mParticles.radii(), mParticles.size() };
+	}
+
+	// Switches the LOD selection on or off, updates the hierarchy if the particles have changed, and selects the spheres
+	// to render again if the camera has moved far enough (the selection of the previous frame is used otherwise):
+	void update_lod()
+	{
+		if (mEnableLod != mLodActive) {
+			mLodActive = mEnableLod;
+			mLod.invalidate();
+			mLodOutdated = mLodActive;
+			mTlasUpdateRequired = tlas_update_type::rebuild;
+		}
+		if (!mLodActive || mSurfaceActive || mChunksActive) {
+			return;
+		}
+
+		// Particles have changed whenever the instances would have to be updated:
+		const bool particlesChanged = mLodOutdated || tlas_update_type::none != mTlasUpdateRequired;
+		auto* mainInvokee = gvk::current_composition()->element_by_type<fluid_nightmare_main>();
+		assert(nullptr != mainInvokee);
+		const auto cameraPos = mainInvokee->camera_position();
+		if (!particlesChanged && glm::distance(cameraPos, mLodCameraPos) < mLodReselectDistance) {
+			return;
+		}
+		mLodOutdated = false;
+
+		cpu_scope lodScope(shared_profiler(), mLodScope);
+		const auto [x, y, z, r, count] = current_particles();
+		if (particlesChanged) {
+			mLod.update(x, y, z, r, count, shared_thread_pool());
+		}
+		const auto prevCount = mLod.number_of_selected();
+		const auto [begin, end] = mLod.select(cameraPos, x, y, z, r);
+		mLodCameraPos = cameraPos;
+		if (begin < end) {
+			mLodDirtyBegin = std::min(mLodDirtyBegin, begin);
+			mLodDirtyEnd = std::max(mLodDirtyEnd, end);
+			mTlasUpdateRequired = combine(mTlasUpdateRequired, prevCount == mLod.number_of_selected() ? tlas_update_type::refit : tlas_update_type::rebuild);
+		}
+	}
 
-			// We don't add a barrier here. We'll just wait for completion via the fence.
+	// Switches between spheres and the reconstructed surface, and reconstructs the surface if the particles have changed.
+	// The BLAS of all re-meshed bricks are built right away; the TLAS build of this frame is submitted after them:
+	void update_fluid_surface()
+	{
+		auto* mainWnd = gvk::context().main_window();
+		const auto frameId = mainWnd->current_frame();
+		mSurfaceGeometry.release_retired(frameId, mainWnd->number_of_frames_in_flight());
 
-			cmdbfr->end_recording();
-			auto fen = mQueue->submit_with_fence(avk::referenced(cmdbfr));
-			fen->wait_until_signalled();
+		if (mRenderSurface != mSurfaceActive) {
+			mSurfaceActive = mRenderSurface;
+			mSurfaceOutdated = mSurfaceActive;
+			if (!mSurfaceActive) {
+				mSurfaceGeometry.clear(frameId);
+				mSurface.clear();
+				mSurfaceStatus.clear();
+				mLodOutdated = true;
+				mChunksOutdated = true;
+			}
+			mTlasUpdateRequired = tlas_update_type::rebuild;
+		}
+		// Particles have changed whenever the instances would have to be updated:
+		if (!mSurfaceActive || (!mSurfaceOutdated && tlas_update_type::none == mTlasUpdateRequired)) {
+			return;
+		}
+		mSurfaceOutdated = false;
 
-			// Read back the data into an array:
-			auto candidates = mSpawnedParticlesBuffer->read<std::array<glm::vec4, cNewParticleCandidatesToSpawn>>(0, avk::sync::wait_idle());
-			// Select the "best" of the candidates. We'll just go for the candidate with minimal y coordinates:
-			glm::vec4 selectedCandidate = candidates[0];
-			for (uint32_t i = 1u; i < cNewParticleCandidatesToSpawn; ++i) {
-				if (candidates[i].y < selectedCandidate.y) {
-					selectedCandidate = candidates[i];
+		cpu_scope reconstructionScope(shared_profiler(), mSurfaceReconstructionScope);
+		const auto [x, y, z, r, count] = current_particles();
+		if (!mSurface.reconstruct(x, y, z, r, count, shared_thread_pool())) {
+			mSurfaceStatus = "The particles are spread over too large a volume, the surface has not been updated.";
+			return;
+		}
+		mSurfaceStatus.clear();
+		if (mSurface.changed_bricks().empty()) {
+			return;
+		}
+
+		auto& cmdbfr = mStageCommandBuffers->acquire();
+		cmdbfr->begin_recording();
+		bool instancesChanged;
+		{
+			gpu_scope buildScope(shared_gpu_profiler(), *cmdbfr, mSurfaceReconstructionScope);
+			instancesChanged = mSurfaceGeometry.update(mSurface, *cmdbfr, frameId);
+		}
+		cmdbfr->end_recording();
+		mQueue->submit(avk::referenced(cmdbfr));
+		if (mSurfaceGeometry.number_of_dropped_bricks() > 0) {
+			mSurfaceStatus = fmt::format("Only {} bricks fit into the brick table.", fluid_surface_geometry::cMaxBricks);
+		}
+		if (instancesChanged) {
+			mTlasUpdateRequired = tlas_update_type::rebuild; // Bricks refer to new BLAS
+		}
+	}
+
+	// Switches between one instance per particle and chunks of particles, and updates the boxes of the chunks if the
+	// particles have changed. The BLAS of all chunks whose boxes have changed are rebuilt or refit right away:
+	void update_particle_chunks()
+	{
+		if (mEnableChunks != mChunksActive) {
+			mChunksActive = mEnableChunks;
+			mChunks.invalidate();
+			mChunksOutdated = mChunksActive;
+			if (!mChunksActive) {
+				mLodOutdated = true;
+			}
+			mTlasUpdateRequired = tlas_update_type::rebuild;
+		}
+		// Particles have changed whenever the instances would have to be updated:
+		if (!mChunksActive || mSurfaceActive || (!mChunksOutdated && tlas_update_type::none == mTlasUpdateRequired)) {
+			return;
+		}
+		mChunksOutdated = false;
+
+		cpu_scope chunksScope(shared_profiler(), mChunksScope);
+		const auto [x, y, z, r, count] = current_particles();
+		mChunks.update(x, y, z, r, count, shared_thread_pool());
+		if (0 == mChunks.stats().mNumDirtyChunks && mChunks.chunks().size() == mChunkGeometry.number_of_instances()) {
+			return;
+		}
+
+		auto& cmdbfr = mStageCommandBuffers->acquire();
+		cmdbfr->begin_recording();
+		bool instancesChanged;
+		{
+			gpu_scope buildScope(shared_gpu_profiler(), *cmdbfr, mChunksScope);
+			instancesChanged = mChunkGeometry.update(mChunks, *cmdbfr, gvk::context().main_window()->in_flight_index_for_frame());
+		}
+		cmdbfr->end_recording();
+		mQueue->submit(avk::referenced(cmdbfr));
+		// The instances of the chunks never move, but the bounds of their BLAS change:
+		mTlasUpdateRequired = combine(mTlasUpdateRequired, instancesChanged || mChunks.stats().mRegrouped ? tlas_update_type::rebuild : tlas_update_type::refit);
+	}
+
+	// Consumes the results of earlier spawn dispatches which have completed in the meantime, and makes sure that this
+	// frame's dispatch has got a free slot. Particles which are spawned on the CPU are added right away:
+	void readback_stage()
+	{
+		mDispatchSpawnRays = false;
+		{
+			cpu_scope readbackScope(shared_profiler(), mCandidateReadbackScope);
+			consume_completed_spawn_requests();
+		}
+		if (!mCurrentlySpawningWaterParticles || mPlayingSequence) {
+			return;
+		}
+
+		// Alternatively, trace the spawn rays on the CPU and add the new particles right away:
+		if (mSpawnOnCpu) {
+			if (mParticles.size() < cMaxNumParticles) {
+				cpu_scope cpuSpawnScope(shared_profiler(), mCpuSpawnScope);
+				spawn_on_cpu();
+			}
+			return;
+		}
+
+		if (mParticles.size() + num_pending_spawn_requests() >= cMaxNumParticles) {
+			return;
+		}
+		// The slot which has been used mSpawnQueueDepth dispatches ago. If its results
+		// have not arrived yet, there's no other way than to wait for them:
+		auto& slot = mSpawnSlots[mSpawnDispatchCounter % static_cast<uint64_t>(mSpawnQueueDepth)];
+		if (slot.mPending) {
+			cpu_scope stallScope(shared_profiler(), mCandidateReadbackScope);
+			++mNumStalledSpawnFrames;
+			while (slot.mPending) { // Results are consumed in order => wait for the oldest ones first
+				oldest_pending_spawn_request()->mFence->wait_until_signalled();
+				consume_completed_spawn_requests();
+			}
+		}
+		mDispatchSpawnRays = true;
+	}
+
+	// Lets the water flow:
+	void simulate()
+	{
+		mLastNumSubsteps = 0;
+		mLastSimulationTimeMs = 0.0f;
+		if (mSimulateParticles && !mPlayingSequence && mParticles.size() > 0) {
+			cpu_scope simulationScope(shared_profiler(), mSimulationScope);
+			const auto t0 = std::chrono::steady_clock::now();
+			mSolver.parameters().mParticleRadius = mRadiusOfNewWaterParticles;
+			mLastNumSubsteps = mSolver.advance(mParticles, gvk::time().delta_time(), shared_thread_pool());
+			if (mLastNumSubsteps > 0) {
+				mFirstOutdatedInstance = 0; // All particles have moved
+				mTlasUpdateRequired = combine(mTlasUpdateRequired, tlas_update_type::refit); // Only transformations have changed
+			}
+			mLastSimulationTimeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - t0).count();
+		}
+	}
+
+	// Keeps spatial neighbours close in memory. Not while a sequence is being recorded, because its frames store the
+	// radii and flags of the particles only once per index (see particle_snapshot_writer):
+	void reorder_particles()
+	{
+		if ((mReorderParticles || mReorderNow) && !mPlayingSequence && !mRecorder.is_open()) {
+			cpu_scope reorderScope(shared_profiler(), mReorderScope);
+			const bool reordered = mReorderNow
+				? mReorderer.reorder(mParticles, shared_thread_pool(), true)
+				: mReorderer.update(mParticles, shared_thread_pool());
+			mReorderNow = false;
+			if (reordered) {
+				// Only the active hierarchies are kept up to date with the particles, the others are built anew when activated:
+				if (mLodActive) {
+					mLod.remap_particles(mReorderer.new_index_of());
+				}
+				else {
+					mLod.invalidate();
+				}
+				if (mChunksActive) {
+					mChunks.remap_particles(mReorderer.new_index_of());
 				}
+				else {
+					mChunks.invalidate();
+				}
+				mFirstOutdatedInstance = 0; // The instances are aligned with the particles' indices
+				mTlasUpdateRequired = combine(mTlasUpdateRequired, tlas_update_type::refit);
 			}
-			
-			mGeometryInstances.push_back(
-				gvk::context().create_geometry_instance(mBlas) // Refer to the concrete BLAS; it is the same for each water particle
-					// Handle water particles instance offset of 1; i.e. based on that, the
-					// right (procedural) shaders will be chosen from the shader binding table:
-					.set_instance_offset(1)
-					// Set this instance's transformation matrix (offset by the selected candidate's position, do not rotate, scale according to the current setting):
-				.set_transform_column_major(gvk::to_array(gvk::matrix_from_transforms(glm::vec3{ selectedCandidate }, glm::quat(), glm::vec3{ mRadiusOfNewWaterParticles })))
-			);
+		}
+	}
 
-			mTlasUpdateRequired = true;
+	// Appends the particles to the sequence which is being recorded, if any:
+	void record_frame()
+	{
+		if (mRecorder.is_open()) {
+			if (!mRecorder.write_frame(mParticles, mRecordingTime)) {
+				mSnapshotStatus = "Recording failed, file closed.";
+				mRecorder.finish();
+			}
+			mRecordingTime += gvk::time().delta_time();
 		}
-		else {
-			std::vector<glm::vec4> candidates(cNewParticleCandidatesToSpawn, glm::vec4{ 0.0f });
-			mSpawnedParticlesBuffer->read(candidates.data(), 0, avk::sync::wait_idle());
-
-			// Select the "best" of the candidates. We'll just go for the candidate with minimal y coordinates:
-			glm::vec4 selectedCandidate = candidates[0];
-			for (uint32_t i = 1u; i < cNewParticleCandidatesToSpawn; ++i) {
-				if (candidates[i].y < selectedCandidate.y) {
-					selectedCandidate = candidates[i];
+	}
+
+	// Reads back the candidates of all completed spawn dispatches (oldest first) and adds up to mMaxNewParticlesPerSpawnDispatch
+	// new particles per dispatch, none of which overlap with each other or with existing particles.
+	// This never blocks: the first dispatch which has not completed yet ends the process, s.t. the order is preserved.
+	void consume_completed_spawn_requests()
+	{
+		bool selectorReady = false;
+		mNewParticlePositions.clear();
+		mNewParticleRadii.clear();
+		for (;;) {
+			auto* oldest = oldest_pending_spawn_request();
+			if (nullptr == oldest || vk::Result::eSuccess != gvk::context().device().getFenceStatus(oldest->mFence->handle())) {
+				break;
+			}
+
+			// The GPU is done with it => read back the data without further synchronization:
+			oldest->mCandidatesBuffer->read(mCandidates.data(), 0, avk::sync::not_required());
+
+			// Only index the existing particles if there is something to select from:
+			if (!selectorReady) {
+				float maxRadius = 0.0f;
+				for (const auto& slot : mSpawnSlots) {
+					maxRadius = slot.mPending ? std::max(maxRadius, slot.mRadius) : maxRadius;
 				}
+				mSpawnSelector.begin(mParticles, maxRadius, shared_thread_pool());
+				selectorReady = true;
 			}
+
+			// Select candidates in a deterministic order (lowest first), but never more than fit into the particle budget:
+			const auto budget = cMaxNumParticles - std::min<size_t>(cMaxNumParticles, mParticles.size() + mNewParticlePositions.size());
+			mLastNumAcceptedCandidates = mSpawnSelector.select(
+				mCandidates.data(), mCandidates.size(), oldest->mRadius,
+				std::min<size_t>(budget, static_cast<size_t>(mMaxNewParticlesPerSpawnDispatch)),
+				mNewParticlePositions
+			);
+			mNewParticleRadii.resize(mNewParticlePositions.size(), oldest->mRadius);
+
+			// Free the slot:
+			oldest->mPending = false;
+			oldest->mFence = {};
 		}
+
+		add_new_particles();
+	}
+
+	// Traces the spawn rays of one dispatch against mCpuScene (see cpu_particle_spawner) instead of the TLAS, and adds the
+	// selected candidates right away. The static scene is loaded on first use; the mesh instances which have been disabled
+	// in the UI are not taken into account:
+	void spawn_on_cpu()
+	{
+		const auto t0 = std::chrono::steady_clock::now();
+		auto& pool = shared_thread_pool();
+		if (!mCpuSceneLoaded) {
+			// Same scene and flags as triangle_mesh_geometry_manager:
+			mCpuScene = load_cpu_scene_from_orca("assets/sponza_and_terrain.fscene", aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace, pool);
+			mCpuSceneLoaded = true;
+			mCpuSceneBuilt = false;
+		}
+		// The top-level BVH is only refit while the number of particles stays the same:
+		if (mCpuSceneBuilt && mParticles.size() == mCpuScene.number_of_spheres()) {
+			mCpuScene.refit_spheres(mParticles.positions_x(), mParticles.positions_y(), mParticles.positions_z(), mParticles.radii(), mParticles.size(), &pool);
+		}
+		else {
+			mCpuScene.set_spheres(mParticles.positions_x(), mParticles.positions_y(), mParticles.positions_z(), mParticles.radii(), mParticles.size());
+			mCpuScene.build(pool);
+			mCpuSceneBuilt = true;
+		}
+
+		cpu_spawn_settings settings;
+		settings.mSpawnTransformation = spawn_transformation(mSpawnOrigin, mSpawnDirection);
+		settings.mSpawnAngleRad = mSpawnAngleRad;
+		settings.mNewParticlesRadius = mRadiusOfNewWaterParticles;
+		mLastNumCpuSpawnHits = cpu_particle_spawner::trace(mCpuScene, settings, cNewParticleCandidatesToSpawn, mCandidates, pool);
+
+		mNewParticlePositions.clear();
+		mNewParticleRadii.clear();
+		mSpawnSelector.begin(mParticles, mRadiusOfNewWaterParticles, pool);
+		mLastNumAcceptedCandidates = mSpawnSelector.select(
+			mCandidates.data(), mCandidates.size(), mRadiusOfNewWaterParticles,
+			std::min<size_t>(cMaxNumParticles - mParticles.size(), static_cast<size_t>(mMaxNewParticlesPerSpawnDispatch)),
+			mNewParticlePositions
+		);
+		mNewParticleRadii.resize(mNewParticlePositions.size(), mRadiusOfNewWaterParticles);
+		add_new_particles();
+		mLastCpuSpawnTimeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - t0).count();
+	}
+
+	// Appends mNewParticlePositions and mNewParticleRadii to the particles:
+	void add_new_particles()
+	{
+		if (mNewParticlePositions.empty()) {
+			return;
+		}
+		// The selector refers to the particles' arrays => only add the new particles after all selections have been made:
+		mParticles.reserve(mParticles.size() + mNewParticlePositions.size());
+		for (size_t i = 0; i < mNewParticlePositions.size(); ++i) {
+			mParticles.add(mNewParticlePositions[i], mNewParticleRadii[i]);
+		}
+		// Their geometry instances (offset by the selected candidates' positions, not rotated, scaled according to the radius) must be written:
+		mFirstOutdatedInstance = std::min(mFirstOutdatedInstance, mParticles.size() - mNewParticlePositions.size());
+		mTlasUpdateRequired = tlas_update_type::rebuild; // The number of instances has changed
+	}
+
+	// Saves all particles as a single-frame snapshot to mSnapshotPath:
+	void save_snapshot()
+	{
+		const auto t0 = std::chrono::steady_clock::now();
+		const bool success = save_particle_snapshot(mSnapshotPath.data(), mParticles);
+		const auto ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - t0).count();
+		mSnapshotStatus = success
+			? fmt::format("Saved {} particles in {:.2f} ms.", mParticles.size(), ms)
+			: fmt::format("Couldn't write '{}'.", mSnapshotPath.data());
+	}
+
+	// Replaces all particles with the first frame of the snapshot at mSnapshotPath:
+	void load_snapshot()
+	{
+		stop_playback();
+		const auto t0 = std::chrono::steady_clock::now();
+		particle_snapshot snapshot;
+		std::string error;
+		if (!snapshot.open(mSnapshotPath.data(), error)) {
+			mSnapshotStatus = error;
+			return;
+		}
+		const auto numParticles = snapshot.frame(0).mNumParticles;
+		if (numParticles > cMaxNumParticles) {
+			mSnapshotStatus = fmt::format("The snapshot contains {} particles, but at most {} are supported.", numParticles, cMaxNumParticles);
+			return;
+		}
+		snapshot.load_into(0, mParticles);
+		mLod.invalidate();
+		mChunks.invalidate();
+		const auto ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - t0).count();
+		mSnapshotStatus = fmt::format("Loaded {} particles in {:.2f} ms.", numParticles, ms);
+		mFirstOutdatedInstance = 0;
+		mTlasUpdateRequired = tlas_update_type::rebuild;
+	}
+
+	// Starts recording every simulated frame to mSnapshotPath, or finishes the recording:
+	void toggle_recording()
+	{
+		if (mRecorder.is_open()) {
+			const auto numFrames = mRecorder.number_of_frames();
+			mSnapshotStatus = mRecorder.finish()
+				? fmt::format("Recorded {} frames.", numFrames)
+				: fmt::format("Couldn't finish '{}'.", mSnapshotPath.data());
+			return;
+		}
+		stop_playback();
+		// Only positions are needed to replay a sequence, leave out the velocities to halve the amount of data per frame:
+		if (!mRecorder.open(mSnapshotPath.data(), false)) {
+			mSnapshotStatus = fmt::format("Couldn't write '{}'.", mSnapshotPath.data());
+			return;
+		}
+		mRecordingTime = 0.0;
+		mSnapshotStatus.clear();
+	}
+
+	// Starts replaying the sequence at mSnapshotPath (in a loop), or stops it:
+	void toggle_playback()
+	{
+		if (mPlayingSequence) {
+			stop_playback();
+			return;
+		}
+		if (mRecorder.is_open()) {
+			mSnapshotStatus = "Stop recording first.";
+			return;
+		}
+		std::string error;
+		if (!mPlayback.open(mSnapshotPath.data(), error)) {
+			mSnapshotStatus = error;
+			return;
+		}
+		if (mPlayback.max_number_of_particles() > cMaxNumParticles) {
+			mSnapshotStatus = fmt::format("The sequence contains up to {} particles, but at most {} are supported.", mPlayback.max_number_of_particles(), cMaxNumParticles);
+			mPlayback.close();
+			return;
+		}
+		mPlayingSequence = true;
+		mPlaybackTime = 0.0;
+		mPlaybackFrame = 0;
+		mPlayback.prefetch_frame(0);
+		mPlayback.prefetch_frame(1);
+		mSnapshotStatus.clear();
+		mFirstOutdatedInstance = 0;
+		mTlasUpdateRequired = tlas_update_type::rebuild;
+	}
+
+	// Switches the instances back to mParticles:
+	void stop_playback()
+	{
+		if (!mPlayingSequence) {
+			return;
+		}
+		mPlayingSequence = false;
+		mPlayback.close();
+		mFirstOutdatedInstance = 0;
+		mTlasUpdateRequired = tlas_update_type::rebuild;
+	}
+
+	// Selects the frame according to the recorded time stamps, s.t. the sequence is replayed at its original speed.
+	// The pages of the next frame are requested ahead of time, s.t. the sequence streams from disk without stalls:
+	void advance_playback(float aDeltaTime)
+	{
+		const auto duration = mPlayback.frame(mPlayback.number_of_frames() - 1).mTime;
+		mPlaybackTime += aDeltaTime;
+		if (mPlaybackTime > duration) {
+			mPlaybackTime = duration > 0.0 ? std::fmod(mPlaybackTime, duration) : 0.0;
+		}
+		const auto frame = mPlayback.frame_at_time(mPlaybackTime);
+		if (frame == mPlaybackFrame) {
+			return;
+		}
+		const bool countChanged = mPlayback.frame(frame).mNumParticles != mPlayback.frame(mPlaybackFrame).mNumParticles;
+		mPlaybackFrame = frame;
+		mPlayback.prefetch_frame((frame + 1) % mPlayback.number_of_frames());
+		mFirstOutdatedInstance = 0; // All particles may have moved
+		mTlasUpdateRequired = combine(mTlasUpdateRequired, countChanged ? tlas_update_type::rebuild : tlas_update_type::refit);
 	}
 
-	// Some getters that will be used by the main invokee:
-	[[nodiscard]] constexpr uint32_t max_number_of_geometry_instances() const { return cMaxNumParticles; }
-	
 private: // v== Member variables ==v
 
 	// --------------- Some fundamental stuff -----------------
@@ -219,14 +1011,33 @@ private: // v== Member variables ==v
 	// Our only queue where we submit command buffers to:
 	avk::queue* mQueue;
 
-	// Our only descriptor cache which stores reusable descriptor sets:
-	avk::descriptor_cache mDescriptorCache;
+	// How many new particle candidates shall be spawned at a time (must be a square number, see spawn_particles.rgen):
+	const static uint32_t cNewParticleCandidatesToSpawn = 64u * 64u;
 
-	// How many new particle candidates shall be spawned at a time
-	const static uint32_t cNewParticleCandidatesToSpawn = 16u * 16u;
-	
-	// A buffer that will contain potential positions of new particles
-	avk::buffer mSpawnedParticlesBuffer;
+	// One entry of the ring of in-flight spawn dispatches:
+	struct spawn_request_slot
+	{
+		// A buffer that will contain potential positions of new particles:
+		avk::buffer mCandidatesBuffer;
+		// The fence which signals the completion of the dispatch which fills mCandidatesBuffer:
+		avk::fence mFence;
+		// The radius which the particle shall get:
+		float mRadius = 0.0f;
+		// Dispatches are consumed in the order of their sequence numbers:
+		uint64_t mSequenceNumber = 0;
+		// True while the results have not been consumed:
+		bool mPending = false;
+	};
+
+	// How many spawn dispatches can be in flight at most:
+	const static uint32_t cMaxSpawnQueueDepth = 4u;
+
+	// The ring of spawn dispatches. Only the first mSpawnQueueDepth entries are used for new dispatches:
+	std::array<spawn_request_slot, cMaxSpawnQueueDepth> mSpawnSlots;
+
+	// The descriptor sets of mPipeline, one per frame in flight and slot (see dispatch_spawn_rays):
+	stable_descriptor_sets mSpawnDescriptorSets;
+	bool mSpawnDescriptorSetsWritten = false;
 	
 	// ------------------- Constants/Settings ----------------------
 
@@ -242,8 +1053,109 @@ private: // v== Member variables ==v
 	// A BLAS which represents one single water particle. All other particles are instanced:
 	avk::bottom_level_acceleration_structure mBlas;
 
-	// A buffer which contains all a geometry instance for every single water particle:
-	std::vector<avk::geometry_instance> mGeometryInstances;
+	// Everything but the transformation matrix of every water particle's geometry instance:
+	packed_instance_header mParticleInstanceHeader;
+
+	// Geometry instances of the particles from this index on have not been written to the TLAS instance buffer yet:
+	size_t mFirstOutdatedInstance = 0;
+
+	// ------------------- Fluid simulation ------------------------
+
+	// All water particles. Their indices are aligned with the geometry instances, which are derived from this data:
+	particle_store mParticles;
+
+	// Simulates the water particles on the CPU:
+	sph_solver mSolver;
+
+	// True if the water particles shall move:
+	bool mSimulateParticles = true;
+
+	// Statistics of the last frame's simulation:
+	int mLastNumSubsteps = 0;
+	float mLastSimulationTimeMs = 0.0f;
+
+	// Sorts the particles along a Morton curve from time to time, if enabled (UI), or once on request (UI):
+	particle_reorderer mReorderer;
+	bool mReorderParticles = false;
+	bool mReorderNow = false;
+
+	// The command buffers which the stages of the frame record into (see add_update_stages):
+	stage_command_buffers* mStageCommandBuffers = nullptr;
+
+	// Set by readback_stage() if dispatch_spawn_rays() shall dispatch spawn rays in this frame:
+	bool mDispatchSpawnRays = false;
+
+	// ------------------- Particle snapshots ----------------------
+
+	// The file which snapshots and sequences are saved to and loaded from:
+	std::array<char, 260> mSnapshotPath = { "particles.fnps" };
+
+	// Records one frame per simulated frame while it is open:
+	particle_snapshot_writer mRecorder;
+	double mRecordingTime = 0.0;
+
+	// The sequence which is being replayed. While playing, it replaces mParticles as the source of the geometry instances:
+	particle_snapshot mPlayback;
+	bool mPlayingSequence = false;
+	double mPlaybackTime = 0.0;
+	size_t mPlaybackFrame = 0;
+
+	// Result of the last snapshot operation, shown in the UI:
+	std::string mSnapshotStatus;
+
+	// ------------------- Level of detail -------------------------
+
+	// Clusters distant particles, s.t. the number of spheres stays within a budget:
+	particle_lod mLod;
+
+	// True if the LOD selection shall be used (UI), and true if it actually is (switched in update()):
+	bool mEnableLod = false;
+	bool mLodActive = false;
+
+	// True if the hierarchy must be updated and the spheres selected again, even if neither the particles nor the camera have moved:
+	bool mLodOutdated = false;
+
+	// The camera position of the latest selection, and how far the camera must move until the spheres are selected again:
+	glm::vec3 mLodCameraPos = glm::vec3{ 0.0f };
+	float mLodReselectDistance = 0.5f;
+
+	// The range of the selection which has changed since its instances have been written:
+	size_t mLodDirtyBegin = SIZE_MAX;
+	size_t mLodDirtyEnd = 0;
+
+	// How the water is represented in the TLAS:
+	enum struct water_representation { spheres, lod, chunks, surface };
+	// The representation whose instances are in the TLAS instance buffer:
+	water_representation mWrittenRepresentation = water_representation::spheres;
+
+	// ------------------- Chunked BLAS ----------------------------
+
+	// Groups the particles into chunks (on the CPU), and holds the chunks' BLAS and the boxes of all particles:
+	particle_chunks mChunks;
+	particle_chunk_geometry mChunkGeometry;
+
+	// True if the particles shall be grouped into chunks (UI), and true if they actually are (switched in update()):
+	bool mEnableChunks = false;
+	bool mChunksActive = false;
+
+	// True if the chunks must be updated even if the particles haven't changed, e.g. after the surface has been switched off:
+	bool mChunksOutdated = false;
+
+	// ------------------- Fluid surface ---------------------------
+
+	// Reconstructs the surface from the particles (on the CPU), and holds its BLAS and the brick table:
+	fluid_surface_reconstructor mSurface;
+	fluid_surface_geometry mSurfaceGeometry;
+
+	// True if the surface shall be rendered instead of the spheres (UI), and true if it actually is (switched in update()):
+	bool mRenderSurface = false;
+	bool mSurfaceActive = false;
+
+	// True if the surface must be reconstructed even if the particles haven't changed, e.g. after its parameters have changed:
+	bool mSurfaceOutdated = false;
+
+	// Problems of the last reconstruction, shown in the UI:
+	std::string mSurfaceStatus;
 
 	// ------------------- UI settings -----------------------
 
@@ -266,8 +1178,54 @@ private: // v== Member variables ==v
 	// True if water particles are currently being spawned:
 	bool mCurrentlySpawningWaterParticles = false;
 
-	// True when an TLAS update is immanent:
-	bool mTlasUpdateRequired = true;
+	// Not none when an TLAS update is immanent:
+	tlas_update_type mTlasUpdateRequired = tlas_update_type::rebuild;
+
+	// After how many dispatches the results of a spawn dispatch are consumed (at the latest):
+	int mSpawnQueueDepth = 3;
+
+	// Total number of spawn dispatches so far:
+	uint64_t mSpawnDispatchCounter = 0;
+
+	// How often we had to wait for the GPU, because a dispatch's results were not available in time:
+	uint64_t mNumStalledSpawnFrames = 0;
+
+	// How many candidates of one spawn dispatch may become new particles at most:
+	int mMaxNewParticlesPerSpawnDispatch = 1024;
+
+	// Picks non-overlapping candidates, and the number it has accepted from the most recent dispatch:
+	spawn_candidate_selector mSpawnSelector;
+	size_t mLastNumAcceptedCandidates = 0;
+
+	// True if the spawn rays shall be traced on the CPU instead of the GPU (UI):
+	bool mSpawnOnCpu = false;
+
+	// The static scene and the particles on the CPU, which the spawn rays are traced against if mSpawnOnCpu is set:
+	cpu_scene mCpuScene;
+	bool mCpuSceneLoaded = false;
+	bool mCpuSceneBuilt = false;
+
+	// Statistics of the most recent dispatch on the CPU:
+	size_t mLastNumCpuSpawnHits = 0;
+	float mLastCpuSpawnTimeMs = 0.0f;
+
+	// Profiler scopes of the spawn dispatches (CPU: recording and submission, GPU: the ray tracing), of the spawn dispatches
+	// on the CPU (spawn_on_cpu()), of consume_completed_spawn_requests(), of the fluid simulation, of the surface reconstruction (GPU: the BLAS builds),
+	// of the LOD hierarchy update and selection, of the update of the chunks (GPU: the uploads and BLAS builds), and of the
+	// reordering of the particles:
+	profiler::scope_id mSpawnDispatchScope = 0;
+	profiler::scope_id mCpuSpawnScope = 0;
+	profiler::scope_id mCandidateReadbackScope = 0;
+	profiler::scope_id mSimulationScope = 0;
+	profiler::scope_id mSurfaceReconstructionScope = 0;
+	profiler::scope_id mLodScope = 0;
+	profiler::scope_id mChunksScope = 0;
+	profiler::scope_id mReorderScope = 0;
+
+	// Temporary data of consume_completed_spawn_requests(), kept around to avoid re-allocations:
+	std::vector<glm::vec4> mCandidates;
+	std::vector<glm::vec3> mNewParticlePositions;
+	std::vector<float> mNewParticleRadii;
 
 	// How often a particle has been spawned. I.e. this number should
 	// represent the total number of water particles in the scene:
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// A fixed-size ring buffer of samples; pushing overwrites the oldest sample once it is full.
+// The layout fits ImGui::PlotLines: pass data(), size() and offset() (the index of the oldest sample).
+template <size_t N>
+class sample_ring
+{
+public:
+	void push(float aValue)
+	{
+		mValues[mHead] = aValue;
+		mHead = (mHead + 1) % N;
+		mCount = std::min(mCount + 1, N);
+	}
+
+	void clear() { mHead = mCount = 0; }
+
+	[[nodiscard]] const float* data() const { return mValues.data(); }
+	[[nodiscard]] size_t size() const { return mCount; }
+	[[nodiscard]] size_t offset() const { return N == mCount ? mHead : 0; }
+	[[nodiscard]] static constexpr size_t capacity() { return N; }
+
+	// The i-th sample in chronological order (0 is the oldest):
+	[[nodiscard]] float operator[](size_t i) const { return mValues[(offset() + i) % N]; }
+
+	[[nodiscard]] float last() const { return 0 == mCount ? 0.0f : mValues[(mHead + N - 1) % N]; }
+
+private:
+	std::array<float, N> mValues{};
+	size_t mHead = 0;
+	size_t mCount = 0;
+};
+
+// Statistics over the samples in a sample_ring:
+struct sample_statistics
+{
+	size_t mNumSamples = 0;
+	float mMin = 0.0f;
+	float mAvg = 0.0f;
+	float mP99 = 0.0f;
+	float mMax = 0.0f;
+	float mLast = 0.0f;
+};
+
+template <size_t N>
+[[nodiscard]] sample_statistics compute_statistics(const sample_ring<N>& aRing)
+{
+	sample_statistics s;
+	s.mNumSamples = aRing.size();
+	if (0 == s.mNumSamples) {
+		return s;
+	}
+	std::array<float, N> sorted;
+	std::copy(aRing.data(), aRing.data() + aRing.size(), std::begin(sorted));
+	const auto end = std::begin(sorted) + aRing.size();
+	double sum = 0.0;
+	for (auto it = std::begin(sorted); it != end; ++it) {
+		sum += *it;
+	}
+	s.mAvg = static_cast<float>(sum / static_cast<double>(s.mNumSamples));
+	s.mMin = *std::min_element(std::begin(sorted), end);
+	s.mMax = *std::max_element(std::begin(sorted), end);
+	// Nearest-rank percentile:
+	const auto rank = static_cast<size_t>(std::ceil(0.99 * static_cast<double>(s.mNumSamples))) - 1;
+	std::nth_element(std::begin(sorted), std::begin(sorted) + rank, end);
+	s.mP99 = sorted[rank];
+	s.mLast = aRing.last();
+	return s;
+}
+
+// Collects per-frame timings of named scopes, measured on the CPU and/or on the GPU (see gpu_profiler).
+// Every scope accumulates the time of all of its occurrences during one frame; end_frame() turns the
+// accumulated times into one sample per scope and source, which are kept in fixed-size ring buffers.
+// Scopes which haven't occurred during a frame don't get a sample for it.
+// Scopes must be registered (via scope(...)) before they are used on multiple threads. Adding time to
+// a scope is lock-free and may happen on any thread, e.g. on the workers of a thread_pool.
+// This class does not depend on the GPU or on the framework and can be used anywhere.
+class profiler
+{
+public:
+	using scope_id = uint32_t;
+	static constexpr size_t cMaxScopes = 32;
+	static constexpr size_t cHistorySize = 512;
+
+	enum struct source { cpu, gpu };
+
+	// Returns the id of the scope with the given name, and registers it if it doesn't exist yet:
+	scope_id scope(const std::string& aName)
+	{
+		for (scope_id i = 0; i < mNumScopes; ++i) {
+			if (mScopes[i].mName == aName) {
+				return i;
+			}
+		}
+		assert(mNumScopes < cMaxScopes);
+		mScopes[mNumScopes].mName = aName;
+		return static_cast<scope_id>(mNumScopes++);
+	}
+
+	[[nodiscard]] size_t number_of_scopes() const { return mNumScopes; }
+	[[nodiscard]] const std::string& name(scope_id aScope) const { return mScopes[aScope].mName; }
+
+	void add_time(scope_id aScope, source aSource, std::chrono::nanoseconds aDuration)
+	{
+		auto& acc = mScopes[aScope].mAccumulators[static_cast<size_t>(aSource)];
+		acc.mNanoseconds.fetch_add(static_cast<uint64_t>(aDuration.count()), std::memory_order_relaxed);
+		acc.mOccurred.store(true, std::memory_order_relaxed);
+	}
+
+	// Turns the times which have been accumulated since the last call into samples:
+	void end_frame()
+	{
+		for (size_t i = 0; i < mNumScopes; ++i) {
+			for (size_t s = 0; s < 2; ++s) {
+				auto& acc = mScopes[i].mAccumulators[s];
+				if (acc.mOccurred.exchange(false, std::memory_order_relaxed)) {
+					mScopes[i].mHistories[s].push(static_cast<float>(static_cast<double>(acc.mNanoseconds.exchange(0, std::memory_order_relaxed)) * 1e-6));
+				}
+			}
+		}
+		++mNumFrames;
+	}
+
+	// The last cHistorySize samples of a scope, in milliseconds:
+	[[nodiscard]] const sample_ring<cHistorySize>& history(scope_id aScope, source aSource) const { return mScopes[aScope].mHistories[static_cast<size_t>(aSource)]; }
+	[[nodiscard]] sample_statistics statistics(scope_id aScope, source aSource) const { return compute_statistics(history(aScope, aSource)); }
+	[[nodiscard]] uint64_t number_of_frames() const { return mNumFrames; }
+
+	// Writes the statistics of all scopes as CSV (one line per scope and source which has samples):
+	bool write_csv(const std::string& aPath) const
+	{
+		std::ofstream file(aPath, std::ios::trunc);
+		file << "scope,source,samples,min_ms,avg_ms,p99_ms,max_ms,last_ms\n";
+		for_each_history([&](scope_id aScope, const char* aSource, const sample_statistics& aStats, const sample_ring<cHistorySize>&) {
+			file << '"' << name(aScope) << "\"," << aSource << ',' << aStats.mNumSamples << ',' << aStats.mMin << ',' << aStats.mAvg << ','
+				<< aStats.mP99 << ',' << aStats.mMax << ',' << aStats.mLast << '\n';
+		});
+		return static_cast<bool>(file);
+	}
+
+	// Writes the statistics and all samples (oldest first) of all scopes as JSON:
+	bool write_json(const std::string& aPath) const
+	{
+		std::ofstream file(aPath, std::ios::trunc);
+		file << "{\n  \"frames\": " << mNumFrames << ",\n  \"scopes\": [";
+		bool first = true;
+		for_each_history([&](scope_id aScope, const char* aSource, const sample_statistics& aStats, const sample_ring<cHistorySize>& aHistory) {
+			file << (first ? "\n" : ",\n") << "    { \"name\": \"" << name(aScope) << "\", \"source\": \"" << aSource << "\", \"samples\": " << aStats.mNumSamples
+				<< ", \"min_ms\": " << aStats.mMin << ", \"avg_ms\": " << aStats.mAvg << ", \"p99_ms\": " << aStats.mP99 << ", \"max_ms\": " << aStats.mMax
+				<< ", \"last_ms\": " << aStats.mLast << ", \"history_ms\": [";
+			for (size_t i = 0; i < aHistory.size(); ++i) {
+				file << (0 == i ? "" : ", ") << aHistory[i];
+			}
+			file << "] }";
+			first = false;
+		});
+		file << "\n  ]\n}\n";
+		return static_cast<bool>(file);
+	}
+
+	// Writes JSON if aPath ends with .json, and CSV otherwise:
+	bool write(const std::string& aPath) const
+	{
+		const auto isJson = aPath.size() >= 5 && 0 == aPath.compare(aPath.size() - 5, 5, ".json");
+		return isJson ? write_json(aPath) : write_csv(aPath);
+	}
+
+private:
+	template <typename F>
+	void for_each_history(F&& aCallback) const
+	{
+		const char* sourceNames[2] = { "cpu", "gpu" };
+		for (scope_id i = 0; i < mNumScopes; ++i) {
+			for (size_t s = 0; s < 2; ++s) {
+				const auto& h = mScopes[i].mHistories[s];
+				if (h.size() > 0) {
+					aCallback(i, sourceNames[s], compute_statistics(h), h);
+				}
+			}
+		}
+	}
+
+	struct accumulator
+	{
+		std::atomic<uint64_t> mNanoseconds{ 0 };
+		std::atomic<bool> mOccurred{ false };
+	};
+
+	struct scope_data
+	{
+		std::string mName;
+		accumulator mAccumulators[2];                  // per source
+		sample_ring<cHistorySize> mHistories[2];       // per source
+	};
+
+	std::array<scope_data, cMaxScopes> mScopes;
+	size_t mNumScopes = 0;
+	uint64_t mNumFrames = 0;
+};
+
+// Measures the CPU time from its construction until its destruction and adds it to a profiler scope:
+class cpu_scope
+{
+public:
+	cpu_scope(profiler& aProfiler, profiler::scope_id aScope)
+		: mProfiler{ &aProfiler }, mScope{ aScope }, mStart{ std::chrono::steady_clock::now() }
+	{}
+	cpu_scope(const cpu_scope&) = delete;
+	cpu_scope& operator=(const cpu_scope&) = delete;
+	~cpu_scope()
+	{
+		mProfiler->add_time(mScope, profiler::source::cpu, std::chrono::steady_clock::now() - mStart);
+	}
+
+private:
+	profiler* mProfiler;
+	profiler::scope_id mScope;
+	std::chrono::steady_clock::time_point mStart;
+};
+
+// A profiler which is shared by all systems of this application:
+inline profiler& shared_profiler()
+{
+	static profiler sProfiler;
+	return sProfiler;
+}
+
+// Command line switch which writes the profiler's statistics into a file when the application exits:
+//   fluid-nightmare --profile-output <profile.csv|profile.json>
+constexpr const char* cProfileOutputSwitch = "--profile-output";
+
+// Returns the path which follows the profile output switch in argv, or an empty string if it isn't present:
+inline std::string find_profile_output_path(int argc, char* argv[])
+{
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (std::string(argv[i]) == cProfileOutputSwitch) {
+			return argv[i + 1];
+		}
+	}
+	return {};
+}
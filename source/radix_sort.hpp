@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+// A parallel LSD radix sort of unsigned integer keys with a uint32_t value each (e.g. Morton codes and particle indices).
+// Every pass sorts by one byte of the keys: the input is split into one block per thread, the histograms of the blocks
+// are counted in parallel, and then every block scatters its elements to the offsets which the prefix sums over
+// (byte, block) yield. Hence, the sort is stable. Passes over bytes which are the same in all keys are skipped, i.e.
+// keys with 30 significant bits take at most four passes, even if they are stored in 64 bits.
+// The scratch memory is kept between sorts to avoid re-allocations.
+// This class does not depend on the GPU or on the framework and can be used anywhere.
+template <typename Key>
+class radix_sorter
+{
+	static_assert(std::is_unsigned<Key>::value, "Keys must be unsigned integers");
+
+public:
+	// Blocks are not made smaller than this, s.t. small inputs are sorted by fewer threads:
+	static constexpr size_t cMinBlockSize = 16384;
+
+	// Sorts aKeys ascendingly and permutes aValues along with them. Both must have the same size:
+	void sort(std::vector<Key>& aKeys, std::vector<uint32_t>& aValues, thread_pool& aPool)
+	{
+		const size_t n = aKeys.size();
+		if (n < 2) {
+			mNumPasses = 0;
+			return;
+		}
+		const size_t numBlocks = std::max<size_t>(1, std::min(aPool.size(), (n + cMinBlockSize - 1) / cMinBlockSize));
+		const size_t blockSize = (n + numBlocks - 1) / numBlocks;
+		const auto blockBegin = [=](size_t b) { return std::min(n, b * blockSize); };
+
+		// Find the bits which differ between the keys:
+		mBlockOr.assign(numBlocks, Key{ 0 });
+		mBlockAnd.assign(numBlocks, static_cast<Key>(~Key{ 0 }));
+		aPool.parallel_for_each_index(0, numBlocks, 1, [&](size_t b) {
+			Key anyOnes = 0, allOnes = static_cast<Key>(~Key{ 0 });
+			for (size_t i = blockBegin(b); i < blockBegin(b + 1); ++i) {
+				anyOnes |= aKeys[i];
+				allOnes &= aKeys[i];
+			}
+			mBlockOr[b] = anyOnes;
+			mBlockAnd[b] = allOnes;
+		});
+		Key anyOnes = 0, allOnes = static_cast<Key>(~Key{ 0 });
+		for (size_t b = 0; b < numBlocks; ++b) {
+			anyOnes |= mBlockOr[b];
+			allOnes &= mBlockAnd[b];
+		}
+		const Key varying = anyOnes & static_cast<Key>(~allOnes);
+
+		mTmpKeys.resize(n);
+		mTmpValues.resize(n);
+		mHistograms.resize(numBlocks * 256);
+		Key* srcKeys = aKeys.data();
+		uint32_t* srcValues = aValues.data();
+		Key* dstKeys = mTmpKeys.data();
+		uint32_t* dstValues = mTmpValues.data();
+		mNumPasses = 0;
+		for (unsigned shift = 0; shift < sizeof(Key) * 8; shift += 8) {
+			if (0 == ((varying >> shift) & 0xFF)) {
+				continue;
+			}
+			aPool.parallel_for_each_index(0, numBlocks, 1, [&](size_t b) {
+				uint32_t* histogram = mHistograms.data() + b * 256;
+				std::fill(histogram, histogram + 256, 0u);
+				for (size_t i = blockBegin(b); i < blockBegin(b + 1); ++i) {
+					++histogram[(srcKeys[i] >> shift) & 0xFF];
+				}
+			});
+			// Every block's offset for every byte value, ordered by byte value first and block second:
+			uint32_t sum = 0;
+			for (size_t d = 0; d < 256; ++d) {
+				for (size_t b = 0; b < numBlocks; ++b) {
+					const auto count = mHistograms[b * 256 + d];
+					mHistograms[b * 256 + d] = sum;
+					sum += count;
+				}
+			}
+			aPool.parallel_for_each_index(0, numBlocks, 1, [&](size_t b) {
+				uint32_t* offsets = mHistograms.data() + b * 256;
+				for (size_t i = blockBegin(b); i < blockBegin(b + 1); ++i) {
+					const auto o = offsets[(srcKeys[i] >> shift) & 0xFF]++;
+					dstKeys[o] = srcKeys[i];
+					dstValues[o] = srcValues[i];
+				}
+			});
+			std::swap(srcKeys, dstKeys);
+			std::swap(srcValues, dstValues);
+			++mNumPasses;
+		}
+		// After an odd number of passes, the result is in the scratch memory:
+		if (1 == mNumPasses % 2) {
+			aKeys.swap(mTmpKeys);
+			aValues.swap(mTmpValues);
+		}
+	}
+
+	// How many passes the most recent sort(...) has needed:
+	[[nodiscard]] uint32_t number_of_passes() const { return mNumPasses; }
+
+private:
+	std::vector<Key> mTmpKeys;
+	std::vector<uint32_t> mTmpValues;
+	std::vector<uint32_t> mHistograms;
+	std::vector<Key> mBlockOr;
+	std::vector<Key> mBlockAnd;
+	uint32_t mNumPasses = 0;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// The resolution to ray trace at for a given output resolution and render scale (which applies to both axes):
+[[nodiscard]] inline glm::uvec2 scaled_render_resolution(const glm::uvec2& aOutputResolution, float aScale)
+{
+	const auto scaled = [aScale](uint32_t aSize) { return static_cast<uint32_t>(std::max(1L, std::lround(static_cast<float>(aSize) * aScale))); };
+	return glm::uvec2{ scaled(aOutputResolution.x), scaled(aOutputResolution.y) };
+}
+
+// Adapts the render scale s.t. the measured GPU time of rendering approaches a budget. The cost of ray tracing
+// grows with the number of pixels, i.e. with the square of the scale. Measurements are smoothed, and the scale
+// changes only in steps of cScaleStep and not more often than every cCooldownFrames frames, because every change
+// recreates the render targets (and restarts the temporal accumulation of ambient occlusion).
+class dynamic_render_scale
+{
+public:
+	static constexpr float cScaleStep = 0.05f;
+	static constexpr uint32_t cCooldownFrames = 30;
+	static constexpr float cSmoothing = 0.1f;
+
+	// Feeds the GPU time of one frame (in milliseconds) and returns the render scale to use from now on:
+	float update(float aMeasuredMs)
+	{
+		mSmoothedMs = mSmoothedMs > 0.0f ? mSmoothedMs + (aMeasuredMs - mSmoothedMs) * cSmoothing : aMeasuredMs;
+		if (++mFramesSinceChange < cCooldownFrames || mSmoothedMs <= 0.0f) {
+			return mScale;
+		}
+		// Change only if the ideal scale is at least one full step away, which prevents toggling between two steps:
+		const float ideal = mScale * std::sqrt(mBudgetMs / mSmoothedMs);
+		if (std::abs(ideal - mScale) >= cScaleStep) {
+			const float quantized = std::clamp(std::round(ideal / cScaleStep) * cScaleStep, mMinScale, mMaxScale);
+			if (quantized != mScale) {
+				mScale = quantized;
+				mFramesSinceChange = 0;
+				mSmoothedMs = 0.0f; // Measurements at the old scale are meaningless now
+			}
+		}
+		return mScale;
+	}
+
+	// Starts over at the given scale, e.g. when switching from a fixed scale to the dynamic mode:
+	void reset(float aScale)
+	{
+		mScale = std::clamp(aScale, mMinScale, mMaxScale);
+		mSmoothedMs = 0.0f;
+		mFramesSinceChange = 0;
+	}
+
+	void set_budget_ms(float aBudgetMs) { mBudgetMs = std::max(aBudgetMs, 0.1f); }
+	void set_limits(float aMinScale, float aMaxScale)
+	{
+		mMinScale = std::min(aMinScale, aMaxScale);
+		mMaxScale = aMaxScale;
+		mScale = std::clamp(mScale, mMinScale, mMaxScale);
+	}
+
+	[[nodiscard]] float scale() const { return mScale; }
+	[[nodiscard]] float budget_ms() const { return mBudgetMs; }
+	[[nodiscard]] float min_scale() const { return mMinScale; }
+	[[nodiscard]] float max_scale() const { return mMaxScale; }
+
+private:
+	float mScale = 1.0f;
+	float mBudgetMs = 8.0f;
+	float mMinScale = 0.5f;
+	float mMaxScale = 1.0f;
+	float mSmoothedMs = 0.0f;
+	uint32_t mFramesSinceChange = 0;
+};
@@ -0,0 +1,519 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "mapped_file.hpp"
+
+// A 64-bit hash of arbitrary bytes, processed in 8-byte words (fast enough to hash large model files on startup):
+inline uint64_t hash_bytes(const void* aData, size_t aSize, uint64_t aSeed = 0)
+{
+	constexpr uint64_t cPrime = 0x9E3779B97F4A7C15ull;
+	const auto mix = [](uint64_t h) {
+		h ^= h >> 33; h *= 0xFF51AFD7ED558CCDull;
+		h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ull;
+		return h ^ (h >> 33);
+	};
+	const auto* bytes = static_cast<const uint8_t*>(aData);
+	uint64_t h = aSeed ^ (static_cast<uint64_t>(aSize) * cPrime);
+	size_t i = 0;
+	for (; i + 8 <= aSize; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, bytes + i, 8);
+		h = (h ^ mix(word)) * cPrime;
+	}
+	uint64_t tail = 0;
+	std::memcpy(&tail, bytes + i, aSize - i);
+	h = (h ^ mix(tail)) * cPrime;
+	return mix(h);
+}
+
+// Hashes the contents of a file. Returns false if it can't be read:
+inline bool hash_file(const std::string& aPath, uint64_t& aHash, uint64_t& aSize)
+{
+	mapped_file file;
+	if (!file.open(aPath)) {
+		return false;
+	}
+	aHash = hash_bytes(file.data(), file.size());
+	aSize = file.size();
+	return true;
+}
+
+// A preprocessed, binary form of the triangle mesh geometry which triangle_mesh_geometry_manager
+// creates from an ORCA scene: one group of meshes per distinct material config of every model,
+// with positions, indices, normals and texture coordinates, the instances of the groups, and
+// the material configs. The file records the hashes of all source files it has been created from,
+// and the import flags, i.e. it can be detected whether it is outdated without invoking Assimp.
+// All offsets are in bytes from the beginning of the file, and all blocks are aligned to 64 bytes,
+// s.t. the vertex data can be uploaded from a mapped file in place:
+//
+//   header
+//   per group: positions, indices, normals, texture coordinates
+//   source files, models, groups, instances, materials (one table each)
+//   strings
+namespace scene_cache_format
+{
+	constexpr uint32_t cMagic = 0x43534E46u; // "FNSC"
+	constexpr uint32_t cVersion = 2u;
+	constexpr size_t cAlignment = 64;
+
+	// Texture slots of a material, in the same order as in the shaders' MaterialGpuData:
+	enum texture_slot : uint32_t { diffuse, specular, ambient, emissive, height, normals, shininess, opacity, displacement, reflection, lightmap, extra, cNumTextureSlots };
+
+	// Refers to a string in the strings block (which is not null-terminated):
+	struct string_ref
+	{
+		uint32_t mOffset;
+		uint32_t mLength;
+	};
+
+	struct header
+	{
+		uint32_t mMagic;
+		uint32_t mVersion;
+		uint32_t mHeaderSize;
+		uint32_t mNumSourceFiles;
+		uint64_t mImportFlags;
+		uint32_t mNumModels;
+		uint32_t mNumGroups;
+		uint32_t mNumInstances;
+		uint32_t mNumMaterials;
+		uint64_t mSourceFilesOffset;
+		uint64_t mModelsOffset;
+		uint64_t mGroupsOffset;
+		uint64_t mInstancesOffset;
+		uint64_t mMaterialsOffset;
+		uint64_t mStringsOffset;
+		uint64_t mStringsSize;
+		uint64_t mReserved[4];
+	};
+	static_assert(sizeof(header) == 128, "The header is expected to occupy 128 bytes");
+
+	struct source_file
+	{
+		string_ref mPath;
+		uint64_t mSize;
+		uint64_t mHash;
+	};
+
+	// A model of the ORCA scene. Its instances are [mFirstInstance, mEndInstance) of the instances table,
+	// and its groups are [mFirstGroup, mEndGroup) of the groups table. Every instance of a model exists once per group:
+	struct model
+	{
+		string_ref mName;
+		uint32_t mFirstInstance;
+		uint32_t mEndInstance;
+		uint32_t mFirstGroup;
+		uint32_t mEndGroup;
+	};
+
+	// Meshes of one model which share the same material. Group i uses material i:
+	struct group
+	{
+		uint32_t mNumVertices;
+		uint32_t mNumIndices;
+		uint64_t mPositionsOffset; // glm::vec3 per vertex
+		uint64_t mIndicesOffset;   // uint32_t per index
+		uint64_t mNormalsOffset;   // glm::vec3 per vertex
+		uint64_t mTexCoordsOffset; // glm::vec2 per vertex
+	};
+
+	struct instance
+	{
+		glm::mat4 mTransform;
+		uint32_t mGroup;
+		string_ref mDescription;
+		uint32_t mPadding;
+	};
+
+	// All values of a material config which the shaders can access:
+	struct material
+	{
+		string_ref mName;
+		string_ref mTextures[cNumTextureSlots]; // Paths, empty if a slot is not used
+		glm::vec4 mTexOffsetTiling[cNumTextureSlots];
+		glm::vec4 mDiffuseReflectivity;
+		glm::vec4 mAmbientReflectivity;
+		glm::vec4 mSpecularReflectivity;
+		glm::vec4 mEmissiveColor;
+		glm::vec4 mTransparentColor;
+		glm::vec4 mReflectiveColor;
+		glm::vec4 mAlbedo;
+		float mOpacity;
+		float mBumpScaling;
+		float mShininess;
+		float mShininessStrength;
+		float mRefractionIndex;
+		float mReflectivity;
+		float mMetallic;
+		float mSmoothness;
+		float mSheen;
+		float mThickness;
+		float mRoughness;
+		float mAnisotropy;
+		glm::vec4 mAnisotropyRotation;
+		glm::vec4 mCustomData;
+	};
+}
+
+// Collects the data of a scene cache and creates the file's contents. Add the source files, then the models
+// with their groups and instances in the order in which they shall be used, then invoke build():
+class scene_cache_builder
+{
+public:
+	explicit scene_cache_builder(uint64_t aImportFlags)
+		: mImportFlags{ aImportFlags }
+	{}
+
+	// Records a file which the scene has been created from. Returns false if it can't be read:
+	bool add_source_file(const std::string& aPath)
+	{
+		scene_cache_format::source_file file{};
+		if (!hash_file(aPath, file.mHash, file.mSize)) {
+			return false;
+		}
+		file.mPath = add_string(aPath);
+		mSourceFiles.push_back(file);
+		return true;
+	}
+
+	scene_cache_format::string_ref add_string(const std::string& aString)
+	{
+		const scene_cache_format::string_ref ref{ static_cast<uint32_t>(mStrings.size()), static_cast<uint32_t>(aString.size()) };
+		mStrings += aString;
+		return ref;
+	}
+
+	// Starts a new model. All groups and instances which are added afterwards belong to it:
+	void begin_model(const std::string& aName)
+	{
+		const auto numInstances = static_cast<uint32_t>(mInstances.size());
+		const auto numGroups = static_cast<uint32_t>(mGroupData.size());
+		mModels.push_back(scene_cache_format::model{ add_string(aName), numInstances, numInstances, numGroups, numGroups });
+	}
+
+	// Adds a group of meshes and its material, and returns the group's index:
+	uint32_t add_group(const scene_cache_format::material& aMaterial, std::vector<glm::vec3> aPositions, std::vector<uint32_t> aIndices, std::vector<glm::vec3> aNormals, std::vector<glm::vec2> aTexCoords)
+	{
+		aNormals.resize(aPositions.size());
+		aTexCoords.resize(aPositions.size());
+		mMaterials.push_back(aMaterial);
+		mGroupData.push_back(group_data{ std::move(aPositions), std::move(aIndices), std::move(aNormals), std::move(aTexCoords) });
+		mModels.back().mEndGroup = static_cast<uint32_t>(mGroupData.size());
+		return static_cast<uint32_t>(mGroupData.size() - 1);
+	}
+
+	void add_instance(uint32_t aGroup, const glm::mat4& aTransform, const std::string& aDescription)
+	{
+		scene_cache_format::instance inst{};
+		inst.mTransform = aTransform;
+		inst.mGroup = aGroup;
+		inst.mDescription = add_string(aDescription);
+		mInstances.push_back(inst);
+		mModels.back().mEndInstance = static_cast<uint32_t>(mInstances.size());
+	}
+
+	// Creates the contents of the cache file:
+	[[nodiscard]] std::vector<uint8_t> build() const
+	{
+		using namespace scene_cache_format;
+		std::vector<uint8_t> image(sizeof(header));
+		auto append = [&image](const void* aData, size_t aSize) {
+			image.resize((image.size() + cAlignment - 1) / cAlignment * cAlignment);
+			const auto offset = static_cast<uint64_t>(image.size());
+			image.insert(std::end(image), static_cast<const uint8_t*>(aData), static_cast<const uint8_t*>(aData) + aSize);
+			return offset;
+		};
+
+		std::vector<group> groups;
+		for (const auto& d : mGroupData) {
+			group g{};
+			g.mNumVertices = static_cast<uint32_t>(d.mPositions.size());
+			g.mNumIndices = static_cast<uint32_t>(d.mIndices.size());
+			g.mPositionsOffset = append(d.mPositions.data(), d.mPositions.size() * sizeof(glm::vec3));
+			g.mIndicesOffset = append(d.mIndices.data(), d.mIndices.size() * sizeof(uint32_t));
+			g.mNormalsOffset = append(d.mNormals.data(), d.mNormals.size() * sizeof(glm::vec3));
+			g.mTexCoordsOffset = append(d.mTexCoords.data(), d.mTexCoords.size() * sizeof(glm::vec2));
+			groups.push_back(g);
+		}
+
+		header h{};
+		h.mMagic = cMagic;
+		h.mVersion = cVersion;
+		h.mHeaderSize = sizeof(header);
+		h.mImportFlags = mImportFlags;
+		h.mNumSourceFiles = static_cast<uint32_t>(mSourceFiles.size());
+		h.mNumModels = static_cast<uint32_t>(mModels.size());
+		h.mNumGroups = static_cast<uint32_t>(groups.size());
+		h.mNumInstances = static_cast<uint32_t>(mInstances.size());
+		h.mNumMaterials = static_cast<uint32_t>(mMaterials.size());
+		h.mSourceFilesOffset = append(mSourceFiles.data(), mSourceFiles.size() * sizeof(source_file));
+		h.mModelsOffset = append(mModels.data(), mModels.size() * sizeof(model));
+		h.mGroupsOffset = append(groups.data(), groups.size() * sizeof(group));
+		h.mInstancesOffset = append(mInstances.data(), mInstances.size() * sizeof(instance));
+		h.mMaterialsOffset = append(mMaterials.data(), mMaterials.size() * sizeof(material));
+		h.mStringsOffset = append(mStrings.data(), mStrings.size());
+		h.mStringsSize = mStrings.size();
+		std::memcpy(image.data(), &h, sizeof(h));
+		return image;
+	}
+
+private:
+	struct group_data
+	{
+		std::vector<glm::vec3> mPositions;
+		std::vector<uint32_t> mIndices;
+		std::vector<glm::vec3> mNormals;
+		std::vector<glm::vec2> mTexCoords;
+	};
+
+	uint64_t mImportFlags;
+	std::vector<scene_cache_format::source_file> mSourceFiles;
+	std::vector<scene_cache_format::model> mModels;
+	std::vector<group_data> mGroupData;
+	std::vector<scene_cache_format::instance> mInstances;
+	std::vector<scene_cache_format::material> mMaterials;
+	std::string mStrings;
+};
+
+// Writes the contents of a cache file, see scene_cache_builder::build():
+inline bool write_scene_cache(const std::string& aPath, const std::vector<uint8_t>& aImage)
+{
+	std::ofstream file(aPath, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(aImage.data()), static_cast<std::streamsize>(aImage.size()));
+	return static_cast<bool>(file);
+}
+
+// Read access to a scene cache, either memory-mapped from a file or held in memory. All data is accessed in place.
+class scene_cache
+{
+public:
+	// Maps a cache file and validates its structure. Returns false and describes the problem in aError if it isn't a valid cache:
+	bool open(const std::string& aPath, std::string& aError)
+	{
+		close();
+		if (!mFile.open(aPath)) {
+			aError = "Couldn't open '" + aPath + "'";
+			return false;
+		}
+		return validate(mFile.data(), mFile.size(), aError);
+	}
+
+	// Uses the contents of a cache which has just been built (e.g. if it couldn't be written to a file):
+	bool open(std::vector<uint8_t> aImage, std::string& aError)
+	{
+		close();
+		mImage = std::move(aImage);
+		return validate(mImage.data(), mImage.size(), aError);
+	}
+
+	void close()
+	{
+		mFile.close();
+		mImage.clear();
+		mData = nullptr;
+		mSize = 0;
+	}
+
+	[[nodiscard]] bool is_open() const { return nullptr != mData; }
+
+	// Returns true if the cache has been created with the given import flags from source files which haven't changed since.
+	// Otherwise, aReason describes why the cache is outdated:
+	[[nodiscard]] bool is_up_to_date(uint64_t aImportFlags, std::string& aReason) const
+	{
+		if (header().mImportFlags != aImportFlags) {
+			aReason = "The import flags have changed";
+			return false;
+		}
+		for (const auto& file : source_files()) {
+			const std::string path{ string(file.mPath) };
+			uint64_t hash, size;
+			if (!hash_file(path, hash, size)) {
+				aReason = "'" + path + "' can't be read";
+				return false;
+			}
+			if (size != file.mSize || hash != file.mHash) {
+				aReason = "'" + path + "' has changed";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// A read-only view of one table:
+	template <typename T>
+	struct table
+	{
+		const T* mBegin;
+		size_t mSize;
+		[[nodiscard]] const T* begin() const { return mBegin; }
+		[[nodiscard]] const T* end() const { return mBegin + mSize; }
+		[[nodiscard]] size_t size() const { return mSize; }
+		[[nodiscard]] const T& operator[](size_t i) const { return mBegin[i]; }
+	};
+
+	[[nodiscard]] const scene_cache_format::header& header() const { return *reinterpret_cast<const scene_cache_format::header*>(mData); }
+	[[nodiscard]] table<scene_cache_format::source_file> source_files() const { return table_at<scene_cache_format::source_file>(header().mSourceFilesOffset, header().mNumSourceFiles); }
+	[[nodiscard]] table<scene_cache_format::model> models() const { return table_at<scene_cache_format::model>(header().mModelsOffset, header().mNumModels); }
+	[[nodiscard]] table<scene_cache_format::group> groups() const { return table_at<scene_cache_format::group>(header().mGroupsOffset, header().mNumGroups); }
+	[[nodiscard]] table<scene_cache_format::instance> instances() const { return table_at<scene_cache_format::instance>(header().mInstancesOffset, header().mNumInstances); }
+	[[nodiscard]] table<scene_cache_format::material> materials() const { return table_at<scene_cache_format::material>(header().mMaterialsOffset, header().mNumMaterials); }
+
+	[[nodiscard]] std::string_view string(const scene_cache_format::string_ref& aRef) const
+	{
+		return std::string_view{ reinterpret_cast<const char*>(mData + header().mStringsOffset) + aRef.mOffset, aRef.mLength };
+	}
+
+	[[nodiscard]] const glm::vec3* positions(const scene_cache_format::group& aGroup) const { return reinterpret_cast<const glm::vec3*>(mData + aGroup.mPositionsOffset); }
+	[[nodiscard]] const uint32_t* indices(const scene_cache_format::group& aGroup) const { return reinterpret_cast<const uint32_t*>(mData + aGroup.mIndicesOffset); }
+	[[nodiscard]] const glm::vec3* normals(const scene_cache_format::group& aGroup) const { return reinterpret_cast<const glm::vec3*>(mData + aGroup.mNormalsOffset); }
+	[[nodiscard]] const glm::vec2* tex_coords(const scene_cache_format::group& aGroup) const { return reinterpret_cast<const glm::vec2*>(mData + aGroup.mTexCoordsOffset); }
+
+	// The number of bytes of a group's vertex data:
+	[[nodiscard]] static size_t size_of(const scene_cache_format::group& aGroup)
+	{
+		return static_cast<size_t>(aGroup.mNumVertices) * (2 * sizeof(glm::vec3) + sizeof(glm::vec2)) + static_cast<size_t>(aGroup.mNumIndices) * sizeof(uint32_t);
+	}
+
+	// Lets the operating system read a group's vertex data in the background (only has an effect for mapped files):
+	void prefetch(const scene_cache_format::group& aGroup) const
+	{
+		mFile.prefetch(static_cast<size_t>(aGroup.mPositionsOffset), aGroup.mNumVertices * sizeof(glm::vec3));
+		mFile.prefetch(static_cast<size_t>(aGroup.mIndicesOffset), aGroup.mNumIndices * sizeof(uint32_t));
+		mFile.prefetch(static_cast<size_t>(aGroup.mNormalsOffset), aGroup.mNumVertices * sizeof(glm::vec3));
+		mFile.prefetch(static_cast<size_t>(aGroup.mTexCoordsOffset), aGroup.mNumVertices * sizeof(glm::vec2));
+	}
+
+private:
+	template <typename T>
+	[[nodiscard]] table<T> table_at(uint64_t aOffset, size_t aCount) const { return table<T>{ reinterpret_cast<const T*>(mData + aOffset), aCount }; }
+
+	[[nodiscard]] bool is_valid_block(uint64_t aOffset, uint64_t aSize) const
+	{
+		return 0 == aOffset % scene_cache_format::cAlignment && aOffset <= mSize && aSize <= mSize - aOffset;
+	}
+
+	[[nodiscard]] bool is_valid_string(const scene_cache_format::string_ref& aRef) const
+	{
+		return aRef.mOffset <= header().mStringsSize && aRef.mLength <= header().mStringsSize - aRef.mOffset;
+	}
+
+	bool validate(const uint8_t* aData, size_t aSize, std::string& aError)
+	{
+		using namespace scene_cache_format;
+		mData = aData;
+		mSize = aSize;
+		auto fail = [this, &aError](const std::string& aMessage) { aError = aMessage; close(); return false; };
+		if (mSize < sizeof(scene_cache_format::header)) {
+			return fail("File too small for a scene cache");
+		}
+		const auto& h = header();
+		if (cMagic != h.mMagic) {
+			return fail("Not a scene cache");
+		}
+		if (cVersion != h.mVersion || sizeof(scene_cache_format::header) != h.mHeaderSize) {
+			return fail("Unsupported scene cache version " + std::to_string(h.mVersion));
+		}
+		if (!is_valid_block(h.mSourceFilesOffset, uint64_t{ h.mNumSourceFiles } * sizeof(source_file))
+			|| !is_valid_block(h.mModelsOffset, uint64_t{ h.mNumModels } * sizeof(model))
+			|| !is_valid_block(h.mGroupsOffset, uint64_t{ h.mNumGroups } * sizeof(group))
+			|| !is_valid_block(h.mInstancesOffset, uint64_t{ h.mNumInstances } * sizeof(instance))
+			|| !is_valid_block(h.mMaterialsOffset, uint64_t{ h.mNumMaterials } * sizeof(material))
+			|| !is_valid_block(h.mStringsOffset, h.mStringsSize)
+			|| h.mNumMaterials != h.mNumGroups) {
+			return fail("Corrupt scene cache header");
+		}
+		for (const auto& f : source_files()) {
+			if (!is_valid_string(f.mPath)) {
+				return fail("Corrupt source file record");
+			}
+		}
+		uint32_t previousEndGroup = 0;
+		for (const auto& m : models()) {
+			if (!is_valid_string(m.mName) || m.mFirstInstance > m.mEndInstance || m.mEndInstance > h.mNumInstances
+				|| m.mFirstGroup < previousEndGroup || m.mFirstGroup > m.mEndGroup || m.mEndGroup > h.mNumGroups) {
+				return fail("Corrupt model record");
+			}
+			previousEndGroup = m.mEndGroup;
+		}
+		for (const auto& g : groups()) {
+			const uint64_t n = g.mNumVertices;
+			if (0 == n || 0 == g.mNumIndices || 0 != g.mNumIndices % 3
+				|| !is_valid_block(g.mPositionsOffset, n * sizeof(glm::vec3)) || !is_valid_block(g.mIndicesOffset, uint64_t{ g.mNumIndices } * sizeof(uint32_t))
+				|| !is_valid_block(g.mNormalsOffset, n * sizeof(glm::vec3)) || !is_valid_block(g.mTexCoordsOffset, n * sizeof(glm::vec2))) {
+				return fail("Corrupt group record");
+			}
+		}
+		for (const auto& i : instances()) {
+			if (i.mGroup >= h.mNumGroups || !is_valid_string(i.mDescription)) {
+				return fail("Corrupt instance record");
+			}
+		}
+		for (const auto& m : materials()) {
+			bool valid = is_valid_string(m.mName);
+			for (const auto& t : m.mTextures) {
+				valid = valid && is_valid_string(t);
+			}
+			if (!valid) {
+				return fail("Corrupt material record");
+			}
+		}
+		return true;
+	}
+
+	mapped_file mFile;
+	std::vector<uint8_t> mImage;
+	const uint8_t* mData = nullptr;
+	size_t mSize = 0;
+};
+
+// Decides which groups share one BLAS. All groups of a model have the same instances (i.e. transforms), therefore merging
+// consecutive groups of a model into one BLAS with multiple geometries doesn't change the scene, but reduces the number of
+// BLAS and TLAS instances. Groups with fewer than aSmallGroupTriangles triangles are merged with their small neighbors (up to
+// aMaxMergedTriangles triangles per BLAS); all other groups get a BLAS of their own. Pass 0 to merge nothing.
+// Returns the [first, end) range of groups of every BLAS, covering all groups in order:
+inline std::vector<std::pair<uint32_t, uint32_t>> plan_blas_merging(const scene_cache& aCache, uint32_t aSmallGroupTriangles, uint32_t aMaxMergedTriangles)
+{
+	std::vector<std::pair<uint32_t, uint32_t>> ranges;
+	const auto groups = aCache.groups();
+	uint32_t next = 0;
+	auto addSingleGroups = [&](uint32_t aEnd) {
+		for (; next < aEnd; ++next) {
+			ranges.emplace_back(next, next + 1);
+		}
+	};
+	for (const auto& model : aCache.models()) {
+		addSingleGroups(model.mFirstGroup); // Groups which belong to no model
+		uint32_t runBegin = model.mFirstGroup;
+		uint32_t runTriangles = 0;
+		for (auto g = model.mFirstGroup; g < model.mEndGroup; ++g) {
+			const auto triangles = groups[g].mNumIndices / 3;
+			const bool full = runTriangles + triangles > aMaxMergedTriangles;
+			if (triangles >= aSmallGroupTriangles || full) {
+				if (runBegin < g) {
+					ranges.emplace_back(runBegin, g);
+				}
+				runBegin = g;
+				runTriangles = 0;
+			}
+			if (triangles >= aSmallGroupTriangles) {
+				ranges.emplace_back(g, g + 1);
+				runBegin = g + 1;
+				continue;
+			}
+			runTriangles += triangles;
+		}
+		if (runBegin < model.mEndGroup) {
+			ranges.emplace_back(runBegin, model.mEndGroup);
+		}
+		next = model.mEndGroup;
+	}
+	addSingleGroups(static_cast<uint32_t>(groups.size()));
+	return ranges;
+}
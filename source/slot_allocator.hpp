@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "packed_bitset.hpp"
+
+// Refers to one occupant of a slot of a slot_allocator. Every slot counts how often it has been released (its generation),
+// s.t. a handle whose occupant has been released is recognised as stale, even after the slot has been taken over by another one:
+struct slot_handle
+{
+	uint32_t mIndex = UINT32_MAX;
+	uint32_t mGeneration = 0;
+
+	[[nodiscard]] bool is_null() const { return UINT32_MAX == mIndex; }
+	[[nodiscard]] bool operator==(const slot_handle& aOther) const { return mIndex == aOther.mIndex && mGeneration == aOther.mGeneration; }
+	[[nodiscard]] bool operator!=(const slot_handle& aOther) const { return !(*this == aOther); }
+};
+
+// Hands out the indices of a fixed number of slots, e.g. of the elements of a descriptor array. Released slots are reused
+// (the most recently released one first), s.t. the indices stay dense, and the index of an occupant never changes.
+// Besides, it tracks which slots have changed, separately for several copies of whatever the slots refer to (e.g. one
+// descriptor set per frame in flight), s.t. every copy can be patched on its own, when it isn't in use.
+// This class does not depend on the GPU or on the framework and can be used anywhere.
+class slot_allocator
+{
+public:
+	slot_allocator() = default;
+	explicit slot_allocator(uint32_t aCapacity, uint32_t aNumCopies = 1) { reset(aCapacity, aNumCopies); }
+
+	// Releases all slots and sets up aCapacity new ones, whose changes are tracked for aNumCopies copies:
+	void reset(uint32_t aCapacity, uint32_t aNumCopies = 1)
+	{
+		mCapacity = aCapacity;
+		mEnd = 0;
+		mSize = 0;
+		mGenerations.assign(aCapacity, 0);
+		mOccupied.assign(aCapacity, false);
+		mFreeList.clear();
+		mChanged.assign(aNumCopies, packed_bitset{ aCapacity });
+		mChangedSlots.assign(aNumCopies, {});
+	}
+
+	// Occupies a slot and marks it as changed. Returns a null handle if all slots are occupied:
+	[[nodiscard]] slot_handle allocate()
+	{
+		uint32_t index;
+		if (!mFreeList.empty()) {
+			index = mFreeList.back();
+			mFreeList.pop_back();
+		}
+		else if (mEnd < mCapacity) {
+			index = mEnd++;
+		}
+		else {
+			return slot_handle{};
+		}
+		mOccupied.set(index);
+		++mSize;
+		mark_changed(index);
+		return slot_handle{ index, mGenerations[index] };
+	}
+
+	// Frees the slot of aHandle, which invalidates all handles to its occupant. Returns false if aHandle is stale or null.
+	// The slot is not marked as changed: it keeps referring to its former occupant until it is taken over by another one:
+	bool release(slot_handle aHandle)
+	{
+		if (!is_valid(aHandle)) {
+			return false;
+		}
+		++mGenerations[aHandle.mIndex];
+		mOccupied.set(aHandle.mIndex, false);
+		mFreeList.push_back(aHandle.mIndex);
+		--mSize;
+		return true;
+	}
+
+	// True if aHandle refers to the current occupant of its slot:
+	[[nodiscard]] bool is_valid(slot_handle aHandle) const
+	{
+		return aHandle.mIndex < mEnd && mOccupied.test(aHandle.mIndex) && mGenerations[aHandle.mIndex] == aHandle.mGeneration;
+	}
+
+	// Marks a slot as changed for all copies, e.g. if another resource has been assigned to it:
+	void mark_changed(uint32_t aIndex)
+	{
+		assert(aIndex < mCapacity);
+		for (size_t c = 0; c < mChanged.size(); ++c) {
+			if (!mChanged[c].test(aIndex)) {
+				mChanged[c].set(aIndex);
+				mChangedSlots[c].push_back(aIndex);
+			}
+		}
+	}
+
+	// Moves the indices of the slots which have changed since the previous invocation for aCopy into aSlots (in the
+	// order in which they have changed first), and forgets about them:
+	void take_changed(uint32_t aCopy, std::vector<uint32_t>& aSlots)
+	{
+		assert(aCopy < mChangedSlots.size());
+		aSlots.clear();
+		aSlots.swap(mChangedSlots[aCopy]);
+		for (auto i : aSlots) {
+			mChanged[aCopy].set(i, false);
+		}
+	}
+
+	[[nodiscard]] uint32_t capacity() const { return mCapacity; }
+	// The number of occupied slots:
+	[[nodiscard]] uint32_t size() const { return mSize; }
+	// All slots with an index of end() or higher have never been occupied:
+	[[nodiscard]] uint32_t end() const { return mEnd; }
+	[[nodiscard]] uint32_t number_of_copies() const { return static_cast<uint32_t>(mChanged.size()); }
+
+private:
+	uint32_t mCapacity = 0;
+	uint32_t mEnd = 0;
+	uint32_t mSize = 0;
+	std::vector<uint32_t> mGenerations;
+	packed_bitset mOccupied;
+	std::vector<uint32_t> mFreeList;
+	std::vector<packed_bitset> mChanged;              // Per copy: which slots are in mChangedSlots
+	std::vector<std::vector<uint32_t>> mChangedSlots; // Per copy
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "thread_pool.hpp"
+
+// A uniform grid over an unbounded domain, where cells are mapped into a fixed-size hash table.
+// Points are bucketed with a counting sort, i.e. after build(...) the point indices of one bucket
+// are stored contiguously in sorted_indices(). Since several cells may end up in the same bucket,
+// every sorted entry also stores the key of the cell it actually belongs to, which lets queries
+// skip the points of colliding cells (and prevents them from being visited twice).
+class spatial_hash_grid
+{
+public:
+	// Integer coordinates of one grid cell:
+	using cell_coords = glm::ivec3;
+
+	// (Re-)builds the grid from the given SoA positions. aCellSize should be at
+	// least the query radius, s.t. a query only needs to visit 3x3x3 cells.
+	void build(const float* aX, const float* aY, const float* aZ, size_t aCount, float aCellSize, thread_pool& aPool)
+	{
+		mCellSize = aCellSize;
+		mInvCellSize = 1.0f / aCellSize;
+
+		// Use (at least) twice as many buckets as points to keep collisions rare:
+		size_t numBuckets = 1024;
+		while (numBuckets < 2 * aCount) {
+			numBuckets *= 2;
+		}
+		mBucketMask = static_cast<uint32_t>(numBuckets - 1);
+
+		mCellKeysUnsorted.resize(aCount);
+		mBucketOfPoint.resize(aCount);
+		aPool.parallel_for(0, aCount, 8192, [&](size_t aBegin, size_t aEnd) {
+			for (size_t i = aBegin; i < aEnd; ++i) {
+				const auto c = cell_of(glm::vec3{ aX[i], aY[i], aZ[i] });
+				mCellKeysUnsorted[i] = key_of(c);
+				mBucketOfPoint[i] = bucket_of(c);
+			}
+		});
+
+		// Counting sort by bucket:
+		mBucketStart.assign(numBuckets + 1, 0u);
+		for (size_t i = 0; i < aCount; ++i) {
+			++mBucketStart[mBucketOfPoint[i] + 1];
+		}
+		for (size_t b = 0; b < numBuckets; ++b) {
+			mBucketStart[b + 1] += mBucketStart[b];
+		}
+		mSortedIndices.resize(aCount);
+		mSortedCellKeys.resize(aCount);
+		mWriteCursor.assign(std::begin(mBucketStart), std::end(mBucketStart) - 1);
+		for (size_t i = 0; i < aCount; ++i) {
+			const auto dst = mWriteCursor[mBucketOfPoint[i]]++;
+			mSortedIndices[dst] = static_cast<uint32_t>(i);
+			mSortedCellKeys[dst] = mCellKeysUnsorted[i];
+		}
+	}
+
+	[[nodiscard]] float cell_size() const { return mCellSize; }
+
+	[[nodiscard]] cell_coords cell_of(const glm::vec3& aPosition) const
+	{
+		return cell_coords{
+			static_cast<int>(std::floor(aPosition.x * mInvCellSize)),
+			static_cast<int>(std::floor(aPosition.y * mInvCellSize)),
+			static_cast<int>(std::floor(aPosition.z * mInvCellSize))
+		};
+	}
+
+	// Point indices, grouped by bucket:
+	[[nodiscard]] const std::vector<uint32_t>& sorted_indices() const { return mSortedIndices; }
+
+	// Invokes aFunc(sortedPosition, pointIndex) for every point inside of the given cell:
+	template <typename F>
+	void for_each_in_cell(const cell_coords& aCell, F&& aFunc) const
+	{
+		if (mSortedIndices.empty()) {
+			return;
+		}
+		const auto key = key_of(aCell);
+		const auto bucket = bucket_of(aCell);
+		for (auto s = mBucketStart[bucket], end = mBucketStart[bucket + 1]; s < end; ++s) {
+			if (mSortedCellKeys[s] == key) {
+				aFunc(s, mSortedIndices[s]);
+			}
+		}
+	}
+
+	// Invokes aFunc(sortedPosition, pointIndex) for every point in the 3x3x3 cells around aPosition,
+	// i.e. for all candidates within a distance of (at least) cell_size():
+	template <typename F>
+	void for_each_in_neighborhood(const glm::vec3& aPosition, F&& aFunc) const
+	{
+		const auto center = cell_of(aPosition);
+		for (int dz = -1; dz <= 1; ++dz) {
+			for (int dy = -1; dy <= 1; ++dy) {
+				for (int dx = -1; dx <= 1; ++dx) {
+					for_each_in_cell(center + cell_coords{ dx, dy, dz }, aFunc);
+				}
+			}
+		}
+	}
+
+	// Packs the cell coordinates into one unique 63-bit key:
+	[[nodiscard]] static uint64_t key_of(const cell_coords& aCell)
+	{
+		return (static_cast<uint64_t>(static_cast<uint32_t>(aCell.x) & 0x1FFFFFu) << 42)
+		     | (static_cast<uint64_t>(static_cast<uint32_t>(aCell.y) & 0x1FFFFFu) << 21)
+		     |  static_cast<uint64_t>(static_cast<uint32_t>(aCell.z) & 0x1FFFFFu);
+	}
+
+private:
+	[[nodiscard]] uint32_t bucket_of(const cell_coords& aCell) const
+	{
+		const auto h = (static_cast<uint32_t>(aCell.x) * 73856093u)
+		             ^ (static_cast<uint32_t>(aCell.y) * 19349663u)
+		             ^ (static_cast<uint32_t>(aCell.z) * 83492791u);
+		return h & mBucketMask;
+	}
+
+	float mCellSize = 1.0f;
+	float mInvCellSize = 1.0f;
+	uint32_t mBucketMask = 0;
+
+	// Index of the first sorted entry per bucket, with one additional entry at the end:
+	std::vector<uint32_t> mBucketStart;
+	std::vector<uint32_t> mSortedIndices;
+	std::vector<uint64_t> mSortedCellKeys;
+
+	// Temporary data, kept around to avoid re-allocations:
+	std::vector<uint64_t> mCellKeysUnsorted;
+	std::vector<uint32_t> mBucketOfPoint;
+	std::vector<uint32_t> mWriteCursor;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "thread_pool.hpp"
+
+// An edge-aware spatial upscaler, which turns an image that has been ray traced at a reduced render resolution
+// into an image of the output resolution. Every output pixel blends the four source pixels around its position
+// like bilinear filtering does, but the weight of each tap decreases with its luminance difference to the nearest
+// tap. Hence, edges stay sharp instead of being smeared across several output pixels. aEdgeSharpness == 0 results
+// in plain bilinear filtering. The result is always a convex combination of the taps, i.e. it doesn't overshoot.
+// upscale.comp mirrors upscale_pixel one to one; keep them in sync.
+namespace spatial_upscaling
+{
+	constexpr float cDefaultEdgeSharpness = 8.0f;
+
+	[[nodiscard]] inline float luminance(const glm::vec3& aColor)
+	{
+		return glm::dot(aColor, glm::vec3{ 0.2126f, 0.7152f, 0.0722f });
+	}
+
+	// Computes the output pixel aDstPixel of an image of aDstResolution from a source image of aSrcResolution.
+	// aFetch(x, y) must return the color of source pixel (x, y); it is only invoked with coordinates inside the image:
+	template <typename F>
+	[[nodiscard]] glm::vec3 upscale_pixel(const glm::uvec2& aDstPixel, const glm::uvec2& aSrcResolution, const glm::uvec2& aDstResolution, float aEdgeSharpness, F&& aFetch)
+	{
+		const glm::vec2 srcPos = (glm::vec2{ aDstPixel } + 0.5f) * glm::vec2{ aSrcResolution } / glm::vec2{ aDstResolution } - 0.5f;
+		const glm::vec2 base = glm::floor(srcPos);
+		const glm::vec2 f = srcPos - base;
+		const glm::ivec2 maxCoord = glm::ivec2{ aSrcResolution } - 1;
+
+		glm::vec3 taps[4];
+		float bilinear[4];
+		int nearest = 0;
+		for (int i = 0; i < 4; ++i) {
+			const glm::ivec2 xy = glm::clamp(glm::ivec2{ base } + glm::ivec2{ i & 1, i >> 1 }, glm::ivec2{ 0 }, maxCoord);
+			taps[i] = aFetch(xy.x, xy.y);
+			bilinear[i] = ((i & 1) ? f.x : 1.0f - f.x) * ((i >> 1) ? f.y : 1.0f - f.y);
+			if (bilinear[i] > bilinear[nearest]) {
+				nearest = i;
+			}
+		}
+
+		// Taps on the other side of an edge (as seen from the nearest tap) contribute less:
+		const float referenceLuminance = luminance(taps[nearest]);
+		glm::vec3 sum{ 0.0f };
+		float weightSum = 0.0f;
+		for (int i = 0; i < 4; ++i) {
+			const float w = bilinear[i] / (1.0f + aEdgeSharpness * std::abs(luminance(taps[i]) - referenceLuminance));
+			sum += w * taps[i];
+			weightSum += w;
+		}
+		return sum / weightSum;
+	}
+
+	// Upscales a whole image (row by row, top row first) of aSrcWidth x aSrcHeight pixels into aDst, which receives aDstWidth x aDstHeight pixels:
+	inline void upscale(const std::vector<glm::vec3>& aSrc, uint32_t aSrcWidth, uint32_t aSrcHeight, std::vector<glm::vec3>& aDst, uint32_t aDstWidth, uint32_t aDstHeight, float aEdgeSharpness, thread_pool& aPool)
+	{
+		aDst.resize(static_cast<size_t>(aDstWidth) * aDstHeight);
+		const glm::uvec2 srcResolution{ aSrcWidth, aSrcHeight };
+		const glm::uvec2 dstResolution{ aDstWidth, aDstHeight };
+		const auto fetch = [&](int x, int y) { return aSrc[static_cast<size_t>(y) * aSrcWidth + x]; };
+		aPool.parallel_for_each_index(0, aDstHeight, 16, [&](size_t y) {
+			for (uint32_t x = 0; x < aDstWidth; ++x) {
+				aDst[y * aDstWidth + x] = upscale_pixel(glm::uvec2{ x, static_cast<uint32_t>(y) }, srcResolution, dstResolution, aEdgeSharpness, fetch);
+			}
+		});
+	}
+}
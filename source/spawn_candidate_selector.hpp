@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "particle_store.hpp"
+#include "spatial_hash_grid.hpp"
+#include "thread_pool.hpp"
+
+// Selects the positions of new water particles among the candidates which a spawn dispatch has produced.
+// Candidates are considered in a deterministic order (lowest first, like the original selection of one
+// single candidate with minimal y; ties are broken by x, then z, then by index), and accepted greedily
+// unless the new particle would overlap with an existing particle or with one accepted before.
+// Existing particles are looked up in a spatial_hash_grid; accepted ones are tracked in a hash map over
+// the same cells. Invoke begin(...) once, then select(...) from one or multiple batches of candidates.
+class spawn_candidate_selector
+{
+public:
+	// Prepares the lookup of the existing particles. aMaxNewRadius is the largest radius that new particles will have:
+	void begin(const particle_store& aExisting, float aMaxNewRadius, thread_pool& aPool)
+	{
+		mExistingX = aExisting.positions_x();
+		mExistingY = aExisting.positions_y();
+		mExistingZ = aExisting.positions_z();
+		mExistingRadii = aExisting.radii();
+		mMaxRadius = aMaxNewRadius;
+		for (size_t i = 0; i < aExisting.size(); ++i) {
+			mMaxRadius = std::max(mMaxRadius, mExistingRadii[i]);
+		}
+		// Two particles overlap if they are closer than the sum of their radii, which is never more than one cell:
+		mGrid.build(aExisting.positions_x(), aExisting.positions_y(), aExisting.positions_z(), aExisting.size(), 2.0f * mMaxRadius, aPool);
+		mAccepted.clear();
+		mAcceptedPerCell.clear();
+	}
+
+	// Appends the positions of up to aMaxCount accepted candidates to aSelected and returns how many have been accepted.
+	// Candidates with w == 0 are invalid (their spawn rays didn't hit anything):
+	size_t select(const glm::vec4* aCandidates, size_t aNumCandidates, float aRadius, size_t aMaxCount, std::vector<glm::vec3>& aSelected)
+	{
+		assert(aRadius <= mMaxRadius);
+		mOrder.clear();
+		for (uint32_t i = 0; i < static_cast<uint32_t>(aNumCandidates); ++i) {
+			const auto& c = aCandidates[i];
+			if (c.w > 0.0f && std::isfinite(c.x) && std::isfinite(c.y) && std::isfinite(c.z)) {
+				mOrder.push_back(i);
+			}
+		}
+		std::sort(std::begin(mOrder), std::end(mOrder), [aCandidates](uint32_t a, uint32_t b) {
+			return std::make_tuple(aCandidates[a].y, aCandidates[a].x, aCandidates[a].z, a) < std::make_tuple(aCandidates[b].y, aCandidates[b].x, aCandidates[b].z, b);
+		});
+
+		size_t numAccepted = 0;
+		for (const auto i : mOrder) {
+			if (numAccepted == aMaxCount) {
+				break;
+			}
+			const glm::vec3 position{ aCandidates[i] };
+			if (overlaps(position, aRadius)) {
+				continue;
+			}
+			mAcceptedPerCell.emplace(spatial_hash_grid::key_of(mGrid.cell_of(position)), static_cast<uint32_t>(mAccepted.size()));
+			mAccepted.emplace_back(position, aRadius);
+			aSelected.push_back(position);
+			++numAccepted;
+		}
+		return numAccepted;
+	}
+
+private:
+	[[nodiscard]] bool overlaps(const glm::vec3& aPosition, float aRadius) const
+	{
+		bool found = false;
+		mGrid.for_each_in_neighborhood(aPosition, [&](uint32_t, uint32_t aIndex) {
+			found = found || glm::distance(aPosition, glm::vec3{ mExistingX[aIndex], mExistingY[aIndex], mExistingZ[aIndex] }) < aRadius + mExistingRadii[aIndex];
+		});
+		if (found) {
+			return true;
+		}
+		const auto center = mGrid.cell_of(aPosition);
+		for (int dz = -1; dz <= 1; ++dz) {
+			for (int dy = -1; dy <= 1; ++dy) {
+				for (int dx = -1; dx <= 1; ++dx) {
+					const auto range = mAcceptedPerCell.equal_range(spatial_hash_grid::key_of(center + spatial_hash_grid::cell_coords{ dx, dy, dz }));
+					for (auto it = range.first; it != range.second; ++it) {
+						const auto& other = mAccepted[it->second];
+						if (glm::distance(aPosition, glm::vec3{ other }) < aRadius + other.w) {
+							return true;
+						}
+					}
+				}
+			}
+		}
+		return false;
+	}
+
+	spatial_hash_grid mGrid;
+	// The existing particles' attributes, valid from begin(...) on as long as no particles are added:
+	const float* mExistingX = nullptr;
+	const float* mExistingY = nullptr;
+	const float* mExistingZ = nullptr;
+	const float* mExistingRadii = nullptr;
+	float mMaxRadius = 0.0f;
+
+	// Particles accepted since begin(...) (position and radius), and their indices per cell key:
+	std::vector<glm::vec4> mAccepted;
+	std::unordered_multimap<uint64_t, uint32_t> mAcceptedPerCell;
+
+	// Temporary data, kept around to avoid re-allocations:
+	std::vector<uint32_t> mOrder;
+};
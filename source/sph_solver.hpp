@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "particle_store.hpp"
+#include "spatial_hash_grid.hpp"
+#include "thread_pool.hpp"
+
+// Settings of the SPH fluid simulation:
+struct sph_parameters
+{
+	// Radius of one particle; the particles' rest spacing is twice this value:
+	float mParticleRadius = 0.35f;
+	// The smoothing radius (i.e. the support of the kernels) relative to the rest spacing:
+	float mSmoothingRadiusFactor = 2.0f;
+	// Density of the fluid at rest, in kg/m^3:
+	float mRestDensity = 1000.0f;
+	// Relates density deviation to pressure (p = k * (rho - rho0)):
+	float mStiffness = 2000.0f;
+	// Dynamic viscosity of the fluid:
+	float mViscosity = 100.0f;
+	// External acceleration:
+	glm::vec3 mGravity = glm::vec3{ 0.0f, -9.81f, 0.0f };
+	// Length of one simulation step, in seconds:
+	float mFixedTimeStep = 1.0f / 120.0f;
+	// Simulation time will be dropped if more substeps than this would be required in one frame:
+	int mMaxSubstepsPerFrame = 4;
+	// Velocities are clamped to this value to keep the simulation stable:
+	float mMaxSpeed = 40.0f;
+	// The simulation domain; particles bounce off its walls:
+	glm::vec3 mBoundsMin = glm::vec3{ -30.0f,  0.0f, -15.0f };
+	glm::vec3 mBoundsMax = glm::vec3{  30.0f, 40.0f,  15.0f };
+	// Fraction of the normal velocity which is kept when bouncing off a wall:
+	float mBoundaryRestitution = 0.3f;
+
+	[[nodiscard]] float rest_spacing() const { return 2.0f * mParticleRadius; }
+	[[nodiscard]] float smoothing_radius() const { return mSmoothingRadiusFactor * rest_spacing(); }
+	// Every particle has the mass of a cube of fluid with the rest spacing as its edge length:
+	[[nodiscard]] float particle_mass() const { const auto s = rest_spacing(); return mRestDensity * s * s * s; }
+};
+
+// A weakly compressible SPH solver (after Mueller et al. 2003: poly6 density, spiky pressure and
+// laplacian viscosity kernels) which runs entirely on the CPU on the SoA arrays of a particle_store.
+// Neighbours are found via a spatial_hash_grid with a cell size of the smoothing radius, and
+// all per-particle passes are processed in the grid's bucket order for better cache coherence.
+// The walls of the domain contribute density and pressure as if they were made of fluid particles
+// (wall weight functions after Harada et al. 2007), which prevents particles from clumping there.
+// Particles flagged as particle_flags::frozen contribute to their neighbours' density and forces, but stay where they are.
+class sph_solver
+{
+public:
+	[[nodiscard]] sph_parameters& parameters() { return mParameters; }
+	[[nodiscard]] const sph_parameters& parameters() const { return mParameters; }
+
+	// The densities of the last step, in the order in which the particles have been processed: densities()[s] is the
+	// density of particle particle_order()[s]:
+	[[nodiscard]] const std::vector<float>& densities() const { return mDensity; }
+	[[nodiscard]] const std::vector<uint32_t>& particle_order() const { return mGrid.sorted_indices(); }
+
+	// Advances the simulation by aDeltaTime seconds in steps of mFixedTimeStep. Left-over time is
+	// carried over into the next call. Returns the number of steps which have been performed.
+	int advance(particle_store& aParticles, float aDeltaTime, thread_pool& aPool)
+	{
+		const auto dt = mParameters.mFixedTimeStep;
+		mTimeAccumulator += std::max(0.0f, aDeltaTime);
+		// Don't try to catch up if we're too slow, drop the time instead:
+		mTimeAccumulator = std::min(mTimeAccumulator, dt * static_cast<float>(mParameters.mMaxSubstepsPerFrame));
+
+		int numSteps = 0;
+		while (mTimeAccumulator >= dt && numSteps < mParameters.mMaxSubstepsPerFrame) {
+			step(aParticles, dt, aPool);
+			mTimeAccumulator -= dt;
+			++numSteps;
+		}
+		return numSteps;
+	}
+
+	// Performs exactly one simulation step of length aTimeStep:
+	void step(particle_store& aParticles, float aTimeStep, thread_pool& aPool)
+	{
+		const auto n = aParticles.size();
+		if (0 == n) {
+			return;
+		}
+
+		const auto h = mParameters.smoothing_radius();
+		const auto h2 = h * h;
+		const auto mass = mParameters.particle_mass();
+		const auto restDensity = mParameters.mRestDensity;
+		const auto stiffness = mParameters.mStiffness;
+		const auto viscosity = mParameters.mViscosity;
+		const auto poly6 = 315.0f / (64.0f * glm::pi<float>() * std::pow(h, 9.0f));
+		const auto spikyGrad = -45.0f / (glm::pi<float>() * std::pow(h, 6.0f));
+		const auto viscLap = 45.0f / (glm::pi<float>() * std::pow(h, 6.0f));
+		constexpr size_t grain = 1024;
+		update_wall_tables();
+		const auto wMin = mParameters.mBoundsMin;
+		const auto wMax = mParameters.mBoundsMax;
+
+		auto* posX = aParticles.positions_x(); auto* posY = aParticles.positions_y(); auto* posZ = aParticles.positions_z();
+		auto* velX = aParticles.velocities_x(); auto* velY = aParticles.velocities_y(); auto* velZ = aParticles.velocities_z();
+		const auto* flags = aParticles.flags();
+		mGrid.build(posX, posY, posZ, n, h, aPool);
+		const auto& order = mGrid.sorted_indices();
+
+		// Gather into grid order:
+		for (auto* v : { &mSortedPosX, &mSortedPosY, &mSortedPosZ, &mSortedVelX, &mSortedVelY, &mSortedVelZ, &mDensity, &mPressure }) {
+			v->resize(n);
+		}
+		aPool.parallel_for(0, n, 8192, [&](size_t aBegin, size_t aEnd) {
+			for (size_t s = aBegin; s < aEnd; ++s) {
+				const auto i = order[s];
+				mSortedPosX[s] = posX[i]; mSortedPosY[s] = posY[i]; mSortedPosZ[s] = posZ[i];
+				mSortedVelX[s] = velX[i]; mSortedVelY[s] = velY[i]; mSortedVelZ[s] = velZ[i];
+			}
+		});
+
+		// Pass 1: density and pressure
+		aPool.parallel_for(0, n, grain, [&](size_t aBegin, size_t aEnd) {
+			for (size_t s = aBegin; s < aEnd; ++s) {
+				const glm::vec3 pi{ mSortedPosX[s], mSortedPosY[s], mSortedPosZ[s] };
+				float density = 0.0f;
+				mGrid.for_each_in_neighborhood(pi, [&](uint32_t t, uint32_t) {
+					const glm::vec3 d = pi - glm::vec3{ mSortedPosX[t], mSortedPosY[t], mSortedPosZ[t] };
+					const auto r2 = glm::dot(d, d);
+					if (r2 < h2) {
+						const auto x = h2 - r2;
+						density += x * x * x;
+					}
+				});
+				for (int c = 0; c < 3; ++c) {
+					density += wall_density(pi[c] - wMin[c]) + wall_density(wMax[c] - pi[c]);
+				}
+				density *= mass * poly6;
+				mDensity[s] = density;
+				mPressure[s] = std::max(0.0f, stiffness * (density - restDensity));
+			}
+		});
+
+		// Pass 2: forces and integration (results are written back in original order)
+		const auto gravity = mParameters.mGravity;
+		const auto maxSpeed = mParameters.mMaxSpeed;
+		const auto bMin = mParameters.mBoundsMin + glm::vec3{ mParameters.mParticleRadius };
+		const auto bMax = mParameters.mBoundsMax - glm::vec3{ mParameters.mParticleRadius };
+		const auto restitution = mParameters.mBoundaryRestitution;
+		aPool.parallel_for(0, n, grain, [&](size_t aBegin, size_t aEnd) {
+			for (size_t s = aBegin; s < aEnd; ++s) {
+				const auto i = order[s];
+				if (0u != (flags[i] & particle_flags::frozen)) {
+					continue;
+				}
+				const glm::vec3 pi{ mSortedPosX[s], mSortedPosY[s], mSortedPosZ[s] };
+				const glm::vec3 vi{ mSortedVelX[s], mSortedVelY[s], mSortedVelZ[s] };
+				const auto rhoi = mDensity[s];
+				const auto presi = mPressure[s];
+				glm::vec3 fPressure{ 0.0f };
+				glm::vec3 fViscosity{ 0.0f };
+				mGrid.for_each_in_neighborhood(pi, [&](uint32_t t, uint32_t) {
+					if (t == s) {
+						return;
+					}
+					const glm::vec3 d = pi - glm::vec3{ mSortedPosX[t], mSortedPosY[t], mSortedPosZ[t] };
+					const auto r2 = glm::dot(d, d);
+					if (r2 >= h2 || r2 <= 1e-12f) {
+						return;
+					}
+					const auto r = std::sqrt(r2);
+					const auto hr = h - r;
+					const auto rhoj = mDensity[t];
+					fPressure += d * (-(presi + mPressure[t]) / (2.0f * rhoj) * spikyGrad * hr * hr / r);
+					fViscosity += (glm::vec3{ mSortedVelX[t], mSortedVelY[t], mSortedVelZ[t] } - vi) * (viscLap * hr / rhoj);
+				});
+				// The walls push back with the particle's own pressure:
+				for (int c = 0; c < 3; ++c) {
+					fPressure[c] += (wall_pressure_gradient(pi[c] - wMin[c]) - wall_pressure_gradient(wMax[c] - pi[c])) * (-spikyGrad * presi / rhoi);
+				}
+				auto accel = (fPressure + viscosity * fViscosity) * (mass / rhoi) + gravity;
+
+				auto v = vi + accel * aTimeStep;
+				const auto speed = glm::length(v);
+				if (speed > maxSpeed) {
+					v *= maxSpeed / speed;
+				}
+				auto p = pi + v * aTimeStep;
+				for (int c = 0; c < 3; ++c) {
+					if (p[c] < bMin[c]) { p[c] = bMin[c]; v[c] = std::abs(v[c]) * restitution; }
+					if (p[c] > bMax[c]) { p[c] = bMax[c]; v[c] = -std::abs(v[c]) * restitution; }
+				}
+
+				posX[i] = p.x; posY[i] = p.y; posZ[i] = p.z;
+				velX[i] = v.x; velY[i] = v.y; velZ[i] = v.z;
+			}
+		});
+	}
+
+private:
+	static constexpr size_t cWallTableSize = 64;
+
+	// Precomputes the kernel sums over a half-space of particles (on a lattice with the rest spacing)
+	// behind a wall, depending on a particle's distance to the wall:
+	void update_wall_tables()
+	{
+		const auto h = mParameters.smoothing_radius();
+		const auto spacing = mParameters.rest_spacing();
+		if (h == mWallTablesSmoothingRadius && spacing == mWallTablesSpacing) {
+			return;
+		}
+		mWallTablesSmoothingRadius = h;
+		mWallTablesSpacing = spacing;
+
+		const auto n = static_cast<int>(std::ceil(h / spacing));
+		for (size_t k = 0; k < cWallTableSize; ++k) {
+			const auto distToWall = h * static_cast<float>(k) / static_cast<float>(cWallTableSize - 1);
+			float densitySum = 0.0f;
+			float gradientSum = 0.0f;
+			for (int layer = 0; layer <= n; ++layer) {
+				const auto dy = distToWall + spacing * (0.5f + static_cast<float>(layer));
+				for (int ix = -n; ix <= n; ++ix) {
+					for (int iz = -n; iz <= n; ++iz) {
+						const auto dx = spacing * static_cast<float>(ix);
+						const auto dz = spacing * static_cast<float>(iz);
+						const auto r2 = dx * dx + dy * dy + dz * dz;
+						if (r2 >= h * h) {
+							continue;
+						}
+						const auto r = std::sqrt(r2);
+						const auto x = h * h - r2;
+						densitySum += x * x * x;
+						gradientSum += (h - r) * (h - r) * dy / r;
+					}
+				}
+			}
+			mWallDensity[k] = densitySum;
+			mWallPressureGradient[k] = gradientSum;
+		}
+	}
+
+	[[nodiscard]] static float lookup(const std::array<float, cWallTableSize>& aTable, float aDistToWall, float aSmoothingRadius)
+	{
+		const auto x = std::max(0.0f, aDistToWall / aSmoothingRadius) * static_cast<float>(aTable.size() - 1);
+		if (x >= static_cast<float>(aTable.size() - 1)) {
+			return 0.0f;
+		}
+		const auto k = static_cast<size_t>(x);
+		const auto t = x - static_cast<float>(k);
+		return aTable[k] * (1.0f - t) + aTable[k + 1] * t;
+	}
+
+	[[nodiscard]] float wall_density(float aDistToWall) const { return lookup(mWallDensity, aDistToWall, mWallTablesSmoothingRadius); }
+	[[nodiscard]] float wall_pressure_gradient(float aDistToWall) const { return lookup(mWallPressureGradient, aDistToWall, mWallTablesSmoothingRadius); }
+
+	sph_parameters mParameters;
+	float mTimeAccumulator = 0.0f;
+
+	// Per-step data, indexed in grid order:
+	spatial_hash_grid mGrid;
+	std::vector<float> mSortedPosX, mSortedPosY, mSortedPosZ;
+	std::vector<float> mSortedVelX, mSortedVelY, mSortedVelZ;
+	std::vector<float> mDensity;
+	std::vector<float> mPressure;
+
+	// Wall weight functions, see update_wall_tables():
+	std::array<float, cWallTableSize> mWallDensity{};
+	std::array<float, cWallTableSize> mWallPressureGradient{};
+	float mWallTablesSmoothingRadius = 0.0f;
+	float mWallTablesSpacing = 0.0f;
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <gvk.hpp>
+
+// A fixed number of descriptor sets of the same layout which are allocated once, from a descriptor pool dedicated to them,
+// and which are bound for many frames. In contrast to the sets of a descriptor cache, they are not looked up by hashing
+// their bindings, and their descriptors can be (re-)written afterwards, e.g. by bindless_registry::write_changed_slots(...).
+// A set must not be written while it is in use by the GPU.
+class stable_descriptor_sets
+{
+public:
+	// Creates the layout of aBindings, which must all belong to the same set and must be defined like in the pipeline's
+	// layout, s.t. the layouts are compatible, and allocates aNumSets sets of this layout. The sets are not written yet:
+	void create(const std::vector<avk::binding_data>& aBindings, uint32_t aNumSets)
+	{
+		assert(!aBindings.empty() && aNumSets > 0);
+		auto& device = gvk::context().device();
+		mSetId = aBindings.front().mSetId;
+		mLayout = avk::descriptor_set_layout::prepare(std::begin(aBindings), std::end(aBindings));
+		mLayout.allocate(device);
+
+		auto poolSizes = mLayout.required_pool_sizes();
+		for (auto& size : poolSizes) {
+			size.descriptorCount *= aNumSets;
+		}
+		mPool = device.createDescriptorPoolUnique(vk::DescriptorPoolCreateInfo{ {}, aNumSets, static_cast<uint32_t>(poolSizes.size()), poolSizes.data() });
+		const std::vector<vk::DescriptorSetLayout> layouts(aNumSets, mLayout.handle());
+		mSets = device.allocateDescriptorSets(vk::DescriptorSetAllocateInfo{ mPool.get(), static_cast<uint32_t>(layouts.size()), layouts.data() });
+	}
+
+	[[nodiscard]] size_t size() const { return mSets.size(); }
+	[[nodiscard]] vk::DescriptorSet operator[](size_t aIndex) const { return mSets[aIndex]; }
+
+	// Write all elements of aBinding of the set at aIndex:
+	void write(size_t aIndex, uint32_t aBinding, const std::vector<avk::image_sampler>& aImageSamplers)
+	{
+		std::vector<vk::DescriptorImageInfo> infos;
+		infos.reserve(aImageSamplers.size());
+		for (const auto& imageSampler : aImageSamplers) {
+			infos.push_back(imageSampler->descriptor_info());
+		}
+		update(vk::WriteDescriptorSet{ mSets[aIndex], aBinding, 0u, static_cast<uint32_t>(infos.size()), vk::DescriptorType::eCombinedImageSampler, infos.data(), nullptr, nullptr });
+	}
+
+	void write(size_t aIndex, uint32_t aBinding, const std::vector<avk::buffer_view>& aUniformTexelBufferViews)
+	{
+		std::vector<vk::BufferView> handles;
+		handles.reserve(aUniformTexelBufferViews.size());
+		for (const auto& view : aUniformTexelBufferViews) {
+			handles.push_back(view->view_handle());
+		}
+		update(vk::WriteDescriptorSet{ mSets[aIndex], aBinding, 0u, static_cast<uint32_t>(handles.size()), vk::DescriptorType::eUniformTexelBuffer, nullptr, nullptr, handles.data() });
+	}
+
+	void write(size_t aIndex, uint32_t aBinding, const avk::buffer& aStorageBuffer)
+	{
+		const vk::DescriptorBufferInfo info{ aStorageBuffer->handle(), 0, VK_WHOLE_SIZE };
+		update(vk::WriteDescriptorSet{ mSets[aIndex], aBinding, 0u, 1u, vk::DescriptorType::eStorageBuffer, nullptr, &info, nullptr });
+	}
+
+	void write(size_t aIndex, uint32_t aBinding, const avk::top_level_acceleration_structure& aTlas)
+	{
+		const auto handle = aTlas->acceleration_structure_handle();
+		const vk::WriteDescriptorSetAccelerationStructureKHR info{ 1u, &handle };
+		auto write = vk::WriteDescriptorSet{ mSets[aIndex], aBinding, 0u, 1u, vk::DescriptorType::eAccelerationStructureKHR, nullptr, nullptr, nullptr };
+		write.setPNext(&info);
+		update(write);
+	}
+
+	// Binds the set at aIndex at its set index of aPipelineLayout:
+	void bind(avk::command_buffer_t& aCommandBuffer, vk::PipelineBindPoint aBindPoint, vk::PipelineLayout aPipelineLayout, size_t aIndex) const
+	{
+		aCommandBuffer.handle().bindDescriptorSets(aBindPoint, aPipelineLayout, mSetId, mSets[aIndex], nullptr);
+	}
+
+private:
+	static void update(const vk::WriteDescriptorSet& aWrite)
+	{
+		gvk::context().device().updateDescriptorSets(aWrite, nullptr);
+	}
+
+	uint32_t mSetId = 0;
+	avk::descriptor_set_layout mLayout;
+	vk::UniqueDescriptorPool mPool;
+	std::vector<vk::DescriptorSet> mSets;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <gvk.hpp>
+
+// The command buffers which the stages of a frame (see task_graph) record their GPU work into. The stages might run on the
+// threads of a task_executor, but a command pool must not be used by several threads at the same time, and the framework's
+// pools belong to the thread which asks for them. Therefore, all command buffers are allocated before the stages run, and
+// handed over to the window after the stages have completed, both by the thread which runs the graph. The stages which
+// acquire a command buffer must depend on each other, s.t. they never record or submit concurrently:
+class stage_command_buffers
+{
+public:
+	// Allocates aCount command buffers from the single-use pool of aQueue for the next run of the stages:
+	void allocate(avk::queue& aQueue, size_t aCount)
+	{
+		assert(mCommandBuffers.empty());
+		auto& commandPool = gvk::context().get_command_pool_for_single_use_command_buffers(aQueue);
+		for (size_t i = 0; i < aCount; ++i) {
+			mCommandBuffers.push_back(commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+		}
+		mNumAcquired = 0;
+	}
+
+	// The next command buffer which hasn't been acquired yet. It can be submitted, but it stays owned by this class:
+	[[nodiscard]] avk::command_buffer& acquire()
+	{
+		assert(mNumAcquired < mCommandBuffers.size()); // Allocate more
+		return mCommandBuffers[mNumAcquired++];
+	}
+
+	// Hands all command buffers over to the main window, which keeps them alive until no frame in flight uses them anymore:
+	void release()
+	{
+		auto* mainWnd = gvk::context().main_window();
+		for (auto& cmdbfr : mCommandBuffers) {
+			mainWnd->handle_lifetime(avk::owned(cmdbfr));
+		}
+		mCommandBuffers.clear();
+		mNumAcquired = 0;
+	}
+
+private:
+	std::vector<avk::command_buffer> mCommandBuffers;
+	size_t mNumAcquired = 0;
+};
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <gvk.hpp>
+
+// A bottom-level acceleration structure over static triangle geometry. In contrast to the framework's BLAS, it is
+// created and built with plain Vulkan calls, which allows to build many of them with one command (see static_blas_batch)
+// and to compact them afterwards. Instances refer to it via device_address().
+class static_blas
+{
+public:
+	static_blas() = default;
+	static_blas(const static_blas&) = delete;
+	static_blas& operator=(const static_blas&) = delete;
+	static_blas(static_blas&& aOther) noexcept { *this = std::move(aOther); }
+	static_blas& operator=(static_blas&& aOther) noexcept
+	{
+		if (this != &aOther) {
+			destroy();
+			std::swap(mHandle, aOther.mHandle);
+			std::swap(mBuffer, aOther.mBuffer);
+			std::swap(mDeviceAddress, aOther.mDeviceAddress);
+			std::swap(mSize, aOther.mSize);
+		}
+		return *this;
+	}
+	~static_blas() { destroy(); }
+
+	// Creates an acceleration structure with storage for aSize bytes. It contains nothing until it is built or copied into:
+	static static_blas create(vk::DeviceSize aSize)
+	{
+		static_blas result;
+		result.mBuffer = gvk::context().create_buffer(
+			avk::memory_usage::device, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | vk::BufferUsageFlagBits::eShaderDeviceAddressKHR,
+			avk::generic_buffer_meta::create_from_size(aSize)
+		);
+		result.mHandle = gvk::context().device().createAccelerationStructureKHR(
+			vk::AccelerationStructureCreateInfoKHR{}
+				.setBuffer(result.mBuffer->handle())
+				.setSize(aSize)
+				.setType(vk::AccelerationStructureTypeKHR::eBottomLevel),
+			nullptr, gvk::context().dynamic_dispatch()
+		);
+		result.mDeviceAddress = gvk::context().device().getAccelerationStructureAddressKHR(vk::AccelerationStructureDeviceAddressInfoKHR{ result.mHandle }, gvk::context().dynamic_dispatch());
+		result.mSize = aSize;
+		return result;
+	}
+
+	[[nodiscard]] vk::AccelerationStructureKHR handle() const { return mHandle; }
+	[[nodiscard]] vk::DeviceAddress device_address() const { return mDeviceAddress; }
+	[[nodiscard]] vk::DeviceSize size() const { return mSize; }
+
+private:
+	void destroy()
+	{
+		if (mHandle) {
+			gvk::context().device().destroyAccelerationStructureKHR(mHandle, nullptr, gvk::context().dynamic_dispatch());
+			mHandle = nullptr;
+		}
+	}
+
+	vk::AccelerationStructureKHR mHandle;
+	avk::buffer mBuffer;
+	vk::DeviceAddress mDeviceAddress = 0;
+	vk::DeviceSize mSize = 0;
+};
+
+// One geometry of a static_blas: indexed triangles in buffers which have been created with eShaderDeviceAddressKHR:
+struct static_blas_geometry
+{
+	vk::DeviceAddress mPositions; // glm::vec3 per vertex
+	vk::DeviceAddress mIndices;   // uint32_t per index
+	uint32_t mNumVertices;
+	uint32_t mNumTriangles;
+};
+
+// Builds several static_blas with one command. All builds use disjoint ranges of one scratch buffer, s.t. the GPU can
+// process them concurrently. Optionally, the BLAS are compacted afterwards: their compacted sizes are queried after the
+// builds, and each one is copied into a new acceleration structure of exactly that size.
+// The batch must stay alive until all of its recorded commands have completed.
+class static_blas_batch
+{
+public:
+	explicit static_blas_batch(bool aCompact)
+		: mCompact{ aCompact }
+	{}
+
+	// Adds a BLAS which consists of the given geometries; in shaders, gl_GeometryIndexEXT is the index into aGeometries.
+	// The BLAS is created right away and built by record_builds(...):
+	void add(const std::vector<static_blas_geometry>& aGeometries)
+	{
+		auto& entry = mEntries.emplace_back();
+		std::vector<uint32_t> maxPrimitiveCounts;
+		for (const auto& g : aGeometries) {
+			entry.mGeometries.push_back(vk::AccelerationStructureGeometryKHR{}
+				.setGeometryType(vk::GeometryTypeKHR::eTriangles)
+				.setFlags(vk::GeometryFlagBitsKHR::eOpaque)
+				.setGeometry(vk::AccelerationStructureGeometryTrianglesDataKHR{}
+					.setVertexFormat(vk::Format::eR32G32B32Sfloat)
+					.setVertexData(vk::DeviceOrHostAddressConstKHR{}.setDeviceAddress(g.mPositions))
+					.setVertexStride(sizeof(glm::vec3))
+					.setMaxVertex(g.mNumVertices - 1)
+					.setIndexType(vk::IndexType::eUint32)
+					.setIndexData(vk::DeviceOrHostAddressConstKHR{}.setDeviceAddress(g.mIndices))
+				)
+			);
+			entry.mRanges.push_back(vk::AccelerationStructureBuildRangeInfoKHR{ g.mNumTriangles, 0, 0, 0 });
+			maxPrimitiveCounts.push_back(g.mNumTriangles);
+		}
+		entry.mInfo = vk::AccelerationStructureBuildGeometryInfoKHR{}
+			.setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
+			.setFlags(mCompact
+				? vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace | vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction
+				: vk::BuildAccelerationStructureFlagsKHR{ vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace })
+			.setMode(vk::BuildAccelerationStructureModeKHR::eBuild)
+			.setGeometryCount(static_cast<uint32_t>(entry.mGeometries.size()))
+			.setPGeometries(entry.mGeometries.data());
+		const auto sizes = gvk::context().device().getAccelerationStructureBuildSizesKHR(
+			vk::AccelerationStructureBuildTypeKHR::eDevice, entry.mInfo, maxPrimitiveCounts, gvk::context().dynamic_dispatch()
+		);
+
+		// Sub-allocate a range of the scratch buffer:
+		const auto alignment = scratch_offset_alignment();
+		entry.mScratchOffset = (mScratchSize + alignment - 1) / alignment * alignment;
+		mScratchSize = entry.mScratchOffset + sizes.buildScratchSize;
+
+		mBlas.push_back(static_blas::create(sizes.accelerationStructureSize));
+		entry.mInfo.setDstAccelerationStructure(mBlas.back().handle());
+	}
+
+	// Records all builds into aCommandBuffer. The inputs must be readable by acceleration structure builds at this point.
+	// If the batch shall be compacted, the compacted sizes are queried afterwards:
+	void record_builds(avk::command_buffer_t& aCommandBuffer)
+	{
+		if (mEntries.empty()) {
+			return;
+		}
+		mScratchBuffer = gvk::context().create_buffer(
+			avk::memory_usage::device, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eShaderDeviceAddressKHR,
+			avk::generic_buffer_meta::create_from_size(mScratchSize + scratch_offset_alignment()) // Reserve room to align the base address
+		);
+		const auto alignment = scratch_offset_alignment();
+		const auto scratchBase = (mScratchBuffer->device_address() + alignment - 1) / alignment * alignment;
+
+		std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> infos;
+		std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> ranges;
+		for (auto& entry : mEntries) {
+			entry.mInfo.setPGeometries(entry.mGeometries.data());
+			entry.mInfo.setScratchData(vk::DeviceOrHostAddressKHR{}.setDeviceAddress(scratchBase + entry.mScratchOffset));
+			infos.push_back(entry.mInfo);
+			ranges.push_back(entry.mRanges.data());
+		}
+		aCommandBuffer.handle().buildAccelerationStructuresKHR(infos, ranges, gvk::context().dynamic_dispatch());
+
+		// Everything which comes afterwards (compacted size queries, copies, TLAS builds) reads the BLAS:
+		aCommandBuffer.establish_global_memory_barrier(
+			avk::pipeline_stage::acceleration_structure_build,       /* -> */ avk::pipeline_stage::acceleration_structure_build,
+			avk::memory_access::acceleration_structure_write_access, /* -> */ avk::memory_access::acceleration_structure_read_access
+		);
+
+		if (mCompact) {
+			const auto count = static_cast<uint32_t>(mBlas.size());
+			mQueryPool = gvk::context().device().createQueryPoolUnique(vk::QueryPoolCreateInfo{ {}, vk::QueryType::eAccelerationStructureCompactedSizeKHR, count });
+			aCommandBuffer.handle().resetQueryPool(mQueryPool.get(), 0, count);
+			std::vector<vk::AccelerationStructureKHR> handles;
+			for (const auto& blas : mBlas) {
+				handles.push_back(blas.handle());
+			}
+			aCommandBuffer.handle().writeAccelerationStructuresPropertiesKHR(handles, vk::QueryType::eAccelerationStructureCompactedSizeKHR, mQueryPool.get(), 0, gvk::context().dynamic_dispatch());
+		}
+	}
+
+	// Must be invoked after the commands of record_builds(...) have completed. Creates a compacted acceleration structure
+	// per BLAS and records the copies into aCommandBuffer. Invoke finish_compaction() after they have completed:
+	void record_compaction(avk::command_buffer_t& aCommandBuffer)
+	{
+		if (!mQueryPool) {
+			return;
+		}
+		const auto count = static_cast<uint32_t>(mBlas.size());
+		const auto compactedSizes = gvk::context().device().getQueryPoolResults<vk::DeviceSize>(
+			mQueryPool.get(), 0, count, count * sizeof(vk::DeviceSize), sizeof(vk::DeviceSize), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait
+		).value;
+		mCompacted.clear();
+		for (uint32_t i = 0; i < count; ++i) {
+			mCompacted.push_back(static_blas::create(compactedSizes[i]));
+			aCommandBuffer.handle().copyAccelerationStructureKHR(
+				vk::CopyAccelerationStructureInfoKHR{ mBlas[i].handle(), mCompacted.back().handle(), vk::CopyAccelerationStructureModeKHR::eCompact },
+				gvk::context().dynamic_dispatch()
+			);
+		}
+		aCommandBuffer.establish_global_memory_barrier(
+			avk::pipeline_stage::acceleration_structure_build,       /* -> */ avk::pipeline_stage::acceleration_structure_build,
+			avk::memory_access::acceleration_structure_write_access, /* -> */ avk::memory_access::acceleration_structure_read_access
+		);
+	}
+
+	// Replaces the BLAS with their compacted copies, which must have completed by now:
+	void finish_compaction()
+	{
+		if (mCompacted.size() == mBlas.size()) {
+			mBlas = std::move(mCompacted);
+			mCompacted.clear();
+		}
+		mQueryPool.reset();
+		mScratchBuffer = avk::buffer{};
+	}
+
+	[[nodiscard]] std::vector<static_blas>& blas() { return mBlas; }
+
+	// The memory which the BLAS occupy (without the scratch buffer):
+	[[nodiscard]] vk::DeviceSize blas_memory() const
+	{
+		vk::DeviceSize sum = 0;
+		for (const auto& blas : mBlas) {
+			sum += blas.size();
+		}
+		return sum;
+	}
+
+private:
+	static vk::DeviceSize scratch_offset_alignment()
+	{
+		static const vk::DeviceSize sAlignment = std::max<vk::DeviceSize>(1, gvk::context().physical_device().getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceAccelerationStructurePropertiesKHR>()
+			.get<vk::PhysicalDeviceAccelerationStructurePropertiesKHR>().minAccelerationStructureScratchOffsetAlignment);
+		return sAlignment;
+	}
+
+	struct entry
+	{
+		std::vector<vk::AccelerationStructureGeometryKHR> mGeometries;
+		std::vector<vk::AccelerationStructureBuildRangeInfoKHR> mRanges;
+		vk::AccelerationStructureBuildGeometryInfoKHR mInfo;
+		vk::DeviceSize mScratchOffset = 0;
+	};
+
+	std::vector<entry> mEntries;
+	std::vector<static_blas> mBlas;
+	std::vector<static_blas> mCompacted;
+	vk::DeviceSize mScratchSize = 0;
+	avk::buffer mScratchBuffer;
+	vk::UniqueQueryPool mQueryPool;
+	bool mCompact;
+};
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class task_executor;
+
+// A set of tasks with explicit dependencies between them, e.g. the stages of a frame's update: every task runs after all
+// of its dependencies have completed, and tasks which don't depend on each other may run concurrently (see task_executor).
+// Dependencies must have been added before the tasks which depend on them, i.e. the order of add(...) is a valid
+// sequential order, too. A graph is meant to be set up once and run every frame.
+// Every run records a timeline: when and on which thread every task has run, and which tasks form the critical path,
+// i.e. the chain of dependent tasks which has taken the longest and therefore bounds the duration of the whole run.
+// This class does not depend on the GPU or on the framework and can be used anywhere.
+class task_graph
+{
+public:
+	using task_id = uint32_t;
+
+	struct timeline_entry
+	{
+		double mStartMs = 0.0; // Relative to the start of the run
+		double mEndMs = 0.0;
+		uint32_t mThread = 0;  // 0 is the thread which has invoked run(...)
+		bool mOnCriticalPath = false;
+	};
+
+	struct statistics
+	{
+		double mWallMs = 0.0;         // From the start of the run until its last task has completed
+		double mWorkMs = 0.0;         // Sum of the durations of all tasks
+		double mCriticalPathMs = 0.0; // Sum of the durations of the tasks on the critical path
+		size_t mNumThreads = 0;       // Threads which have been available to the run
+	};
+
+	// Adds a task which runs aWork after all tasks in aDependencies have completed:
+	task_id add(std::string aName, std::function<void()> aWork, std::initializer_list<task_id> aDependencies = {})
+	{
+		const auto id = static_cast<task_id>(mTasks.size());
+		auto& t = mTasks.emplace_back();
+		t.mName = std::move(aName);
+		t.mWork = std::move(aWork);
+		for (auto d : aDependencies) {
+			mTasks[d].mDependents.push_back(id);
+			t.mDependencies.push_back(d);
+		}
+		mTimeline.resize(mTasks.size());
+		return id;
+	}
+
+	// Runs all tasks on the threads of aExecutor (including the calling thread) and returns after all of them have completed:
+	inline void run(task_executor& aExecutor);
+
+	// Runs all tasks one after the other on the calling thread, in the order in which they have been added:
+	void run_sequentially()
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for (task_id t = 0; t < mTasks.size(); ++t) {
+			execute(t, 0, start);
+		}
+		finish_run(1);
+	}
+
+	[[nodiscard]] size_t size() const { return mTasks.size(); }
+	[[nodiscard]] const std::string& name(task_id aTask) const { return mTasks[aTask].mName; }
+	// The timeline of the most recent run, one entry per task:
+	[[nodiscard]] const std::vector<timeline_entry>& timeline() const { return mTimeline; }
+	[[nodiscard]] const statistics& stats() const { return mStats; }
+
+private:
+	friend class task_executor;
+
+	struct task
+	{
+		std::string mName;
+		std::function<void()> mWork;
+		std::vector<task_id> mDependencies;
+		std::vector<task_id> mDependents;
+	};
+
+	void execute(task_id aTask, uint32_t aThread, std::chrono::steady_clock::time_point aRunStart)
+	{
+		const auto t0 = std::chrono::steady_clock::now();
+		mTasks[aTask].mWork();
+		const auto t1 = std::chrono::steady_clock::now();
+		auto& e = mTimeline[aTask];
+		e.mStartMs = std::chrono::duration<double, std::milli>(t0 - aRunStart).count();
+		e.mEndMs = std::chrono::duration<double, std::milli>(t1 - aRunStart).count();
+		e.mThread = aThread;
+	}
+
+	// Finds the critical path: the latest finish of every task if it had started as soon as its dependencies were done:
+	void finish_run(size_t aNumThreads)
+	{
+		mStats = statistics{};
+		mStats.mNumThreads = aNumThreads;
+		std::vector<double> finish(mTasks.size(), 0.0);
+		std::vector<task_id> slowestDependency(mTasks.size(), UINT32_MAX);
+		task_id last = UINT32_MAX;
+		for (task_id t = 0; t < mTasks.size(); ++t) {
+			double ready = 0.0;
+			for (auto d : mTasks[t].mDependencies) {
+				if (finish[d] >= ready) {
+					ready = finish[d];
+					slowestDependency[t] = d;
+				}
+			}
+			const auto duration = mTimeline[t].mEndMs - mTimeline[t].mStartMs;
+			finish[t] = ready + duration;
+			mStats.mWorkMs += duration;
+			mStats.mWallMs = std::max(mStats.mWallMs, mTimeline[t].mEndMs);
+			mTimeline[t].mOnCriticalPath = false;
+			if (UINT32_MAX == last || finish[t] > finish[last]) {
+				last = t;
+			}
+		}
+		for (auto t = last; UINT32_MAX != t; t = slowestDependency[t]) {
+			mTimeline[t].mOnCriticalPath = true;
+		}
+		mStats.mCriticalPathMs = UINT32_MAX == last ? 0.0 : finish[last];
+	}
+
+	std::vector<task> mTasks;
+	std::vector<timeline_entry> mTimeline;
+	statistics mStats;
+};
+
+// Runs task_graphs on a fixed set of threads with work stealing: every thread has a queue of tasks whose dependencies
+// have completed. A thread which completes a task pushes the dependents which have become ready onto its own queue and
+// continues with the most recent one (which is likely to use the data which has just been produced). A thread whose
+// queue is empty steals the oldest task from another thread's queue.
+// The threads are separate from the shared_thread_pool(), s.t. tasks may use parallel_for. Since only one loop can be
+// in flight in a thread_pool at any time, concurrent tasks which both use it take turns.
+class task_executor
+{
+public:
+	// Creates an executor with aNumThreads threads in total (including the thread which invokes run(...)):
+	explicit task_executor(size_t aNumThreads = 3)
+	{
+		const auto n = std::max<size_t>(1, aNumThreads);
+		for (size_t t = 0; t < n; ++t) {
+			mQueues.push_back(std::make_unique<task_queue>());
+		}
+		for (size_t t = 1; t < n; ++t) {
+			mWorkers.emplace_back([this, t]() { worker_loop(static_cast<uint32_t>(t)); });
+		}
+	}
+
+	task_executor(const task_executor&) = delete;
+	task_executor(task_executor&&) = delete;
+	task_executor& operator=(const task_executor&) = delete;
+	task_executor& operator=(task_executor&&) = delete;
+
+	~task_executor()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mShuttingDown = true;
+		}
+		mWakeUp.notify_all();
+		for (auto& w : mWorkers) {
+			w.join();
+		}
+	}
+
+	[[nodiscard]] size_t size() const { return mQueues.size(); }
+
+	// Runs all tasks of aGraph, see task_graph::run(...). Must not be invoked from within a task:
+	void run(task_graph& aGraph)
+	{
+		const auto n = aGraph.mTasks.size();
+		if (0 == n) {
+			aGraph.finish_run(size());
+			return;
+		}
+		mGraph = &aGraph;
+		mPending = std::make_unique<std::atomic<uint32_t>[]>(n);
+		for (size_t t = 0; t < n; ++t) {
+			mPending[t].store(static_cast<uint32_t>(aGraph.mTasks[t].mDependencies.size()));
+		}
+		mRemaining.store(n);
+		mRunStart = std::chrono::steady_clock::now();
+		for (task_graph::task_id t = 0; t < n; ++t) {
+			if (aGraph.mTasks[t].mDependencies.empty()) {
+				push(0, t);
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mRunning = true;
+		}
+		mWakeUp.notify_all();
+
+		// Lend a hand, until everything is done:
+		for (;;) {
+			process(0);
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWakeUp.wait(lock, [this]() { return 0 == mRemaining.load() || mNumQueued.load() > 0; });
+			if (0 == mRemaining.load()) {
+				mRunning = false;
+				break;
+			}
+		}
+		mGraph = nullptr;
+		aGraph.finish_run(size());
+	}
+
+private:
+	struct task_queue
+	{
+		std::mutex mMutex;
+		std::deque<task_graph::task_id> mTasks;
+	};
+
+	void push(uint32_t aThread, task_graph::task_id aTask)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mQueues[aThread]->mMutex);
+			mQueues[aThread]->mTasks.push_back(aTask);
+		}
+		mNumQueued.fetch_add(1);
+	}
+
+	// The most recent task of the own queue, or else the oldest one of another thread's queue:
+	bool pop(uint32_t aThread, task_graph::task_id& aTask)
+	{
+		for (size_t k = 0; k < mQueues.size(); ++k) {
+			auto& q = *mQueues[(aThread + k) % mQueues.size()];
+			std::lock_guard<std::mutex> lock(q.mMutex);
+			if (!q.mTasks.empty()) {
+				if (0 == k) {
+					aTask = q.mTasks.back();
+					q.mTasks.pop_back();
+				}
+				else {
+					aTask = q.mTasks.front();
+					q.mTasks.pop_front();
+				}
+				mNumQueued.fetch_sub(1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Executes tasks until there are none left to take:
+	void process(uint32_t aThread)
+	{
+		task_graph::task_id t;
+		while (pop(aThread, t)) {
+			mGraph->execute(t, aThread, mRunStart);
+			bool readied = false;
+			for (auto d : mGraph->mTasks[t].mDependents) {
+				if (1 == mPending[d].fetch_sub(1)) {
+					push(aThread, d);
+					readied = true;
+				}
+			}
+			const bool done = 1 == mRemaining.fetch_sub(1);
+			if (readied || done) {
+				// Acquire the mutex once, s.t. no waiting thread misses the change:
+				{ std::lock_guard<std::mutex> lock(mMutex); }
+				mWakeUp.notify_all();
+			}
+		}
+	}
+
+	void worker_loop(uint32_t aThread)
+	{
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mWakeUp.wait(lock, [this]() { return mShuttingDown || (mRunning && mNumQueued.load() > 0); });
+				if (mShuttingDown) {
+					return;
+				}
+			}
+			process(aThread);
+		}
+	}
+
+	std::vector<std::unique_ptr<task_queue>> mQueues;
+	std::vector<std::thread> mWorkers;
+	std::mutex mMutex;
+	std::condition_variable mWakeUp;
+	bool mShuttingDown = false;
+	bool mRunning = false;
+
+	// State of the current run:
+	task_graph* mGraph = nullptr;
+	std::unique_ptr<std::atomic<uint32_t>[]> mPending; // Dependencies which every task is still waiting for
+	std::atomic<size_t> mRemaining{ 0 };
+	std::atomic<size_t> mNumQueued{ 0 };
+	std::chrono::steady_clock::time_point mRunStart;
+};
+
+inline void task_graph::run(task_executor& aExecutor)
+{
+	aExecutor.run(*this);
+}
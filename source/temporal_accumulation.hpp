@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// CPU reference of the temporal ambient occlusion which ray_gen_shader.rgen performs. Every frame traces only a
+// few randomized AO rays per pixel and blends their result into a per-pixel history, which is reprojected from
+// the previous frame via the camera transforms. History is rejected where depth or normal don't match (i.e. where
+// a surface has been disoccluded). The history also tracks the first two moments of the per-frame estimates, and
+// pixels with a short history or a high variance receive extra rays.
+// The shader mirrors these functions one to one; keep them in sync.
+namespace temporal_accumulation
+{
+	// Bits of push_const_data_scene_rendering::mTemporalFlags:
+	constexpr uint32_t cFlagEnabled = 1u << 0;
+	constexpr uint32_t cFlagResetHistory = 1u << 1;
+
+	// Below this history length, pixels are always considered noisy:
+	constexpr float cMinConfidentHistoryLength = 4.0f;
+
+	struct parameters
+	{
+		uint32_t mBaseRays = 1;              // AO rays per pixel and frame
+		uint32_t mExtraRays = 2;             // Additional AO rays for pixels with a short history or a high variance
+		float mMaxHistoryLength = 32.0f;     // Limits the weight of the history, i.e. how fast it adapts to changes
+		float mVarianceThreshold = 0.1f;     // Standard deviation of the per-frame estimates above which extra rays are spent
+		float mDepthTolerance = 0.05f;       // Maximum relative difference of the view depths for history to be reused
+		float mNormalTolerance = 0.9f;       // Minimum cosine between the normals for history to be reused
+	};
+
+	// The history of one pixel: the mean and the mean of the squares of the per-frame AO estimates (occluded fraction
+	// of the rays), over mLength frames, for the surface at view depth mDepth with normal mNormal. mLength == 0 means no history:
+	struct history_sample
+	{
+		float mMean = 0.0f;
+		float mSecondMoment = 0.0f;
+		float mLength = 0.0f;
+		float mDepth = 0.0f;
+		glm::vec3 mNormal = glm::vec3{ 0.0f };
+	};
+
+	// The direction of a primary ray in camera space, exactly like ray_gen_shader.rgen creates it (before normalization).
+	// aPixel is in pixel coordinates, i.e. pixel centers are at (x + 0.5, y + 0.5):
+	[[nodiscard]] inline glm::vec3 camera_ray_direction(const glm::vec2& aPixel, const glm::uvec2& aResolution, float aHalfFovAngle)
+	{
+		const glm::vec2 xy = aPixel / glm::vec2{ aResolution } * 2.0f - 1.0f;
+		const float aspectRatio = static_cast<float>(aResolution.x) / static_cast<float>(aResolution.y);
+		return glm::vec3{ xy.x * aspectRatio, -xy.y, -1.0f / std::tan(aHalfFovAngle) };
+	}
+
+	// The view depth (distance along the camera's forward axis) of a hit at distance aHitT along a primary ray with the given camera space direction:
+	[[nodiscard]] inline float view_depth(float aHitT, const glm::vec3& aCameraSpaceDirection)
+	{
+		return aHitT * -aCameraSpaceDirection.z / glm::length(aCameraSpaceDirection);
+	}
+
+	// Projects a world space position into the image of a camera (inverse of camera_ray_direction). aWorldToCamera is the inverse of the
+	// camera's transform. Returns false if the position is behind the camera; otherwise aPixel receives its pixel coordinates and aDepth its view depth:
+	[[nodiscard]] inline bool project_to_pixel(const glm::mat4& aWorldToCamera, const glm::uvec2& aResolution, float aHalfFovAngle, const glm::vec3& aWorldPos, glm::vec2& aPixel, float& aDepth)
+	{
+		const glm::vec4 p = aWorldToCamera * glm::vec4{ aWorldPos, 1.0f };
+		aDepth = -p.z;
+		if (aDepth <= 0.0f) {
+			return false;
+		}
+		const float aspectRatio = static_cast<float>(aResolution.x) / static_cast<float>(aResolution.y);
+		const float scale = 1.0f / (std::tan(aHalfFovAngle) * aDepth);
+		const glm::vec2 xy{ p.x * scale / aspectRatio, -p.y * scale };
+		aPixel = (xy + 1.0f) * 0.5f * glm::vec2{ aResolution };
+		return true;
+	}
+
+	// Tells whether the history of a pixel belongs to the same surface as the current hit:
+	[[nodiscard]] inline bool is_consistent(const history_sample& aHistory, float aDepth, const glm::vec3& aNormal, const parameters& aParams)
+	{
+		return aHistory.mLength > 0.0f
+			&& std::abs(aHistory.mDepth - aDepth) <= aParams.mDepthTolerance * aDepth
+			&& glm::dot(aHistory.mNormal, aNormal) >= aParams.mNormalTolerance;
+	}
+
+	// Fetches the history at a (reprojected) position via bilinear interpolation of the four surrounding pixels. Pixels outside
+	// of the image or with inconsistent history don't contribute; if none does, the result has no history (mLength == 0).
+	// aFetch(x, y) must return the history_sample of pixel (x, y) of the previous frame:
+	template <typename F>
+	[[nodiscard]] history_sample reproject(const glm::vec2& aPixel, const glm::uvec2& aResolution, float aDepth, const glm::vec3& aNormal, const parameters& aParams, F&& aFetch)
+	{
+		const glm::vec2 pos = aPixel - 0.5f;
+		const glm::vec2 base = glm::floor(pos);
+		const glm::vec2 f = pos - base;
+		history_sample result;
+		float weightSum = 0.0f;
+		for (int i = 0; i < 4; ++i) {
+			const int x = static_cast<int>(base.x) + (i & 1);
+			const int y = static_cast<int>(base.y) + (i >> 1);
+			if (x < 0 || y < 0 || x >= static_cast<int>(aResolution.x) || y >= static_cast<int>(aResolution.y)) {
+				continue;
+			}
+			const float w = ((i & 1) ? f.x : 1.0f - f.x) * ((i >> 1) ? f.y : 1.0f - f.y);
+			const history_sample h = aFetch(x, y);
+			if (w <= 0.0f || !is_consistent(h, aDepth, aNormal, aParams)) {
+				continue;
+			}
+			result.mMean += w * h.mMean;
+			result.mSecondMoment += w * h.mSecondMoment;
+			result.mLength += w * h.mLength;
+			weightSum += w;
+		}
+		if (weightSum < 0.01f) {
+			return history_sample{};
+		}
+		result.mMean /= weightSum;
+		result.mSecondMoment /= weightSum;
+		result.mLength /= weightSum;
+		return result;
+	}
+
+	// The number of AO rays to trace for a pixel with the given (reprojected) history:
+	[[nodiscard]] inline uint32_t number_of_rays(const history_sample& aHistory, const parameters& aParams)
+	{
+		const float variance = std::max(0.0f, aHistory.mSecondMoment - aHistory.mMean * aHistory.mMean);
+		const bool noisy = aHistory.mLength < cMinConfidentHistoryLength || std::sqrt(variance) > aParams.mVarianceThreshold;
+		return aParams.mBaseRays + (noisy ? aParams.mExtraRays : 0u);
+	}
+
+	// Blends this frame's estimate (the occluded fraction of this frame's AO rays) into the reprojected history, and
+	// stores the current surface with it. The mean of the result is the AO value which is used for shading:
+	[[nodiscard]] inline history_sample accumulate(const history_sample& aHistory, float aEstimate, float aDepth, const glm::vec3& aNormal, const parameters& aParams)
+	{
+		history_sample result;
+		result.mLength = std::min(aHistory.mLength + 1.0f, aParams.mMaxHistoryLength);
+		const float alpha = 1.0f / result.mLength;
+		result.mMean = aHistory.mMean + (aEstimate - aHistory.mMean) * alpha;
+		result.mSecondMoment = aHistory.mSecondMoment + (aEstimate * aEstimate - aHistory.mSecondMoment) * alpha;
+		result.mDepth = aDepth;
+		result.mNormal = aNormal;
+		return result;
+	}
+
+	// A PCG hash, which the shader uses to derive random numbers from the pixel, the frame index, and the ray index:
+	[[nodiscard]] inline uint32_t pcg_hash(uint32_t aValue)
+	{
+		const uint32_t state = aValue * 747796405u + 2891336453u;
+		const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+	}
+
+	// A random number in [0, 1) for the given pixel, frame and ray (two per ray, selected via aDimension):
+	[[nodiscard]] inline float random_float(const glm::uvec2& aPixel, uint32_t aFrameIndex, uint32_t aRayIndex, uint32_t aDimension)
+	{
+		const uint32_t h = pcg_hash(pcg_hash(pcg_hash(aPixel.x) ^ aPixel.y) ^ pcg_hash(aFrameIndex * 16u + aRayIndex * 2u + aDimension));
+		return static_cast<float>(h >> 8u) * (1.0f / 16777216.0f);
+	}
+
+	// A cosine-weighted direction in the hemisphere around aNormal, from two random numbers in [0, 1):
+	[[nodiscard]] inline glm::vec3 cosine_weighted_direction(const glm::vec3& aNormal, float aU1, float aU2)
+	{
+		const float r = std::sqrt(aU1);
+		const float phi = 6.28318530718f * aU2;
+		const glm::vec3 helper = std::abs(aNormal.x) > 0.9f ? glm::vec3{ 0.0f, 1.0f, 0.0f } : glm::vec3{ 1.0f, 0.0f, 0.0f };
+		const glm::vec3 tangent = glm::normalize(glm::cross(helper, aNormal));
+		const glm::vec3 bitangent = glm::cross(aNormal, tangent);
+		return tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + aNormal * std::sqrt(std::max(0.0f, 1.0f - aU1));
+	}
+}
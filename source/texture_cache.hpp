@@ -0,0 +1,433 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stb_image.h>
+
+#include "mapped_file.hpp"
+#include "scene_cache.hpp"
+#include "texture_compression.hpp"
+#include "thread_pool.hpp"
+
+// A preprocessed, binary form of the textures which triangle_mesh_geometry_manager uploads to the GPU: decoded,
+// flipped vertically, optionally with a complete chain of MIP levels, and optionally block-compressed (BC1 for
+// opaque textures, BC3 for textures with alpha), i.e. exactly the bytes which end up in the images. The file
+// records size and hash of every source image file and the preprocessing options, s.t. it can be detected
+// whether it is outdated without decoding any image. All offsets are in bytes from the beginning of the file,
+// and all blocks are aligned to 64 bytes, s.t. MIP levels can be uploaded from a mapped file in place:
+//
+//   header
+//   per texture: all MIP levels, largest first
+//   texture table
+//   strings (the paths of the source image files)
+namespace texture_cache_format
+{
+	constexpr uint32_t cMagic = 0x43544E46u; // "FNTC"
+	constexpr uint32_t cVersion = 1u;
+	constexpr size_t cAlignment = 64;
+	constexpr uint32_t cMaxMipLevels = 16;
+
+	enum struct pixel_format : uint32_t
+	{
+		rgba8,
+		bc1,
+		bc3
+	};
+
+	// Bits of header::mOptions:
+	constexpr uint32_t cOptionMipMaps = 1u << 0;
+	constexpr uint32_t cOptionCompression = 1u << 1;
+
+	// Bits of texture::mFlags:
+	constexpr uint32_t cFlagSrgb = 1u << 0;
+	constexpr uint32_t cFlagSourceMissing = 1u << 1; // The source couldn't be loaded, a white texel has been stored instead
+
+	struct header
+	{
+		uint32_t mMagic;
+		uint32_t mVersion;
+		uint32_t mHeaderSize;
+		uint32_t mNumTextures;
+		uint32_t mOptions;
+		uint32_t mReserved0;
+		uint64_t mTexturesOffset;
+		uint64_t mStringsOffset;
+		uint64_t mStringsSize;
+		uint64_t mReserved[2];
+	};
+	static_assert(sizeof(header) == 64, "The header is expected to occupy 64 bytes");
+
+	struct texture
+	{
+		uint64_t mPathOffset;
+		uint32_t mPathLength;
+		uint32_t mFlags;
+		uint64_t mSourceSize;
+		uint64_t mSourceHash;
+		uint32_t mWidth;
+		uint32_t mHeight;
+		uint32_t mNumMipLevels;
+		pixel_format mFormat;
+		uint64_t mMipOffsets[cMaxMipLevels];
+	};
+	static_assert(sizeof(texture) == 176, "Texture records are expected to occupy 176 bytes");
+
+	// The size of one MIP level of an image with the given size and format:
+	[[nodiscard]] inline size_t mip_size(uint32_t aWidth, uint32_t aHeight, uint32_t aLevel, pixel_format aFormat)
+	{
+		const auto w = std::max(1u, aWidth >> aLevel);
+		const auto h = std::max(1u, aHeight >> aLevel);
+		return pixel_format::rgba8 == aFormat ? static_cast<size_t>(w) * h * 4 : texture_compression::compressed_size(w, h, pixel_format::bc3 == aFormat);
+	}
+}
+
+// Which texture is requested, and how its texels are to be interpreted:
+struct texture_request
+{
+	std::string mPath;
+	bool mSrgb;
+};
+
+// How textures are preprocessed:
+struct texture_cache_options
+{
+	bool mMipMaps = true;
+	bool mCompression = true;
+
+	[[nodiscard]] uint32_t bits() const
+	{
+		return (mMipMaps ? texture_cache_format::cOptionMipMaps : 0u) | (mCompression ? texture_cache_format::cOptionCompression : 0u);
+	}
+};
+
+// One preprocessed texture, before it is stored in a texture cache:
+struct preprocessed_texture
+{
+	uint64_t mSourceSize = 0;
+	uint64_t mSourceHash = 0;
+	bool mSourceMissing = false;
+	uint32_t mWidth = 1;
+	uint32_t mHeight = 1;
+	texture_cache_format::pixel_format mFormat = texture_cache_format::pixel_format::rgba8;
+	std::vector<std::vector<uint8_t>> mMipLevels;
+};
+
+// Computes the next smaller MIP level of an RGBA8 image with a 2x2 box filter. sRGB-encoded colors are averaged in linear space:
+inline std::vector<uint8_t> downsample_rgba8(const uint8_t* aRgba, uint32_t aWidth, uint32_t aHeight, bool aSrgb)
+{
+	static const auto sToLinear = []() {
+		std::array<float, 256> table;
+		for (int i = 0; i < 256; ++i) {
+			const auto c = static_cast<float>(i) / 255.0f;
+			table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return table;
+	}();
+	const auto toSrgb = [](float aLinear) {
+		const auto c = aLinear <= 0.0031308f ? aLinear * 12.92f : 1.055f * std::pow(aLinear, 1.0f / 2.4f) - 0.055f;
+		return static_cast<uint8_t>(std::clamp(c * 255.0f + 0.5f, 0.0f, 255.0f));
+	};
+
+	const auto w = std::max(1u, aWidth / 2), h = std::max(1u, aHeight / 2);
+	std::vector<uint8_t> result(static_cast<size_t>(w) * h * 4);
+	for (uint32_t y = 0; y < h; ++y) {
+		const uint32_t sy[2] = { std::min(2 * y, aHeight - 1), std::min(2 * y + 1, aHeight - 1) };
+		for (uint32_t x = 0; x < w; ++x) {
+			const uint32_t sx[2] = { std::min(2 * x, aWidth - 1), std::min(2 * x + 1, aWidth - 1) };
+			auto* dst = &result[(static_cast<size_t>(y) * w + x) * 4];
+			for (int c = 0; c < 4; ++c) {
+				const bool linearize = aSrgb && c < 3; // Alpha is always linear
+				float sum = 0.0f;
+				for (auto yy : sy) {
+					for (auto xx : sx) {
+						const auto v = aRgba[(static_cast<size_t>(yy) * aWidth + xx) * 4 + c];
+						sum += linearize ? sToLinear[v] : static_cast<float>(v);
+					}
+				}
+				dst[c] = linearize ? toSrgb(sum * 0.25f) : static_cast<uint8_t>(sum * 0.25f + 0.5f);
+			}
+		}
+	}
+	return result;
+}
+
+// Loads an image file and preprocesses it like triangle_mesh_geometry_manager expects its textures: RGBA8, flipped vertically,
+// with MIP levels and block-compressed, depending on aOptions. A missing or broken file results in one white texel:
+inline preprocessed_texture preprocess_texture(const texture_request& aRequest, const texture_cache_options& aOptions)
+{
+	preprocessed_texture result;
+	std::vector<uint8_t> rgba;
+	mapped_file file;
+	int w = 0, h = 0, channels = 0;
+	stbi_uc* data = nullptr;
+	if (file.open(aRequest.mPath)) {
+		result.mSourceSize = file.size();
+		result.mSourceHash = hash_bytes(file.data(), file.size());
+		data = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &w, &h, &channels, 4);
+	}
+	if (nullptr == data) {
+		result.mSourceMissing = true;
+		result.mMipLevels.emplace_back(4, uint8_t{ 255 });
+		return result;
+	}
+	result.mWidth = static_cast<uint32_t>(w);
+	result.mHeight = static_cast<uint32_t>(h);
+	rgba.resize(static_cast<size_t>(w) * h * 4);
+	const size_t rowSize = static_cast<size_t>(w) * 4;
+	for (int y = 0; y < h; ++y) {
+		std::memcpy(rgba.data() + static_cast<size_t>(y) * rowSize, data + static_cast<size_t>(h - 1 - y) * rowSize, rowSize);
+	}
+	stbi_image_free(data);
+
+	// Build the complete chain of MIP levels, down to 1x1:
+	std::vector<std::vector<uint8_t>> levels;
+	levels.push_back(std::move(rgba));
+	for (uint32_t lw = result.mWidth, lh = result.mHeight; aOptions.mMipMaps && (lw > 1 || lh > 1) && levels.size() < texture_cache_format::cMaxMipLevels; lw = std::max(1u, lw / 2), lh = std::max(1u, lh / 2)) {
+		levels.push_back(downsample_rgba8(levels.back().data(), lw, lh, aRequest.mSrgb));
+	}
+
+	if (!aOptions.mCompression) {
+		result.mMipLevels = std::move(levels);
+		return result;
+	}
+	bool withAlpha = false;
+	for (size_t i = 3; i < levels.front().size() && !withAlpha; i += 4) {
+		withAlpha = levels.front()[i] < 255;
+	}
+	result.mFormat = withAlpha ? texture_cache_format::pixel_format::bc3 : texture_cache_format::pixel_format::bc1;
+	for (uint32_t level = 0; level < levels.size(); ++level) {
+		auto& compressed = result.mMipLevels.emplace_back(texture_cache_format::mip_size(result.mWidth, result.mHeight, level, result.mFormat));
+		texture_compression::compress(levels[level].data(), std::max(1u, result.mWidth >> level), std::max(1u, result.mHeight >> level), withAlpha, compressed.data());
+	}
+	return result;
+}
+
+// Loads and preprocesses all requested textures (in parallel on aPool) and creates the contents of a texture cache from them.
+// The textures are stored in the order of aRequests:
+inline std::vector<uint8_t> build_texture_cache(const std::vector<texture_request>& aRequests, const texture_cache_options& aOptions, thread_pool& aPool)
+{
+	using namespace texture_cache_format;
+	std::vector<preprocessed_texture> textures(aRequests.size());
+	aPool.parallel_for(0, aRequests.size(), 1, [&](size_t aBegin, size_t aEnd) {
+		for (auto i = aBegin; i < aEnd; ++i) {
+			textures[i] = preprocess_texture(aRequests[i], aOptions);
+		}
+	});
+
+	std::vector<uint8_t> image(sizeof(header));
+	const auto append = [&image](const void* aData, size_t aSize) {
+		image.resize((image.size() + cAlignment - 1) / cAlignment * cAlignment);
+		const auto offset = image.size();
+		image.insert(std::end(image), static_cast<const uint8_t*>(aData), static_cast<const uint8_t*>(aData) + aSize);
+		return static_cast<uint64_t>(offset);
+	};
+
+	std::vector<texture> records(textures.size());
+	std::string strings;
+	for (size_t i = 0; i < textures.size(); ++i) {
+		auto& r = records[i];
+		const auto& t = textures[i];
+		r.mPathOffset = strings.size();
+		r.mPathLength = static_cast<uint32_t>(aRequests[i].mPath.size());
+		strings += aRequests[i].mPath;
+		r.mFlags = (aRequests[i].mSrgb ? cFlagSrgb : 0u) | (t.mSourceMissing ? cFlagSourceMissing : 0u);
+		r.mSourceSize = t.mSourceSize;
+		r.mSourceHash = t.mSourceHash;
+		r.mWidth = t.mWidth;
+		r.mHeight = t.mHeight;
+		r.mNumMipLevels = static_cast<uint32_t>(t.mMipLevels.size());
+		r.mFormat = t.mFormat;
+		for (uint32_t level = 0; level < r.mNumMipLevels; ++level) {
+			r.mMipOffsets[level] = append(t.mMipLevels[level].data(), t.mMipLevels[level].size());
+		}
+		textures[i] = preprocessed_texture{}; // Release the memory early
+	}
+
+	header h{};
+	h.mMagic = cMagic;
+	h.mVersion = cVersion;
+	h.mHeaderSize = sizeof(header);
+	h.mNumTextures = static_cast<uint32_t>(records.size());
+	h.mOptions = aOptions.bits();
+	h.mTexturesOffset = append(records.data(), records.size() * sizeof(texture));
+	h.mStringsSize = strings.size();
+	h.mStringsOffset = append(strings.data(), strings.size());
+	std::memcpy(image.data(), &h, sizeof(h));
+	return image;
+}
+
+inline bool write_texture_cache(const std::string& aPath, const std::vector<uint8_t>& aImage)
+{
+	std::ofstream file(aPath, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(aImage.data()), static_cast<std::streamsize>(aImage.size()));
+	return static_cast<bool>(file);
+}
+
+// Read access to a texture cache, either memory-mapped from a file or held in memory. All data is accessed in place.
+class texture_cache
+{
+public:
+	// Maps a cache file and validates its structure. Returns false and describes the problem in aError if it isn't a valid cache:
+	bool open(const std::string& aPath, std::string& aError)
+	{
+		close();
+		if (!mFile.open(aPath)) {
+			aError = "Couldn't open '" + aPath + "'";
+			return false;
+		}
+		return validate(mFile.data(), mFile.size(), aError);
+	}
+
+	// Uses the contents of a cache which has just been built (e.g. if it couldn't be written to a file):
+	bool open(std::vector<uint8_t> aImage, std::string& aError)
+	{
+		close();
+		mImage = std::move(aImage);
+		return validate(mImage.data(), mImage.size(), aError);
+	}
+
+	void close()
+	{
+		mFile.close();
+		mImage.clear();
+		mData = nullptr;
+		mSize = 0;
+	}
+
+	[[nodiscard]] bool is_open() const { return nullptr != mData; }
+
+	// Returns true if the cache contains exactly the requested textures (in this order), preprocessed with the given options,
+	// and none of the source image files has changed since. Otherwise, aReason describes why the cache is outdated.
+	// The source files are hashed in parallel on aPool:
+	[[nodiscard]] bool is_up_to_date(const std::vector<texture_request>& aRequests, const texture_cache_options& aOptions, thread_pool& aPool, std::string& aReason) const
+	{
+		using namespace texture_cache_format;
+		if (header().mOptions != aOptions.bits()) {
+			aReason = "The preprocessing options have changed";
+			return false;
+		}
+		if (header().mNumTextures != aRequests.size()) {
+			aReason = "The set of textures has changed";
+			return false;
+		}
+		for (size_t i = 0; i < aRequests.size(); ++i) {
+			const auto& t = textures()[i];
+			if (path(t) != aRequests[i].mPath || ((t.mFlags & cFlagSrgb) != 0) != aRequests[i].mSrgb) {
+				aReason = "The set of textures has changed";
+				return false;
+			}
+		}
+		std::vector<uint8_t> changed(aRequests.size(), 0);
+		aPool.parallel_for(0, aRequests.size(), 1, [&](size_t aBegin, size_t aEnd) {
+			for (auto i = aBegin; i < aEnd; ++i) {
+				const auto& t = textures()[i];
+				uint64_t hash = 0, size = 0;
+				const bool readable = hash_file(aRequests[i].mPath, hash, size);
+				// A source which was missing before is still up to date if it is still missing:
+				changed[i] = (t.mFlags & cFlagSourceMissing) != 0 ? readable : (!readable || size != t.mSourceSize || hash != t.mSourceHash);
+			}
+		});
+		for (size_t i = 0; i < aRequests.size(); ++i) {
+			if (changed[i]) {
+				aReason = "'" + aRequests[i].mPath + "' has changed";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// A read-only view of the texture table:
+	struct table
+	{
+		const texture_cache_format::texture* mBegin;
+		size_t mSize;
+		[[nodiscard]] const texture_cache_format::texture* begin() const { return mBegin; }
+		[[nodiscard]] const texture_cache_format::texture* end() const { return mBegin + mSize; }
+		[[nodiscard]] size_t size() const { return mSize; }
+		[[nodiscard]] const texture_cache_format::texture& operator[](size_t i) const { return mBegin[i]; }
+	};
+
+	[[nodiscard]] const texture_cache_format::header& header() const { return *reinterpret_cast<const texture_cache_format::header*>(mData); }
+	[[nodiscard]] table textures() const { return table{ reinterpret_cast<const texture_cache_format::texture*>(mData + header().mTexturesOffset), header().mNumTextures }; }
+
+	[[nodiscard]] std::string_view path(const texture_cache_format::texture& aTexture) const
+	{
+		return std::string_view{ reinterpret_cast<const char*>(mData + header().mStringsOffset) + aTexture.mPathOffset, aTexture.mPathLength };
+	}
+
+	[[nodiscard]] const uint8_t* mip_level(const texture_cache_format::texture& aTexture, uint32_t aLevel) const { return mData + aTexture.mMipOffsets[aLevel]; }
+	[[nodiscard]] static size_t mip_level_size(const texture_cache_format::texture& aTexture, uint32_t aLevel)
+	{
+		return texture_cache_format::mip_size(aTexture.mWidth, aTexture.mHeight, aLevel, aTexture.mFormat);
+	}
+
+	// The number of bytes of all MIP levels of a texture:
+	[[nodiscard]] static size_t size_of(const texture_cache_format::texture& aTexture)
+	{
+		size_t sum = 0;
+		for (uint32_t level = 0; level < aTexture.mNumMipLevels; ++level) {
+			sum += mip_level_size(aTexture, level);
+		}
+		return sum;
+	}
+
+	// Lets the operating system read a texture's data in the background (only has an effect for mapped files):
+	void prefetch(const texture_cache_format::texture& aTexture) const
+	{
+		for (uint32_t level = 0; level < aTexture.mNumMipLevels; ++level) {
+			mFile.prefetch(static_cast<size_t>(aTexture.mMipOffsets[level]), mip_level_size(aTexture, level));
+		}
+	}
+
+private:
+	[[nodiscard]] bool is_valid_block(uint64_t aOffset, uint64_t aSize) const
+	{
+		return 0 == aOffset % texture_cache_format::cAlignment && aOffset <= mSize && aSize <= mSize - aOffset;
+	}
+
+	bool validate(const uint8_t* aData, size_t aSize, std::string& aError)
+	{
+		using namespace texture_cache_format;
+		mData = aData;
+		mSize = aSize;
+		auto fail = [this, &aError](const std::string& aMessage) { aError = aMessage; close(); return false; };
+		if (mSize < sizeof(texture_cache_format::header)) {
+			return fail("File too small for a texture cache");
+		}
+		const auto& h = header();
+		if (cMagic != h.mMagic) {
+			return fail("Not a texture cache");
+		}
+		if (cVersion != h.mVersion || sizeof(texture_cache_format::header) != h.mHeaderSize) {
+			return fail("Unsupported texture cache version " + std::to_string(h.mVersion));
+		}
+		if (!is_valid_block(h.mTexturesOffset, uint64_t{ h.mNumTextures } * sizeof(texture)) || !is_valid_block(h.mStringsOffset, h.mStringsSize)) {
+			return fail("Corrupt texture cache header");
+		}
+		for (const auto& t : textures()) {
+			bool valid = t.mPathOffset <= h.mStringsSize && t.mPathLength <= h.mStringsSize - t.mPathOffset
+				&& t.mWidth > 0 && t.mHeight > 0 && t.mNumMipLevels > 0 && t.mNumMipLevels <= cMaxMipLevels
+				&& (1u << (t.mNumMipLevels - 1)) <= std::max(t.mWidth, t.mHeight)
+				&& t.mFormat >= pixel_format::rgba8 && t.mFormat <= pixel_format::bc3;
+			for (uint32_t level = 0; valid && level < t.mNumMipLevels; ++level) {
+				valid = is_valid_block(t.mMipOffsets[level], mip_level_size(t, level));
+			}
+			if (!valid) {
+				return fail("Corrupt texture record");
+			}
+		}
+		return true;
+	}
+
+	mapped_file mFile;
+	std::vector<uint8_t> mImage;
+	const uint8_t* mData = nullptr;
+	size_t mSize = 0;
+};
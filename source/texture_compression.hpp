@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// A simple CPU encoder for the BC1 and BC3 block-compressed formats. Every block of 4x4 texels is encoded
+// independently: the color endpoints are the corners of the block's bounding box in RGB space (inset a bit
+// to reduce the error at the extremes), and every texel picks the closest of the interpolated colors.
+// That is by far not the best possible quality, but it is fast, deterministic, and good enough for albedo textures.
+namespace texture_compression
+{
+	// The number of bytes of one compressed block of 4x4 texels:
+	constexpr size_t cBc1BlockSize = 8;
+	constexpr size_t cBc3BlockSize = 16;
+
+	[[nodiscard]] inline uint16_t to_rgb565(const uint8_t* aColor)
+	{
+		return static_cast<uint16_t>(((aColor[0] * 31 + 127) / 255) << 11 | ((aColor[1] * 63 + 127) / 255) << 5 | ((aColor[2] * 31 + 127) / 255));
+	}
+
+	inline void from_rgb565(uint16_t aColor, int* aOut)
+	{
+		const int r = (aColor >> 11) & 31, g = (aColor >> 5) & 63, b = aColor & 31;
+		aOut[0] = (r << 3) | (r >> 2);
+		aOut[1] = (g << 2) | (g >> 4);
+		aOut[2] = (b << 3) | (b >> 2);
+	}
+
+	// Gathers the 4x4 RGBA8 texels of the block at (aBlockX, aBlockY). Texels outside of the image repeat the border:
+	inline void fetch_block(const uint8_t* aRgba, uint32_t aWidth, uint32_t aHeight, uint32_t aBlockX, uint32_t aBlockY, uint8_t (&aBlock)[16][4])
+	{
+		for (uint32_t y = 0; y < 4; ++y) {
+			for (uint32_t x = 0; x < 4; ++x) {
+				const auto sx = std::min(aBlockX * 4 + x, aWidth - 1);
+				const auto sy = std::min(aBlockY * 4 + y, aHeight - 1);
+				std::memcpy(aBlock[y * 4 + x], aRgba + (static_cast<size_t>(sy) * aWidth + sx) * 4, 4);
+			}
+		}
+	}
+
+	// Encodes the color of 16 texels into 8 bytes, always in the four-color mode (which BC3 requires):
+	inline void encode_color_block(const uint8_t (&aBlock)[16][4], uint8_t* aOut)
+	{
+		uint8_t lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+		for (const auto& t : aBlock) {
+			for (int c = 0; c < 3; ++c) {
+				lo[c] = std::min(lo[c], t[c]);
+				hi[c] = std::max(hi[c], t[c]);
+			}
+		}
+		for (int c = 0; c < 3; ++c) {
+			const auto inset = (hi[c] - lo[c]) / 16;
+			lo[c] = static_cast<uint8_t>(lo[c] + inset);
+			hi[c] = static_cast<uint8_t>(hi[c] - inset);
+		}
+		auto c0 = to_rgb565(hi);
+		auto c1 = to_rgb565(lo);
+		if (c0 < c1) {
+			std::swap(c0, c1);
+		}
+
+		uint32_t indices = 0;
+		if (c0 != c1) {
+			int palette[4][3];
+			from_rgb565(c0, palette[0]);
+			from_rgb565(c1, palette[1]);
+			for (int c = 0; c < 3; ++c) {
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+			for (int i = 0; i < 16; ++i) {
+				int best = 0, bestDistance = INT32_MAX;
+				for (int p = 0; p < 4; ++p) {
+					int distance = 0;
+					for (int c = 0; c < 3; ++c) {
+						const int d = aBlock[i][c] - palette[p][c];
+						distance += d * d;
+					}
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						best = p;
+					}
+				}
+				indices |= static_cast<uint32_t>(best) << (2 * i);
+			}
+		}
+		std::memcpy(aOut, &c0, 2);
+		std::memcpy(aOut + 2, &c1, 2);
+		std::memcpy(aOut + 4, &indices, 4);
+	}
+
+	// Encodes the alpha of 16 texels into 8 bytes, in the eight-value mode:
+	inline void encode_alpha_block(const uint8_t (&aBlock)[16][4], uint8_t* aOut)
+	{
+		uint8_t a0 = 0, a1 = 255;
+		for (const auto& t : aBlock) {
+			a0 = std::max(a0, t[3]);
+			a1 = std::min(a1, t[3]);
+		}
+		uint64_t bits = 0;
+		if (a0 != a1) {
+			int palette[8] = { a0, a1 };
+			for (int p = 1; p < 7; ++p) {
+				palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+			}
+			for (int i = 0; i < 16; ++i) {
+				int best = 0, bestDistance = INT32_MAX;
+				for (int p = 0; p < 8; ++p) {
+					const int distance = std::abs(aBlock[i][3] - palette[p]);
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						best = p;
+					}
+				}
+				bits |= static_cast<uint64_t>(best) << (3 * i);
+			}
+		}
+		aOut[0] = a0;
+		aOut[1] = a1;
+		for (int b = 0; b < 6; ++b) {
+			aOut[2 + b] = static_cast<uint8_t>(bits >> (8 * b));
+		}
+	}
+
+	// The number of bytes which an image of the given size occupies in BC1 or BC3:
+	[[nodiscard]] inline size_t compressed_size(uint32_t aWidth, uint32_t aHeight, bool aWithAlpha)
+	{
+		return static_cast<size_t>((aWidth + 3) / 4) * ((aHeight + 3) / 4) * (aWithAlpha ? cBc3BlockSize : cBc1BlockSize);
+	}
+
+	// Compresses an RGBA8 image into BC3 if aWithAlpha is true, or into BC1 (alpha is ignored) otherwise.
+	// aOut must provide compressed_size(...) bytes:
+	inline void compress(const uint8_t* aRgba, uint32_t aWidth, uint32_t aHeight, bool aWithAlpha, uint8_t* aOut)
+	{
+		const uint32_t blocksX = (aWidth + 3) / 4, blocksY = (aHeight + 3) / 4;
+		uint8_t block[16][4];
+		for (uint32_t by = 0; by < blocksY; ++by) {
+			for (uint32_t bx = 0; bx < blocksX; ++bx) {
+				fetch_block(aRgba, aWidth, aHeight, bx, by, block);
+				if (aWithAlpha) {
+					encode_alpha_block(block, aOut);
+					aOut += 8;
+				}
+				encode_color_block(block, aOut);
+				aOut += 8;
+			}
+		}
+	}
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A pool of worker threads which executes data-parallel loops.
+// The calling thread participates in the work, i.e. parallel_for only returns after all
+// iterations have been processed. Iterations are handed out in chunks of aGrainSize via
+// an atomic counter, so that threads which finish early simply grab the next chunk.
+// This class does not depend on the GPU or on the framework and can be used anywhere.
+class thread_pool
+{
+public:
+	// Creates a pool with aNumThreads threads in total (including the calling thread).
+	explicit thread_pool(size_t aNumThreads = std::max(1u, std::thread::hardware_concurrency()))
+	{
+		const auto numWorkers = std::max<size_t>(1, aNumThreads) - 1;
+		mWorkers.reserve(numWorkers);
+		for (size_t i = 0; i < numWorkers; ++i) {
+			mWorkers.emplace_back([this]() { worker_loop(); });
+		}
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool(thread_pool&&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+	thread_pool& operator=(thread_pool&&) = delete;
+
+	~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mShuttingDown = true;
+		}
+		mWakeUp.notify_all();
+		for (auto& w : mWorkers) {
+			w.join();
+		}
+	}
+
+	// The total number of threads which participate in a parallel_for (workers + calling thread):
+	[[nodiscard]] size_t size() const { return mWorkers.size() + 1; }
+
+	// Invokes aBody(chunkBegin, chunkEnd) for consecutive, non-overlapping chunks of [aBegin, aEnd).
+	// Each chunk contains at most aGrainSize iterations. Must not be called from within aBody.
+	template <typename F>
+	void parallel_for(size_t aBegin, size_t aEnd, size_t aGrainSize, F&& aBody)
+	{
+		if (aEnd <= aBegin) {
+			return;
+		}
+		aGrainSize = std::max<size_t>(1, aGrainSize);
+		// Not worth waking anybody up:
+		if (mWorkers.empty() || aEnd - aBegin <= aGrainSize) {
+			aBody(aBegin, aEnd);
+			return;
+		}
+
+		// Only one loop can be in flight at any time:
+		std::lock_guard<std::mutex> submitLock(mSubmitMutex);
+
+		std::function<void(size_t, size_t)> body = std::forward<F>(aBody);
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mBody = &body;
+			mEnd = aEnd;
+			mGrainSize = aGrainSize;
+			mNextChunk.store(aBegin);
+			mBusyWorkers = mWorkers.size();
+			++mGeneration;
+		}
+		mWakeUp.notify_all();
+
+		// Lend a hand:
+		process_chunks(body);
+
+		// Wait for the workers to finish their last chunks:
+		std::unique_lock<std::mutex> lock(mMutex);
+		mAllDone.wait(lock, [this]() { return 0 == mBusyWorkers; });
+		mBody = nullptr;
+	}
+
+	// Convenience overload which invokes aBody(i) once per index:
+	template <typename F>
+	void parallel_for_each_index(size_t aBegin, size_t aEnd, size_t aGrainSize, F&& aBody)
+	{
+		parallel_for(aBegin, aEnd, aGrainSize, [&aBody](size_t aChunkBegin, size_t aChunkEnd) {
+			for (size_t i = aChunkBegin; i < aChunkEnd; ++i) {
+				aBody(i);
+			}
+		});
+	}
+
+private:
+	void process_chunks(const std::function<void(size_t, size_t)>& aBody)
+	{
+		for (;;) {
+			const auto chunkBegin = mNextChunk.fetch_add(mGrainSize);
+			if (chunkBegin >= mEnd) {
+				return;
+			}
+			aBody(chunkBegin, std::min(chunkBegin + mGrainSize, mEnd));
+		}
+	}
+
+	void worker_loop()
+	{
+		uint64_t lastGeneration = 0;
+		for (;;) {
+			const std::function<void(size_t, size_t)>* body = nullptr;
+			{
+				std::unique_lock<std::mutex> lock(mMutex);
+				mWakeUp.wait(lock, [this, lastGeneration]() { return mShuttingDown || mGeneration != lastGeneration; });
+				if (mShuttingDown) {
+					return;
+				}
+				lastGeneration = mGeneration;
+				body = mBody;
+			}
+
+			process_chunks(*body);
+
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				--mBusyWorkers;
+			}
+			mAllDone.notify_one();
+		}
+	}
+
+	std::vector<std::thread> mWorkers;
+
+	std::mutex mSubmitMutex;
+	std::mutex mMutex;
+	std::condition_variable mWakeUp;
+	std::condition_variable mAllDone;
+
+	// The loop which is currently being processed:
+	const std::function<void(size_t, size_t)>* mBody = nullptr;
+	size_t mEnd = 0;
+	size_t mGrainSize = 1;
+	std::atomic<size_t> mNextChunk{ 0 };
+	size_t mBusyWorkers = 0;
+	uint64_t mGeneration = 0;
+	bool mShuttingDown = false;
+};
+
+// A thread pool which is shared by all of the CPU-side systems of this application:
+inline thread_pool& shared_thread_pool()
+{
+	static thread_pool sPool;
+	return sPool;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Distributes the tiles of an image across threads with work stealing: Every thread starts with
+// a contiguous block of tiles (which keeps neighbouring tiles, and therefore similar rays, on the
+// same core) and processes them front to back. A thread which runs out of tiles steals from the
+// back of another thread's block. This keeps all cores busy even if the cost per tile varies
+// strongly, e.g. between tiles showing the sky and tiles showing detailed geometry.
+class tile_scheduler
+{
+public:
+	struct statistics
+	{
+		uint64_t mNumTiles = 0;
+		uint64_t mNumStolenTiles = 0;
+		size_t mNumThreads = 0;
+	};
+
+	// Invokes aBody(tileIndex, threadIndex) exactly once for every tile in [0, aNumTiles), using aNumThreads threads
+	// (including the calling thread). Returns after all tiles have been processed.
+	template <typename F>
+	static statistics run(size_t aNumTiles, size_t aNumThreads, F&& aBody)
+	{
+		aNumThreads = std::max<size_t>(1, std::min(aNumThreads, aNumTiles));
+		std::vector<std::unique_ptr<tile_queue>> queues;
+		for (size_t t = 0; t < aNumThreads; ++t) {
+			auto& q = queues.emplace_back(std::make_unique<tile_queue>());
+			const auto begin = aNumTiles * t / aNumThreads;
+			const auto end = aNumTiles * (t + 1) / aNumThreads;
+			for (auto i = begin; i < end; ++i) {
+				q->mTiles.push_back(static_cast<uint32_t>(i));
+			}
+		}
+
+		std::atomic<uint64_t> numStolen{ 0 };
+		auto work = [&](size_t aThreadIndex) {
+			uint32_t tile;
+			for (;;) {
+				if (queues[aThreadIndex]->pop_front(tile)) {
+					aBody(static_cast<size_t>(tile), aThreadIndex);
+					continue;
+				}
+				// Own queue is empty => try to steal from the others:
+				bool stole = false;
+				for (size_t k = 1; k < aNumThreads && !stole; ++k) {
+					stole = queues[(aThreadIndex + k) % aNumThreads]->pop_back(tile);
+				}
+				if (!stole) {
+					return; // Tiles are never added, so all queues stay empty from now on
+				}
+				numStolen.fetch_add(1, std::memory_order_relaxed);
+				aBody(static_cast<size_t>(tile), aThreadIndex);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		threads.reserve(aNumThreads - 1);
+		for (size_t t = 1; t < aNumThreads; ++t) {
+			threads.emplace_back(work, t);
+		}
+		work(0);
+		for (auto& th : threads) {
+			th.join();
+		}
+		return statistics{ aNumTiles, numStolen.load(), aNumThreads };
+	}
+
+private:
+	struct tile_queue
+	{
+		bool pop_front(uint32_t& aTile)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (mTiles.empty()) {
+				return false;
+			}
+			aTile = mTiles.front();
+			mTiles.pop_front();
+			return true;
+		}
+
+		bool pop_back(uint32_t& aTile)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (mTiles.empty()) {
+				return false;
+			}
+			aTile = mTiles.back();
+			mTiles.pop_back();
+			return true;
+		}
+
+		std::mutex mMutex;
+		std::deque<uint32_t> mTiles;
+	};
+};
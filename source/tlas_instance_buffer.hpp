@@ -0,0 +1,79 @@
+#pragma once
+
+#include <gvk.hpp>
+
+#include "instance_packing.hpp"
+#include "tlas_instance_rows.hpp"
+
+// Let the framework convert a prototype instance (its transformation matrix is ignored), s.t.
+// the packed header is bit-identical to what the framework would produce for the same instance:
+[[nodiscard]] inline packed_instance_header make_packed_instance_header(const avk::geometry_instance& aPrototype)
+{
+	const packed_instance converted = avk::convert_for_gpu_usage(aPrototype);
+	packed_instance_header header;
+	std::memcpy(&header, reinterpret_cast<const char*>(&converted) + sizeof(VkTransformMatrixKHR), sizeof(header));
+	return header;
+}
+
+// Holds the instance rows of a TLAS (see tlas_instance_rows) and uploads only what has changed.
+// There is one GPU buffer per frame in flight, each with its own dirty range, s.t. a frame never
+// overwrites instance data which an earlier frame's TLAS build might still be reading.
+class tlas_instance_buffer : public tlas_instance_rows
+{
+public:
+	void create(size_t aNumConcurrentFrames, size_t aNumStaticInstances, size_t aMaxDynamicInstances)
+	{
+		tlas_instance_rows::create(aNumConcurrentFrames, aNumStaticInstances, aMaxDynamicInstances);
+		mPerFrame.clear();
+		mPerFrame.resize(aNumConcurrentFrames);
+	}
+
+	// Copies the rows which have changed since the given frame in flight's last upload into its GPU buffer
+	// and returns that buffer. The buffer is host-coherent, therefore the data is visible to any commands
+	// which are submitted afterwards.
+	[[nodiscard]] const avk::buffer& upload(int64_t aInFlightIndex)
+	{
+		auto& entry = mPerFrame[static_cast<size_t>(aInFlightIndex) % mPerFrame.size()];
+		auto [dirtyBegin, dirtyEnd] = take_dirty_range(aInFlightIndex);
+		if (entry.mNumRows != size()) {
+			// The number of rows has changed => (re-)create this frame's buffer. The old one might still be used by
+			// a TLAS build which has been submitted before => keep it alive until no frame in flight uses it anymore:
+			if (entry.mNumRows > 0) {
+				gvk::context().main_window()->handle_lifetime(avk::owned(entry.mBuffer));
+			}
+			entry.mBuffer = gvk::context().create_buffer(
+				avk::memory_usage::host_coherent, vk::BufferUsageFlagBits::eShaderDeviceAddressKHR,
+				avk::geometry_instance_buffer_meta::create_from_num_elements(size(), sizeof(packed_instance))
+			);
+			entry.mNumRows = size();
+			dirtyBegin = 0;
+			dirtyEnd = size();
+		}
+		if (dirtyBegin < dirtyEnd) {
+			entry.mBuffer->fill(
+				rows() + dirtyBegin, 0,
+				dirtyBegin * sizeof(packed_instance),              // offset in bytes
+				(dirtyEnd - dirtyBegin) * sizeof(packed_instance), // size in bytes
+				avk::sync::not_required()
+			);
+			mLastUploadedBytes = (dirtyEnd - dirtyBegin) * sizeof(packed_instance);
+		}
+		else {
+			mLastUploadedBytes = 0;
+		}
+		return entry.mBuffer;
+	}
+
+	// How many bytes the last upload(...) has copied:
+	[[nodiscard]] size_t last_uploaded_bytes() const { return mLastUploadedBytes; }
+
+private:
+	struct per_frame_buffer
+	{
+		avk::buffer mBuffer;
+		size_t mNumRows = 0;
+	};
+
+	std::vector<per_frame_buffer> mPerFrame;
+	size_t mLastUploadedBytes = 0;
+};
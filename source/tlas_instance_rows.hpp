@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+#include <vector>
+
+#include "instance_packing.hpp"
+#include "packed_bitset.hpp"
+
+// The CPU side of a TLAS's instance data: all rows in their final GPU layout, plus one dirty range per frame in flight.
+// The rows consist of a fixed-size prefix of static instances (which can be enabled/disabled) followed
+// by a section of dynamic instances, which can be appended and overwritten in place.
+// Disabled static rows stay resident, but with a visibility mask of 0, s.t. no ray hits them; enabling or
+// disabling them only touches their mask, and an update-build (refit) of the TLAS suffices. Unused dynamic
+// rows are written as inactive instances (BLAS reference 0), which lets the number of rows stay constant most
+// of the time. Only when the dynamic section outgrows its capacity, it is doubled.
+// This class doesn't depend on the framework; tlas_instance_buffer adds the GPU buffers.
+class tlas_instance_rows
+{
+public:
+	void create(size_t aNumConcurrentFrames, size_t aNumStaticInstances, size_t aMaxDynamicInstances)
+	{
+		mNumStatic = aNumStaticInstances;
+		mMaxDynamic = aMaxDynamicInstances;
+		mNumDynamic = 0;
+		mDynamicCapacity = std::min(cMinDynamicCapacity, mMaxDynamic);
+		mRows.assign(mNumStatic + mDynamicCapacity, packed_instance{});
+		mDirtyRanges.assign(aNumConcurrentFrames, std::pair<size_t, size_t>{ 0, 0 });
+	}
+
+	// Overwrites the static prefix. aVisible tells for each of them whether it shall be visible to rays:
+	void set_static_instances(const std::vector<packed_instance>& aInstances, const packed_bitset& aVisible)
+	{
+		assert(aInstances.size() == mNumStatic && aVisible.size() == mNumStatic);
+		mStaticMasks.resize(mNumStatic);
+		for (size_t i = 0; i < mNumStatic; ++i) {
+			mRows[i] = aInstances[i];
+			mStaticMasks[i] = static_cast<uint8_t>(aInstances[i].mask);
+			mRows[i].mask = aVisible[i] ? mStaticMasks[i] : 0u;
+		}
+		mStaticVisible = aVisible;
+		mark_dirty(0, mNumStatic);
+	}
+
+	// Changes only the visibility masks of those static instances whose visibility differs from the last call
+	// (or from set_static_instances). Only the range of changed rows is uploaded. Returns the number of changed rows:
+	size_t set_static_instance_visibility(const packed_bitset& aVisible)
+	{
+		assert(aVisible.size() == mNumStatic && mStaticVisible.size() == mNumStatic);
+		size_t begin = mNumStatic, end = 0, count = 0;
+		aVisible.for_each_difference(mStaticVisible, [&](size_t i) {
+			mRows[i].mask = aVisible[i] ? mStaticMasks[i] : 0u;
+			begin = std::min(begin, i);
+			end = std::max(end, i + 1);
+			++count;
+		});
+		mStaticVisible = aVisible;
+		mark_dirty(begin, end);
+		return count;
+	}
+
+	// Sets the number of dynamic instances. New rows must be written via dynamic_instances() and
+	// mark_dynamic_instances_dirty(...) afterwards; rows which are no longer used become inactive.
+	void set_number_of_dynamic_instances(size_t aCount)
+	{
+		assert(aCount <= mMaxDynamic);
+		if (aCount > mDynamicCapacity) {
+			while (mDynamicCapacity < aCount) {
+				mDynamicCapacity *= 2;
+			}
+			mDynamicCapacity = std::min(mDynamicCapacity, mMaxDynamic);
+			mRows.resize(mNumStatic + mDynamicCapacity, packed_instance{});
+			// The GPU buffers will be recreated with all rows on their next upload.
+		}
+		else if (aCount < mNumDynamic) {
+			std::fill(std::begin(mRows) + mNumStatic + aCount, std::begin(mRows) + mNumStatic + mNumDynamic, packed_instance{});
+			mark_dirty(mNumStatic + aCount, mNumStatic + mNumDynamic);
+		}
+		mNumDynamic = aCount;
+	}
+
+	// The rows of the dynamic instances, which may be written to directly:
+	[[nodiscard]] packed_instance* dynamic_instances() { return mRows.data() + mNumStatic; }
+
+	// Must be invoked after the dynamic rows in [aBegin, aEnd) have been written to:
+	void mark_dynamic_instances_dirty(size_t aBegin, size_t aEnd)
+	{
+		assert(aEnd <= mNumDynamic);
+		mark_dirty(mNumStatic + aBegin, mNumStatic + aEnd);
+	}
+
+	// The number of rows (active and inactive) which a TLAS is built from:
+	[[nodiscard]] size_t size() const { return mRows.size(); }
+	[[nodiscard]] const packed_instance* rows() const { return mRows.data(); }
+
+	// Returns the [begin, end) range of rows which have changed since the last call for the given frame in flight, and resets it:
+	std::pair<size_t, size_t> take_dirty_range(int64_t aInFlightIndex)
+	{
+		auto& range = mDirtyRanges[static_cast<size_t>(aInFlightIndex) % mDirtyRanges.size()];
+		const auto result = range;
+		range = { 0, 0 };
+		return result;
+	}
+
+private:
+	void mark_dirty(size_t aBegin, size_t aEnd)
+	{
+		if (aBegin >= aEnd) {
+			return;
+		}
+		for (auto& range : mDirtyRanges) {
+			if (range.first >= range.second) {
+				range = { aBegin, aEnd };
+			}
+			else {
+				range.first = std::min(range.first, aBegin);
+				range.second = std::max(range.second, aEnd);
+			}
+		}
+	}
+
+	// The dynamic section starts out with this many rows:
+	static constexpr size_t cMinDynamicCapacity = 1024;
+
+	// CPU-side copy of all rows:
+	std::vector<packed_instance> mRows;
+	size_t mNumStatic = 0;
+	// The visibility masks of the static instances when they are visible, and which of them are:
+	std::vector<uint8_t> mStaticMasks;
+	packed_bitset mStaticVisible;
+	size_t mNumDynamic = 0;
+	size_t mDynamicCapacity = 0;
+	size_t mMaxDynamic = 0;
+	// Per frame in flight, the rows which have changed since its last upload:
+	std::vector<std::pair<size_t, size_t>> mDirtyRanges;
+};
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <chrono>
+#include <gvk.hpp>
+
+#include "tlas_instance_buffer.hpp"
+
+// Describes which kind of TLAS update is required after some geometry has changed:
+enum struct tlas_update_type
+{
+	none,    // Nothing has changed
+	refit,   // Only transformations or visibility masks have changed => an update-build (refit) is sufficient
+	rebuild  // Instances have been added, removed, or replaced => a full rebuild is required
+};
+
+// Combines two update requirements into one which satisfies both:
+[[nodiscard]] inline tlas_update_type combine(tlas_update_type aFirst, tlas_update_type aSecond)
+{
+	return static_cast<int>(aFirst) > static_cast<int>(aSecond) ? aFirst : aSecond;
+}
+
+// Manages one TLAS per frame in flight and decides for each of them whether it has to be
+// fully rebuilt or whether an update-build (refit) is sufficient. Every frame only touches
+// the TLAS of its own in-flight index, s.t. builds can overlap with the rendering of the
+// other frames in flight instead of having to wait for the device to become idle.
+// A TLAS is read by two kinds of work, which the build must not overwrite it under:
+//  - The work of the frame which has used this TLAS before, i.e. aNumConcurrentFrames frames ago. After a frame
+//    has submitted all of it, end_reads(...) submits a fence, which the next update(...) waits for on the CPU.
+//  - The work of the current frame. It must be submitted after update(...), whose commands end with a barrier
+//    which makes the ray tracing shaders of all subsequent commands wait for the build. Work which is submitted
+//    before update(...) (e.g. in an earlier invokee's update()) must not read the TLAS of the current frame.
+class tlas_manager
+{
+public:
+	// Statistics about the TLAS work of one frame:
+	struct frame_stats
+	{
+		uint32_t mNumBuilds = 0;
+		uint32_t mNumRefits = 0;
+		uint32_t mNumInstances = 0;
+		float mBuildTimeMs = 0.0f; // CPU time spent for recording full builds
+		float mRefitTimeMs = 0.0f; // CPU time spent for recording update-builds
+		float mReadsWaitMs = 0.0f; // CPU time spent waiting for the previous readers of the TLAS
+		size_t mUploadedBytes = 0; // Instance data which has been copied into the GPU buffers
+	};
+
+	// Creates aNumConcurrentFrames TLAS, each able to hold up to aMaxInstances geometry instances:
+	void create(size_t aNumConcurrentFrames, uint32_t aMaxInstances)
+	{
+		mPerFrame.clear();
+		for (size_t i = 0; i < aNumConcurrentFrames; ++i) {
+			auto& entry = mPerFrame.emplace_back();
+			entry.mTlas = gvk::context().create_top_level_acceleration_structure(
+				aMaxInstances, // <-- Specify how many geometry instances there are expected to be at most
+				true           // <-- Allow updates, s.t. moving geometry can be refit instead of rebuilt
+			);
+			entry.mReadsCompleted = gvk::context().device().createFenceUnique(vk::FenceCreateInfo{});
+		}
+	}
+
+	// After how many consecutive refits a TLAS is rebuilt anyways (because its quality degrades with every refit):
+	void set_max_refits_before_rebuild(uint32_t aMaxRefits) { mMaxRefitsBeforeRebuild = aMaxRefits; }
+	[[nodiscard]] uint32_t max_refits_before_rebuild() const { return mMaxRefitsBeforeRebuild; }
+
+	// Marks all TLAS as outdated. Each one of them will be brought up to date when its frame comes:
+	void request_update(tlas_update_type aUpdateType)
+	{
+		for (auto& entry : mPerFrame) {
+			entry.mPendingUpdate = combine(entry.mPendingUpdate, aUpdateType);
+		}
+	}
+
+	// Decides which kind of update a TLAS needs, given its state and the instances it shall be built with:
+	[[nodiscard]] static tlas_update_type decide(tlas_update_type aPendingUpdate, bool aHasBeenBuilt, size_t aNumInstancesOfLastBuild, size_t aNumInstances, uint32_t aRefitsSinceRebuild, uint32_t aMaxRefitsBeforeRebuild)
+	{
+		if (tlas_update_type::none == aPendingUpdate) {
+			return tlas_update_type::none;
+		}
+		if (tlas_update_type::rebuild == aPendingUpdate
+			|| !aHasBeenBuilt
+			|| aNumInstancesOfLastBuild != aNumInstances  // An update-build requires the same number of instances
+			|| aRefitsSinceRebuild >= aMaxRefitsBeforeRebuild) {
+			return tlas_update_type::rebuild;
+		}
+		return tlas_update_type::refit;
+	}
+
+	// Records the commands which bring the TLAS of the given frame in flight up to date into aCommandBuffer.
+	// The changed instance rows are uploaded into the frame's instance buffer before. Returns the kind of work which has been recorded.
+	tlas_update_type update(int64_t aInFlightIndex, tlas_instance_buffer& aInstances, avk::command_buffer_t& aCommandBuffer)
+	{
+		auto& entry = entry_for(aInFlightIndex);
+		if (0 == aInstances.size()) {
+			return tlas_update_type::none;
+		}
+
+		const auto updateType = decide(entry.mPendingUpdate, entry.mHasBeenBuilt, entry.mNumInstances, aInstances.size(), entry.mRefitsSinceRebuild, mMaxRefitsBeforeRebuild);
+		if (tlas_update_type::none == updateType) {
+			return updateType;
+		}
+
+		const auto t0 = std::chrono::steady_clock::now();
+
+		// This TLAS and the frame's instance buffer might still be read by the frame which has used them last, i.e. the one
+		// which has been submitted aNumConcurrentFrames frames ago. Wait for that frame's work only, not for the other frames':
+		wait_for_reads(entry);
+		mCurrentFrameStats.mReadsWaitMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+		const auto& instancesBuffer = aInstances.upload(aInFlightIndex);
+		mCurrentFrameStats.mUploadedBytes += aInstances.last_uploaded_bytes();
+
+		if (tlas_update_type::rebuild == updateType) {
+			entry.mTlas->build(
+				instancesBuffer, // Build with all the geometry instances, be it a reference to a triangle mesh, or an AABB => just everything mixed
+				{},              // Let the scratch buffer be created internally
+				avk::sync::with_barriers_into_existing_command_buffer(aCommandBuffer, {}, {})
+			);
+			entry.mRefitsSinceRebuild = 0;
+		}
+		else {
+			entry.mTlas->update(
+				instancesBuffer, // Same instances as before, but with modified transformations
+				{},
+				avk::sync::with_barriers_into_existing_command_buffer(aCommandBuffer, {}, {})
+			);
+			++entry.mRefitsSinceRebuild;
+		}
+
+		// ...and we need to ensure that the TLAS (update-)build has completed (also in terms of memory
+		// access--not only execution) before we may continue ray tracing with that TLAS:
+		aCommandBuffer.establish_global_memory_barrier(
+			avk::pipeline_stage::acceleration_structure_build,       /* -> */ avk::pipeline_stage::ray_tracing_shaders,
+			avk::memory_access::acceleration_structure_write_access, /* -> */ avk::memory_access::acceleration_structure_read_access
+		);
+
+		entry.mHasBeenBuilt = true;
+		entry.mNumInstances = aInstances.size();
+		entry.mPendingUpdate = tlas_update_type::none;
+
+		const auto ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - t0).count();
+		mCurrentFrameStats.mNumInstances = static_cast<uint32_t>(aInstances.size());
+		if (tlas_update_type::rebuild == updateType) {
+			++mCurrentFrameStats.mNumBuilds;
+			++mTotalNumBuilds;
+			mCurrentFrameStats.mBuildTimeMs += ms;
+		}
+		else {
+			++mCurrentFrameStats.mNumRefits;
+			++mTotalNumRefits;
+			mCurrentFrameStats.mRefitTimeMs += ms;
+		}
+		return updateType;
+	}
+
+	// Must be invoked after all work which reads the TLAS of the given frame in flight (ray tracing, spawn rays) has been
+	// submitted to aQueue. The next update(...) of this TLAS waits until this work has completed:
+	void end_reads(int64_t aInFlightIndex, avk::queue& aQueue)
+	{
+		auto& entry = entry_for(aInFlightIndex);
+		wait_for_reads(entry); // Reads of a frame which has been submitted aNumConcurrentFrames frames ago, i.e. long completed
+		gvk::context().device().resetFences(entry.mReadsCompleted.get());
+		// A submission without any batches signals the fence when all work which has been submitted before has completed:
+		aQueue.handle().submit(nullptr, entry.mReadsCompleted.get());
+		entry.mReadsPending = true;
+	}
+
+	// Must be invoked once per frame, before the first update(...):
+	void begin_frame()
+	{
+		mLastFrameStats = mCurrentFrameStats;
+		mCurrentFrameStats = {};
+	}
+
+	// True if the TLAS of the given frame in flight is outdated:
+	[[nodiscard]] bool needs_update(int64_t aInFlightIndex) const
+	{
+		return tlas_update_type::none != mPerFrame[static_cast<size_t>(aInFlightIndex) % mPerFrame.size()].mPendingUpdate;
+	}
+
+	// The TLAS which is to be used by the given frame in flight:
+	[[nodiscard]] const avk::top_level_acceleration_structure& tlas_for_frame(int64_t aInFlightIndex) const
+	{
+		return mPerFrame[static_cast<size_t>(aInFlightIndex) % mPerFrame.size()].mTlas;
+	}
+
+	[[nodiscard]] const frame_stats& last_frame_stats() const { return mLastFrameStats; }
+	[[nodiscard]] uint64_t total_number_of_builds() const { return mTotalNumBuilds; }
+	[[nodiscard]] uint64_t total_number_of_refits() const { return mTotalNumRefits; }
+
+private:
+	struct per_frame_tlas
+	{
+		avk::top_level_acceleration_structure mTlas;
+		tlas_update_type mPendingUpdate = tlas_update_type::rebuild;
+		bool mHasBeenBuilt = false;
+		size_t mNumInstances = 0;
+		uint32_t mRefitsSinceRebuild = 0;
+		vk::UniqueFence mReadsCompleted; // Signalled when the work which has been submitted before end_reads(...) has completed
+		bool mReadsPending = false;      // True if mReadsCompleted has been submitted and not been waited for
+	};
+
+	[[nodiscard]] per_frame_tlas& entry_for(int64_t aInFlightIndex)
+	{
+		return mPerFrame[static_cast<size_t>(aInFlightIndex) % mPerFrame.size()];
+	}
+
+	static void wait_for_reads(per_frame_tlas& aEntry)
+	{
+		if (!aEntry.mReadsPending) {
+			return;
+		}
+		const auto result = gvk::context().device().waitForFences(aEntry.mReadsCompleted.get(), VK_TRUE, UINT64_MAX);
+		assert(vk::Result::eSuccess == result);
+		(void)result;
+		aEntry.mReadsPending = false;
+	}
+
+	std::vector<per_frame_tlas> mPerFrame;
+	uint32_t mMaxRefitsBeforeRebuild = 32;
+
+	frame_stats mCurrentFrameStats;
+	frame_stats mLastFrameStats;
+	uint64_t mTotalNumBuilds = 0;
+	uint64_t mTotalNumRefits = 0;
+};
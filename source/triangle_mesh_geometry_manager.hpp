@@ -6,98 +6,215 @@
 
 #include "preprocessor_defines.hpp"
 #include "cpu_to_gpu_data_types.hpp"
+#include "tlas_manager.hpp"
+#include "scene_cache.hpp"
+#include "texture_cache.hpp"
+#include "static_blas.hpp"
+#include "instance_packing.hpp"
+#include "packed_bitset.hpp"
+#include "thread_pool.hpp"
+#include "bindless_registry.hpp"
 
 // An invokee that handles triangle mesh geometry:
 class triangle_mesh_geometry_manager : public gvk::invokee
 {
 public: // v== gvk::invokee overrides which will be invoked by the framework ==v
-	triangle_mesh_geometry_manager()
+	triangle_mesh_geometry_manager(avk::queue& aQueue)
 		: invokee{ -10 } // This invokee must execute BEFORE the main invokee
+		, mQueue{ &aQueue }
 	{}
 
 	void initialize() override
 	{
-		// Load an ORCA scene from file:
-		auto orca = gvk::orca_scene_t::load_from_file("assets/sponza_and_terrain.fscene", aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
+		const auto t0 = std::chrono::steady_clock::now();
+
+		// Get the scene's geometry from the cache, or import it with Assimp if the cache is missing or outdated:
+		const std::string scenePath = "assets/sponza_and_terrain.fscene";
+		const aiProcessFlagType importFlags = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace;
+		scene_cache cache;
+		bool fromCache = false;
+#if ENABLE_SCENE_CACHE
+		const auto cachePath = scenePath + ".fncache";
+		std::string reason;
+		fromCache = cache.open(cachePath, reason) && cache.is_up_to_date(importFlags, reason);
+		if (!fromCache) {
+			LOG_INFO("Scene cache can't be used (" + reason + "), importing '" + scenePath + "'.");
+		}
+#endif
+		if (!fromCache) {
+			auto image = import_scene(scenePath, importFlags);
+#if ENABLE_SCENE_CACHE
+			if (!write_scene_cache(cachePath, image)) {
+				LOG_WARNING("Couldn't write the scene cache '" + cachePath + "'.");
+			}
+#endif
+			std::string error;
+			if (!cache.open(std::move(image), error)) {
+				throw gvk::runtime_error("Importing '" + scenePath + "' has failed: " + error);
+			}
+		}
+		const auto t1 = std::chrono::steady_clock::now();
+
+		// Decide which groups of meshes share one BLAS (see plan_blas_merging). The geometries of a merged BLAS are consecutive
+		// groups; in shaders, the custom index of an instance plus gl_GeometryIndexEXT is the index of the group:
+#if ENABLE_STATIC_BLAS_MERGING
+		const auto blasRanges = plan_blas_merging(cache, cSmallGroupTriangles, cMaxMergedTriangles);
+#else
+		const auto blasRanges = plan_blas_merging(cache, 0, 0);
+#endif
+		const auto groups = cache.groups();
+
+		// Upload every group of meshes with the same material, straight from the (mapped) cache. The BLAS are split into a few
+		// batches; the transfers and BLAS builds of each batch are recorded into one command buffer, and while the GPU works on
+		// one batch, the next one is recorded. All BLAS builds of a batch share one sub-allocated scratch buffer:
+		std::vector<avk::command_buffer> batchCommandBuffers;
+		std::vector<static_blas_batch> batches;
+		std::vector<avk::fence> batchFences;
+		std::vector<avk::buffer_view> indexBufferViews, texCoordsBufferViews, normalsBufferViews; // Registered with mBindless below
+		auto& commandPool = gvk::context().get_command_pool_for_single_use_command_buffers(*mQueue);
+		for (size_t firstBlas = 0, endBlas = 0; firstBlas < blasRanges.size(); firstBlas = endBlas) {
+			size_t batchBytes = 0;
+			while (endBlas < blasRanges.size() && (endBlas == firstBlas || batchBytes < cUploadBatchBytes)) {
+				for (auto g = blasRanges[endBlas].first; g < blasRanges[endBlas].second; ++g) {
+					batchBytes += cache.size_of(groups[g]);
+				}
+				++endBlas;
+			}
+			const auto first = blasRanges[firstBlas].first;
+			const auto end = blasRanges[endBlas - 1].second;
+			// Let the operating system read the next batch from disk while this one is being processed:
+			for (auto g = end; g < groups.size() && g < end + (end - first); ++g) {
+				cache.prefetch(groups[g]);
+			}
 
-		// Prepare a vector to hold all the material information of all models:
-		std::vector<gvk::material_config> materialData;
+			auto cmdbfr = commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+			cmdbfr->begin_recording();
+			auto sync = [&cmdbfr]() { return avk::sync::with_barriers_into_existing_command_buffer(*cmdbfr, {}, {}); };
+
+			// Store all of this data in buffers and buffer views, s.t. we can access it later in ray tracing shaders.
+			// Position and index buffers need the eShaderDeviceAddressKHR flag to be made usable with ray tracing:
+			std::vector<static_blas_geometry> geometries;
+			for (auto g = first; g < end; ++g) {
+				const auto& group = groups[g];
+				auto posBfr = create_buffer_from_array<avk::vertex_buffer_meta, avk::uniform_texel_buffer_meta, avk::read_only_input_to_acceleration_structure_builds_buffer_meta>(
+					cache.positions(group), group.mNumVertices, avk::content_description::position, vk::BufferUsageFlagBits::eShaderDeviceAddressKHR, sync());
+				auto idxBfr = create_buffer_from_array<avk::index_buffer_meta, avk::uniform_texel_buffer_meta, avk::read_only_input_to_acceleration_structure_builds_buffer_meta>(
+					cache.indices(group), group.mNumIndices, avk::content_description::index, vk::BufferUsageFlagBits::eShaderDeviceAddressKHR, sync());
+				auto nrmBfr = create_buffer_from_array<avk::vertex_buffer_meta, avk::uniform_texel_buffer_meta>(
+					cache.normals(group), group.mNumVertices, avk::content_description::normal, {}, sync());
+				auto texBfr = create_buffer_from_array<avk::vertex_buffer_meta, avk::uniform_texel_buffer_meta>(
+					cache.tex_coords(group), group.mNumVertices, avk::content_description::texture_coordinate, {}, sync());
+				geometries.push_back(static_blas_geometry{ posBfr->device_address(), idxBfr->device_address(), group.mNumVertices, group.mNumIndices / 3 });
+
+				// Buffer views allow us to access the per vertex data in ray tracing shaders, where they will be accessible via
+				// samplerBuffer- or usamplerBuffer-type uniforms. Their buffers stay alive as long as the views:
+				mPositionsBufferViews.push_back(gvk::context().create_buffer_view(avk::owned(posBfr))); // owned is equivalent to move
+				indexBufferViews.push_back(gvk::context().create_buffer_view(avk::owned(idxBfr)));
+				normalsBufferViews.push_back(gvk::context().create_buffer_view(avk::owned(nrmBfr)));
+				texCoordsBufferViews.push_back(gvk::context().create_buffer_view(avk::owned(texBfr)));
+			}
 
-		for (auto& model : orca->models()) {
-			auto& nameAndRangeInfo = mBlasNamesAndRanges.emplace_back(
-				model.mName,                                  // We are about to add several entries to mBlas for the model with this name
-				static_cast<int>(mAllGeometryInstances.size()),  // These ^ entries start at this index
-				-1                                            //  ... and we'll figure out the end index as we go.
+			// Create the bottom level acceleration structures of this batch and build them:
+			auto& batch = batches.emplace_back(ENABLE_BLAS_COMPACTION != 0);
+			for (auto b = firstBlas; b < endBlas; ++b) {
+				batch.add(std::vector<static_blas_geometry>(
+					std::begin(geometries) + (blasRanges[b].first - first), std::begin(geometries) + (blasRanges[b].second - first)
+				));
+			}
+			// The BLAS builds read the uploaded positions and indices:
+			cmdbfr->establish_global_memory_barrier(
+				avk::pipeline_stage::transfer,              /* -> */ avk::pipeline_stage::acceleration_structure_build,
+				avk::memory_access::transfer_write_access,  /* -> */ avk::memory_access::shader_buffers_and_images_read_access
 			);
+			batch.record_builds(*cmdbfr);
+			cmdbfr->end_recording();
+			batchFences.push_back(mQueue->submit_with_fence(avk::referenced(cmdbfr)));
+			batchCommandBuffers.push_back(std::move(cmdbfr)); // Keep it (and the staging buffers it owns) alive until the fence has been signalled
+		}
+		const auto t2 = std::chrono::steady_clock::now();
 
-			// Get the distinct materials for every (static) mesh and accumulate them in a big array
-			// wich will be transformed and stored in a big buffer, eventually:
-			auto distinctMaterials = model.mLoadedModel->distinct_material_configs();
-			for (const auto& [materialConfig, meshIndices] : distinctMaterials) {
-				materialData.push_back(materialConfig);
-
-				auto selection = gvk::make_models_and_meshes_selection(model.mLoadedModel, meshIndices);
-				// Store all of this data in buffers and buffer views, s.t. we can access it later in ray tracing shaders
-				auto [posBfr, idxBfr] = gvk::create_vertex_and_index_buffers<avk::uniform_texel_buffer_meta, avk::read_only_input_to_acceleration_structure_builds_buffer_meta>(
-					selection,                                          // Select several indices (those with the same material) from a model
-					vk::BufferUsageFlagBits::eShaderDeviceAddressKHR    // Buffers need this additional flag to be made usable with ray tracing
-					);
-				auto nrmBfr = gvk::create_normals_buffer               <avk::uniform_texel_buffer_meta>(selection);
-				auto texBfr = gvk::create_2d_texture_coordinates_buffer<avk::uniform_texel_buffer_meta>(selection);
-
-				// Create a bottom level acceleration structure instance with this geometry.
-				auto blas = gvk::context().create_bottom_level_acceleration_structure(
-					{ avk::acceleration_structure_size_requirements::from_buffers(avk::vertex_index_buffer_pair{ posBfr, idxBfr }) },
-					false // no need to allow updates for static geometry
-				);
-				blas->build({ avk::vertex_index_buffer_pair{ posBfr, idxBfr } });
+		// Wait until all batches have been uploaded and built:
+		for (auto& fence : batchFences) {
+			fence->wait_until_signalled();
+		}
+		const auto t3 = std::chrono::steady_clock::now();
 
-				// Create a geometry instance entry per instance in the ORCA scene file:
-				for (const auto& inst : model.mInstances) {
-					auto bufferViewIndex = static_cast<uint32_t>(mTexCoordsBufferViews.size());
-
-					// Create a concrete geometry instance:
-					mAllGeometryInstances.push_back(
-						gvk::context().create_geometry_instance(blas) // Refer to the concrete BLAS
-							// Handle triangle meshes with an instance offset of 0:
-							.set_instance_offset(0)
-							// Set this instance's transformation matrix:
-							.set_transform_column_major(gvk::to_array(gvk::matrix_from_transforms(inst.mTranslation, glm::quat(inst.mRotation), inst.mScaling)))
-							// Set this instance's custom index, which is especially important since we'll use it in shaders
-							// to refer to the right material and also vertex data (these two are aligned index-wise):
-							.set_custom_index(bufferViewIndex)
-					);
-
-					// State that this geometry instance shall be included in TLAS generation by default:
-					mGeometryInstanceActive.push_back(true);
-
-					// Generate and store a description for what this geometry instance entry represents:
-					assert(!selection.empty());
-					std::string description = model.mName + " (" + inst.mName + "): "; // ...refers to one specific model, and...
-					for (const auto& tpl : selection) {
-						for (const auto meshIndex : std::get<1>(tpl)) {
-							description += std::get<0>(tpl)->name_of_mesh(meshIndex) + ", "; // ...to one or multiple submeshes.
-						}
-					}
-					mGeometryInstanceDescriptions.push_back(description.substr(0, description.size() - 2));
+		// Compact all BLAS (their compacted sizes are known only now) with one more submission:
+		for (const auto& batch : batches) {
+			mBlasMemoryBeforeCompaction += batch.blas_memory();
+		}
+#if ENABLE_BLAS_COMPACTION
+		{
+			auto cmdbfr = commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+			cmdbfr->begin_recording();
+			for (auto& batch : batches) {
+				batch.record_compaction(*cmdbfr);
+			}
+			cmdbfr->end_recording();
+			mQueue->submit_with_fence(avk::referenced(cmdbfr))->wait_until_signalled();
+			for (auto& batch : batches) {
+				batch.finish_compaction();
+			}
+		}
+#endif
+		for (auto& batch : batches) {
+			mBlasMemory += batch.blas_memory();
+			for (auto& blas : batch.blas()) {
+				mBlas.push_back(std::move(blas));
+			}
+		}
+		const auto t4 = std::chrono::steady_clock::now();
+
+		// Create one geometry instance per instance in the ORCA scene file and BLAS. The instances of the groups of
+		// a merged BLAS (except for those of its first group) are represented by the instances of the merged BLAS:
+		std::vector<uint32_t> blasOfGroup(groups.size());
+		for (uint32_t b = 0; b < blasRanges.size(); ++b) {
+			for (auto g = blasRanges[b].first; g < blasRanges[b].second; ++g) {
+				blasOfGroup[g] = b;
+			}
+		}
+		for (const auto& model : cache.models()) {
+			const auto firstInstance = static_cast<int>(mAllGeometryInstances.size());
+			for (auto i = model.mFirstInstance; i < model.mEndInstance; ++i) {
+				const auto& inst = cache.instances()[i];
+				const auto b = blasOfGroup[inst.mGroup];
+				if (blasRanges[b].first != inst.mGroup) {
+					continue;
 				}
+				// The custom index is especially important since we'll use it in shaders to refer to the right
+				// material and also vertex data (these two are aligned index-wise with the groups):
+				mAllGeometryInstances.push_back(make_packed_instance(inst.mTransform, inst.mGroup, 0 /* Handle triangle meshes with an instance offset of 0 */, mBlas[b].device_address()));
 
-				mBlas.push_back(std::move(blas)); // Move this BLAS s.t. we don't have to enable_shared_ownership. We're done with it here.
-
-				// After we have used positions and indices for building the BLAS, still need to create buffer views which allow us to access
-				// the per vertex data in ray tracing shaders, where they will be accessible via samplerBuffer- or usamplerBuffer-type uniforms.
-				mPositionsBufferViews.push_back(gvk::context().create_buffer_view(avk::owned(posBfr))); // owned is equivalent to move
-				mIndexBufferViews.push_back(gvk::context().create_buffer_view(avk::owned(idxBfr)));
-				mNormalsBufferViews.push_back(gvk::context().create_buffer_view(avk::owned(nrmBfr)));
-				mTexCoordsBufferViews.push_back(gvk::context().create_buffer_view(avk::owned(texBfr)));
+				// A description for what this geometry instance entry represents:
+				const auto numMerged = blasRanges[b].second - blasRanges[b].first;
+				mGeometryInstanceDescriptions.push_back(std::string{ cache.string(inst.mDescription) } + (numMerged > 1 ? fmt::format(" (+{} merged groups)", numMerged - 1) : std::string{}));
 			}
-
-			// Set the final range-to index (one after the end, i.e. excluding the last index):
-			std::get<2>(nameAndRangeInfo) = static_cast<int>(mAllGeometryInstances.size());
+			mBlasNamesAndRanges.emplace_back(std::string{ cache.string(model.mName) }, firstInstance, static_cast<int>(mAllGeometryInstances.size()));
 		}
+		mNumInstancesBeforeMerging = cache.instances().size();
+
+		// State that all geometry instances shall be visible by default:
+		mGeometryInstanceActive.assign(mAllGeometryInstances.size(), true);
+
+		const auto ms = [](auto aFrom, auto aTo) { return std::chrono::duration<double, std::milli>(aTo - aFrom).count(); };
+		LOG_INFO(fmt::format("Scene geometry {} in {:.1f} ms, recorded in {:.1f} ms ({} batches), GPU upload and BLAS builds finished {:.1f} ms later, compaction took {:.1f} ms.",
+			fromCache ? "loaded from cache" : "imported", ms(t0, t1), ms(t1, t2), batchFences.size(), ms(t2, t3), ms(t3, t4)));
+		LOG_INFO(fmt::format("{} groups in {} BLAS ({} TLAS instances, {} without merging). BLAS memory: {:.2f} MiB ({:.2f} MiB before compaction).",
+			groups.size(), mBlas.size(), mAllGeometryInstances.size(), mNumInstancesBeforeMerging,
+			static_cast<double>(mBlasMemory) / (1024.0 * 1024.0), static_cast<double>(mBlasMemoryBeforeCompaction) / (1024.0 * 1024.0)));
 
 		// Set the flag in order to trigger initial TLAS build in our main invokee:
-		mTlasUpdateRequired = true;
+		mTlasUpdateRequired = tlas_update_type::rebuild;
+
+#if ENABLE_TEXTURE_CACHE
+		// Convert the materials into a GPU-compatible format and upload their (preprocessed) images to the GPU:
+		auto [gpuMaterials, imageSamplers] = convert_for_gpu_usage_with_texture_cache(cache, scenePath + ".fntexcache");
+#else
+		// Prepare a vector to hold all the material information of all models:
+		std::vector<gvk::material_config> materialData;
+		for (const auto& material : cache.materials()) {
+			materialData.push_back(to_material_config(cache, material));
+		}
 
 		// Convert the materials that were gathered above into a GPU-compatible format and generate and upload images to the GPU:
 		auto [gpuMaterials, imageSamplers] = gvk::convert_for_gpu_usage<gvk::material_gpu_data>(
@@ -105,9 +222,19 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 			avk::image_usage::general_texture,
 			avk::filter_mode::trilinear // No need for MIP-mapping (which would be activated with trilinear or anisotropic) since we're using ray tracing
 			);
-
-		// Store images in a member variable, otherwise they would get destroyed.
-		mImageSamplers = std::move(imageSamplers);
+#endif
+
+		// Give every texture and every group of meshes a stable slot in the descriptor arrays (which also keeps them alive).
+		// Materials refer to textures and instances refer to groups by their indices in the vectors, which become their slots:
+		mBindless.create(static_cast<uint32_t>(imageSamplers.size()), static_cast<uint32_t>(groups.size()), static_cast<uint32_t>(gvk::context().main_window()->number_of_frames_in_flight()));
+		for (auto& imageSampler : imageSamplers) {
+			mTextureHandles.push_back(mBindless.add_texture(std::move(imageSampler)));
+			assert(mTextureHandles.back().mIndex + 1 == mTextureHandles.size());
+		}
+		for (size_t g = 0; g < groups.size(); ++g) {
+			mGeometryHandles.push_back(mBindless.add_geometry(std::move(indexBufferViews[g]), std::move(texCoordsBufferViews[g]), std::move(normalsBufferViews[g])));
+			assert(mGeometryHandles.back().mIndex == g);
+		}
 
 		// Upload materials in GPU-compatible format into a GPU storage buffer:
 		mMaterialBuffer = gvk::context().create_buffer(
@@ -128,6 +255,11 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 				ImGui::SetWindowPos(ImVec2(3.0f, 474.0f), ImGuiCond_FirstUseEver);
 				ImGui::SetWindowSize(ImVec2(410.0f, 606.0f), ImGuiCond_FirstUseEver);
 				
+				ImGui::Text("%zu BLAS, %.2f MiB (%.2f MiB before compaction)", mBlas.size(),
+					static_cast<double>(mBlasMemory) / (1024.0 * 1024.0), static_cast<double>(mBlasMemoryBeforeCompaction) / (1024.0 * 1024.0));
+				ImGui::Text("%zu TLAS instances (%zu without merging)", mAllGeometryInstances.size(), mNumInstancesBeforeMerging);
+				ImGui::Separator();
+
 				ImGui::Text("Specify which geometry instances to included in TLAS:");
 
 				ImGui::TextColored(ImVec4(0.f, .6f, .8f, 1.f), "Supported modifier keys:");
@@ -137,7 +269,7 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 				// Let the user enable/disable some geometry instances w.r.t. includion into the TLAS:
 				assert(mAllGeometryInstances.size() == mGeometryInstanceActive.size());
 				assert(mAllGeometryInstances.size() == mGeometryInstanceDescriptions.size());
-				auto numActive = std::accumulate(std::begin(mGeometryInstanceActive), std::end(mGeometryInstanceActive), 0, [](auto cur, auto nxt) { return cur + (nxt ? 1 : 0); });
+				const auto numActive = mGeometryInstanceActive.count();
 				for (size_t i = 0; i < mAllGeometryInstances.size(); ++i) {
 					bool tmp = mGeometryInstanceActive[i];
 
@@ -148,20 +280,19 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 					}
 
 					auto clicked = ImGui::Checkbox((mGeometryInstanceDescriptions[i] + "##geominst" + std::to_string(i)).c_str(), &tmp);
-					mTlasUpdateRequired = mTlasUpdateRequired || clicked;
+					if (clicked) {
+						// All instances stay in the TLAS, only their visibility masks change => a refit suffices:
+						mTlasUpdateRequired = combine(mTlasUpdateRequired, tlas_update_type::refit);
+					}
 
 					if (clicked && (gvk::input().key_down(gvk::key_code::left_shift) || gvk::input().key_down(gvk::key_code::right_shift))) {
-						for (size_t j = 0; j < mGeometryInstanceActive.size(); ++j) {
-							mGeometryInstanceActive[j] = j == i;
-						}
+						mGeometryInstanceActive.set_only(i);
 					}
 					else if (clicked && (gvk::input().key_down(gvk::key_code::left_control) || gvk::input().key_down(gvk::key_code::right_control))) {
-						for (size_t j = 0; j < mGeometryInstanceActive.size(); ++j) {
-							mGeometryInstanceActive[j] = j != i;
-						}
+						mGeometryInstanceActive.set_all_except(i);
 					}
-					else { // No modifier keys pressed => no special treatment:
-						mGeometryInstanceActive[i] = tmp;
+					else if (clicked) { // No modifier keys pressed => no special treatment:
+						mGeometryInstanceActive.set(i, tmp);
 					}
 
 					if (disable) {
@@ -176,25 +307,32 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 
 	// Returns true if a TLAS that uses the geometry of this invokee must be updated because the geometry (selection) has changed.
 	[[nodiscard]] bool has_updated_geometry_for_tlas() const
+	{
+		return tlas_update_type::none != mTlasUpdateRequired;
+	}
+
+	// Returns which kind of TLAS update the changes require:
+	[[nodiscard]] tlas_update_type required_tlas_update() const
 	{
 		return mTlasUpdateRequired;
 	}
 
 	void reset_update_required_flag()
 	{
-		mTlasUpdateRequired = false;
+		mTlasUpdateRequired = tlas_update_type::none;
 	}
 	
-	// Return the active geometry instances to the caller, who will use it for a TLAS build:
-	[[nodiscard]] std::vector<avk::geometry_instance> get_active_geometry_instances_for_tlas_build()
+	// Writes all geometry instances into the static section of the given TLAS instance buffer, or, if only their
+	// visibility has changed since, only the masks of those which have been enabled or disabled. The disabled ones
+	// stay in the TLAS (with a visibility mask of 0), s.t. the number of instances never changes:
+	void write_geometry_instances_for_tlas_build(tlas_instance_buffer& aInstances) const
 	{
-		std::vector<avk::geometry_instance> activeGeometryInstances;
-		for (size_t i = 0; i < mAllGeometryInstances.size(); ++i) {
-			if (mGeometryInstanceActive[i]) {
-				activeGeometryInstances.push_back(mAllGeometryInstances[i]);
-			}
+		if (tlas_update_type::rebuild == mTlasUpdateRequired) {
+			aInstances.set_static_instances(mAllGeometryInstances, mGeometryInstanceActive);
+		}
+		else {
+			aInstances.set_static_instance_visibility(mGeometryInstanceActive);
 		}
-		return activeGeometryInstances;
 	}
 
 	// Invoked by the framework every frame:
@@ -205,33 +343,404 @@ public: // v== gvk::invokee overrides which will be invoked by the framework ==v
 	// Some getters that will be used by the main invokee:
 	uint32_t max_number_of_geometry_instances() const { return static_cast<uint32_t>(mAllGeometryInstances.size()); }
 	const auto& material_buffer() const { return mMaterialBuffer; }
-	const auto& image_samplers() const { return mImageSamplers; }
-	const auto& index_buffer_views() const { return mIndexBufferViews; }
+	const auto& image_samplers() const { return mBindless.textures(); }
+	const auto& index_buffer_views() const { return mBindless.index_buffer_views(); }
 	const auto& position_buffer_views() const { return mPositionsBufferViews; }
-	const auto& tex_coords_buffer_views() const { return mTexCoordsBufferViews; }
-	const auto& normals_buffer_views() const { return mNormalsBufferViews; }
+	const auto& tex_coords_buffer_views() const { return mBindless.tex_coords_buffer_views(); }
+	const auto& normals_buffer_views() const { return mBindless.normals_buffer_views(); }
+	// The textures' and groups' slots in the descriptor arrays, whose changes must be written into every frame's descriptor set:
+	bindless_registry& bindless() { return mBindless; }
 	
+private: // v== Helper functions ==v
+
+	// Imports an ORCA scene with Assimp and converts it into the contents of a scene cache. The meshes of every model
+	// are grouped by their distinct material configs; groups and instances are in the order in which they are uploaded:
+	static std::vector<uint8_t> import_scene(const std::string& aPath, aiProcessFlagType aImportFlags)
+	{
+		scene_cache_builder builder{ static_cast<uint64_t>(aImportFlags) };
+		builder.add_source_file(aPath);
+
+		// Load an ORCA scene from file:
+		const auto t0 = std::chrono::steady_clock::now();
+		auto orca = gvk::orca_scene_t::load_from_file(aPath, aImportFlags);
+		const auto t1 = std::chrono::steady_clock::now();
+		auto& models = orca->models();
+		auto& pool = shared_thread_pool();
+
+		// Get the distinct materials for every (static) mesh. Models are independent of each other:
+		using distinct_materials_t = decltype(models.front().mLoadedModel->distinct_material_configs());
+		std::vector<distinct_materials_t> distinctMaterialsPerModel(models.size());
+		pool.parallel_for(0, models.size(), 1, [&](size_t aBegin, size_t aEnd) {
+			for (auto m = aBegin; m < aEnd; ++m) {
+				distinctMaterialsPerModel[m] = models[m].mLoadedModel->distinct_material_configs();
+			}
+		});
+
+		// Gather the vertex data of all groups. Groups are independent of each other, too:
+		struct group_data
+		{
+			size_t mModel;
+			const gvk::material_config* mMaterial;
+			decltype(gvk::make_models_and_meshes_selection(models.front().mLoadedModel, std::declval<const distinct_materials_t&>().begin()->second)) mSelection;
+			std::vector<glm::vec3> mPositions;
+			std::vector<uint32_t> mIndices;
+			std::vector<glm::vec3> mNormals;
+			std::vector<glm::vec2> mTexCoords;
+		};
+		std::vector<group_data> groups;
+		for (size_t m = 0; m < models.size(); ++m) {
+			for (const auto& [materialConfig, meshIndices] : distinctMaterialsPerModel[m]) {
+				groups.push_back(group_data{ m, &materialConfig, gvk::make_models_and_meshes_selection(models[m].mLoadedModel, meshIndices) });
+			}
+		}
+		pool.parallel_for(0, groups.size(), 1, [&](size_t aBegin, size_t aEnd) {
+			for (auto g = aBegin; g < aEnd; ++g) {
+				auto& group = groups[g];
+				std::tie(group.mPositions, group.mIndices) = gvk::get_vertices_and_indices(group.mSelection);
+				group.mNormals = gvk::get_normals(group.mSelection);
+				group.mTexCoords = gvk::get_2d_texture_coordinates(group.mSelection);
+			}
+		});
+		const auto t2 = std::chrono::steady_clock::now();
+
+		// Add everything to the cache in a deterministic order (the same as if it was done sequentially):
+		for (size_t m = 0, g = 0; m < models.size(); ++m) {
+			auto& model = models[m];
+			builder.add_source_file(model.mFullPathOfModel);
+			builder.begin_model(model.mName);
+			for (; g < groups.size() && groups[g].mModel == m; ++g) {
+				auto& data = groups[g];
+				const auto group = builder.add_group(
+					to_cached_material(builder, *data.mMaterial),
+					std::move(data.mPositions), std::move(data.mIndices), std::move(data.mNormals), std::move(data.mTexCoords)
+				);
+
+				// Generate a description for what the geometry instances of this group represent:
+				assert(!data.mSelection.empty());
+				std::string meshNames;
+				for (const auto& tpl : data.mSelection) {
+					for (const auto meshIndex : std::get<1>(tpl)) {
+						meshNames += std::get<0>(tpl)->name_of_mesh(meshIndex) + ", "; // ...refers to one or multiple submeshes.
+					}
+				}
+				meshNames = meshNames.substr(0, meshNames.size() - 2);
+
+				for (const auto& inst : model.mInstances) {
+					builder.add_instance(group, gvk::matrix_from_transforms(inst.mTranslation, glm::quat(inst.mRotation), inst.mScaling), model.mName + " (" + inst.mName + "): " + meshNames);
+				}
+			}
+		}
+		auto image = builder.build();
+		const auto t3 = std::chrono::steady_clock::now();
+		const auto ms = [](auto aFrom, auto aTo) { return std::chrono::duration<double, std::milli>(aTo - aFrom).count(); };
+		LOG_INFO(fmt::format("Scene import: Assimp {:.1f} ms, vertex data of {} groups {:.1f} ms ({} threads), cache image {:.1f} ms.",
+			ms(t0, t1), groups.size(), ms(t1, t2), pool.size(), ms(t2, t3)));
+		return image;
+	}
+
+	// Stores all values of a material config which the shaders can access:
+	static scene_cache_format::material to_cached_material(scene_cache_builder& aBuilder, const gvk::material_config& aConfig)
+	{
+		using namespace scene_cache_format;
+		material m{};
+		m.mName = aBuilder.add_string(aConfig.mName);
+		const std::string* textures[cNumTextureSlots] = { &aConfig.mDiffuseTex, &aConfig.mSpecularTex, &aConfig.mAmbientTex, &aConfig.mEmissiveTex, &aConfig.mHeightTex, &aConfig.mNormalsTex,
+			&aConfig.mShininessTex, &aConfig.mOpacityTex, &aConfig.mDisplacementTex, &aConfig.mReflectionTex, &aConfig.mLightmapTex, &aConfig.mExtraTex };
+		const glm::vec4* offsetTilings[cNumTextureSlots] = { &aConfig.mDiffuseTexOffsetTiling, &aConfig.mSpecularTexOffsetTiling, &aConfig.mAmbientTexOffsetTiling, &aConfig.mEmissiveTexOffsetTiling,
+			&aConfig.mHeightTexOffsetTiling, &aConfig.mNormalsTexOffsetTiling, &aConfig.mShininessTexOffsetTiling, &aConfig.mOpacityTexOffsetTiling,
+			&aConfig.mDisplacementTexOffsetTiling, &aConfig.mReflectionTexOffsetTiling, &aConfig.mLightmapTexOffsetTiling, &aConfig.mExtraTexOffsetTiling };
+		for (uint32_t i = 0; i < cNumTextureSlots; ++i) {
+			m.mTextures[i] = aBuilder.add_string(*textures[i]);
+			m.mTexOffsetTiling[i] = *offsetTilings[i];
+		}
+		m.mDiffuseReflectivity = aConfig.mDiffuseReflectivity;
+		m.mAmbientReflectivity = aConfig.mAmbientReflectivity;
+		m.mSpecularReflectivity = aConfig.mSpecularReflectivity;
+		m.mEmissiveColor = aConfig.mEmissiveColor;
+		m.mTransparentColor = aConfig.mTransparentColor;
+		m.mReflectiveColor = aConfig.mReflectiveColor;
+		m.mAlbedo = aConfig.mAlbedo;
+		m.mOpacity = aConfig.mOpacity;
+		m.mBumpScaling = aConfig.mBumpScaling;
+		m.mShininess = aConfig.mShininess;
+		m.mShininessStrength = aConfig.mShininessStrength;
+		m.mRefractionIndex = aConfig.mRefractionIndex;
+		m.mReflectivity = aConfig.mReflectivity;
+		m.mMetallic = aConfig.mMetallic;
+		m.mSmoothness = aConfig.mSmoothness;
+		m.mSheen = aConfig.mSheen;
+		m.mThickness = aConfig.mThickness;
+		m.mRoughness = aConfig.mRoughness;
+		m.mAnisotropy = aConfig.mAnisotropy;
+		m.mAnisotropyRotation = aConfig.mAnisotropyRotation;
+		m.mCustomData = aConfig.mCustomData;
+		return m;
+	}
+
+	// Converts the materials of a scene cache into a GPU-compatible format, like gvk::convert_for_gpu_usage does (color textures in sRGB,
+	// all textures flipped, a white texture for unused slots and a straight-up normal for unused normal maps), but takes the images from
+	// a texture cache, which is (re-)built first if it is missing or outdated. The images are uploaded in batches, like the vertex data:
+	std::tuple<std::vector<gvk::material_gpu_data>, std::vector<avk::image_sampler>> convert_for_gpu_usage_with_texture_cache(const scene_cache& aCache, const std::string& aTextureCachePath)
+	{
+		using namespace scene_cache_format;
+		const auto t0 = std::chrono::steady_clock::now();
+		auto& pool = shared_thread_pool();
+
+		// Gather all distinct textures. Color textures are in sRGB, all others (like normal maps) are linear:
+		constexpr bool cSrgbSlot[cNumTextureSlots] = { true, true, true, true, false, false, false, false, false, true, false, false };
+		std::vector<texture_request> requests;
+		std::vector<std::array<int32_t, cNumTextureSlots>> textureIndices;
+		for (const auto& material : aCache.materials()) {
+			auto& indices = textureIndices.emplace_back();
+			for (uint32_t slot = 0; slot < cNumTextureSlots; ++slot) {
+				indices[slot] = -1;
+				const std::string path{ aCache.string(material.mTextures[slot]) };
+				if (path.empty()) {
+					continue;
+				}
+				const auto it = std::find_if(std::begin(requests), std::end(requests), [&](const texture_request& r) { return r.mPath == path && r.mSrgb == cSrgbSlot[slot]; });
+				indices[slot] = static_cast<int32_t>(it - std::begin(requests));
+				if (std::end(requests) == it) {
+					requests.push_back(texture_request{ path, cSrgbSlot[slot] });
+				}
+			}
+		}
+
+		// Block-compress the textures only if the device can sample from such images:
+		const auto canSample = [](vk::Format aFormat) {
+			return static_cast<bool>(gvk::context().physical_device().getFormatProperties(aFormat).optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage);
+		};
+		texture_cache_options options;
+		options.mCompression = ENABLE_TEXTURE_COMPRESSION && canSample(vk::Format::eBc1RgbaSrgbBlock) && canSample(vk::Format::eBc1RgbaUnormBlock)
+			&& canSample(vk::Format::eBc3SrgbBlock) && canSample(vk::Format::eBc3UnormBlock);
+
+		texture_cache textures;
+		std::string reason;
+		const bool fromCache = textures.open(aTextureCachePath, reason) && textures.is_up_to_date(requests, options, pool, reason);
+		if (!fromCache) {
+			LOG_INFO("Texture cache can't be used (" + reason + "), preprocessing " + std::to_string(requests.size()) + " textures.");
+			auto image = build_texture_cache(requests, options, pool);
+			if (!write_texture_cache(aTextureCachePath, image)) {
+				LOG_WARNING("Couldn't write the texture cache '" + aTextureCachePath + "'.");
+			}
+			std::string error;
+			if (!textures.open(std::move(image), error)) {
+				throw gvk::runtime_error("Preprocessing textures has failed: " + error);
+			}
+		}
+		const auto t1 = std::chrono::steady_clock::now();
+
+		// Upload all MIP levels of all textures straight from the (mapped) cache, via one staging buffer per texture. The MIP levels of a
+		// texture are stored one after the other (at aligned offsets), i.e. they can be copied into the staging buffer all at once:
+		std::vector<avk::image_sampler> imageSamplers;
+		std::vector<avk::command_buffer> batchCommandBuffers;
+		std::vector<avk::buffer> stagingBuffers;
+		std::vector<avk::fence> batchFences;
+		auto& commandPool = gvk::context().get_command_pool_for_single_use_command_buffers(*mQueue);
+		size_t imageBytes = 0;
+		const auto upload = [&](uint32_t aWidth, uint32_t aHeight, vk::Format aFormat, uint32_t aNumMipLevels, const uint8_t* aData, size_t aSize, const uint64_t* aMipOffsets, avk::command_buffer_t& aCommandBuffer) {
+			auto sync = [&aCommandBuffer]() { return avk::sync::with_barriers_into_existing_command_buffer(aCommandBuffer, {}, {}); };
+			auto image = gvk::context().create_image(aWidth, aHeight, aFormat, 1, avk::memory_usage::device, avk::image_usage::general_texture,
+				[aNumMipLevels](avk::image_t& aImage) { aImage.config().setMipLevels(aNumMipLevels); }
+			);
+			std::vector<vk::BufferImageCopy> regions;
+			for (uint32_t level = 0; level < aNumMipLevels; ++level) {
+				regions.push_back(vk::BufferImageCopy{ aMipOffsets[level] - aMipOffsets[0], 0, 0, vk::ImageSubresourceLayers{ vk::ImageAspectFlagBits::eColor, level, 0, 1 },
+					vk::Offset3D{ 0, 0, 0 }, vk::Extent3D{ std::max(1u, aWidth >> level), std::max(1u, aHeight >> level), 1u } });
+			}
+			auto& staging = stagingBuffers.emplace_back(gvk::context().create_buffer(
+				avk::memory_usage::host_coherent, vk::BufferUsageFlagBits::eTransferSrc, avk::generic_buffer_meta::create_from_size(aSize)
+			));
+			staging->fill(aData, 0, avk::sync::not_required());
+			image->transition_to_layout(vk::ImageLayout::eTransferDstOptimal, sync());
+			aCommandBuffer.handle().copyBufferToImage(staging->handle(), image->handle(), vk::ImageLayout::eTransferDstOptimal, regions);
+			image->transition_to_layout({}, sync()); // ...into its target layout for sampling
+			imageBytes += aSize;
+			imageSamplers.push_back(gvk::context().create_image_sampler(
+				avk::owned(gvk::context().create_image_view(avk::owned(image))),
+				avk::owned(gvk::context().create_sampler(avk::filter_mode::trilinear, avk::border_handling_mode::repeat))
+			));
+		};
+		const auto formatOf = [](const texture_cache_format::texture& aTexture) {
+			const bool srgb = 0 != (aTexture.mFlags & texture_cache_format::cFlagSrgb);
+			switch (aTexture.mFormat) {
+			case texture_cache_format::pixel_format::bc1: return srgb ? vk::Format::eBc1RgbaSrgbBlock : vk::Format::eBc1RgbaUnormBlock;
+			case texture_cache_format::pixel_format::bc3: return srgb ? vk::Format::eBc3SrgbBlock : vk::Format::eBc3UnormBlock;
+			default: return srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+			}
+		};
+
+		const auto all = textures.textures();
+		size_t end = 0;
+		do {
+			const auto first = end;
+			size_t batchBytes = 0;
+			while (end < all.size() && (end == first || batchBytes < cUploadBatchBytes)) {
+				batchBytes += texture_cache::size_of(all[end++]);
+			}
+			// Let the operating system read the next batch from disk while this one is being processed:
+			for (auto i = end; i < all.size() && i < end + (end - first); ++i) {
+				textures.prefetch(all[i]);
+			}
+
+			auto cmdbfr = commandPool->alloc_command_buffer(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+			cmdbfr->begin_recording();
+			for (auto i = first; i < end; ++i) {
+				const auto& t = all[i];
+				const auto last = t.mNumMipLevels - 1;
+				const auto size = static_cast<size_t>(t.mMipOffsets[last] - t.mMipOffsets[0]) + texture_cache::mip_level_size(t, last);
+				upload(t.mWidth, t.mHeight, formatOf(t), t.mNumMipLevels, textures.mip_level(t, 0), size, t.mMipOffsets, *cmdbfr);
+			}
+			if (end == all.size()) {
+				// Finally, the textures for unused slots, which are appended to the cached ones:
+				static const uint8_t sWhite[4] = { 255, 255, 255, 255 };
+				static const uint8_t sStraightUpNormal[4] = { 128, 128, 255, 255 };
+				static const uint64_t sMipOffsets[1] = { 0 };
+				for (const auto* texel : { sWhite, sStraightUpNormal }) {
+					upload(1, 1, vk::Format::eR8G8B8A8Unorm, 1, texel, 4, sMipOffsets, *cmdbfr);
+				}
+			}
+			// Make the images available to the ray tracing shaders:
+			cmdbfr->establish_global_memory_barrier(
+				avk::pipeline_stage::transfer,              /* -> */ avk::pipeline_stage::ray_tracing_shaders,
+				avk::memory_access::transfer_write_access,  /* -> */ avk::memory_access::shader_buffers_and_images_read_access
+			);
+			cmdbfr->end_recording();
+			batchFences.push_back(mQueue->submit_with_fence(avk::referenced(cmdbfr)));
+			batchCommandBuffers.push_back(std::move(cmdbfr)); // Keep it (and the staging buffers) alive until the fence has been signalled
+		} while (end < all.size());
+		for (auto& fence : batchFences) {
+			fence->wait_until_signalled();
+		}
+		const auto t2 = std::chrono::steady_clock::now();
+
+		// Assemble the materials. Textures of unused slots refer to the white texture (or to the straight-up normal):
+		const auto whiteTexIndex = static_cast<int32_t>(all.size());
+		const auto straightUpNormalTexIndex = whiteTexIndex + 1;
+		std::vector<gvk::material_gpu_data> gpuMaterials;
+		for (size_t i = 0; i < aCache.materials().size(); ++i) {
+			const auto& m = aCache.materials()[i];
+			gvk::material_gpu_data g{};
+			int32_t* indices[cNumTextureSlots] = { &g.mDiffuseTexIndex, &g.mSpecularTexIndex, &g.mAmbientTexIndex, &g.mEmissiveTexIndex, &g.mHeightTexIndex, &g.mNormalsTexIndex,
+				&g.mShininessTexIndex, &g.mOpacityTexIndex, &g.mDisplacementTexIndex, &g.mReflectionTexIndex, &g.mLightmapTexIndex, &g.mExtraTexIndex };
+			glm::vec4* offsetTilings[cNumTextureSlots] = { &g.mDiffuseTexOffsetTiling, &g.mSpecularTexOffsetTiling, &g.mAmbientTexOffsetTiling, &g.mEmissiveTexOffsetTiling,
+				&g.mHeightTexOffsetTiling, &g.mNormalsTexOffsetTiling, &g.mShininessTexOffsetTiling, &g.mOpacityTexOffsetTiling,
+				&g.mDisplacementTexOffsetTiling, &g.mReflectionTexOffsetTiling, &g.mLightmapTexOffsetTiling, &g.mExtraTexOffsetTiling };
+			for (uint32_t slot = 0; slot < cNumTextureSlots; ++slot) {
+				const auto index = textureIndices[i][slot];
+				*indices[slot] = index >= 0 ? index : (static_cast<uint32_t>(texture_slot::normals) == slot ? straightUpNormalTexIndex : whiteTexIndex);
+				*offsetTilings[slot] = m.mTexOffsetTiling[slot];
+			}
+			g.mDiffuseReflectivity = m.mDiffuseReflectivity;
+			g.mAmbientReflectivity = m.mAmbientReflectivity;
+			g.mSpecularReflectivity = m.mSpecularReflectivity;
+			g.mEmissiveColor = m.mEmissiveColor;
+			g.mTransparentColor = m.mTransparentColor;
+			g.mReflectiveColor = m.mReflectiveColor;
+			g.mAlbedo = m.mAlbedo;
+			g.mOpacity = m.mOpacity;
+			g.mBumpScaling = m.mBumpScaling;
+			g.mShininess = m.mShininess;
+			g.mShininessStrength = m.mShininessStrength;
+			g.mRefractionIndex = m.mRefractionIndex;
+			g.mReflectivity = m.mReflectivity;
+			g.mMetallic = m.mMetallic;
+			g.mSmoothness = m.mSmoothness;
+			g.mSheen = m.mSheen;
+			g.mThickness = m.mThickness;
+			g.mRoughness = m.mRoughness;
+			g.mAnisotropy = m.mAnisotropy;
+			g.mAnisotropyRotation = m.mAnisotropyRotation;
+			g.mCustomData = m.mCustomData;
+			gpuMaterials.push_back(g);
+		}
+
+		const auto ms = [](auto aFrom, auto aTo) { return std::chrono::duration<double, std::milli>(aTo - aFrom).count(); };
+		LOG_INFO(fmt::format("{} textures {} in {:.1f} ms, uploaded in {:.1f} ms ({:.2f} MiB of image data{}{}).",
+			all.size(), fromCache ? "loaded from cache" : "preprocessed", ms(t0, t1), ms(t1, t2), static_cast<double>(imageBytes) / (1024.0 * 1024.0),
+			options.mCompression ? ", block-compressed" : "", options.mMipMaps ? ", with MIP levels" : ""));
+		return std::make_tuple(std::move(gpuMaterials), std::move(imageSamplers));
+	}
+
+	// The inverse of to_cached_material. All values which are not stored keep their defaults:
+	static gvk::material_config to_material_config(const scene_cache& aCache, const scene_cache_format::material& aMaterial)
+	{
+		using namespace scene_cache_format;
+		gvk::material_config c;
+		c.mName = aCache.string(aMaterial.mName);
+		std::string* textures[cNumTextureSlots] = { &c.mDiffuseTex, &c.mSpecularTex, &c.mAmbientTex, &c.mEmissiveTex, &c.mHeightTex, &c.mNormalsTex,
+			&c.mShininessTex, &c.mOpacityTex, &c.mDisplacementTex, &c.mReflectionTex, &c.mLightmapTex, &c.mExtraTex };
+		glm::vec4* offsetTilings[cNumTextureSlots] = { &c.mDiffuseTexOffsetTiling, &c.mSpecularTexOffsetTiling, &c.mAmbientTexOffsetTiling, &c.mEmissiveTexOffsetTiling,
+			&c.mHeightTexOffsetTiling, &c.mNormalsTexOffsetTiling, &c.mShininessTexOffsetTiling, &c.mOpacityTexOffsetTiling,
+			&c.mDisplacementTexOffsetTiling, &c.mReflectionTexOffsetTiling, &c.mLightmapTexOffsetTiling, &c.mExtraTexOffsetTiling };
+		for (uint32_t i = 0; i < cNumTextureSlots; ++i) {
+			*textures[i] = aCache.string(aMaterial.mTextures[i]);
+			*offsetTilings[i] = aMaterial.mTexOffsetTiling[i];
+		}
+		c.mDiffuseReflectivity = aMaterial.mDiffuseReflectivity;
+		c.mAmbientReflectivity = aMaterial.mAmbientReflectivity;
+		c.mSpecularReflectivity = aMaterial.mSpecularReflectivity;
+		c.mEmissiveColor = aMaterial.mEmissiveColor;
+		c.mTransparentColor = aMaterial.mTransparentColor;
+		c.mReflectiveColor = aMaterial.mReflectiveColor;
+		c.mAlbedo = aMaterial.mAlbedo;
+		c.mOpacity = aMaterial.mOpacity;
+		c.mBumpScaling = aMaterial.mBumpScaling;
+		c.mShininess = aMaterial.mShininess;
+		c.mShininessStrength = aMaterial.mShininessStrength;
+		c.mRefractionIndex = aMaterial.mRefractionIndex;
+		c.mReflectivity = aMaterial.mReflectivity;
+		c.mMetallic = aMaterial.mMetallic;
+		c.mSmoothness = aMaterial.mSmoothness;
+		c.mSheen = aMaterial.mSheen;
+		c.mThickness = aMaterial.mThickness;
+		c.mRoughness = aMaterial.mRoughness;
+		c.mAnisotropy = aMaterial.mAnisotropy;
+		c.mAnisotropyRotation = aMaterial.mAnisotropyRotation;
+		c.mCustomData = aMaterial.mCustomData;
+		return c;
+	}
+
+	// Creates a device buffer with the given metas from a contiguous array and uploads its contents. Like
+	// gvk::create_buffer, but the data may live anywhere, e.g. in a mapped file, and needn't be copied into a vector.
+	// If aSync records into an existing command buffer, the staging buffer lives as long as that command buffer:
+	template <typename... Metas, typename T>
+	static avk::buffer create_buffer_from_array(const T* aData, size_t aCount, avk::content_description aContent, vk::BufferUsageFlags aUsageFlags, avk::sync aSync)
+	{
+		auto result = gvk::context().create_buffer(
+			avk::memory_usage::device, aUsageFlags,
+			Metas::create_from_element_size(sizeof(T), aCount).describe_only_member(aData[0], aContent)...
+		);
+		result->fill(aData, 0, std::move(aSync));
+		return result;
+	}
+
 private: // v== Member variables ==v
 
+	// Our only queue where we submit command buffers to:
+	avk::queue* mQueue;
+
+	// The amount of vertex data which is uploaded per batch (at least one group of meshes):
+	static constexpr size_t cUploadBatchBytes = 64 * 1024 * 1024;
+
+	// Groups of meshes with fewer triangles are merged with their neighbours of the same model (see plan_blas_merging),
+	// as long as the merged BLAS don't exceed the maximum number of triangles:
+	static constexpr uint32_t cSmallGroupTriangles = 16 * 1024;
+	static constexpr uint32_t cMaxMergedTriangles = 256 * 1024;
+
 	// ------------------ Buffers and Buffer Views ------------------
 
 	// A buffer that stores all material data of the loaded models:
 	avk::buffer mMaterialBuffer;
 
-	// Several images(+samplers) which store the material data's images:
-	std::vector<avk::image_sampler> mImageSamplers;
-
-	// Buffer views which provide the indexed geometry's index data:
-	std::vector<avk::buffer_view> mIndexBufferViews;
+	// The images(+samplers) which store the material data's images, and the buffer views which provide the indexed
+	// geometry's index, texture coordinates and normals data, each in its slot of the descriptor arrays:
+	bindless_registry mBindless;
+	std::vector<bindless_registry::texture_handle> mTextureHandles;
+	std::vector<bindless_registry::geometry_handle> mGeometryHandles;
 
 	// Buffer views which provide the indexed geometry's positions data:
 	std::vector<avk::buffer_view> mPositionsBufferViews;
-
-	// Buffer views which provide the indexed geometry's texture coordinates data:
-	std::vector<avk::buffer_view> mTexCoordsBufferViews;
-
-	// Buffer views which provide the indexed geometry's normals data:
-	std::vector<avk::buffer_view> mNormalsBufferViews;
 	
 	// ---------------- Acceleration Structures --------------------
 
@@ -239,26 +748,30 @@ private: // v== Member variables ==v
 	// The indices referred to by the [std:get<1>, std::get<2>) range are the associated submeshes.
 	std::vector<std::tuple<std::string, int, int>> mBlasNamesAndRanges;
 
-	// A vector of multiple bottom-level acceleration structures (BLAS) which store geometry:
-	std::vector<avk::bottom_level_acceleration_structure> mBlas;
+	// A vector of multiple bottom-level acceleration structures (BLAS) which store geometry.
+	// A BLAS contains one or multiple consecutive groups of meshes as its geometries:
+	std::vector<static_blas> mBlas;
+
+	// Statistics of the static BLAS for the UI: memory of all BLAS before and after compaction (in bytes),
+	// and the number of instances which there would be without merging:
+	vk::DeviceSize mBlasMemoryBeforeCompaction = 0;
+	vk::DeviceSize mBlasMemory = 0;
+	size_t mNumInstancesBeforeMerging = 0;
 
 	// Geometry instance data which store the instance data per BLAS inststance:
 	//    In our specific setup, this will be perfectly aligned with:
-	//     - mIndexBufferViews
-	//     - mTexCoordBufferViews
-	//     - mNormalsBufferViews
-	std::vector<avk::geometry_instance> mAllGeometryInstances;
+	//     - the slots of the groups in mBindless
+	std::vector<packed_instance> mAllGeometryInstances;
 
 	// A description per geometry instance to roughly describe what they refer to:
 	std::vector<std::string> mGeometryInstanceDescriptions;
 
 	// ------------------- UI settings -----------------------
 
-	// One boolean per geometry instance to tell if it shall be included in the
-	// generation of the TLAS or not:
-	std::vector<bool> mGeometryInstanceActive;
+	// One bit per geometry instance to tell if it shall be visible to rays or not:
+	packed_bitset mGeometryInstanceActive;
 
-	// True when an TLAS update is immanent:
-	bool mTlasUpdateRequired = true;
+	// Not none when an TLAS update is immanent:
+	tlas_update_type mTlasUpdateRequired = tlas_update_type::rebuild;
 
 }; // End of triangle_mesh_geometry_manager
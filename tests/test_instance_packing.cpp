@@ -0,0 +1,76 @@
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "instance_packing.hpp"
+#include "unit_tests.hpp"
+
+namespace
+{
+	const packed_instance_header cHeader{ { 0x00000001u, 0xFF000000u, 0x89ABCDEFu, 0x01234567u } };
+
+	// Packs aCount spheres, starting at aFirst of the input arrays, into the rows starting at aFirst, with both
+	// implementations, and tells whether the results are bit-identical and the rows around them are untouched:
+	bool packs_like_scalar(const std::vector<float>& aValues, size_t aFirst, size_t aCount)
+	{
+		const size_t n = aValues.size() / 4;
+		const float* x = aValues.data();
+		const float* y = x + n;
+		const float* z = y + n;
+		const float* r = z + n;
+		std::vector<packed_instance> simd(aFirst + aCount + 1), scalar(aFirst + aCount + 1);
+		std::memset(simd.data(), 0xCD, simd.size() * sizeof(packed_instance));
+		std::memset(scalar.data(), 0xCD, scalar.size() * sizeof(packed_instance));
+		pack_sphere_instances(x + aFirst, y + aFirst, z + aFirst, r + aFirst, aCount, cHeader, simd.data() + aFirst);
+		pack_sphere_instances_scalar(x + aFirst, y + aFirst, z + aFirst, r + aFirst, aCount, cHeader, scalar.data() + aFirst);
+		return 0 == std::memcmp(simd.data(), scalar.data(), simd.size() * sizeof(packed_instance));
+	}
+
+	// x, y, z, radii of aCount spheres, one array after the other. Includes values whose bits must survive, like -0 and denormals:
+	std::vector<float> random_spheres(size_t aCount, uint32_t aSeed)
+	{
+		std::mt19937 rng{ aSeed };
+		std::uniform_real_distribution<float> value(-1000.0f, 1000.0f);
+		std::vector<float> v(4 * aCount);
+		for (auto& f : v) {
+			f = value(rng);
+		}
+		if (aCount > 5) {
+			v[1] = -0.0f;
+			v[aCount + 2] = 1e-40f;
+			v[3 * aCount + 5] = 0.0f;
+		}
+		return v;
+	}
+}
+
+// The SIMD packing produces the very same bits as the scalar reference, for all remainders, and for inputs and outputs
+// which don't start at a 16-byte boundary. This checks the AVX2 path if it is enabled (like in the test project), and
+// the SSE2 path otherwise (e.g. if built with -msse2 instead of -mavx2):
+TEST(instance_packing_matches_scalar_reference)
+{
+	const auto spheres = random_spheres(10007, 1);
+	for (size_t count = 0; count <= 17; ++count) {
+		for (size_t first = 0; first < 4; ++first) {
+			CHECK(packs_like_scalar(spheres, first, count));
+		}
+	}
+	CHECK(packs_like_scalar(spheres, 0, 10000));
+	CHECK(packs_like_scalar(spheres, 3, 10003));
+}
+
+// A packed sphere is the instance of a BLAS, translated to the sphere's center and scaled by its radius:
+TEST(instance_packing_matches_packed_transform)
+{
+	const float x = 1.5f, y = -2.25f, z = 3.0f, r = 0.125f;
+	glm::mat4 transform{ r };
+	transform[3] = glm::vec4{ x, y, z, 1.0f };
+	const uint64_t blasAddress = 0x0123456789ABCDEFull;
+	const auto expected = make_packed_instance(transform, 7u, 1u, blasAddress);
+
+	packed_instance_header header;
+	std::memcpy(&header, reinterpret_cast<const char*>(&expected) + sizeof(VkTransformMatrixKHR), sizeof(header));
+	packed_instance packed;
+	pack_sphere_instances(&x, &y, &z, &r, 1, header, &packed);
+	CHECK(0 == std::memcmp(&expected, &packed, sizeof(packed_instance)));
+}
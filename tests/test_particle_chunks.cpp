@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "particle_chunks.hpp"
+#include "unit_tests.hpp"
+
+namespace
+{
+	struct particles
+	{
+		std::vector<float> mX, mY, mZ, mRadii;
+
+		void add(const glm::vec3& aPosition, float aRadius)
+		{
+			mX.push_back(aPosition.x);
+			mY.push_back(aPosition.y);
+			mZ.push_back(aPosition.z);
+			mRadii.push_back(aRadius);
+		}
+		[[nodiscard]] size_t size() const { return mX.size(); }
+	};
+
+	particles random_particles(size_t aCount, uint32_t aSeed)
+	{
+		std::mt19937 rng{ aSeed };
+		std::uniform_real_distribution<float> pos(-10.0f, 10.0f), radius(0.05f, 0.2f);
+		particles p;
+		for (size_t i = 0; i < aCount; ++i) {
+			p.add(glm::vec3{ pos(rng), pos(rng), pos(rng) }, radius(rng));
+		}
+		return p;
+	}
+
+	void update(particle_chunks& aChunks, const particles& aParticles)
+	{
+		aChunks.update(aParticles.mX.data(), aParticles.mY.data(), aParticles.mZ.data(), aParticles.mRadii.data(), aParticles.size(), shared_thread_pool());
+	}
+
+	bool same_box(const particle_chunks::box& a, const particle_chunks::box& b)
+	{
+		return a.mMin == b.mMin && a.mMax == b.mMax;
+	}
+}
+
+// Every particle's box (tight around its rendered sphere) is in exactly one chunk, and the chunks' bounds enclose their boxes:
+TEST(particle_chunks_hold_every_particle_once)
+{
+	const auto p = random_particles(3 * particle_chunks::cChunkCapacity + 123, 1);
+	particle_chunks chunks;
+	update(chunks, p);
+	CHECK(chunks.stats().mRegrouped);
+	CHECK(chunks.chunks().size() == 4);
+
+	std::vector<bool> found(p.size(), false);
+	size_t total = 0;
+	for (const auto& c : chunks.chunks()) {
+		CHECK(c.mNumParticles <= particle_chunks::cChunkCapacity);
+		CHECK(0 == c.mFirstBox % particle_chunks::cChunkCapacity);
+		total += c.mNumParticles;
+		for (uint32_t k = 0; k < c.mNumParticles; ++k) {
+			const auto& b = chunks.boxes()[c.mFirstBox + k];
+			CHECK(glm::all(glm::lessThanEqual(c.mMin, b.mMin)) && glm::all(glm::lessThanEqual(b.mMax, c.mMax)));
+			// Find the particle of this box:
+			const glm::vec3 center = (b.mMin + b.mMax) * 0.5f;
+			bool matched = false;
+			for (size_t i = 0; i < p.size() && !matched; ++i) {
+				const glm::vec3 pos{ p.mX[i], p.mY[i], p.mZ[i] };
+				const float h = particle_chunks::cSphereRadiusScale * p.mRadii[i];
+				if (!found[i] && same_box(b, particle_chunks::box{ pos - h, pos + h })) {
+					found[i] = matched = true;
+				}
+			}
+			CHECK(matched);
+			CHECK(glm::all(glm::lessThan(glm::abs(center), glm::vec3{ 10.0f + 1e-4f })));
+		}
+	}
+	CHECK(total == p.size());
+	CHECK(std::all_of(std::begin(found), std::end(found), [](bool f) { return f; }));
+}
+
+// Two clusters of one chunk's worth of particles each are not mixed up:
+TEST(particle_chunks_are_compact)
+{
+	particles p;
+	std::mt19937 rng{ 2 };
+	std::uniform_real_distribution<float> pos(0.0f, 1.0f);
+	for (uint32_t i = 0; i < 2 * particle_chunks::cChunkCapacity; ++i) {
+		const float offset = i % 2 == 0 ? -100.0f : 100.0f; // Interleaved in memory
+		p.add(glm::vec3{ offset + pos(rng), pos(rng), pos(rng) }, 0.1f);
+	}
+	particle_chunks chunks;
+	update(chunks, p);
+	CHECK(chunks.chunks().size() == 2);
+	const auto& a = chunks.chunks()[0];
+	const auto& b = chunks.chunks()[1];
+	CHECK(a.mMax.x < b.mMin.x || b.mMax.x < a.mMin.x);
+}
+
+// Only chunks with moved particles are dirty, and the particles are regrouped after mMaxUpdatesBeforeRegroup dirty updates:
+TEST(particle_chunks_track_dirty_chunks)
+{
+	auto p = random_particles(2 * particle_chunks::cChunkCapacity, 3);
+	particle_chunks chunks;
+	chunks.params().mMaxUpdatesBeforeRegroup = 3;
+	update(chunks, p);
+	update(chunks, p);
+	CHECK(!chunks.stats().mRegrouped);
+	CHECK(0 == chunks.stats().mNumDirtyChunks);
+
+	for (int u = 0; u < 3; ++u) {
+		p.mX[7] += 0.01f;
+		update(chunks, p);
+		CHECK(!chunks.stats().mRegrouped);
+		CHECK(1 == chunks.stats().mNumDirtyChunks);
+	}
+	update(chunks, p);
+	CHECK(chunks.stats().mRegrouped);
+
+	// A different number of particles always regroups them:
+	p.add(glm::vec3{ 0.0f }, 0.1f);
+	update(chunks, p);
+	CHECK(chunks.stats().mRegrouped);
+}
+
+// After the particles have been permuted (like particle_reorderer does it), remap_particles keeps the chunks unchanged:
+TEST(particle_chunks_follow_remapped_particles)
+{
+	const auto p = random_particles(particle_chunks::cChunkCapacity + 500, 4);
+	particle_chunks chunks;
+	update(chunks, p);
+
+	std::vector<uint32_t> oldIndexOf(p.size());
+	std::iota(std::begin(oldIndexOf), std::end(oldIndexOf), 0u);
+	std::shuffle(std::begin(oldIndexOf), std::end(oldIndexOf), std::mt19937{ 5 });
+	std::vector<uint32_t> newIndexOf(p.size());
+	particles permuted;
+	for (uint32_t k = 0; k < p.size(); ++k) {
+		newIndexOf[oldIndexOf[k]] = k;
+		permuted.add(glm::vec3{ p.mX[oldIndexOf[k]], p.mY[oldIndexOf[k]], p.mZ[oldIndexOf[k]] }, p.mRadii[oldIndexOf[k]]);
+	}
+	chunks.remap_particles(newIndexOf);
+	update(chunks, permuted);
+	CHECK(!chunks.stats().mRegrouped);
+	CHECK(0 == chunks.stats().mNumDirtyChunks);
+}
@@ -0,0 +1,114 @@
+#include <random>
+#include <vector>
+
+#include "particle_lod.hpp"
+#include "unit_tests.hpp"
+
+namespace
+{
+	struct particles
+	{
+		std::vector<float> mX, mY, mZ, mRadii;
+		[[nodiscard]] size_t size() const { return mX.size(); }
+	};
+
+	particles random_particles(size_t aCount, uint32_t aSeed)
+	{
+		std::mt19937 rng{ aSeed };
+		std::uniform_real_distribution<float> pos(-20.0f, 20.0f), radius(0.05f, 0.4f);
+		particles p;
+		for (size_t i = 0; i < aCount; ++i) {
+			p.mX.push_back(pos(rng));
+			p.mY.push_back(pos(rng));
+			p.mZ.push_back(pos(rng));
+			p.mRadii.push_back(radius(rng));
+		}
+		return p;
+	}
+
+	void update(particle_lod& aLod, const particles& aParticles)
+	{
+		aLod.update(aParticles.mX.data(), aParticles.mY.data(), aParticles.mZ.data(), aParticles.mRadii.data(), aParticles.size(), shared_thread_pool());
+	}
+
+	std::pair<size_t, size_t> select(particle_lod& aLod, const particles& aParticles, const glm::vec3& aCameraPos)
+	{
+		return aLod.select(aCameraPos, aParticles.mX.data(), aParticles.mY.data(), aParticles.mZ.data(), aParticles.mRadii.data());
+	}
+
+	// True if every particle's rendered sphere lies within the rendered sphere of one of the selected spheres:
+	bool selection_contains_rendered_spheres(const particle_lod& aLod, const particles& aParticles)
+	{
+		const float scale = particle_lod::cSphereRadiusScale;
+		for (size_t i = 0; i < aParticles.size(); ++i) {
+			const glm::vec3 p{ aParticles.mX[i], aParticles.mY[i], aParticles.mZ[i] };
+			bool contained = false;
+			for (size_t s = 0; s < aLod.number_of_selected() && !contained; ++s) {
+				const glm::vec3 c{ aLod.selected_x()[s], aLod.selected_y()[s], aLod.selected_z()[s] };
+				contained = glm::length(p - c) + aParticles.mRadii[i] * scale <= aLod.selected_radii()[s] * scale + 1e-4f;
+			}
+			if (!contained) {
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+// From far away, clusters are selected, and the spheres which are rendered for them contain those of their particles:
+TEST(particle_lod_clusters_contain_rendered_spheres)
+{
+	const auto p = random_particles(5000, 1);
+	particle_lod lod;
+	lod.params().mInstanceBudget = 500;
+	update(lod, p);
+	CHECK(lod.stats().mRebuilt);
+
+	for (const auto& camera : { glm::vec3{ 0.0f, 0.0f, 300.0f }, glm::vec3{ 0.0f, 0.0f, 25.0f }, glm::vec3{ 5.0f, 5.0f, 5.0f } }) {
+		select(lod, p, camera);
+		CHECK(lod.stats().mNumSelectedClusters > 0);
+		CHECK(lod.number_of_selected() <= lod.params().mInstanceBudget);
+		CHECK(lod.number_of_selected() == lod.stats().mNumSelectedClusters + lod.stats().mNumSelectedParticles);
+		CHECK(selection_contains_rendered_spheres(lod, p));
+	}
+}
+
+// The bounds follow the particles when the hierarchy is only refit:
+TEST(particle_lod_refit_keeps_containment)
+{
+	auto p = random_particles(4000, 2);
+	particle_lod lod;
+	lod.params().mInstanceBudget = 300;
+	update(lod, p);
+	std::mt19937 rng{ 3 };
+	std::uniform_real_distribution<float> step(-0.5f, 0.5f);
+	for (int frame = 0; frame < 5; ++frame) {
+		for (size_t i = 0; i < p.size(); ++i) {
+			p.mX[i] += step(rng);
+			p.mY[i] += step(rng);
+			p.mZ[i] += step(rng);
+		}
+		update(lod, p);
+		CHECK(!lod.stats().mRebuilt);
+		select(lod, p, glm::vec3{ 0.0f, 0.0f, 100.0f });
+		CHECK(selection_contains_rendered_spheres(lod, p));
+	}
+}
+
+// Up close and with a sufficient budget, every particle is selected as it is, and an unchanged selection reports no changed range:
+TEST(particle_lod_selects_particles_up_close)
+{
+	const auto p = random_particles(1000, 4);
+	particle_lod lod;
+	lod.params().mInstanceBudget = 1000;
+	lod.params().mMaxAngularError = 0.0f;
+	update(lod, p);
+	select(lod, p, glm::vec3{ 0.0f });
+	CHECK(lod.stats().mNumSelectedClusters == 0);
+	CHECK(lod.number_of_selected() == p.size());
+	for (size_t s = 0; s < lod.number_of_selected(); ++s) {
+		CHECK(lod.selected_radii()[s] >= 0.05f && lod.selected_radii()[s] <= 0.4f);
+	}
+	const auto [begin, end] = select(lod, p, glm::vec3{ 0.0f });
+	CHECK(begin == end);
+}
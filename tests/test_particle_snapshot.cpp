@@ -0,0 +1,184 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "particle_snapshot.hpp"
+#include "unit_tests.hpp"
+
+namespace
+{
+	std::string temp_path(const char* aName)
+	{
+		return (std::filesystem::temp_directory_path() / aName).string();
+	}
+
+	void add_random_particles(particle_store& aParticles, size_t aCount, std::mt19937& aRng)
+	{
+		std::uniform_real_distribution<float> value(-10.0f, 10.0f), radius(0.05f, 0.5f);
+		for (size_t i = 0; i < aCount; ++i) {
+			aParticles.add(
+				glm::vec3{ value(aRng), value(aRng), value(aRng) }, radius(aRng),
+				glm::vec3{ value(aRng), value(aRng), value(aRng) }, i % 3 == 0 ? particle_flags::frozen : particle_flags::none
+			);
+		}
+	}
+
+	bool same_bytes(const void* a, const void* b, size_t aSize)
+	{
+		return 0 == std::memcmp(a, b, aSize);
+	}
+
+	bool same_particles(const particle_store& a, const particle_store& b)
+	{
+		const auto bytes = a.size() * sizeof(float);
+		return a.size() == b.size()
+			&& same_bytes(a.positions_x(), b.positions_x(), bytes) && same_bytes(a.positions_y(), b.positions_y(), bytes) && same_bytes(a.positions_z(), b.positions_z(), bytes)
+			&& same_bytes(a.velocities_x(), b.velocities_x(), bytes) && same_bytes(a.velocities_y(), b.velocities_y(), bytes) && same_bytes(a.velocities_z(), b.velocities_z(), bytes)
+			&& same_bytes(a.radii(), b.radii(), bytes) && same_bytes(a.flags(), b.flags(), a.size() * sizeof(uint32_t));
+	}
+
+	// Overwrites aSize bytes at aOffset of the file at aPath:
+	void patch_file(const std::string& aPath, size_t aOffset, const void* aData, size_t aSize)
+	{
+		std::fstream file(aPath, std::ios::binary | std::ios::in | std::ios::out);
+		file.seekp(static_cast<std::streamoff>(aOffset));
+		file.write(static_cast<const char*>(aData), static_cast<std::streamsize>(aSize));
+	}
+}
+
+// A saved and loaded snapshot is bit-identical to the particles which have been saved:
+TEST(particle_snapshot_round_trip_is_bit_identical)
+{
+	const auto path = temp_path("fluid_nightmare_test_snapshot.fnps");
+	std::mt19937 rng{ 1 };
+	particle_store saved;
+	add_random_particles(saved, 12345, rng);
+	CHECK(save_particle_snapshot(path, saved));
+
+	particle_snapshot snapshot;
+	std::string error;
+	CHECK(snapshot.open(path, error));
+	CHECK(1 == snapshot.number_of_frames());
+	CHECK(saved.size() == snapshot.max_number_of_particles());
+	particle_store loaded;
+	add_random_particles(loaded, 99, rng); // Replaced entirely
+	snapshot.load_into(0, loaded);
+	CHECK(same_particles(saved, loaded));
+	snapshot.close();
+	std::remove(path.c_str());
+}
+
+// Every frame of a sequence with a growing number of particles is restored, except for the velocities, if they have been left out:
+TEST(particle_snapshot_sequence_with_growing_particle_count)
+{
+	const auto path = temp_path("fluid_nightmare_test_sequence.fnps");
+	std::mt19937 rng{ 2 };
+	std::uniform_real_distribution<float> step(-0.1f, 0.1f);
+	particle_store particles;
+	std::vector<particle_store> frames;
+	particle_snapshot_writer writer;
+	CHECK(writer.open(path, false));
+	for (int f = 0; f < 5; ++f) {
+		add_random_particles(particles, 100 * f + 17, rng);
+		for (size_t i = 0; i < particles.size(); ++i) {
+			particles.positions_y()[i] += step(rng);
+		}
+		CHECK(writer.write_frame(particles, f / 30.0));
+		frames.emplace_back();
+		frames.back().resize(particles.size());
+		std::memcpy(frames.back().positions_y(), particles.positions_y(), particles.size() * sizeof(float));
+	}
+	// The number of particles must not decrease:
+	particle_store fewer;
+	add_random_particles(fewer, 3, rng);
+	CHECK(!writer.write_frame(fewer, 1.0));
+	CHECK(5 == writer.number_of_frames());
+	CHECK(writer.finish());
+
+	particle_snapshot sequence;
+	std::string error;
+	CHECK(sequence.open(path, error));
+	CHECK(5 == sequence.number_of_frames());
+	CHECK(particles.size() == sequence.max_number_of_particles());
+	for (size_t f = 0; f < sequence.number_of_frames(); ++f) {
+		const auto v = sequence.frame(f);
+		CHECK(v.mNumParticles == frames[f].size());
+		CHECK(nullptr == v.mVelocitiesX && nullptr == v.mVelocitiesY && nullptr == v.mVelocitiesZ);
+		CHECK(same_bytes(v.mPositionsY, frames[f].positions_y(), v.mNumParticles * sizeof(float)));
+		CHECK(sequence.frame_at_time(f / 30.0 + 0.001) == f);
+	}
+	particle_store loaded;
+	sequence.load_into(4, loaded);
+	CHECK(loaded.size() == particles.size());
+	CHECK(same_bytes(loaded.positions_x(), particles.positions_x(), particles.size() * sizeof(float)));
+	CHECK(same_bytes(loaded.radii(), particles.radii(), particles.size() * sizeof(float)));
+	CHECK(same_bytes(loaded.flags(), particles.flags(), particles.size() * sizeof(uint32_t)));
+	CHECK(0.0f == loaded.velocities_x()[0] && 0.0f == loaded.velocities_z()[particles.size() - 1]);
+	sequence.close();
+	std::remove(path.c_str());
+}
+
+// Truncated files and corrupt headers are rejected:
+TEST(particle_snapshot_rejects_corrupt_files)
+{
+	const auto path = temp_path("fluid_nightmare_test_corrupt.fnps");
+	std::mt19937 rng{ 3 };
+	particle_store particles;
+	add_random_particles(particles, 1000, rng);
+	particle_snapshot snapshot;
+	std::string error;
+
+	// Shorter than a header:
+	CHECK(save_particle_snapshot(path, particles));
+	std::filesystem::resize_file(path, sizeof(particle_snapshot_format::header) / 2);
+	CHECK(!snapshot.open(path, error) && !snapshot.is_open());
+
+	// Cut off within the data:
+	CHECK(save_particle_snapshot(path, particles));
+	std::filesystem::resize_file(path, std::filesystem::file_size(path) - 100);
+	CHECK(!snapshot.open(path, error));
+
+	// Wrong magic number:
+	CHECK(save_particle_snapshot(path, particles));
+	const uint32_t wrongMagic = 0x12345678u;
+	patch_file(path, offsetof(particle_snapshot_format::header, mMagic), &wrongMagic, sizeof(wrongMagic));
+	CHECK(!snapshot.open(path, error));
+
+	// Unsupported version:
+	CHECK(save_particle_snapshot(path, particles));
+	const uint32_t futureVersion = particle_snapshot_format::cVersion + 1;
+	patch_file(path, offsetof(particle_snapshot_format::header, mVersion), &futureVersion, sizeof(futureVersion));
+	CHECK(!snapshot.open(path, error));
+
+	// More particles than there is data for:
+	CHECK(save_particle_snapshot(path, particles));
+	const uint64_t tooManyParticles = 1000000;
+	patch_file(path, offsetof(particle_snapshot_format::header, mNumParticles), &tooManyParticles, sizeof(tooManyParticles));
+	CHECK(!snapshot.open(path, error));
+
+	// Misaligned radii:
+	CHECK(save_particle_snapshot(path, particles));
+	particle_snapshot_format::header h{};
+	std::ifstream(path, std::ios::binary).read(reinterpret_cast<char*>(&h), sizeof(h));
+	const uint64_t misaligned = h.mRadiiOffset + sizeof(float);
+	patch_file(path, offsetof(particle_snapshot_format::header, mRadiiOffset), &misaligned, sizeof(misaligned));
+	CHECK(!snapshot.open(path, error));
+
+	// A frame record which refers to data beyond the end of the file:
+	CHECK(save_particle_snapshot(path, particles));
+	const uint64_t beyondEnd = (std::filesystem::file_size(path) / particle_snapshot_format::cAlignment + 1) * particle_snapshot_format::cAlignment;
+	patch_file(path, h.mFrameTableOffset + offsetof(particle_snapshot_format::frame_record, mPositionOffsets), &beyondEnd, sizeof(beyondEnd));
+	CHECK(!snapshot.open(path, error));
+
+	// The unmodified file is fine:
+	CHECK(save_particle_snapshot(path, particles));
+	CHECK(snapshot.open(path, error));
+	snapshot.close();
+
+	std::remove(path.c_str());
+}
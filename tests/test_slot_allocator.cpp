@@ -0,0 +1,103 @@
+#include <vector>
+
+#include "slot_allocator.hpp"
+#include "unit_tests.hpp"
+
+// Slots are handed out densely, and released slots are reused, the most recently released one first:
+TEST(slot_allocator_reuses_released_slots_last_in_first_out)
+{
+	slot_allocator slots{ 8 };
+	std::vector<slot_handle> handles;
+	for (uint32_t i = 0; i < 5; ++i) {
+		handles.push_back(slots.allocate());
+		CHECK(handles.back().mIndex == i);
+	}
+	CHECK(slots.size() == 5 && slots.end() == 5);
+
+	CHECK(slots.release(handles[1]));
+	CHECK(slots.release(handles[3]));
+	CHECK(slots.size() == 3);
+	CHECK(slots.allocate().mIndex == 3);
+	CHECK(slots.allocate().mIndex == 1);
+	CHECK(slots.allocate().mIndex == 5); // The free list is empty => the next slot which has never been occupied
+	CHECK(slots.size() == 6 && slots.end() == 6);
+}
+
+// A released handle stays stale, also after its slot has been taken over by another occupant:
+TEST(slot_allocator_detects_stale_handles)
+{
+	slot_allocator slots{ 4 };
+	const auto a = slots.allocate();
+	CHECK(slots.is_valid(a));
+	CHECK(slots.release(a));
+	CHECK(!slots.is_valid(a));
+	CHECK(!slots.release(a));
+
+	const auto b = slots.allocate();
+	CHECK(b.mIndex == a.mIndex);
+	CHECK(b.mGeneration != a.mGeneration);
+	CHECK(b != a);
+	CHECK(slots.is_valid(b));
+	CHECK(!slots.is_valid(a));
+	CHECK(!slots.release(a));
+	CHECK(slots.is_valid(b));
+
+	CHECK(!slots.is_valid(slot_handle{}));
+	CHECK(!slots.release(slot_handle{}));
+	CHECK(!slots.is_valid(slot_handle{ 3, 0 })); // Never occupied
+}
+
+// If all slots are occupied, a null handle is returned until one of them is released:
+TEST(slot_allocator_returns_null_when_full)
+{
+	slot_allocator slots{ 3 };
+	const auto a = slots.allocate();
+	const auto b = slots.allocate();
+	const auto c = slots.allocate();
+	CHECK(!a.is_null() && !b.is_null() && !c.is_null());
+	CHECK(slots.allocate().is_null());
+	CHECK(slots.size() == 3);
+
+	CHECK(slots.release(b));
+	const auto d = slots.allocate();
+	CHECK(!d.is_null() && d.mIndex == b.mIndex);
+	CHECK(slots.allocate().is_null());
+
+	slot_allocator empty;
+	CHECK(empty.allocate().is_null());
+}
+
+// Every copy is told about every change exactly once, in the order of the first change, independently of the other copies:
+TEST(slot_allocator_tracks_changes_per_copy)
+{
+	slot_allocator slots{ 16, 3 };
+	CHECK(slots.number_of_copies() == 3);
+	const auto a = slots.allocate();
+	const auto b = slots.allocate();
+	slots.mark_changed(a.mIndex); // Already marked by allocate()
+
+	std::vector<uint32_t> changed;
+	slots.take_changed(0, changed);
+	CHECK(changed == (std::vector<uint32_t>{ a.mIndex, b.mIndex }));
+	slots.take_changed(0, changed);
+	CHECK(changed.empty());
+
+	// Copy 1 hasn't been patched yet and sees the later change, too, but still only once per slot:
+	slots.mark_changed(b.mIndex);
+	const auto c = slots.allocate();
+	slots.take_changed(1, changed);
+	CHECK(changed == (std::vector<uint32_t>{ a.mIndex, b.mIndex, c.mIndex }));
+	slots.take_changed(0, changed);
+	CHECK(changed == (std::vector<uint32_t>{ b.mIndex, c.mIndex }));
+
+	// Releasing a slot is no change, taking it over is:
+	CHECK(slots.release(a));
+	slots.take_changed(1, changed);
+	CHECK(changed.empty());
+	const auto d = slots.allocate();
+	slots.take_changed(1, changed);
+	CHECK(changed == (std::vector<uint32_t>{ d.mIndex }));
+
+	slots.take_changed(2, changed);
+	CHECK(changed == (std::vector<uint32_t>{ a.mIndex, b.mIndex, c.mIndex }));
+}
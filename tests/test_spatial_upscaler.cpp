@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "spatial_upscaler.hpp"
+#include "unit_tests.hpp"
+
+using namespace spatial_upscaling;
+
+namespace
+{
+	struct image
+	{
+		std::vector<glm::vec3> mPixels;
+		uint32_t mWidth = 0, mHeight = 0;
+
+		[[nodiscard]] glm::vec3 at(int x, int y) const
+		{
+			return mPixels[static_cast<size_t>(std::clamp(y, 0, static_cast<int>(mHeight) - 1)) * mWidth + std::clamp(x, 0, static_cast<int>(mWidth) - 1)];
+		}
+	};
+
+	// Random colors with hard edges: blocks of similar colors, some of them very bright:
+	image random_image(uint32_t aWidth, uint32_t aHeight, uint32_t aSeed)
+	{
+		std::mt19937 rng{ aSeed };
+		std::uniform_real_distribution<float> value(0.0f, 1.0f);
+		image img{ std::vector<glm::vec3>(static_cast<size_t>(aWidth) * aHeight), aWidth, aHeight };
+		for (uint32_t y = 0; y < aHeight; ++y) {
+			for (uint32_t x = 0; x < aWidth; ++x) {
+				const float block = ((x / 3 + y / 2) % 3 == 0) ? 20.0f : 1.0f;
+				img.mPixels[y * aWidth + x] = glm::vec3{ value(rng), value(rng), value(rng) } * block;
+			}
+		}
+		return img;
+	}
+
+	image upscaled(const image& aSrc, uint32_t aWidth, uint32_t aHeight, float aEdgeSharpness)
+	{
+		image dst{ {}, aWidth, aHeight };
+		upscale(aSrc.mPixels, aSrc.mWidth, aSrc.mHeight, dst.mPixels, aWidth, aHeight, aEdgeSharpness, shared_thread_pool());
+		return dst;
+	}
+
+	// The position of output pixel (x, y) in the source image, in pixel coordinates of the source pixels' centers:
+	glm::vec2 source_position(const image& aSrc, const image& aDst, uint32_t x, uint32_t y)
+	{
+		return (glm::vec2{ static_cast<float>(x), static_cast<float>(y) } + 0.5f) * glm::vec2{ static_cast<float>(aSrc.mWidth), static_cast<float>(aSrc.mHeight) }
+			/ glm::vec2{ static_cast<float>(aDst.mWidth), static_cast<float>(aDst.mHeight) } - 0.5f;
+	}
+}
+
+// At the same resolution, every output pixel is its source pixel, regardless of the edge sharpness:
+TEST(spatial_upscaler_scale_one_is_identity)
+{
+	const auto src = random_image(37, 23, 1);
+	for (float sharpness : { 0.0f, cDefaultEdgeSharpness, 1000.0f }) {
+		const auto dst = upscaled(src, src.mWidth, src.mHeight, sharpness);
+		CHECK(dst.mPixels == src.mPixels);
+	}
+}
+
+// Without edge sharpness, the result is plain bilinear filtering (with clamping at the border):
+TEST(spatial_upscaler_without_sharpness_is_bilinear)
+{
+	const auto src = random_image(32, 18, 2);
+	for (const auto& size : { glm::uvec2{ 48u, 27u }, glm::uvec2{ 64u, 36u }, glm::uvec2{ 77u, 41u } }) {
+		const auto dst = upscaled(src, size.x, size.y, 0.0f);
+		for (uint32_t y = 0; y < dst.mHeight; ++y) {
+			for (uint32_t x = 0; x < dst.mWidth; ++x) {
+				const auto p = source_position(src, dst, x, y);
+				const int x0 = static_cast<int>(std::floor(p.x)), y0 = static_cast<int>(std::floor(p.y));
+				const float fx = p.x - static_cast<float>(x0), fy = p.y - static_cast<float>(y0);
+				const glm::vec3 top = src.at(x0, y0) * (1.0f - fx) + src.at(x0 + 1, y0) * fx;
+				const glm::vec3 bottom = src.at(x0, y0 + 1) * (1.0f - fx) + src.at(x0 + 1, y0 + 1) * fx;
+				const glm::vec3 expected = top * (1.0f - fy) + bottom * fy;
+				const glm::vec3 actual = dst.mPixels[y * dst.mWidth + x];
+				for (int c = 0; c < 3; ++c) {
+					CHECK_NEAR(actual[c], expected[c], 1e-4f * std::max(1.0f, expected[c]));
+				}
+			}
+		}
+	}
+}
+
+// Every output pixel lies within the range of its four taps, i.e. the filter never overshoots, however sharp the edges are:
+TEST(spatial_upscaler_stays_within_the_taps)
+{
+	const auto src = random_image(40, 30, 3);
+	for (float sharpness : { 0.0f, 1.0f, cDefaultEdgeSharpness, 1000.0f }) {
+		const auto dst = upscaled(src, 67, 45, sharpness);
+		bool within = true;
+		for (uint32_t y = 0; y < dst.mHeight; ++y) {
+			for (uint32_t x = 0; x < dst.mWidth; ++x) {
+				const auto p = source_position(src, dst, x, y);
+				const int x0 = static_cast<int>(std::floor(p.x)), y0 = static_cast<int>(std::floor(p.y));
+				const glm::vec3 taps[4] = { src.at(x0, y0), src.at(x0 + 1, y0), src.at(x0, y0 + 1), src.at(x0 + 1, y0 + 1) };
+				const glm::vec3 actual = dst.mPixels[y * dst.mWidth + x];
+				for (int c = 0; c < 3; ++c) {
+					const auto [lo, hi] = std::minmax({ taps[0][c], taps[1][c], taps[2][c], taps[3][c] });
+					within = within && actual[c] >= lo - 1e-5f * hi && actual[c] <= hi + 1e-5f * hi;
+				}
+			}
+		}
+		CHECK(within);
+	}
+}
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <vector>
+
+#include "sph_solver.hpp"
+#include "unit_tests.hpp"
+
+// Every index of the range is visited exactly once, in chunks of at most the grain size, also if the grain size doesn't divide the range:
+TEST(thread_pool_parallel_for_covers_every_index_once)
+{
+	thread_pool pool{ 4 };
+	for (size_t grain : { size_t{ 1 }, size_t{ 3 }, size_t{ 7 }, size_t{ 333 }, size_t{ 100001 } }) {
+		const size_t begin = 5, end = 10012;
+		std::vector<std::atomic<int>> visits(end);
+		std::atomic<bool> chunksTooLarge{ false };
+		pool.parallel_for(begin, end, grain, [&](size_t aChunkBegin, size_t aChunkEnd) {
+			chunksTooLarge = chunksTooLarge || aChunkEnd - aChunkBegin > grain || aChunkBegin >= aChunkEnd;
+			for (size_t i = aChunkBegin; i < aChunkEnd; ++i) {
+				++visits[i];
+			}
+		});
+		CHECK(!chunksTooLarge);
+		CHECK(std::all_of(std::begin(visits), std::begin(visits) + begin, [](const std::atomic<int>& v) { return 0 == v; }));
+		CHECK(std::all_of(std::begin(visits) + begin, std::end(visits), [](const std::atomic<int>& v) { return 1 == v; }));
+	}
+
+	// Empty ranges don't invoke the body at all:
+	int invocations = 0;
+	pool.parallel_for(7, 7, 3, [&](size_t, size_t) { ++invocations; });
+	pool.parallel_for_each_index(9, 2, 3, [&](size_t) { ++invocations; });
+	CHECK(0 == invocations);
+}
+
+// A neighborhood query visits every point within a cell size exactly once, like a brute-force search (besides farther candidates):
+TEST(spatial_hash_grid_neighborhood_matches_brute_force)
+{
+	std::mt19937 rng{ 1 };
+	std::uniform_real_distribution<float> pos(-25.0f, 25.0f);
+	const size_t n = 20000;
+	std::vector<float> x(n), y(n), z(n);
+	for (size_t i = 0; i < n; ++i) {
+		x[i] = pos(rng); y[i] = pos(rng); z[i] = pos(rng);
+	}
+	const float radius = 1.3f;
+	spatial_hash_grid grid;
+	grid.build(x.data(), y.data(), z.data(), n, radius, shared_thread_pool());
+	CHECK(grid.sorted_indices().size() == n);
+
+	std::vector<int> visits(n);
+	for (size_t q = 0; q < 200; ++q) {
+		const glm::vec3 center = q % 2 == 0 ? glm::vec3{ x[q], y[q], z[q] } : glm::vec3{ pos(rng), pos(rng), pos(rng) };
+		std::fill(std::begin(visits), std::end(visits), 0);
+		grid.for_each_in_neighborhood(center, [&](uint32_t, uint32_t aIndex) { ++visits[aIndex]; });
+		for (size_t i = 0; i < n; ++i) {
+			const bool inside = glm::length(glm::vec3{ x[i], y[i], z[i] } - center) < radius;
+			CHECK(visits[i] <= 1);
+			CHECK(!inside || 1 == visits[i]);
+		}
+	}
+}
+
+// In the interior of a block of particles on a lattice with the rest spacing, the density is the rest density:
+TEST(sph_solver_density_at_rest)
+{
+	sph_solver solver;
+	auto& params = solver.parameters();
+	params.mBoundsMin = glm::vec3{ -1000.0f };
+	params.mBoundsMax = glm::vec3{ 1000.0f };
+	params.mGravity = glm::vec3{ 0.0f };
+	const float spacing = params.rest_spacing();
+
+	const int extent = 6; // -extent..extent in each dimension
+	particle_store particles;
+	size_t center = 0;
+	for (int i = -extent; i <= extent; ++i) {
+		for (int j = -extent; j <= extent; ++j) {
+			for (int k = -extent; k <= extent; ++k) {
+				const auto index = particles.add(glm::vec3{ i * spacing, j * spacing, k * spacing }, params.mParticleRadius);
+				center = 0 == i && 0 == j && 0 == k ? index : center;
+			}
+		}
+	}
+	solver.step(particles, params.mFixedTimeStep, shared_thread_pool());
+
+	const auto& order = solver.particle_order();
+	const auto s = static_cast<size_t>(std::find(std::begin(order), std::end(order), static_cast<uint32_t>(center)) - std::begin(order));
+	CHECK(s < order.size());
+	CHECK_NEAR(solver.densities()[s], params.mRestDensity, 0.02f * params.mRestDensity);
+
+	// Nothing pushes the particles in the interior apart:
+	CHECK(glm::length(particles.velocity(center)) < 1e-3f);
+}
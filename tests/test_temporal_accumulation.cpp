@@ -0,0 +1,167 @@
+#include <cmath>
+#include <vector>
+
+#include "temporal_accumulation.hpp"
+#include "unit_tests.hpp"
+
+using namespace temporal_accumulation;
+
+namespace
+{
+	const glm::uvec2 cResolution{ 64u, 48u };
+
+	// The inverse of a camera at aPosition which is rotated about the y axis by aAngle:
+	glm::mat4 world_to_camera(const glm::vec3& aPosition, float aAngle)
+	{
+		const float c = std::cos(aAngle), s = std::sin(aAngle);
+		glm::mat4 m{ 1.0f }; // Transposed rotation
+		m[0] = glm::vec4{ c, 0.0f, s, 0.0f };
+		m[1] = glm::vec4{ 0.0f, 1.0f, 0.0f, 0.0f };
+		m[2] = glm::vec4{ -s, 0.0f, c, 0.0f };
+		const glm::vec4 t = m * glm::vec4{ -aPosition, 1.0f };
+		m[3] = glm::vec4{ t.x, t.y, t.z, 1.0f };
+		return m;
+	}
+
+	// The histories of all pixels of the previous frame, initially all the same:
+	struct history_image
+	{
+		std::vector<history_sample> mPixels;
+
+		explicit history_image(const history_sample& aSample) : mPixels(cResolution.x * cResolution.y, aSample) {}
+		history_sample& at(int x, int y) { return mPixels[y * cResolution.x + x]; }
+		auto fetch() { return [this](int x, int y) { return at(x, y); }; }
+	};
+
+	history_sample sample(float aMean, float aLength, float aDepth, const glm::vec3& aNormal)
+	{
+		history_sample h;
+		h.mMean = aMean;
+		h.mSecondMoment = aMean * aMean;
+		h.mLength = aLength;
+		h.mDepth = aDepth;
+		h.mNormal = aNormal;
+		return h;
+	}
+}
+
+// A point along a primary ray is projected back onto the pixel of that ray, at the ray's view depth:
+TEST(temporal_accumulation_projection_inverts_camera_rays)
+{
+	const float halfFov = 0.6f;
+	const glm::vec3 cameraPos{ 1.0f, 2.0f, -3.0f };
+	const float angle = 0.7f;
+	const auto toCamera = world_to_camera(cameraPos, angle);
+	const float c = std::cos(angle), s = std::sin(angle);
+	for (const auto& pixel : { glm::vec2{ 0.5f, 0.5f }, glm::vec2{ 32.0f, 24.0f }, glm::vec2{ 63.5f, 10.25f }, glm::vec2{ 7.75f, 47.5f } }) {
+		const glm::vec3 d = camera_ray_direction(pixel, cResolution, halfFov);
+		const glm::vec3 worldDir = glm::normalize(glm::vec3{ c * d.x + s * d.z, d.y, -s * d.x + c * d.z });
+		const float hitT = 12.5f;
+		glm::vec2 projected;
+		float depth;
+		CHECK(project_to_pixel(toCamera, cResolution, halfFov, cameraPos + worldDir * hitT, projected, depth));
+		CHECK_NEAR(projected.x, pixel.x, 1e-3f);
+		CHECK_NEAR(projected.y, pixel.y, 1e-3f);
+		CHECK_NEAR(depth, view_depth(hitT, d), 1e-3f);
+	}
+
+	// Behind the camera:
+	glm::vec2 projected;
+	float depth;
+	CHECK(!project_to_pixel(toCamera, cResolution, halfFov, cameraPos - glm::vec3{ -s, 0.0f, -c }, projected, depth));
+}
+
+// History is reused where depth and normal match, and rejected per tap where they don't or where the tap is outside of the image:
+TEST(temporal_accumulation_reprojection_rejects_inconsistent_history)
+{
+	const parameters params;
+	const glm::vec3 n{ 0.0f, 1.0f, 0.0f };
+	history_image previous{ sample(0.25f, 10.0f, 5.0f, n) };
+	previous.at(11, 10) = sample(0.75f, 10.0f, 5.0f, n);
+
+	// At a pixel center, only that pixel contributes:
+	auto h = reproject(glm::vec2{ 10.5f, 10.5f }, cResolution, 5.0f, n, params, previous.fetch());
+	CHECK_NEAR(h.mMean, 0.25f, 1e-6f);
+	CHECK_NEAR(h.mLength, 10.0f, 1e-6f);
+	h = reproject(glm::vec2{ 11.0f, 10.5f }, cResolution, 5.0f, n, params, previous.fetch());
+	CHECK_NEAR(h.mMean, 0.5f, 1e-6f);
+
+	// Depth beyond the tolerance:
+	CHECK(0.0f == reproject(glm::vec2{ 10.5f, 10.5f }, cResolution, 5.0f * (1.0f + 2.0f * params.mDepthTolerance), n, params, previous.fetch()).mLength);
+	CHECK(0.0f < reproject(glm::vec2{ 10.5f, 10.5f }, cResolution, 5.0f * (1.0f + 0.5f * params.mDepthTolerance), n, params, previous.fetch()).mLength);
+
+	// Normal beyond the tolerance, for all taps or for one of two:
+	CHECK(0.0f == reproject(glm::vec2{ 10.5f, 10.5f }, cResolution, 5.0f, glm::normalize(glm::vec3{ 1.0f, 1.0f, 0.0f }), params, previous.fetch()).mLength);
+	previous.at(11, 10).mNormal = glm::vec3{ 1.0f, 0.0f, 0.0f };
+	h = reproject(glm::vec2{ 11.0f, 10.5f }, cResolution, 5.0f, n, params, previous.fetch());
+	CHECK_NEAR(h.mMean, 0.25f, 1e-6f);
+
+	// At the border, the taps outside of the image are left out; entirely outside, there is no history:
+	h = reproject(glm::vec2{ 0.0f, 0.0f }, cResolution, 5.0f, n, params, previous.fetch());
+	CHECK_NEAR(h.mMean, 0.25f, 1e-6f);
+	CHECK_NEAR(h.mLength, 10.0f, 1e-6f);
+	h = reproject(glm::vec2{ 64.0f, 48.0f }, cResolution, 5.0f, n, params, previous.fetch());
+	CHECK_NEAR(h.mLength, 10.0f, 1e-6f);
+	CHECK(0.0f == reproject(glm::vec2{ -3.0f, 20.0f }, cResolution, 5.0f, n, params, previous.fetch()).mLength);
+	CHECK(0.0f == reproject(glm::vec2{ 20.0f, 49.0f }, cResolution, 5.0f, n, params, previous.fetch()).mLength);
+}
+
+// Up to mMaxHistoryLength, the history is the mean of all estimates; beyond, it is an exponential moving average:
+TEST(temporal_accumulation_converges_to_the_mean)
+{
+	parameters params;
+	params.mMaxHistoryLength = 1000.0f;
+	const glm::vec3 n{ 0.0f, 0.0f, 1.0f };
+	history_sample h;
+	for (int frame = 0; frame < 200; ++frame) {
+		h = accumulate(h, frame % 2 == 0 ? 1.0f : 0.0f, 3.0f, n, params);
+	}
+	CHECK_NEAR(h.mMean, 0.5f, 1e-4f);
+	CHECK_NEAR(h.mSecondMoment, 0.5f, 1e-4f);
+	CHECK_NEAR(h.mLength, 200.0f, 1e-4f);
+	CHECK(h.mDepth == 3.0f && h.mNormal == n);
+
+	params.mMaxHistoryLength = 32.0f;
+	h = history_sample{};
+	for (int frame = 0; frame < 100; ++frame) {
+		h = accumulate(h, 0.0f, 3.0f, n, params);
+	}
+	CHECK(h.mLength == params.mMaxHistoryLength);
+	CHECK(0.0f == h.mMean);
+	// Every further frame moves the mean by 1/mMaxHistoryLength of the difference, s.t. changes are picked up:
+	h = accumulate(h, 1.0f, 3.0f, n, params);
+	CHECK(h.mLength == params.mMaxHistoryLength);
+	CHECK_NEAR(h.mMean, 1.0f / params.mMaxHistoryLength, 1e-6f);
+	for (int frame = 0; frame < 500; ++frame) {
+		h = accumulate(h, 1.0f, 3.0f, n, params);
+	}
+	CHECK_NEAR(h.mMean, 1.0f, 1e-3f);
+}
+
+// Extra rays are spent on pixels with a short history or a high variance only:
+TEST(temporal_accumulation_adapts_the_number_of_rays)
+{
+	const parameters params;
+	const glm::vec3 n{ 0.0f, 0.0f, 1.0f };
+	const auto base = params.mBaseRays;
+	const auto all = params.mBaseRays + params.mExtraRays;
+	CHECK(number_of_rays(history_sample{}, params) == all);
+
+	history_sample steady, noisy;
+	for (int frame = 0; frame < 20; ++frame) {
+		steady = accumulate(steady, 0.3f, 1.0f, n, params);
+		noisy = accumulate(noisy, frame % 2 == 0 ? 1.0f : 0.0f, 1.0f, n, params);
+		if (frame + 1 < static_cast<int>(cMinConfidentHistoryLength)) {
+			CHECK(number_of_rays(steady, params) == all);
+		}
+	}
+	CHECK(number_of_rays(steady, params) == base);
+	CHECK(number_of_rays(noisy, params) == all);
+
+	// A slightly varying estimate stays below the threshold:
+	history_sample calm;
+	for (int frame = 0; frame < 20; ++frame) {
+		calm = accumulate(calm, frame % 2 == 0 ? 0.32f : 0.28f, 1.0f, n, params);
+	}
+	CHECK(number_of_rays(calm, params) == base);
+}
@@ -0,0 +1,34 @@
+// Unit tests for the parts of the application which depend neither on the GPU nor on the framework (see unit_tests.hpp).
+// Neither a window nor a GPU is required. Only GLM and the Vulkan headers are needed. In Visual Studio, build and run the
+// fluid-nightmare-tests project of the solution. Otherwise, e.g.:
+//   g++ -std=c++17 -O2 -I<path to glm> -I<path to Vulkan headers> -I../source *.cpp -pthread -o unit_tests
+//
+//   unit_tests [<part of a test's name>]
+// The exit code is 0 if all checks have passed.
+
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#include "unit_tests.hpp"
+
+int main(int argc, char* argv[])
+{
+	const std::string filter = argc > 1 ? argv[1] : "";
+	int numRun = 0, numFailedTests = 0;
+	for (const auto& test : unit_tests::registered_tests()) {
+		if (!filter.empty() && nullptr == std::strstr(test.mName, filter.c_str())) {
+			continue;
+		}
+		const auto failedBefore = unit_tests::number_of_failed_checks();
+		const auto t0 = std::chrono::steady_clock::now();
+		test.mFunction();
+		const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+		const bool passed = failedBefore == unit_tests::number_of_failed_checks();
+		std::printf("%s %s (%.1f ms)\n", passed ? "[  OK  ]" : "[FAILED]", test.mName, ms);
+		++numRun;
+		numFailedTests += passed ? 0 : 1;
+	}
+	std::printf("%d of %d tests passed\n", numRun - numFailedTests, numRun);
+	return 0 == numFailedTests && numRun > 0 ? 0 : 1;
+}
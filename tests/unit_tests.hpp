@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+// A minimal test harness for the parts of the application which depend neither on the GPU nor on the framework.
+// TEST(name) defines and registers a test; CHECK(expression) records a failure (and carries on) if expression is false.
+// unit_tests.cpp runs all tests, or only those whose names contain the first command line argument.
+namespace unit_tests
+{
+	struct test_case
+	{
+		const char* mName;
+		void (*mFunction)();
+	};
+
+	inline std::vector<test_case>& registered_tests()
+	{
+		static std::vector<test_case> sTests;
+		return sTests;
+	}
+
+	inline int& number_of_failed_checks()
+	{
+		static int sNumFailed = 0;
+		return sNumFailed;
+	}
+
+	struct registrar
+	{
+		registrar(const char* aName, void (*aFunction)()) { registered_tests().push_back(test_case{ aName, aFunction }); }
+	};
+
+	inline void report_failure(const char* aFile, int aLine, const char* aExpression)
+	{
+		++number_of_failed_checks();
+		std::fprintf(stderr, "%s(%d): CHECK(%s) failed\n", aFile, aLine, aExpression);
+	}
+}
+
+#define TEST(aName) \
+	static void aName(); \
+	static const unit_tests::registrar aName##_registrar{ #aName, &aName }; \
+	static void aName()
+
+#define CHECK(aExpression) ((aExpression) ? static_cast<void>(0) : unit_tests::report_failure(__FILE__, __LINE__, #aExpression))
+#define CHECK_NEAR(aValue, aExpected, aTolerance) CHECK(std::abs((aValue) - (aExpected)) <= (aTolerance))